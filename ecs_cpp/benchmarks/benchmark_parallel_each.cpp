@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/time_utils.hpp"
+
+// Measures how parallel_each scales with the number of threads:
+//   ecs_cpp_benchmark_parallel_each [num_entities] [num_iterations] [grain_size]
+namespace benchmark_parallel_each {
+using TypeIndex = std::size_t;
+
+struct PositionComponent {
+  float y;
+  float x;
+};
+
+struct VelocityComponent {
+  float y;
+  float x;
+};
+
+using ComponentType = std::variant<PositionComponent, VelocityComponent>;
+
+template <template <typename, typename> class StorageTemplate>
+void benchmark(const std::string &storage_name, std::size_t num_entities, std::size_t num_iterations,
+               std::size_t grain_size) {
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) =
+        add_entity(ecdb, {PositionComponent{0, 0}, VelocityComponent{1, 2}});
+  }
+
+  auto move = [](const ecs::mutable_ecs::Entity &, PositionComponent &position, VelocityComponent &velocity) {
+    position.y += velocity.y * 0.5f;
+    position.x += velocity.x * 0.5f;
+  };
+
+  auto max_num_threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+  std::vector<std::size_t> thread_counts;
+  for (std::size_t num_threads = 1; num_threads < max_num_threads; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_num_threads);
+
+  double single_thread_time = 0;
+  for (auto num_threads : thread_counts) {
+    // the thread that calls parallel_each works on the chunks as well
+    ecs::mutable_ecs::ThreadPool thread_pool(num_threads - 1);
+    ecs::mutable_ecs::parallel_each<PositionComponent, VelocityComponent>(ecdb, move, grain_size, thread_pool);
+
+    auto start = ecs::time_utils::now();
+    for (std::size_t iteration = 0; iteration < num_iterations; iteration++) {
+      ecs::mutable_ecs::parallel_each<PositionComponent, VelocityComponent>(ecdb, move, grain_size, thread_pool);
+    }
+    auto end = ecs::time_utils::now();
+
+    auto time = ecs::time_utils::duration<std::chrono::nanoseconds>(start, end) / 1e6 / num_iterations;
+    if (num_threads == 1) {
+      single_thread_time = time;
+    }
+    std::cout << std::setw(20) << storage_name << std::setw(10) << num_threads << std::setw(15) << std::fixed
+              << std::setprecision(3) << time << std::setw(10) << std::setprecision(2) << single_thread_time / time
+              << std::endl;
+  }
+}
+
+} // namespace benchmark_parallel_each
+
+int main(int argc, char *argv[]) {
+  std::size_t num_entities = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::size_t num_iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20;
+  std::size_t grain_size = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : ecs::mutable_ecs::DEFAULT_GRAIN_SIZE;
+
+  std::cout << num_entities << " entities, " << num_iterations << " iterations, grain size " << grain_size
+            << std::endl;
+  std::cout << std::setw(20) << "storage" << std::setw(10) << "threads" << std::setw(15) << "ms/iteration"
+            << std::setw(10) << "speedup" << std::endl;
+
+  benchmark_parallel_each::benchmark<ecs::mutable_ecs::HashMapStorage>("HashMapStorage", num_entities, num_iterations,
+                                                                       grain_size);
+  benchmark_parallel_each::benchmark<ecs::mutable_ecs::ArchetypeStorage>("ArchetypeStorage", num_entities,
+                                                                         num_iterations, grain_size);
+  benchmark_parallel_each::benchmark<ecs::mutable_ecs::SparseSetStorage>("SparseSetStorage", num_entities,
+                                                                         num_iterations, grain_size);
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/snapshot.hpp"
+#include "ecs/time_utils.hpp"
+
+// Measures saving and loading snapshots against re-inserting the result of query() into a new ecdb:
+//   ecs_cpp_benchmark_snapshot [num_entities] [path]
+namespace benchmark_snapshot {
+using TypeIndex = std::size_t;
+
+struct PositionComponent {
+  float y;
+  float x;
+};
+
+struct VelocityComponent {
+  float y;
+  float x;
+};
+
+struct NameComponent {
+  std::string name;
+};
+
+using ComponentType = std::variant<PositionComponent, VelocityComponent, NameComponent>;
+
+} // namespace benchmark_snapshot
+
+template <> struct ecs::mutable_ecs::SnapshotSerializer<benchmark_snapshot::NameComponent> {
+  static void serialize(const benchmark_snapshot::NameComponent &component, std::vector<char> &bytes) {
+    bytes.insert(bytes.end(), component.name.begin(), component.name.end());
+  }
+  static benchmark_snapshot::NameComponent deserialize(const char *bytes, std::size_t size) {
+    return benchmark_snapshot::NameComponent{std::string(bytes, size)};
+  }
+};
+
+namespace benchmark_snapshot {
+
+// Drops the snapshot from the page cache, so loading it reads from disk
+void evict_from_page_cache(const std::string &path) {
+#ifdef POSIX_FADV_DONTNEED
+  auto file_descriptor = ::open(path.c_str(), O_RDONLY);
+  if (file_descriptor >= 0) {
+    ::fdatasync(file_descriptor);
+    ::posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(file_descriptor);
+  }
+#endif
+}
+
+double milliseconds_since(std::chrono::time_point<std::chrono::steady_clock> start) {
+  return ecs::time_utils::duration<std::chrono::nanoseconds>(start, ecs::time_utils::now()) / 1e6;
+}
+
+template <template <typename, typename> class StorageTemplate>
+void benchmark(const std::string &storage_name, std::size_t num_entities, const std::string &path) {
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    std::vector<ComponentType> components = {PositionComponent{0, 0}, VelocityComponent{1, 2}};
+    if (entity_index % 8 == 0) {
+      components.push_back(NameComponent{"entity_" + std::to_string(entity_index)});
+    }
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, components);
+  }
+
+  auto start = ecs::time_utils::now();
+  auto queried_entities = ecs::mutable_ecs::query(ecdb, std::vector<TypeIndex>{});
+  auto copied_ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  for (auto &[entity, components] : queried_entities) {
+    ecs::mutable_ecs::Entity copied_entity;
+    std::tie(copied_ecdb, copied_entity) = add_entity(copied_ecdb, components);
+  }
+  auto query_copy_time = milliseconds_since(start);
+
+  start = ecs::time_utils::now();
+  auto snapshot_size = ecs::mutable_ecs::save_snapshot(ecdb, path);
+  auto save_time = milliseconds_since(start);
+
+  evict_from_page_cache(path);
+  start = ecs::time_utils::now();
+  auto loaded_ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  loaded_ecdb = ecs::mutable_ecs::load_snapshot(loaded_ecdb, path);
+  auto load_time = milliseconds_since(start);
+
+  // Sum of the positions, read straight from the mapping
+  auto query_mapped_snapshot = [&path](ecs::mutable_ecs::SnapshotLoadMode load_mode) {
+    evict_from_page_cache(path);
+    auto start = ecs::time_utils::now();
+    ecs::mutable_ecs::MappedSnapshot<ComponentType> snapshot(path, load_mode);
+    float sum = 0;
+    snapshot.each<PositionComponent>([&sum](const ecs::mutable_ecs::Entity &, const PositionComponent &position) {
+      sum += position.y + position.x;
+    });
+    auto time = milliseconds_since(start);
+    if (sum != 0) {
+      throw std::runtime_error("Unexpected sum of positions");
+    }
+    return time;
+  };
+  auto eager_query_time = query_mapped_snapshot(ecs::mutable_ecs::SnapshotLoadMode::EAGER);
+  auto lazy_query_time = query_mapped_snapshot(ecs::mutable_ecs::SnapshotLoadMode::LAZY);
+
+  std::cout << std::setw(20) << storage_name << std::setw(10) << std::fixed << std::setprecision(1)
+            << snapshot_size / 1e6 << std::setw(15) << std::setprecision(3) << query_copy_time << std::setw(15)
+            << save_time << std::setw(15) << load_time << std::setw(15) << eager_query_time << std::setw(15)
+            << lazy_query_time << std::endl;
+  std::remove(path.c_str());
+}
+
+} // namespace benchmark_snapshot
+
+int main(int argc, char *argv[]) {
+  std::size_t num_entities = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::string path = argc > 2 ? argv[2] : "benchmark_snapshot.ecdb";
+
+  std::cout << num_entities << " entities, snapshot at " << path << ", times in ms" << std::endl;
+  std::cout << std::setw(20) << "storage" << std::setw(10) << "MB" << std::setw(15) << "query+add" << std::setw(15)
+            << "save" << std::setw(15) << "load" << std::setw(15) << "eager each" << std::setw(15) << "lazy each"
+            << std::endl;
+
+  benchmark_snapshot::benchmark<ecs::mutable_ecs::HashMapStorage>("HashMapStorage", num_entities, path);
+  benchmark_snapshot::benchmark<ecs::mutable_ecs::ArchetypeStorage>("ArchetypeStorage", num_entities, path);
+  benchmark_snapshot::benchmark<ecs::mutable_ecs::SparseSetStorage>("SparseSetStorage", num_entities, path);
+  return 0;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ecs/time_utils.hpp"
+
+namespace ecs {
+namespace benchmark_utils {
+
+// Timings of one scenario for one storage and one set of parameters, times are per repetition
+struct BenchmarkResult {
+public:
+  std::string scenario;
+  std::string storage;
+  std::string parameters;
+  std::size_t num_items;
+  std::size_t num_repetitions;
+  double min_time_in_nanoseconds;
+  double median_time_in_nanoseconds;
+  double mean_time_in_nanoseconds;
+
+  double items_per_second() const { return this->num_items / this->median_time_in_nanoseconds * 1e9; }
+};
+
+using SetupFunction = std::function<void()>;
+using RunFunction = std::function<void()>;
+
+// Runs scenarios and collects their results. setup is called before every repetition and is not timed, run is timed.
+// One repetition is run first to warm up caches and allocators and is not recorded.
+class Benchmarks {
+public:
+  std::size_t _num_repetitions;
+  std::string _filter;
+  std::vector<BenchmarkResult> _results;
+
+  explicit Benchmarks(std::size_t num_repetitions = 10, std::string filter = "") {
+    this->_num_repetitions = std::max<std::size_t>(num_repetitions, 1);
+    this->_filter = std::move(filter);
+    this->_results = {};
+  }
+
+  const std::vector<BenchmarkResult> &results() const { return this->_results; }
+
+  // A scenario runs if its name contains the filter
+  bool enabled(const std::string &scenario) const { return scenario.find(this->_filter) != std::string::npos; }
+
+  void run(const std::string &scenario, const std::string &storage, const std::string &parameters,
+           std::size_t num_items, const SetupFunction &setup, const RunFunction &run) {
+    if (not this->enabled(scenario)) {
+      return;
+    }
+    std::vector<double> times;
+    for (std::size_t repetition = 0; repetition <= this->_num_repetitions; repetition++) {
+      setup();
+      auto start = time_utils::now();
+      run();
+      auto time = time_utils::duration<std::chrono::nanoseconds>(start, time_utils::now());
+      if (repetition > 0) {
+        times.push_back(static_cast<double>(time));
+      }
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (auto time : times) {
+      sum += time;
+    }
+    this->_results.push_back(BenchmarkResult{scenario, storage, parameters, num_items, times.size(), times.front(),
+                                             times[times.size() / 2], sum / times.size()});
+  }
+
+  void run(const std::string &scenario, const std::string &storage, const std::string &parameters,
+           std::size_t num_items, const RunFunction &run) {
+    this->run(scenario, storage, parameters, num_items, []() {}, run);
+  }
+};
+
+inline std::string escape_json(const std::string &string) {
+  std::string escaped_string;
+  for (auto character : string) {
+    if (character == '"' or character == '\\') {
+      escaped_string.push_back('\\');
+    }
+    escaped_string.push_back(character);
+  }
+  return escaped_string;
+}
+
+// {"context": {...}, "results": [{...}, ...]}, context holds whatever identifies the build, e.g. compiler and version
+inline void write_json(std::ostream &stream, const std::vector<BenchmarkResult> &results,
+                       const std::vector<std::pair<std::string, std::string>> &context) {
+  stream << "{\n  \"context\": {";
+  for (std::size_t index = 0; index < context.size(); index++) {
+    stream << (index > 0 ? ", " : "") << "\"" << escape_json(context[index].first) << "\": \""
+           << escape_json(context[index].second) << "\"";
+  }
+  stream << "},\n  \"results\": [\n" << std::setprecision(17);
+  for (std::size_t index = 0; index < results.size(); index++) {
+    auto &result = results[index];
+    stream << "    {\"scenario\": \"" << escape_json(result.scenario) << "\", \"storage\": \""
+           << escape_json(result.storage) << "\", \"parameters\": \"" << escape_json(result.parameters)
+           << "\", \"num_items\": " << result.num_items << ", \"num_repetitions\": " << result.num_repetitions
+           << ", \"min_ns\": " << result.min_time_in_nanoseconds
+           << ", \"median_ns\": " << result.median_time_in_nanoseconds
+           << ", \"mean_ns\": " << result.mean_time_in_nanoseconds
+           << ", \"items_per_second\": " << result.items_per_second() << "}" << (index + 1 < results.size() ? "," : "")
+           << "\n";
+  }
+  stream << "  ]\n}\n";
+}
+
+inline void write_csv(std::ostream &stream, const std::vector<BenchmarkResult> &results) {
+  stream << "scenario,storage,parameters,num_items,num_repetitions,min_ns,median_ns,mean_ns,items_per_second\n"
+         << std::setprecision(17);
+  for (auto &result : results) {
+    stream << result.scenario << "," << result.storage << ",\"" << result.parameters << "\"," << result.num_items
+           << "," << result.num_repetitions << "," << result.min_time_in_nanoseconds << ","
+           << result.median_time_in_nanoseconds << "," << result.mean_time_in_nanoseconds << ","
+           << result.items_per_second() << "\n";
+  }
+}
+
+inline void write_table(std::ostream &stream, const std::vector<BenchmarkResult> &results) {
+  stream << std::left << std::setw(28) << "scenario" << std::setw(20) << "storage" << std::setw(36) << "parameters"
+         << std::right << std::setw(15) << "median ms" << std::setw(15) << "min ms" << std::setw(15) << "Mitems/s"
+         << "\n";
+  for (auto &result : results) {
+    stream << std::left << std::setw(28) << result.scenario << std::setw(20) << result.storage << std::setw(36)
+           << result.parameters << std::right << std::fixed << std::setprecision(3) << std::setw(15)
+           << result.median_time_in_nanoseconds / 1e6 << std::setw(15) << result.min_time_in_nanoseconds / 1e6
+           << std::setw(15) << result.items_per_second() / 1e6 << "\n";
+  }
+  stream << std::defaultfloat;
+}
+
+} // namespace benchmark_utils
+} // namespace ecs
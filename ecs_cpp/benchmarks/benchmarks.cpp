@@ -0,0 +1,582 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "benchmark_utils.hpp"
+#include "ecs/journal.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/variant_utils.hpp"
+#include "ecs/world_diff.hpp"
+
+// Parameterized scenarios for every storage, results are written as a table, JSON or CSV:
+//   ecs_cpp_benchmarks [--format table|json|csv] [--output path] [--filter scenario] [--repetitions n] [--scale x]
+namespace benchmarks {
+using TypeIndex = std::size_t;
+using ecs::benchmark_utils::Benchmarks;
+using ecs::mutable_ecs::Entity;
+
+template <std::size_t Index> struct Component {
+  float value;
+};
+
+using ComponentType = std::variant<Component<0>, Component<1>, Component<2>, Component<3>, Component<4>, Component<5>,
+                                   Component<6>, Component<7>>;
+
+template <template <typename, typename> class StorageTemplate>
+using EntityComponentDatabase = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, StorageTemplate>;
+
+// Keeps results of the measured code alive, so the compiler cannot drop it
+volatile float sink = 0;
+
+template <std::size_t... Indices> std::vector<ComponentType> make_components(std::index_sequence<Indices...>) {
+  return {Component<Indices>{1}...};
+}
+
+template <template <typename, typename> class StorageTemplate>
+std::vector<Entity> add_entities_one_by_one(EntityComponentDatabase<StorageTemplate> &ecdb, std::size_t num_entities,
+                                            const std::vector<ComponentType> &components) {
+  std::vector<Entity> entities(num_entities);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, components);
+  }
+  return entities;
+}
+
+template <template <typename, typename> class StorageTemplate>
+void benchmark_create_entities(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto components = make_components(std::make_index_sequence<2>{});
+  benchmarks.run(
+      "create_entities", storage, "entities=" + std::to_string(num_entities), num_entities,
+      [&ecdb]() { ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>(); },
+      [&ecdb, &components, num_entities]() { add_entities_one_by_one(ecdb, num_entities, components); });
+}
+
+// Spawns entities from a template of 4 components with add_entity and with add_entities, and removes them with
+// remove_entity and remove_entities
+template <template <typename, typename> class StorageTemplate>
+void benchmark_bulk_entities(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("bulk_entities")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto components = make_components(std::make_index_sequence<4>{});
+  auto parameters = "entities=" + std::to_string(num_entities);
+  auto reset = [&ecdb]() { ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>(); };
+  benchmarks.run("bulk_entities", storage, parameters + " create=loop", num_entities, reset,
+                 [&ecdb, &components, num_entities]() { add_entities_one_by_one(ecdb, num_entities, components); });
+  benchmarks.run("bulk_entities", storage, parameters + " create=bulk", num_entities, reset,
+                 [&ecdb, &components, num_entities]() {
+                   std::vector<Entity> entities;
+                   std::tie(ecdb, entities) = ecs::mutable_ecs::add_entities(ecdb, num_entities, components);
+                 });
+  benchmarks.run("bulk_entities", storage, parameters + " create=batches_of_8", num_entities, reset,
+                 [&ecdb, &components, num_entities]() {
+                   std::vector<Entity> entities;
+                   for (std::size_t num_created_entities = 0; num_created_entities < num_entities;
+                        num_created_entities += 8) {
+                     std::tie(ecdb, entities) = ecs::mutable_ecs::add_entities(ecdb, 8, components);
+                   }
+                 });
+
+  std::vector<Entity> entities;
+  auto spawn = [&ecdb, &entities, &components, num_entities]() {
+    ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+    std::tie(ecdb, entities) = ecs::mutable_ecs::add_entities(ecdb, num_entities, components);
+  };
+  benchmarks.run("bulk_entities", storage, parameters + " remove=loop", num_entities, spawn, [&ecdb, &entities]() {
+    for (auto &entity : entities) {
+      ecdb = remove_entity(ecdb, entity);
+    }
+  });
+  benchmarks.run("bulk_entities", storage, parameters + " remove=bulk", num_entities, spawn,
+                 [&ecdb, &entities]() { ecdb = ecs::mutable_ecs::remove_entities(ecdb, entities); });
+}
+
+// Adds a component to every entity and removes it again, items are single adds or removes
+template <template <typename, typename> class StorageTemplate>
+void benchmark_component_churn(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("component_churn")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto entities = add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+  auto churned_type = ecs::type_utils::get_type_id<Component<7>>();
+  benchmarks.run("component_churn", storage, "entities=" + std::to_string(num_entities), 2 * num_entities,
+                 [&ecdb, &entities, churned_type]() {
+                   for (auto &entity : entities) {
+                     ecdb = add_component(ecdb, entity, ComponentType{Component<7>{1}});
+                   }
+                   for (auto &entity : entities) {
+                     ecdb = remove_component(ecdb, entity, churned_type);
+                   }
+                 });
+}
+
+// The component churn with no observers, with an observer of another component type and with ADD and REMOVE observers
+// of the churned component type, which get one batch each per frame
+template <template <typename, typename> class StorageTemplate>
+void benchmark_observers(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("observers")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto entities = add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+  auto churned_type = ecs::type_utils::get_type_id<Component<7>>();
+  auto churn = [&ecdb, &entities, churned_type]() {
+    for (auto &entity : entities) {
+      ecdb = add_component(ecdb, entity, ComponentType{Component<7>{1}});
+    }
+    for (auto &entity : entities) {
+      ecdb = remove_component(ecdb, entity, churned_type);
+    }
+    ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  };
+  auto parameters = "entities=" + std::to_string(num_entities);
+  benchmarks.run("observers", storage, parameters + " observers=none", 2 * num_entities, churn);
+
+  auto count_events = [](EntityComponentDatabase<StorageTemplate> &, const std::vector<Entity> &entities) {
+    sink = sink + static_cast<float>(entities.size());
+  };
+  ecs::mutable_ecs::ObserverHandle observer_handle;
+  std::tie(ecdb, observer_handle) =
+      ecs::mutable_ecs::register_observer<Component<6>>(ecdb, ecs::mutable_ecs::ObserverEvent::ADD, count_events);
+  benchmarks.run("observers", storage, parameters + " observers=other_type", 2 * num_entities, churn);
+
+  for (auto event : {ecs::mutable_ecs::ObserverEvent::ADD, ecs::mutable_ecs::ObserverEvent::REMOVE}) {
+    std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<Component<7>>(ecdb, event, count_events);
+  }
+  benchmarks.run("observers", storage, parameters + " observers=churned_type", 2 * num_entities, churn);
+}
+
+template <template <typename, typename> class StorageTemplate, std::size_t... Indices>
+float sum_components(EntityComponentDatabase<StorageTemplate> &ecdb, std::index_sequence<Indices...>) {
+  float sum = 0;
+  ecs::mutable_ecs::each<Component<Indices>...>(
+      ecdb, [&sum](const Entity &, Component<Indices> &... components) { sum += (components.value + ...); });
+  return sum;
+}
+
+// each<> over NumComponents component types. The entities that do not match have all but the last of them.
+template <template <typename, typename> class StorageTemplate, std::size_t NumComponents>
+void benchmark_query(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities,
+                     std::size_t match_percentage) {
+  auto scenario = "query_" + std::to_string(NumComponents) + "_components";
+  if (not benchmarks.enabled(scenario)) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto matching_components = make_components(std::make_index_sequence<NumComponents>{});
+  auto other_components = make_components(std::make_index_sequence<NumComponents - 1>{});
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    Entity entity;
+    auto matches = entity_index % 100 < match_percentage;
+    std::tie(ecdb, entity) = add_entity(ecdb, matches ? matching_components : other_components);
+  }
+  benchmarks.run(scenario, storage,
+                 "entities=" + std::to_string(num_entities) + " match=" + std::to_string(match_percentage) + "%",
+                 num_entities, [&ecdb]() { sink = sum_components(ecdb, std::make_index_sequence<NumComponents>{}); });
+}
+
+// each<> over the 1% of the entities that have Component<7>, by scanning and through a cached query, and the component
+// churn of benchmark_component_churn while the cached query is kept up to date
+template <template <typename, typename> class StorageTemplate>
+void benchmark_cached_query(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("cached_query")) {
+    return;
+  }
+  using CachedQueryHandle = ecs::mutable_ecs::QueryHandle<Component<0>, Component<7>>;
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto entities = add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index += 100) {
+    ecdb = add_component(ecdb, entities[entity_index], ComponentType{Component<7>{1}});
+  }
+  CachedQueryHandle query_handle;
+  std::tie(ecdb, query_handle) = ecs::mutable_ecs::register_query<Component<0>, Component<7>>(ecdb);
+
+  auto sum = [](const Entity &, Component<0> &component_0, Component<7> &component_7) {
+    sink = sink + component_0.value + component_7.value;
+  };
+  auto parameters = "entities=" + std::to_string(num_entities) + " match=1%";
+  benchmarks.run("cached_query", storage, parameters + " query=scan", num_entities,
+                 [&ecdb, &sum]() { ecs::mutable_ecs::each<Component<0>, Component<7>>(ecdb, sum); });
+  benchmarks.run("cached_query", storage, parameters + " query=cached", num_entities,
+                 [&ecdb, &query_handle, &sum]() { ecs::mutable_ecs::each(ecdb, query_handle, sum); });
+
+  auto churned_type = ecs::type_utils::get_type_id<Component<7>>();
+  benchmarks.run("cached_query", storage, "entities=" + std::to_string(num_entities) + " churn", 2 * num_entities,
+                 [&ecdb, &entities, churned_type]() {
+                   for (auto &entity : entities) {
+                     ecdb = add_component(ecdb, entity, ComponentType{Component<7>{1}});
+                   }
+                   for (auto &entity : entities) {
+                     ecdb = remove_component(ecdb, entity, churned_type);
+                   }
+                 });
+}
+
+struct Position {
+  float x;
+  float y;
+};
+
+using SpatialComponentType = std::variant<Position, Component<0>>;
+
+// Neighbors within radius 2 of 100 points of a world with about one entity per unit of area, by scanning every entity
+// and through the spatial index, and moving every entity with and without the spatial index kept up to date
+template <template <typename, typename> class StorageTemplate>
+void benchmark_spatial_index(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("spatial_index")) {
+    return;
+  }
+  using SpatialEntityComponentDatabase =
+      ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, SpatialComponentType, StorageTemplate>;
+  auto world_size = static_cast<float>(std::sqrt(num_entities));
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<float> coordinate(0, world_size);
+  std::uniform_real_distribution<float> offset(-0.5, 0.5);
+
+  auto ecdb = SpatialEntityComponentDatabase();
+  std::vector<Entity> entities(num_entities);
+  for (auto &entity : entities) {
+    Position position{coordinate(generator), coordinate(generator)};
+    std::tie(ecdb, entity) = add_entity(ecdb, {position, Component<0>{1}});
+  }
+  std::vector<ecs::mutable_ecs::SpatialPoint> centers(100);
+  for (auto &center : centers) {
+    center = ecs::mutable_ecs::SpatialPoint{coordinate(generator), coordinate(generator)};
+  }
+  constexpr float radius = 2;
+  auto parameters = "entities=" + std::to_string(num_entities) + " radius=2";
+
+  benchmarks.run("spatial_index", storage, parameters + " query=scan", centers.size(), [&ecdb, &centers]() {
+    for (auto &center : centers) {
+      ecs::mutable_ecs::each<Position, Component<0>>(
+          ecdb, [&center](const Entity &, Position &position, Component<0> &component) {
+            auto dx = position.x - center.x;
+            auto dy = position.y - center.y;
+            if (dx * dx + dy * dy <= radius * radius) {
+              sink = sink + component.value;
+            }
+          });
+    }
+  });
+
+  ecdb = ecs::mutable_ecs::bind_spatial_index<Position>(
+      ecdb, radius, [](const Position &position) { return ecs::mutable_ecs::SpatialPoint{position.x, position.y}; });
+  benchmarks.run("spatial_index", storage, parameters + " query=grid", centers.size(), [&ecdb, &centers]() {
+    for (auto &center : centers) {
+      for (auto &[entity, component] : ecs::mutable_ecs::query_radius<Component<0>>(ecdb, center, radius)) {
+        sink = sink + component.value;
+      }
+    }
+  });
+
+  std::vector<Position> positions;
+  for (auto &[entity, components] : ecs::mutable_ecs::query<Position>(ecdb)) {
+    auto position = std::get<Position>(components[0]);
+    positions.push_back(Position{position.x + offset(generator), position.y + offset(generator)});
+  }
+  auto move_entities = [&ecdb, &entities, &positions]() {
+    for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index++) {
+      ecdb = add_component(ecdb, entities[entity_index], SpatialComponentType{positions[entity_index]});
+    }
+  };
+  benchmarks.run("spatial_index", storage, "entities=" + std::to_string(num_entities) + " move index=grid",
+                 num_entities, move_entities);
+  ecdb = ecs::mutable_ecs::unbind_spatial_index(ecdb);
+  benchmarks.run("spatial_index", storage, "entities=" + std::to_string(num_entities) + " move index=none",
+                 num_entities, move_entities);
+}
+
+// Updates every entity of a world that was just filled and of a world where entities were removed in random order
+// and their indices reused, so entities and components are no longer in the same order
+template <template <typename, typename> class StorageTemplate>
+void benchmark_fragmentation(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("fragmentation")) {
+    return;
+  }
+  auto components = make_components(std::make_index_sequence<2>{});
+  auto move = [](const Entity &, Component<0> &position, Component<1> &velocity) { position.value += velocity.value; };
+
+  auto fresh_ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  add_entities_one_by_one(fresh_ecdb, num_entities, components);
+  benchmarks.run("fragmentation", storage, "entities=" + std::to_string(num_entities) + " world=fresh", num_entities,
+                 [&fresh_ecdb, &move]() { ecs::mutable_ecs::each<Component<0>, Component<1>>(fresh_ecdb, move); });
+
+  auto fragmented_ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  auto entities = add_entities_one_by_one(fragmented_ecdb, 2 * num_entities, components);
+  std::shuffle(entities.begin(), entities.end(), std::mt19937(0));
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    fragmented_ecdb = remove_entity(fragmented_ecdb, entities[entity_index]);
+  }
+  add_entities_one_by_one(fragmented_ecdb, num_entities / 2, components);
+  benchmarks.run("fragmentation", storage,
+                 "entities=" + std::to_string(fragmented_ecdb.size()) + " world=fragmented", fragmented_ecdb.size(),
+                 [&fragmented_ecdb, &move]() {
+                   ecs::mutable_ecs::each<Component<0>, Component<1>>(fragmented_ecdb, move);
+                 });
+}
+
+// Propagates Component<0>, the local value, into Component<1>, the world value, down a hierarchy where every entity
+// has 4 children: in breadth-first order, and by walking the children of every entity depth-first from the root
+template <template <typename, typename> class StorageTemplate>
+void benchmark_hierarchy(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("hierarchy")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  std::vector<Entity> entities;
+  std::tie(ecdb, entities) =
+      ecs::mutable_ecs::add_entities(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+  for (std::size_t entity_index = 1; entity_index < num_entities; entity_index++) {
+    ecdb = ecs::mutable_ecs::set_parent(ecdb, entities[entity_index], entities[(entity_index - 1) / 4]);
+  }
+  auto parameters = "entities=" + std::to_string(num_entities) + " children=4";
+
+  benchmarks.run("hierarchy", storage, parameters + " order=breadth_first", num_entities, [&ecdb]() {
+    ecs::mutable_ecs::each_breadth_first<Component<0>, Component<1>>(
+        ecdb, [&ecdb](const Entity &, const Entity *parent, Component<0> &local, Component<1> &world) {
+          world.value = local.value;
+          if (parent != nullptr) {
+            world.value += ecdb._storage.template find<Component<1>>(*parent)->value;
+          }
+        });
+  });
+
+  benchmarks.run("hierarchy", storage, parameters + " order=children", num_entities, [&ecdb, &entities]() {
+    std::function<void(const Entity &, float)> propagate = [&](const Entity &entity, float parent_value) {
+      auto &world = *ecdb._storage.template find<Component<1>>(entity);
+      world.value = ecdb._storage.template find<Component<0>>(entity)->value + parent_value;
+      for (auto &child : ecs::mutable_ecs::get_children(ecdb, entity)) {
+        propagate(child, world.value);
+      }
+    };
+    propagate(entities[0], 0);
+  });
+}
+
+struct AddComponentAction {
+  Entity entity;
+  ComponentType component;
+};
+
+struct MovementSystem {
+  template <template <typename, typename> class StorageTemplate>
+  std::vector<AddComponentAction> operator()(EntityComponentDatabase<StorageTemplate> &ecdb) const {
+    std::vector<AddComponentAction> actions;
+    ecs::mutable_ecs::each<Component<0>, Component<1>>(
+        ecdb, [&actions](const Entity &entity, Component<0> &position, Component<1> &velocity) {
+          actions.push_back(AddComponentAction{entity, Component<0>{position.value + velocity.value}});
+        });
+    return actions;
+  }
+};
+
+// One process_systems call with a system that returns an action per entity
+template <template <typename, typename> class StorageTemplate>
+void benchmark_process_systems(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("process_systems")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+
+  auto systems = ecs::mutable_ecs::create_systems<MovementSystem>();
+  systems = ecs::mutable_ecs::add_system(systems, MovementSystem(), 0);
+  auto process_system = [](EntityComponentDatabase<StorageTemplate> &ecdb, MovementSystem &system) {
+    return system(ecdb);
+  };
+  auto process_action = [](EntityComponentDatabase<StorageTemplate> &ecdb, AddComponentAction &action) {
+    return add_component(ecdb, action.entity, action.component);
+  };
+  benchmarks.run("process_systems", storage, "entities=" + std::to_string(num_entities), num_entities,
+                 [&ecdb, &systems, &process_system, &process_action]() {
+                   ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, MovementSystem,
+                                                            AddComponentAction, StorageTemplate>(
+                       ecdb, systems, process_system, process_action);
+                 });
+}
+
+// The frame of benchmark_process_systems with the checksum kept up to date and recorded in a journal, the same frame
+// replayed from the journal, and the checksum computed from scratch
+template <template <typename, typename> class StorageTemplate>
+void benchmark_journal(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("journal")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+
+  auto systems = ecs::mutable_ecs::create_systems<MovementSystem>();
+  systems = ecs::mutable_ecs::add_system(systems, MovementSystem(), 0);
+  auto process_system = [](EntityComponentDatabase<StorageTemplate> &ecdb, MovementSystem &system) {
+    return system(ecdb);
+  };
+  auto process_action = [](EntityComponentDatabase<StorageTemplate> &ecdb, AddComponentAction &action) {
+    return add_component(ecdb, action.entity, action.component);
+  };
+  auto parameters = "entities=" + std::to_string(num_entities);
+  auto process_frame = [&ecdb, &systems, &process_system, &process_action]() {
+    ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, MovementSystem, AddComponentAction,
+                                             StorageTemplate>(ecdb, systems, process_system, process_action);
+  };
+  benchmarks.run("journal", storage, parameters + " checksum=none journal=none", num_entities, process_frame);
+  ecdb = ecs::mutable_ecs::enable_checksum(ecdb);
+  benchmarks.run("journal", storage, parameters + " checksum=incremental journal=none", num_entities, process_frame);
+
+  auto journal = ecs::mutable_ecs::create_journal<AddComponentAction>(ecdb);
+  benchmarks.run(
+      "journal", storage, parameters + " checksum=incremental journal=record", num_entities,
+      [&ecdb, &journal]() { journal = ecs::mutable_ecs::create_journal<AddComponentAction>(ecdb); },
+      [&ecdb, &systems, &process_system, &process_action, &journal]() {
+        ecdb = ecs::mutable_ecs::process_systems_with_journal<TypeIndex, ComponentType, MovementSystem,
+                                                              AddComponentAction, StorageTemplate>(
+            ecdb, systems, process_system, process_action, journal);
+      });
+  // The journal holds one frame, replaying it again is not checked against the recorded checksum
+  ecdb = ecs::mutable_ecs::disable_checksum(ecdb);
+  benchmarks.run("journal", storage, parameters + " checksum=none journal=replay", num_entities,
+                 [&ecdb, &journal, &process_action]() {
+                   ecdb = ecs::mutable_ecs::replay_journal_frame<TypeIndex, ComponentType, AddComponentAction,
+                                                                 StorageTemplate>(ecdb, journal, process_action, 0);
+                 });
+  ecdb = ecs::mutable_ecs::enable_checksum(ecdb);
+  benchmarks.run("journal", storage, parameters + " checksum=full", num_entities,
+                 [&ecdb]() { sink = static_cast<float>(ecs::mutable_ecs::compute_checksum(ecdb) % 2); });
+}
+
+// Replication of a world where Component<0> of every entity changes every frame: writing the diff of an unchanged
+// world, writing and applying the diff after every entity changed, and writing the whole world as the first diff
+template <template <typename, typename> class StorageTemplate>
+void benchmark_world_diff(Benchmarks &benchmarks, const std::string &storage, std::size_t num_entities) {
+  if (not benchmarks.enabled("world_diff")) {
+    return;
+  }
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  add_entities_one_by_one(ecdb, num_entities, make_components(std::make_index_sequence<2>{}));
+  auto receiver = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  ecs::mutable_ecs::WorldDiffBaseline<ComponentType> baseline;
+  std::vector<char> buffer(1024 + 64 * num_entities);
+  std::size_t size = 0;
+  auto write = [&ecdb, &baseline, &buffer, &size]() {
+    size = ecs::mutable_ecs::write_world_diff(ecdb, baseline, buffer.data(), buffer.size());
+  };
+  auto apply = [&receiver, &buffer, &size]() {
+    receiver = ecs::mutable_ecs::apply_world_diff(receiver, buffer.data(), size);
+  };
+  auto change = [&ecdb]() {
+    ecs::mutable_ecs::each<Component<0>>(ecdb, [](const Entity &, Component<0> &position) { position.value += 1; });
+  };
+  write();
+  apply();
+
+  auto parameters = "entities=" + std::to_string(num_entities);
+  benchmarks.run("world_diff", storage, parameters + " changes=none write", num_entities, write);
+  benchmarks.run("world_diff", storage, parameters + " changes=all write", num_entities, change, write);
+  // The receiver missed the diffs above, it starts over from the whole world
+  receiver = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, StorageTemplate>();
+  baseline = ecs::mutable_ecs::WorldDiffBaseline<ComponentType>();
+  write();
+  apply();
+  benchmarks.run(
+      "world_diff", storage, parameters + " changes=all apply", num_entities,
+      [&change, &write]() {
+        change();
+        write();
+      },
+      apply);
+  benchmarks.run(
+      "world_diff", storage, parameters + " changes=world write", num_entities,
+      [&baseline]() { baseline = ecs::mutable_ecs::WorldDiffBaseline<ComponentType>(); }, write);
+}
+
+template <template <typename, typename> class StorageTemplate>
+void benchmark_storage(Benchmarks &benchmarks, const std::string &storage, double scale) {
+  auto scaled = [scale](std::size_t num_entities) {
+    return std::max<std::size_t>(static_cast<std::size_t>(num_entities * scale), 1);
+  };
+  for (auto num_entities : {scaled(10000), scaled(100000)}) {
+    benchmark_create_entities<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_bulk_entities<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_component_churn<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_observers<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_fragmentation<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_process_systems<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_journal<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_world_diff<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_cached_query<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_spatial_index<StorageTemplate>(benchmarks, storage, num_entities);
+    benchmark_hierarchy<StorageTemplate>(benchmarks, storage, num_entities);
+  }
+  for (auto match_percentage : {100, 50, 10}) {
+    benchmark_query<StorageTemplate, 1>(benchmarks, storage, scaled(100000), match_percentage);
+    benchmark_query<StorageTemplate, 2>(benchmarks, storage, scaled(100000), match_percentage);
+    benchmark_query<StorageTemplate, 4>(benchmarks, storage, scaled(100000), match_percentage);
+    benchmark_query<StorageTemplate, 8>(benchmarks, storage, scaled(100000), match_percentage);
+  }
+}
+
+} // namespace benchmarks
+
+int main(int argc, char *argv[]) {
+  std::string format = "table";
+  std::string output_path;
+  std::string filter;
+  std::size_t num_repetitions = 10;
+  double scale = 1;
+  for (int arg_index = 1; arg_index + 1 < argc; arg_index += 2) {
+    std::string arg = argv[arg_index];
+    std::string value = argv[arg_index + 1];
+    if (arg == "--format") {
+      format = value;
+    } else if (arg == "--output") {
+      output_path = value;
+    } else if (arg == "--filter") {
+      filter = value;
+    } else if (arg == "--repetitions") {
+      num_repetitions = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (arg == "--scale") {
+      scale = std::strtod(value.c_str(), nullptr);
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+  if (format != "table" and format != "json" and format != "csv") {
+    std::cerr << "Unknown format " << format << std::endl;
+    return 1;
+  }
+
+  ecs::benchmark_utils::Benchmarks benchmarks(num_repetitions, filter);
+  benchmarks::benchmark_storage<ecs::mutable_ecs::HashMapStorage>(benchmarks, "HashMapStorage", scale);
+  benchmarks::benchmark_storage<ecs::mutable_ecs::PoolHashMapStorage>(benchmarks, "PoolHashMapStorage", scale);
+  benchmarks::benchmark_storage<ecs::mutable_ecs::ArchetypeStorage>(benchmarks, "ArchetypeStorage", scale);
+  benchmarks::benchmark_storage<ecs::mutable_ecs::SparseSetStorage>(benchmarks, "SparseSetStorage", scale);
+
+  std::ofstream output_file;
+  if (not output_path.empty()) {
+    output_file.open(output_path);
+  }
+  std::ostream &output = output_path.empty() ? std::cout : output_file;
+  if (format == "json") {
+    ecs::benchmark_utils::write_json(output, benchmarks.results(),
+                                     {{"compiler", __VERSION__},
+                                      {"repetitions", std::to_string(num_repetitions)},
+                                      {"scale", std::to_string(scale)}});
+  } else if (format == "csv") {
+    ecs::benchmark_utils::write_csv(output, benchmarks.results());
+  } else {
+    ecs::benchmark_utils::write_table(output, benchmarks.results());
+  }
+  return 0;
+}
@@ -4,9 +4,15 @@ namespace ecs {
 namespace mutable_ecs {
 void MutableEcsModule(pybind11::module &mutable_ecs);
 } // namespace mutable_ecs
+namespace persistent_ecs {
+void PersistentEcsModule(pybind11::module &persistent_ecs, pybind11::module &mutable_ecs);
+} // namespace persistent_ecs
 } // namespace ecs
 
 PYBIND11_MODULE(ecs_cpp, ecs_cpp) {
   auto mutable_ecs = ecs_cpp.def_submodule("mutable_ecs");
   ecs::mutable_ecs::MutableEcsModule(mutable_ecs);
+
+  auto persistent_ecs = ecs_cpp.def_submodule("persistent_ecs");
+  ecs::persistent_ecs::PersistentEcsModule(persistent_ecs, mutable_ecs);
 }
@@ -1,70 +1,481 @@
+#include <cstring>
+
 #include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/operators.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h> /* Automatically converts STL containers to python objects */
 
 #include "ecs/mutable_ecs.hpp"
+#include "ecs/raw_column.hpp"
 #include "ecs/variant_utils.hpp"
-
-namespace std {
-template <> struct hash<pybind11::object> {
-  std::size_t operator()(const pybind11::object &py_object) const {
-    auto hash = pybind11::hash(py_object);
-    return hash;
-  }
-};
-
-} // namespace std
+#include "pybind_storage.hpp"
+#include "pybind_utils.hpp"
 
 namespace ecs {
 namespace mutable_ecs {
 
-using TypeIndex = pybind11::object;
+using TypeIndex = pybind_utils::InternedComponentType;
 using ComponentType = pybind11::object;
 using SystemType = pybind11::object;
 using ActionType = pybind11::object;
 
-struct GetPybindComponentType {
-  auto operator()(ComponentType component) { return pybind11::type::of(component); }
+using PybindEntityComponentDatabase = EntityComponentDatabase<TypeIndex, ComponentType, PybindStorage>;
+
+using pybind_utils::GetInternedComponentType;
+
+// Structured dtype with the layout of Entity
+pybind11::dtype entity_dtype() {
+  pybind11::list fields;
+  fields.append(pybind11::make_tuple("index", pybind11::dtype::of<EntityIndex>()));
+  fields.append(pybind11::make_tuple("generation", pybind11::dtype::of<EntityGeneration>()));
+  return pybind11::dtype::from_args(fields);
+}
+
+// Contiguous 1-d array with the given dtype, copies array only if it has a different layout
+pybind11::array as_contiguous_array(const pybind11::object &array, const pybind11::dtype &dtype) {
+  auto contiguous_array =
+      pybind11::module::import("numpy").attr("ascontiguousarray")(array, dtype).cast<pybind11::array>();
+  if (contiguous_array.ndim() != 1) {
+    throw std::runtime_error("Expected a 1-dimensional array");
+  }
+  return contiguous_array;
+}
+
+// Throws RecordsExportedError if removing the entity, and its descendants with it, would move the records of a column
+// whose arrays are alive
+void check_remove_entity(const PybindEntityComponentDatabase &ecdb, const Entity &entity) {
+  if (not ecdb.contains(entity)) {
+    return;
+  }
+  ecdb._storage.check_erase_entity(entity);
+  if (ecdb._hierarchy.has_children(entity.index)) {
+    std::vector<Entity> descendants;
+    ecdb._hierarchy.append_descendants(entity.index, descendants);
+    for (auto &descendant : descendants) {
+      ecdb._storage.check_erase_entity(descendant);
+    }
+  }
+}
+
+// Throws RecordsExportedError if adding a new entity with components would move the records of a column whose arrays
+// are alive
+void check_add_entity(const PybindEntityComponentDatabase &ecdb, const std::vector<ComponentType> &components) {
+  for (auto &component : components) {
+    auto column = ecdb._storage.find_column(GetInternedComponentType()(component));
+    if (column != nullptr) {
+      column->column._check_not_exported();
+    }
+  }
+}
+
+// Writes records[i] to the column of component_type of entities[i], all entities are checked before writing anything
+void add_components_to_column(PybindEntityComponentDatabase &ecdb, const Entity *entities, std::size_t num_entities,
+                              const TypeIndex &component_type, const pybind11::object &components) {
+  auto &column = ecdb._storage.column(component_type);
+  auto records = as_contiguous_array(components, column.dtype);
+  if (static_cast<std::size_t>(records.shape(0)) != num_entities) {
+    throw std::runtime_error("Expected one component per entity");
+  }
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    ecdb._get_entity_slot(entities[entity_index]);
+    column.column.check_insert(entities[entity_index]);
+  }
+
+  auto bit = ecdb._component_type_registry.register_component_type(component_type);
+  auto record_data = static_cast<const std::byte *>(records.data());
+  pybind11::gil_scoped_release release_gil;
+  // With live arrays every entity is already in the column, so it must not grow either
+  if (not column.column.exported()) {
+    memory_utils::reserve_for_append(column.column, num_entities);
+  }
+  for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+    auto &entity = entities[entity_index];
+    ecdb._set_component_bit(entity, bit);
+    column.column.insert(entity, record_data + entity_index * column.column.record_size());
+  }
+}
+
+// RawCommandBuffer whose records are converted to the dtype of the column they are written to when they are recorded
+struct PybindColumnCommandBuffer {
+public:
+  const PybindStorage<TypeIndex, ComponentType> *_storage;
+  RawCommandBuffer<TypeIndex> _command_buffer;
+
+  explicit PybindColumnCommandBuffer(const PybindEntityComponentDatabase &ecdb) {
+    this->_storage = &ecdb._storage;
+    this->_command_buffer = RawCommandBuffer<TypeIndex>();
+  }
+
+  void set(const pybind11::object &entities, const TypeIndex &component_type, const pybind11::object &components) {
+    auto column = this->_storage->find_column(component_type);
+    if (column == nullptr) {
+      throw std::out_of_range("Component type is not stored in a column");
+    }
+    auto entity_array = as_contiguous_array(entities, entity_dtype());
+    auto records = as_contiguous_array(components, column->dtype);
+    if (records.shape(0) != entity_array.shape(0)) {
+      throw std::runtime_error("Expected one component per entity");
+    }
+    this->_command_buffer.set(static_cast<const Entity *>(entity_array.data()), entity_array.shape(0), component_type,
+                              static_cast<const std::byte *>(records.data()), column->column.record_size());
+  }
+
+  void remove(const pybind11::object &entities, const TypeIndex &component_type) {
+    auto entity_array = as_contiguous_array(entities, entity_dtype());
+    this->_command_buffer.remove(static_cast<const Entity *>(entity_array.data()), entity_array.shape(0),
+                                 component_type);
+  }
+
+  void destroy(const pybind11::object &entities) {
+    auto entity_array = as_contiguous_array(entities, entity_dtype());
+    this->_command_buffer.destroy(static_cast<const Entity *>(entity_array.data()), entity_array.shape(0));
+  }
+};
+
+// Applies the commands of command_buffer and clears it, commands for entities that are not alive are skipped.
+// Writing and removing components of columns only touches native memory, so those commands are applied in recording
+// order with the GIL released. Removing components that are Python objects and destroying entities releases Python
+// objects, so those commands are applied afterwards with the GIL held.
+// Throws RecordsExportedError before applying anything if a command would move the records of a column whose arrays
+// are alive.
+void flush_column_commands(PybindEntityComponentDatabase &ecdb, PybindColumnCommandBuffer &command_buffer) {
+  auto &raw_command_buffer = command_buffer._command_buffer;
+  if (ecdb._storage.exported()) {
+    for (auto &command : raw_command_buffer.commands()) {
+      if (command.command_type == RawCommandType::DESTROY) {
+        check_remove_entity(ecdb, command.entity);
+      } else if (not ecdb.contains(command.entity)) {
+        continue;
+      } else if (command.command_type == RawCommandType::SET) {
+        ecdb._storage.check_insert(command.entity, command.component_type);
+      } else {
+        ecdb._storage.check_erase(command.entity, command.component_type);
+      }
+    }
+  }
+
+  std::vector<const RawCommand<TypeIndex> *> commands_with_gil;
+  {
+    pybind11::gil_scoped_release release_gil;
+    auto &registry = ecdb._component_type_registry;
+    for (auto &command : raw_command_buffer.commands()) {
+      if (not ecdb.contains(command.entity)) {
+        continue;
+      }
+      auto column = command.command_type == RawCommandType::DESTROY
+                        ? nullptr
+                        : ecdb._storage.find_column(command.component_type);
+      if (column == nullptr) {
+        commands_with_gil.push_back(&command);
+      } else if (command.command_type == RawCommandType::SET) {
+        ecdb._set_component_bit(command.entity, registry.register_component_type(command.component_type));
+        column->column.insert(command.entity, raw_command_buffer.record(command));
+      } else if (column->column.erase(command.entity)) {
+        ecdb._reset_component_bit(command.entity, registry.find_bit(command.component_type));
+      }
+    }
+  }
+
+  for (auto command : commands_with_gil) {
+    if (not ecdb.contains(command->entity)) {
+      continue;
+    }
+    if (command->command_type == RawCommandType::DESTROY) {
+      ecdb = remove_entity(ecdb, command->entity);
+    } else if (ecdb._storage.contains(command->entity, command->component_type)) {
+      ecdb = remove_component(ecdb, command->entity, command->component_type);
+    }
+  }
+  raw_command_buffer.clear();
+}
+
+// Keeps the Python object of the ecdb alive while arrays reference the memory of one of its columns, and counts those
+// arrays as exports of the column
+struct ColumnExport {
+public:
+  pybind11::object ecdb_object;
+  RawColumn *column;
 };
 
 void MutableEcsModule(pybind11::module &mutable_ecs) {
 
+  // Like resizing a bytearray with live exports
+  pybind11::register_exception_translator([](std::exception_ptr exception) {
+    try {
+      if (exception) {
+        std::rethrow_exception(exception);
+      }
+    } catch (const RecordsExportedError &error) {
+      PyErr_SetString(PyExc_BufferError, error.what());
+    }
+  });
+
   pybind11::class_<Entity>(mutable_ecs, "Entity")
-      .def(pybind11::init<UniqueId>(), pybind11::arg("unique_id"))
-      .def_readonly("unique_id", &Entity::unique_id);
+      .def(pybind11::init<EntityIndex, EntityGeneration>(), pybind11::arg("index"), pybind11::arg("generation") = 0)
+      .def_readonly("index", &Entity::index)
+      .def_readonly("generation", &Entity::generation)
+      .def_property_readonly("unique_id", &Entity::unique_id)
+      .def(pybind11::self == pybind11::self)
+      .def(pybind11::self != pybind11::self)
+      .def("__hash__", [](const Entity &entity) { return std::hash<Entity>{}(entity); });
 
-  pybind11::class_<EntityComponentDatabase<TypeIndex, ComponentType>>(mutable_ecs, "EntityComponentDatabase")
+  mutable_ecs.attr("ENTITY_DTYPE") = entity_dtype();
+
+  pybind11::class_<PybindEntityComponentDatabase>(mutable_ecs, "EntityComponentDatabase")
       .def(pybind11::init<>())
-      .def("__len__", [](const EntityComponentDatabase<TypeIndex, ComponentType> &self) { return self.size(); });
+      .def("__len__", [](const PybindEntityComponentDatabase &self) { return self.size(); });
 
-  mutable_ecs.def("create_ecdb", &create_ecdb<TypeIndex, ComponentType>);
-  mutable_ecs.def("add_entity", &add_entity<TypeIndex, ComponentType, GetPybindComponentType>, pybind11::arg("ecdb"),
-                  pybind11::arg("components") = std::vector<ComponentType>{},
-                  pybind11::return_value_policy::take_ownership);
-  mutable_ecs.def("remove_entity", &remove_entity<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+  // The bindings that change an ecdb change its Python object in place and return that same object. Returning the
+  // moved ecdb instead would wrap it in a new Python object that takes over the memory of the arrays returned by
+  // column, while the arrays only keep the old, moved-from object alive.
+  mutable_ecs.def("create_ecdb", &create_ecdb<TypeIndex, ComponentType, PybindStorage>);
+  mutable_ecs.def("is_alive", &is_alive<TypeIndex, ComponentType, PybindStorage>, pybind11::arg("ecdb"),
                   pybind11::arg("entity"));
-  mutable_ecs.def("add_component", &add_component<TypeIndex, ComponentType, GetPybindComponentType>,
-                  pybind11::arg("ecdb"), pybind11::arg("entity"), pybind11::arg("component"));
-  mutable_ecs.def("remove_component", &remove_component<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
-                  pybind11::arg("entity"), pybind11::arg("component_type"));
-  mutable_ecs.def("get_component", &get_component<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+  mutable_ecs.def(
+      "add_entity",
+      [](pybind11::object ecdb_object, const std::vector<ComponentType> &components) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        check_add_entity(ecdb, components);
+        Entity entity;
+        std::tie(ecdb, entity) =
+            add_entity<TypeIndex, ComponentType, GetInternedComponentType, PybindStorage>(ecdb, components);
+        return std::make_tuple(ecdb_object, entity);
+      },
+      pybind11::arg("ecdb"), pybind11::arg("components") = std::vector<ComponentType>{});
+  mutable_ecs.def(
+      "remove_entity",
+      [](pybind11::object ecdb_object, const Entity &entity) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        check_remove_entity(ecdb, entity);
+        ecdb = remove_entity<TypeIndex, ComponentType, PybindStorage>(ecdb, entity);
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("entity"));
+  mutable_ecs.def(
+      "add_component",
+      [](pybind11::object ecdb_object, const Entity &entity, const ComponentType &component) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        if (ecdb.contains(entity)) {
+          ecdb._storage.check_insert(entity, GetInternedComponentType()(component));
+        }
+        ecdb = add_component<TypeIndex, ComponentType, GetInternedComponentType, PybindStorage>(ecdb, entity,
+                                                                                                 component);
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("entity"), pybind11::arg("component"));
+  mutable_ecs.def(
+      "remove_component",
+      [](pybind11::object ecdb_object, const Entity &entity, const TypeIndex &component_type) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        ecdb._storage.check_erase(entity, component_type);
+        ecdb = remove_component<TypeIndex, ComponentType, PybindStorage>(ecdb, entity, component_type);
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("entity"), pybind11::arg("component_type"));
+  mutable_ecs.def("get_component", &get_component<TypeIndex, ComponentType, PybindStorage>, pybind11::arg("ecdb"),
                   pybind11::arg("entity"), pybind11::arg("component_type"));
 
   mutable_ecs.def("query",
-                  pybind11::overload_cast<const EntityComponentDatabase<TypeIndex, ComponentType> &,
-                                          const std::vector<TypeIndex> &>(&query<TypeIndex, ComponentType>),
+                  pybind11::overload_cast<const PybindEntityComponentDatabase &, const std::vector<TypeIndex> &>(
+                      &query<TypeIndex, ComponentType, PybindStorage>),
                   pybind11::arg("ecdb"), pybind11::arg("component_types") = std::vector<TypeIndex>{});
 
+  // Columns: components of a type registered with a structured dtype are stored as records in native memory and
+  // exposed as NumPy arrays without copying. Every field of the dtype is an attribute of the component type.
+  mutable_ecs.def(
+      "register_column",
+      [](pybind11::object ecdb_object, TypeIndex component_type, pybind11::object dtype) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        ecdb._storage.register_column(component_type, pybind11::dtype::from_args(dtype));
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("component_type"), pybind11::arg("dtype"));
+
+  // (entities, components) of the column of component_type. Both arrays reference the memory of the column and keep
+  // the Python object of ecdb alive, which the bindings above change in place. Writing to components updates ecdb in
+  // place. Adding a component of component_type to an entity without one or removing one would move the records, so
+  // like a bytearray with live exports those changes raise BufferError until both arrays, and any views of them, are
+  // released. Overwriting components of entities that already have one is allowed.
+  mutable_ecs.def(
+      "column",
+      [](pybind11::object ecdb_object, TypeIndex component_type) {
+        auto &column = ecdb_object.cast<PybindEntityComponentDatabase &>()._storage.column(component_type);
+        auto &raw_column = column.column;
+        raw_column.export_records();
+        pybind11::capsule column_export(new ColumnExport{ecdb_object, &raw_column}, [](void *pointer) {
+          auto column_export = static_cast<ColumnExport *>(pointer);
+          column_export->column->release_records();
+          delete column_export;
+        });
+        pybind11::array entities(entity_dtype(), {raw_column.size()}, {sizeof(Entity)}, raw_column.entities().data(),
+                                 column_export);
+        entities.attr("setflags")(pybind11::arg("write") = false);
+        pybind11::array components(column.dtype, {raw_column.size()}, {raw_column.record_size()}, raw_column.data(),
+                                   column_export);
+        return pybind11::make_tuple(entities, components);
+      },
+      pybind11::arg("ecdb"), pybind11::arg("component_type"));
+
+  // Adds num_entities entities and returns them as an array of ENTITY_DTYPE. components maps component types with a
+  // column to arrays of num_entities records.
+  mutable_ecs.def(
+      "add_entities",
+      [](pybind11::object ecdb_object, std::size_t num_entities, pybind11::dict components) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        for (auto &&[component_type, component_array] : components) {
+          ecdb._storage.column(pybind11::cast<TypeIndex>(component_type)).column._check_not_exported();
+        }
+        std::vector<Entity> entities(num_entities);
+        for (auto &entity : entities) {
+          std::tie(ecdb, entity) =
+              add_entity<TypeIndex, ComponentType, GetInternedComponentType, PybindStorage>(ecdb, {});
+        }
+        for (auto &&[component_type, component_array] : components) {
+          add_components_to_column(ecdb, entities.data(), num_entities,
+                                   pybind11::cast<TypeIndex>(component_type),
+                                   pybind11::reinterpret_borrow<pybind11::object>(component_array));
+        }
+        auto entity_array = pybind11::array(entity_dtype(), {num_entities}, {sizeof(Entity)}, entities.data());
+        return std::make_tuple(ecdb_object, entity_array);
+      },
+      pybind11::arg("ecdb"), pybind11::arg("num_entities"), pybind11::arg("components") = pybind11::dict());
+
+  // Sets the component of component_type of entities[i] to components[i]
+  mutable_ecs.def(
+      "add_components",
+      [](pybind11::object ecdb_object, pybind11::object entities, TypeIndex component_type,
+         pybind11::object components) {
+        auto entity_array = as_contiguous_array(entities, entity_dtype());
+        add_components_to_column(ecdb_object.cast<PybindEntityComponentDatabase &>(),
+                                 static_cast<const Entity *>(entity_array.data()), entity_array.shape(0),
+                                 component_type, components);
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("entities"), pybind11::arg("component_type"),
+      pybind11::arg("components"));
+
+  // Entities that have all of component_types as an array of ENTITY_DTYPE, matched with the GIL released
+  mutable_ecs.def(
+      "query_entities",
+      [](const PybindEntityComponentDatabase &ecdb, const std::vector<TypeIndex> &component_types) {
+        std::vector<Entity> entities;
+        {
+          pybind11::gil_scoped_release release_gil;
+          ComponentSignature query_signature;
+          if (ecdb._component_type_registry.make_signature(component_types, query_signature) == 0) {
+            for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+              auto &[generation, alive, signature] = ecdb._entity_slots[entity_index];
+              if (alive and signature.contains(query_signature)) {
+                entities.emplace_back(entity_index, generation);
+              }
+            }
+          }
+        }
+        return pybind11::array(entity_dtype(), {entities.size()}, {sizeof(Entity)}, entities.data());
+      },
+      pybind11::arg("ecdb"), pybind11::arg("component_types") = std::vector<TypeIndex>{});
+
+  // Copy of the components of component_type of entities, in the order of entities
+  mutable_ecs.def(
+      "get_components",
+      [](const PybindEntityComponentDatabase &ecdb, pybind11::object entities, TypeIndex component_type) {
+        auto &column = ecdb._storage.column(component_type);
+        auto entity_array = as_contiguous_array(entities, entity_dtype());
+        auto num_entities = static_cast<std::size_t>(entity_array.shape(0));
+        pybind11::array components(column.dtype, {num_entities});
+        auto entity_data = static_cast<const Entity *>(entity_array.data());
+        auto component_data = static_cast<std::byte *>(components.mutable_data());
+        {
+          pybind11::gil_scoped_release release_gil;
+          auto record_size = column.column.record_size();
+          for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+            std::memcpy(component_data + entity_index * record_size, column.column.at(entity_data[entity_index]),
+                        record_size);
+          }
+        }
+        return components;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("entities"), pybind11::arg("component_type"));
+
+  // Commands for columns recorded in batches of entities. The records are copied into native memory when they are
+  // recorded, so the arrays can be reused right away.
+  pybind11::class_<PybindColumnCommandBuffer>(mutable_ecs, "ColumnCommandBuffer")
+      .def("__len__", [](const PybindColumnCommandBuffer &self) { return self._command_buffer.size(); })
+      .def("set", &PybindColumnCommandBuffer::set, pybind11::arg("entities"), pybind11::arg("component_type"),
+           pybind11::arg("components"))
+      .def("remove", &PybindColumnCommandBuffer::remove, pybind11::arg("entities"), pybind11::arg("component_type"))
+      .def("destroy", &PybindColumnCommandBuffer::destroy, pybind11::arg("entities"));
+
+  mutable_ecs.def(
+      "create_column_command_buffer",
+      [](const PybindEntityComponentDatabase &ecdb) { return PybindColumnCommandBuffer(ecdb); },
+      pybind11::arg("ecdb"), pybind11::keep_alive<0, 1>());
+  // Changes ecdb in place like the bindings above, so command_buffer stays bound to it and can be reused every frame
+  mutable_ecs.def(
+      "flush_column_commands",
+      [](pybind11::object ecdb_object, PybindColumnCommandBuffer &command_buffer) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        if (command_buffer._storage != &ecdb._storage) {
+          throw std::runtime_error("ColumnCommandBuffer was created for another EntityComponentDatabase");
+        }
+        flush_column_commands(ecdb, command_buffer);
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("command_buffer"));
+
   // Systems
   pybind11::class_<Systems<SystemType>>(mutable_ecs, "Systems").def(pybind11::init<>());
 
   mutable_ecs.def("create_systems", &create_systems<SystemType>);
-  mutable_ecs.def("add_system", &add_system<SystemType>, pybind11::arg("systems"), pybind11::arg("system"),
-                  pybind11::arg("priority"));
-  mutable_ecs.def("process_systems", &process_systems<TypeIndex, ComponentType, SystemType, ActionType>,
-                  pybind11::arg("ecdb"), pybind11::arg("systems"), pybind11::arg("process_system"),
-                  pybind11::arg("process_action"));
+  mutable_ecs.def(
+      "add_system",
+      [](Systems<SystemType> &systems, SystemType system, SystemPriority priority) {
+        return add_system<SystemType>(systems, system, priority);
+      },
+      pybind11::arg("systems"), pybind11::arg("system"), pybind11::arg("priority"));
+  mutable_ecs.def(
+      "process_systems",
+      [](pybind11::object ecdb_object, Systems<SystemType> &systems,
+         ProcessSystemFunction<TypeIndex, ComponentType, SystemType, ActionType, PybindStorage> process_system,
+         ProcessActionFunction<TypeIndex, ComponentType, ActionType, PybindStorage> process_action) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        // ecdb is replaced by the copy that process_action returns, which would free the records of its columns
+        if (ecdb._storage.exported()) {
+          throw RecordsExportedError("Cannot process systems while arrays of a column of ecdb are alive");
+        }
+        ecdb = process_systems<TypeIndex, ComponentType, SystemType, ActionType, PybindStorage>(
+            ecdb, systems, std::move(process_system), std::move(process_action));
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("systems"), pybind11::arg("process_system"),
+      pybind11::arg("process_action"));
+
+  // Native counterpart of process_systems: process_system(ecdb, system, command_buffer) records the changes of the
+  // system into a ColumnCommandBuffer instead of returning one Python object per action. ecdb is passed to
+  // process_system without copying it and must only be read. The buffer is flushed once per priority level. Like
+  // process_systems, every system sees the changes since its previous run, and the events of the frame are dispatched
+  // and the removals that every system has seen are forgotten at the end of it.
+  mutable_ecs.def(
+      "process_systems_with_column_commands",
+      [](pybind11::object ecdb_object, Systems<SystemType> &systems, pybind11::function process_system) {
+        auto &ecdb = ecdb_object.cast<PybindEntityComponentDatabase &>();
+        auto command_buffer_object = pybind11::cast(PybindColumnCommandBuffer(ecdb));
+        auto &command_buffer = command_buffer_object.cast<PybindColumnCommandBuffer &>();
+        for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
+          auto &last_run_ticks = systems._priority_to_last_run_ticks[priority];
+          for (std::size_t system_index = 0; system_index < systems_with_same_priority.size(); system_index++) {
+            ecdb._last_run_tick = last_run_ticks[system_index];
+            process_system(ecdb_object, systems_with_same_priority[system_index], command_buffer_object);
+            last_run_ticks[system_index] = advance_change_tick(ecdb);
+          }
+          flush_column_commands(ecdb, command_buffer);
+        }
+        ecdb = dispatch_events(ecdb);
+        prune_removals(ecdb, systems._min_last_run_tick());
+        return ecdb_object;
+      },
+      pybind11::arg("ecdb"), pybind11::arg("systems"), pybind11::arg("process_system"));
 }
 
 } // namespace mutable_ecs
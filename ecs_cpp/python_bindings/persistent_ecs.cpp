@@ -0,0 +1,62 @@
+#include <pybind11/functional.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h> /* Automatically converts STL containers to python objects */
+
+#include "ecs/persistent_ecs.hpp"
+#include "pybind_utils.hpp"
+
+namespace ecs {
+namespace persistent_ecs {
+
+using TypeIndex = pybind11::object;
+using ComponentType = pybind11::object;
+using SystemType = pybind11::object;
+using ActionType = pybind11::object;
+
+using pybind_utils::GetPybindComponentType;
+
+// Entity and Systems are the same C++ types as in mutable_ecs, so they are only registered once and aliased here
+void PersistentEcsModule(pybind11::module &persistent_ecs, pybind11::module &mutable_ecs) {
+  persistent_ecs.attr("Entity") = mutable_ecs.attr("Entity");
+
+  pybind11::class_<EntityComponentDatabase<TypeIndex, ComponentType>>(persistent_ecs, "EntityComponentDatabase")
+      .def(pybind11::init<>())
+      .def("__len__", [](const EntityComponentDatabase<TypeIndex, ComponentType> &self) { return self.size(); })
+      .def("__contains__", &EntityComponentDatabase<TypeIndex, ComponentType>::contains)
+      // databases are immutable, a copy shares every node with the original
+      .def("__copy__",
+           [](const EntityComponentDatabase<TypeIndex, ComponentType> &self) {
+             return EntityComponentDatabase<TypeIndex, ComponentType>(self);
+           })
+      .def(
+          "__deepcopy__",
+          [](const EntityComponentDatabase<TypeIndex, ComponentType> &self, pybind11::dict) {
+            return EntityComponentDatabase<TypeIndex, ComponentType>(self);
+          },
+          pybind11::arg("memo"));
+
+  persistent_ecs.def("create_ecdb", &create_ecdb<TypeIndex, ComponentType>);
+  persistent_ecs.def("add_entity", &add_entity<TypeIndex, ComponentType, GetPybindComponentType>,
+                     pybind11::arg("ecdb"), pybind11::arg("components") = std::vector<ComponentType>{});
+  persistent_ecs.def("remove_entity", &remove_entity<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+                     pybind11::arg("entity"));
+  persistent_ecs.def("add_component", &add_component<TypeIndex, ComponentType, GetPybindComponentType>,
+                     pybind11::arg("ecdb"), pybind11::arg("entity"), pybind11::arg("component"));
+  persistent_ecs.def("remove_component", &remove_component<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+                     pybind11::arg("entity"), pybind11::arg("component_type"));
+  persistent_ecs.def("get_component", &get_component<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+                     pybind11::arg("entity"), pybind11::arg("component_type"));
+  persistent_ecs.def("query", &query<TypeIndex, ComponentType>, pybind11::arg("ecdb"),
+                     pybind11::arg("component_types") = std::vector<TypeIndex>{});
+
+  // Systems
+  persistent_ecs.attr("Systems") = mutable_ecs.attr("Systems");
+  persistent_ecs.attr("create_systems") = mutable_ecs.attr("create_systems");
+  persistent_ecs.attr("add_system") = mutable_ecs.attr("add_system");
+  persistent_ecs.def("process_systems", &process_systems<TypeIndex, ComponentType, SystemType, ActionType>,
+                     pybind11::arg("ecdb"), pybind11::arg("systems"), pybind11::arg("process_system"),
+                     pybind11::arg("process_action"));
+}
+
+} // namespace persistent_ecs
+} // namespace ecs
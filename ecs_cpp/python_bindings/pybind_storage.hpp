@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include "ecs/hash_map_storage.hpp"
+#include "ecs/raw_column.hpp"
+#include "pybind_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Component type whose components live in a RawColumn instead of being kept as Python objects. Every field of dtype
+// is an attribute of the component type with the same name.
+struct PybindColumn {
+public:
+  pybind11::dtype dtype;
+  pybind11::list field_names;
+  RawColumn column;
+};
+
+// HashMapStorage of Python objects, except for the component types registered with register_column, whose components
+// are converted to records of their dtype on insert and back to Python objects on get
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+struct PybindStorage : public HashMapStorage<TypeIndexTemplate, ComponentTemplate> {
+public:
+  using Base = HashMapStorage<TypeIndexTemplate, ComponentTemplate>;
+
+  std::unordered_map<TypeIndexTemplate, PybindColumn> _columns;
+
+  explicit PybindStorage() { this->_columns = {}; }
+
+  void register_column(const TypeIndexTemplate &component_type, const pybind11::dtype &dtype) {
+    if (this->_columns.count(component_type) > 0 or this->_component_tables.count(component_type) > 0) {
+      throw std::runtime_error("Component type is already in the storage");
+    }
+    auto field_names = dtype.attr("names");
+    if (field_names.is_none()) {
+      throw std::runtime_error("Columns need a structured dtype");
+    }
+    this->_columns.emplace(component_type,
+                           PybindColumn{dtype, pybind11::list(field_names), RawColumn(dtype.itemsize())});
+  }
+
+  PybindColumn *find_column(const TypeIndexTemplate &component_type) {
+    auto column = this->_columns.find(component_type);
+    return column == this->_columns.end() ? nullptr : &column->second;
+  }
+
+  const PybindColumn *find_column(const TypeIndexTemplate &component_type) const {
+    return const_cast<PybindStorage *>(this)->find_column(component_type);
+  }
+
+  PybindColumn &column(const TypeIndexTemplate &component_type) {
+    auto column = this->find_column(component_type);
+    if (column == nullptr) {
+      throw std::out_of_range("Component type is not stored in a column");
+    }
+    return *column;
+  }
+
+  const PybindColumn &column(const TypeIndexTemplate &component_type) const {
+    return const_cast<PybindStorage *>(this)->column(component_type);
+  }
+
+  // The checks below throw RecordsExportedError if a change would move the records of a column whose arrays are alive.
+  // The bindings run them before changing the ecdb, so a refused change leaves it untouched.
+  void check_insert(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto column = this->find_column(component_type);
+    if (column != nullptr) {
+      column->column.check_insert(entity);
+    }
+  }
+
+  void check_erase(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto column = this->find_column(component_type);
+    if (column != nullptr) {
+      column->column.check_erase(entity);
+    }
+  }
+
+  void check_erase_entity(const Entity &entity) const {
+    for (auto &&[component_type, column] : this->_columns) {
+      column.column.check_erase(entity);
+    }
+  }
+
+  bool exported() const {
+    for (auto &&[component_type, column] : this->_columns) {
+      if (column.column.exported()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void insert(const Entity &entity, const TypeIndexTemplate &component_type, const ComponentTemplate &component) {
+    auto column = this->find_column(component_type);
+    if (column == nullptr) {
+      Base::insert(entity, component_type, component);
+      return;
+    }
+    pybind11::tuple values(column->field_names.size());
+    for (std::size_t field_index = 0; field_index < column->field_names.size(); field_index++) {
+      pybind11::object field_name = column->field_names[field_index];
+      values[field_index] = component.attr(field_name);
+    }
+    auto numpy = pybind11::module::import("numpy");
+    auto record = numpy.attr("array")(pybind11::make_tuple(values), column->dtype).cast<pybind11::array>();
+    column->column.insert(entity, record.data());
+  }
+
+  void erase(const Entity &entity, const TypeIndexTemplate &component_type) {
+    auto column = this->find_column(component_type);
+    if (column == nullptr) {
+      Base::erase(entity, component_type);
+      return;
+    }
+    column->column.erase(entity);
+  }
+
+  void erase_entity(const Entity &entity) {
+    Base::erase_entity(entity);
+    for (auto &&[component_type, column] : this->_columns) {
+      column.column.erase(entity);
+    }
+  }
+
+  void insert_entities(const std::vector<Entity> &entities, const std::vector<TypeIndexTemplate> &component_types,
+                       const std::vector<ComponentTemplate> &components) {
+    for (std::size_t index = 0; index < component_types.size(); index++) {
+      for (auto &entity : entities) {
+        this->insert(entity, component_types[index], components[index]);
+      }
+    }
+  }
+
+  void insert_components(const std::vector<Entity> &entities, const TypeIndexTemplate &component_type,
+                         const std::vector<ComponentTemplate> &components) {
+    if (this->find_column(component_type) == nullptr) {
+      Base::insert_components(entities, component_type, components);
+      return;
+    }
+    for (std::size_t index = 0; index < entities.size(); index++) {
+      this->insert(entities[index], component_type, components[index]);
+    }
+  }
+
+  void erase_entities(std::span<const Entity> entities) {
+    for (auto &entity : entities) {
+      this->erase_entity(entity);
+    }
+  }
+
+  void reserve(const TypeIndexTemplate &component_type, std::size_t num_components) {
+    if (this->find_column(component_type) == nullptr) {
+      Base::reserve(component_type, num_components);
+    }
+  }
+
+  // Components in columns are returned as a new object of their component type
+  ComponentTemplate get(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto column = this->find_column(component_type);
+    if (column == nullptr) {
+      return Base::get(entity, component_type);
+    }
+    auto record = pybind11::array(column->dtype, {1}, {}, column->column.at(entity));
+    pybind11::dict fields;
+    for (auto field_name : column->field_names) {
+      fields[field_name] = record[field_name].attr("tolist")()[pybind11::int_(0)];
+    }
+    return pybind11::cast(component_type)(**fields);
+  }
+
+  bool contains(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto column = this->find_column(component_type);
+    return column == nullptr ? Base::contains(entity, component_type) : column->column.contains(entity);
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
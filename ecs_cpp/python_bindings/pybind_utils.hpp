@@ -0,0 +1,114 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+// Shared by every binding translation unit, so that all of them use the same std::hash<pybind11::object>
+namespace std {
+template <> struct hash<pybind11::object> {
+  std::size_t operator()(const pybind11::object &py_object) const {
+    auto hash = pybind11::hash(py_object);
+    return hash;
+  }
+};
+
+} // namespace std
+
+namespace ecs {
+namespace pybind_utils {
+
+struct GetPybindComponentType {
+  auto operator()(pybind11::object component) { return pybind11::type::of(component); }
+};
+
+// Python component type interned into a dense integer id. Tables keyed by it hash and compare the id instead of calling
+// back into Python, and can be used without holding the GIL.
+struct InternedComponentType {
+public:
+  std::size_t id;
+};
+
+inline bool operator==(const InternedComponentType &component_type_a, const InternedComponentType &component_type_b) {
+  return component_type_a.id == component_type_b.id;
+}
+inline bool operator!=(const InternedComponentType &component_type_a, const InternedComponentType &component_type_b) {
+  return component_type_a.id != component_type_b.id;
+}
+
+// Ids are assigned in the order component types are first seen and never reused, every interned component type is kept
+// alive for the lifetime of the process. Component types are compared by identity, like the hash of a Python type.
+// Only used with the GIL held.
+class ComponentTypeInterner {
+public:
+  std::unordered_map<PyObject *, std::size_t> _component_type_to_id;
+  std::vector<pybind11::object> _id_to_component_type;
+
+  explicit ComponentTypeInterner() {
+    this->_component_type_to_id = {};
+    this->_id_to_component_type = {};
+  }
+
+  InternedComponentType intern(pybind11::handle component_type) {
+    auto id = this->_component_type_to_id.find(component_type.ptr());
+    if (id != this->_component_type_to_id.end()) {
+      return InternedComponentType{id->second};
+    }
+    this->_id_to_component_type.push_back(pybind11::reinterpret_borrow<pybind11::object>(component_type));
+    this->_component_type_to_id.emplace(component_type.ptr(), this->_id_to_component_type.size() - 1);
+    return InternedComponentType{this->_id_to_component_type.size() - 1};
+  }
+
+  const pybind11::object &component_type(const InternedComponentType &component_type) const {
+    return this->_id_to_component_type.at(component_type.id);
+  }
+};
+
+// Leaked on purpose, the interned objects must not be released after the interpreter is finalized
+inline ComponentTypeInterner &component_type_interner() {
+  static auto interner = new ComponentTypeInterner();
+  return *interner;
+}
+
+struct GetInternedComponentType {
+  auto operator()(const pybind11::object &component) {
+    return component_type_interner().intern(reinterpret_cast<PyObject *>(Py_TYPE(component.ptr())));
+  }
+};
+
+} // namespace pybind_utils
+} // namespace ecs
+
+namespace std {
+template <> struct hash<ecs::pybind_utils::InternedComponentType> {
+  std::size_t operator()(const ecs::pybind_utils::InternedComponentType &component_type) const {
+    return component_type.id;
+  }
+};
+
+} // namespace std
+
+// Python component types are interned when they are passed to a binding and turned back into the same type objects
+// when they are returned
+namespace pybind11 {
+namespace detail {
+template <> struct type_caster<ecs::pybind_utils::InternedComponentType> {
+public:
+  PYBIND11_TYPE_CASTER(ecs::pybind_utils::InternedComponentType, _("type"));
+
+  bool load(handle source, bool) {
+    if (not source) {
+      return false;
+    }
+    this->value = ecs::pybind_utils::component_type_interner().intern(source);
+    return true;
+  }
+
+  static handle cast(const ecs::pybind_utils::InternedComponentType &component_type, return_value_policy, handle) {
+    return ecs::pybind_utils::component_type_interner().component_type(component_type).inc_ref();
+  }
+};
+
+} // namespace detail
+} // namespace pybind11
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/type_utils.hpp"
+#include "ecs/variant_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+template <typename TypeIndexTemplate, typename ComponentTemplate> struct ArchetypeStorage;
+
+// Entities with the same set of component types share an archetype. Every archetype stores each of its component
+// types in a contiguous column of the concrete type, so ComponentTemplate has to be a std::variant.
+template <typename TypeIndexTemplate, typename... ComponentTypes>
+struct ArchetypeStorage<TypeIndexTemplate, std::variant<ComponentTypes...>> {
+public:
+  using ComponentTemplate = std::variant<ComponentTypes...>;
+  using ArchetypeMask = std::bitset<sizeof...(ComponentTypes)>;
+  // Columns start at a cache line, so chunks of rows handed to different threads do not share cache lines
+  template <typename ComponentType> using Column = memory_utils::CacheAlignedVector<ComponentType>;
+
+  struct Archetype {
+    ArchetypeMask mask;
+    std::vector<Entity> entities;
+    std::tuple<Column<ComponentTypes>...> columns;
+  };
+
+  struct EntityLocation {
+    std::size_t archetype_index;
+    std::size_t row;
+  };
+
+  static constexpr std::size_t NO_ARCHETYPE = std::numeric_limits<std::size_t>::max();
+
+  // Queries are matched against the masks of the archetypes instead, see each()
+  static constexpr bool MATCHES_ENTITY_SIGNATURES = false;
+
+  std::vector<Archetype> _archetypes;
+  std::unordered_map<ArchetypeMask, std::size_t> _mask_to_archetype_index;
+  // indexed by Entity::index
+  std::vector<EntityLocation> _entity_to_location;
+  std::unordered_map<TypeIndexTemplate, std::size_t> _component_type_to_column_index;
+
+  explicit ArchetypeStorage() {
+    this->_archetypes = {};
+    this->_mask_to_archetype_index = {};
+    this->_entity_to_location = {};
+    this->_component_type_to_column_index = {
+        {type_utils::get_type_id<ComponentTypes>(), column_index<ComponentTypes>()}...};
+  }
+
+  template <typename ComponentType> static constexpr std::size_t column_index() {
+    return variant_utils::index_of<ComponentType, ComponentTemplate>::value;
+  }
+
+  void insert(const Entity &entity, const TypeIndexTemplate &, const ComponentTemplate &component) {
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      auto archetype_index = this->_get_or_create_archetype(ArchetypeMask().set(component.index()));
+      this->_push_entity(archetype_index, entity);
+      this->_push_component(archetype_index, component);
+      return;
+    }
+
+    auto [archetype_index, row] = *location;
+    auto &archetype = this->_archetypes[archetype_index];
+    if (archetype.mask.test(component.index())) {
+      std::visit(
+          [&archetype, row = row](const auto &value) {
+            using ComponentType = std::decay_t<decltype(value)>;
+            std::get<Column<ComponentType>>(archetype.columns)[row] = value;
+          },
+          component);
+      return;
+    }
+
+    auto new_mask = archetype.mask;
+    new_mask.set(component.index());
+    auto new_archetype_index = this->_move_entity(entity, *location, new_mask);
+    this->_push_component(new_archetype_index, component);
+  }
+
+  void erase(const Entity &entity, const TypeIndexTemplate &component_type) {
+    auto column_index = this->_component_type_to_column_index.at(component_type);
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      return;
+    }
+    auto new_mask = this->_archetypes[location->archetype_index].mask;
+    if (not new_mask.test(column_index)) {
+      return;
+    }
+    new_mask.reset(column_index);
+    this->_move_entity(entity, *location, new_mask);
+  }
+
+  void erase_entity(const Entity &entity) {
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      return;
+    }
+    this->_remove_row(*location);
+    location->archetype_index = NO_ARCHETYPE;
+  }
+
+  // Appends entities, which have no components yet, to the archetype of components and fills every column of it in
+  // one pass, instead of moving every entity through the archetypes of the prefixes of components
+  void insert_entities(const std::vector<Entity> &entities, const std::vector<TypeIndexTemplate> &,
+                       const std::vector<ComponentTemplate> &components) {
+    if (components.empty() or entities.empty()) {
+      return;
+    }
+    ArchetypeMask mask;
+    for (auto &component : components) {
+      mask.set(component.index());
+    }
+    auto archetype_index = this->_get_or_create_archetype(mask);
+    auto &archetype = this->_archetypes[archetype_index];
+
+    auto max_entity_index = std::max_element(entities.begin(), entities.end(), [](const auto &a, const auto &b) {
+                              return a.index < b.index;
+                            })->index;
+    if (max_entity_index >= this->_entity_to_location.size()) {
+      this->_entity_to_location.resize(max_entity_index + 1, EntityLocation{NO_ARCHETYPE, 0});
+    }
+    memory_utils::reserve_for_append(archetype.entities, entities.size());
+    for (auto &entity : entities) {
+      this->_push_entity(archetype_index, entity);
+    }
+    for (auto &component : components) {
+      std::visit(
+          [&archetype, &entities](const auto &value) {
+            using ComponentType = std::decay_t<decltype(value)>;
+            auto &column = std::get<Column<ComponentType>>(archetype.columns);
+            column.insert(column.end(), entities.size(), value);
+          },
+          component);
+    }
+  }
+
+  // Every entity that gains the component type moves to another archetype on its own, so the components are inserted
+  // one at a time
+  void insert_components(const std::vector<Entity> &entities, const TypeIndexTemplate &component_type,
+                         const std::vector<ComponentTemplate> &components) {
+    for (std::size_t index = 0; index < entities.size(); index++) {
+      this->insert(entities[index], component_type, components[index]);
+    }
+  }
+
+  void erase_entities(std::span<const Entity> entities) {
+    for (auto &entity : entities) {
+      this->erase_entity(entity);
+    }
+  }
+
+  // Columns belong to archetypes, which insert_entities grows instead
+  void reserve(const TypeIndexTemplate &, std::size_t) {}
+
+  ComponentTemplate get(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    using GetComponentFunction = ComponentTemplate (*)(const Archetype &, std::size_t);
+    static constexpr std::array<GetComponentFunction, sizeof...(ComponentTypes)> get_component_functions = {
+        &_get_component<ComponentTypes>...};
+
+    auto column_index = this->_component_type_to_column_index.at(component_type);
+    auto location = this->_get_location(entity);
+    auto &archetype = this->_archetypes[location.archetype_index];
+    if (not archetype.mask.test(column_index)) {
+      throw std::out_of_range("Entity does not have the requested component");
+    }
+    return get_component_functions[column_index](archetype, location.row);
+  }
+
+  bool contains(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      return false;
+    }
+    auto column_index = this->_component_type_to_column_index.find(component_type);
+    if (column_index == this->_component_type_to_column_index.end()) {
+      return false;
+    }
+    return this->_archetypes[location->archetype_index].mask.test(column_index->second);
+  }
+
+  // Component of the concrete type ComponentType or null if the entity does not have it
+  template <typename ComponentType> ComponentType *find(const Entity &entity) {
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      return nullptr;
+    }
+    auto &archetype = this->_archetypes[location->archetype_index];
+    if (not archetype.mask.test(column_index<ComponentType>())) {
+      return nullptr;
+    }
+    return &std::get<Column<ComponentType>>(archetype.columns)[location->row];
+  }
+
+  template <typename ComponentType> const ComponentType *find(const Entity &entity) const {
+    return const_cast<ArchetypeStorage *>(this)->template find<ComponentType>(entity);
+  }
+
+  template <typename... Args> static ArchetypeMask mask_of() {
+    ArchetypeMask mask;
+    (mask.set(column_index<Args>()), ...);
+    return mask;
+  }
+
+  // Calls function(entity, Args &...) for every entity that has all of Args, one archetype at a time
+  template <typename... Args, typename Function> void each(Function &&function) {
+    _each<Args...>(*this, function);
+  }
+
+  template <typename... Args, typename Function> void each(Function &&function) const {
+    _each<Args...>(*this, function);
+  }
+
+  // Lazily walks the rows of the archetypes that contain all of Args
+  template <typename... Args> class View {
+  public:
+    class Iterator {
+    public:
+      explicit Iterator(ArchetypeStorage &storage, const ArchetypeMask &query_mask, std::size_t archetype_index)
+          : _storage(storage), _query_mask(query_mask), _archetype_index(archetype_index), _row(0) {
+        this->_skip_archetypes();
+      }
+
+      std::tuple<Entity, Args &...> operator*() const {
+        auto &archetype = this->_storage._archetypes[this->_archetype_index];
+        return std::tuple<Entity, Args &...>(archetype.entities[this->_row],
+                                             std::get<Column<Args>>(archetype.columns)[this->_row]...);
+      }
+
+      Iterator &operator++() {
+        this->_row += 1;
+        if (this->_row == this->_storage._archetypes[this->_archetype_index].entities.size()) {
+          this->_archetype_index += 1;
+          this->_row = 0;
+          this->_skip_archetypes();
+        }
+        return *this;
+      }
+
+      bool operator==(const Iterator &other) const {
+        return this->_archetype_index == other._archetype_index and this->_row == other._row;
+      }
+      bool operator!=(const Iterator &other) const { return not(*this == other); }
+
+      void _skip_archetypes() {
+        auto &archetypes = this->_storage._archetypes;
+        while (this->_archetype_index < archetypes.size()) {
+          auto &archetype = archetypes[this->_archetype_index];
+          if ((archetype.mask & this->_query_mask) == this->_query_mask and not archetype.entities.empty()) {
+            return;
+          }
+          this->_archetype_index += 1;
+        }
+      }
+
+      ArchetypeStorage &_storage;
+      ArchetypeMask _query_mask;
+      std::size_t _archetype_index;
+      std::size_t _row;
+    };
+
+    explicit View(ArchetypeStorage &storage) : _storage(storage), _query_mask(mask_of<Args...>()) {}
+
+    Iterator begin() const { return Iterator(this->_storage, this->_query_mask, 0); }
+    Iterator end() const { return Iterator(this->_storage, this->_query_mask, this->_storage._archetypes.size()); }
+
+    ArchetypeStorage &_storage;
+    ArchetypeMask _query_mask;
+  };
+
+  template <typename... Args> View<Args...> view() { return View<Args...>(*this); }
+
+  // Splits the rows of the archetypes that contain all of Args into chunks of about grain_size rows and calls
+  // add_chunk(chunk) for every one of them. chunk(function) calls function(entity, Args &...) for its rows.
+  // Chunk boundaries are aligned to cache lines of every column of Args.
+  template <typename... Args, typename AddChunkFunction>
+  void chunk(std::size_t grain_size, AddChunkFunction &&add_chunk) {
+    auto mask = mask_of<Args...>();
+    auto chunk_size = memory_utils::cache_line_aligned_chunk_size<Args...>(grain_size);
+    for (std::size_t archetype_index = 0; archetype_index < this->_archetypes.size(); archetype_index++) {
+      auto &archetype = this->_archetypes[archetype_index];
+      if ((archetype.mask & mask) != mask) {
+        continue;
+      }
+      for (std::size_t begin = 0; begin < archetype.entities.size(); begin += chunk_size) {
+        auto end = std::min(begin + chunk_size, archetype.entities.size());
+        add_chunk([&archetype, begin, end](auto &function) {
+          auto &entities = archetype.entities;
+          [&entities, &function, begin, end](auto &... columns) {
+            for (std::size_t row = begin; row < end; row++) {
+              function(entities[row], columns[row]...);
+            }
+          }(std::get<Column<Args>>(archetype.columns)...);
+        });
+      }
+    }
+  }
+
+  template <typename... Args, typename Self, typename Function> static void _each(Self &self, Function &function) {
+    auto mask = mask_of<Args...>();
+    for (auto &archetype : self._archetypes) {
+      if ((archetype.mask & mask) != mask) {
+        continue;
+      }
+      auto &entities = archetype.entities;
+      [&entities, &function](auto &... columns) {
+        for (std::size_t row = 0; row < entities.size(); row++) {
+          function(entities[row], columns[row]...);
+        }
+      }(std::get<Column<Args>>(archetype.columns)...);
+    }
+  }
+
+  EntityLocation *_find_location(const Entity &entity) {
+    if (entity.index >= this->_entity_to_location.size()) {
+      return nullptr;
+    }
+    auto &location = this->_entity_to_location[entity.index];
+    return location.archetype_index == NO_ARCHETYPE ? nullptr : &location;
+  }
+
+  const EntityLocation *_find_location(const Entity &entity) const {
+    return const_cast<ArchetypeStorage *>(this)->_find_location(entity);
+  }
+
+  EntityLocation _get_location(const Entity &entity) const {
+    auto location = this->_find_location(entity);
+    if (location == nullptr) {
+      throw std::out_of_range("Entity has no components");
+    }
+    return *location;
+  }
+
+  template <typename ComponentType>
+  static ComponentTemplate _get_component(const Archetype &archetype, std::size_t row) {
+    return std::get<Column<ComponentType>>(archetype.columns)[row];
+  }
+
+  std::size_t _get_or_create_archetype(const ArchetypeMask &mask) {
+    auto archetype_index = this->_mask_to_archetype_index.find(mask);
+    if (archetype_index != this->_mask_to_archetype_index.end()) {
+      return archetype_index->second;
+    }
+
+    Archetype archetype;
+    archetype.mask = mask;
+    this->_archetypes.push_back(std::move(archetype));
+    this->_mask_to_archetype_index[mask] = this->_archetypes.size() - 1;
+    return this->_archetypes.size() - 1;
+  }
+
+  void _push_entity(std::size_t archetype_index, const Entity &entity) {
+    auto &entities = this->_archetypes[archetype_index].entities;
+    if (entity.index >= this->_entity_to_location.size()) {
+      this->_entity_to_location.resize(entity.index + 1, EntityLocation{NO_ARCHETYPE, 0});
+    }
+    this->_entity_to_location[entity.index] = EntityLocation{archetype_index, entities.size()};
+    entities.push_back(entity);
+  }
+
+  void _push_component(std::size_t archetype_index, const ComponentTemplate &component) {
+    auto &archetype = this->_archetypes[archetype_index];
+    std::visit(
+        [&archetype](const auto &value) {
+          using ComponentType = std::decay_t<decltype(value)>;
+          std::get<Column<ComponentType>>(archetype.columns).push_back(value);
+        },
+        component);
+  }
+
+  // Moves the row of the entity into the archetype with new_mask, columns that are not in new_mask are dropped.
+  // Columns that are in new_mask but not in the old mask have to be pushed by the caller.
+  std::size_t _move_entity(const Entity &entity, EntityLocation location, const ArchetypeMask &new_mask) {
+    auto new_archetype_index = this->_get_or_create_archetype(new_mask);
+    auto &source = this->_archetypes[location.archetype_index];
+    auto &destination = this->_archetypes[new_archetype_index];
+
+    auto common_mask = source.mask & new_mask;
+    std::apply(
+        [&](auto &... source_columns) {
+          (_move_column_value(source_columns, destination.columns, common_mask, location.row), ...);
+        },
+        source.columns);
+
+    this->_remove_row(location);
+    this->_push_entity(new_archetype_index, entity);
+    return new_archetype_index;
+  }
+
+  template <typename ComponentType>
+  static void _move_column_value(Column<ComponentType> &source_column,
+                                 std::tuple<Column<ComponentTypes>...> &destination_columns,
+                                 const ArchetypeMask &common_mask, std::size_t row) {
+    if (not common_mask.test(column_index<ComponentType>())) {
+      return;
+    }
+    std::get<Column<ComponentType>>(destination_columns).push_back(std::move(source_column[row]));
+  }
+
+  // Swap-and-pop removal of a row, the last row of the archetype takes its place
+  void _remove_row(const EntityLocation &location) {
+    auto &archetype = this->_archetypes[location.archetype_index];
+    auto last_row = archetype.entities.size() - 1;
+    if (location.row != last_row) {
+      archetype.entities[location.row] = archetype.entities[last_row];
+      this->_entity_to_location[archetype.entities[location.row].index].row = location.row;
+    }
+    archetype.entities.pop_back();
+
+    std::apply([&](auto &... columns) { (_remove_column_value(columns, archetype.mask, location.row), ...); },
+               archetype.columns);
+  }
+
+  template <typename ComponentType>
+  static void _remove_column_value(Column<ComponentType> &column, const ArchetypeMask &mask, std::size_t row) {
+    if (not mask.test(column_index<ComponentType>())) {
+      return;
+    }
+    if (row != column.size() - 1) {
+      column[row] = std::move(column.back());
+    }
+    column.pop_back();
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
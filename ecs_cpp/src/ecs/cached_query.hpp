@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "ecs/component_signature.hpp"
+#include "ecs/entity.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Counters of a CachedQuery, to weigh the cost of keeping it up to date against the scans it saves:
+//  - num_checks: structural changes of entities that had to be matched against the query
+//  - num_insertions and num_erasures: entities that started or stopped matching the query
+//  - num_iterations and num_visited_entities: iterations of the query and the entities they visited
+//  - num_scanned_entities: entity slots that the same iterations would have scanned without the cache
+// Queries are iterated concurrently by parallel systems, so the counters of iterations are atomic. They are only read
+// as statistics, so they are counted with relaxed ordering.
+struct CachedQueryStats {
+public:
+  std::size_t num_checks;
+  std::size_t num_insertions;
+  std::size_t num_erasures;
+  std::atomic<std::size_t> num_iterations;
+  std::atomic<std::size_t> num_visited_entities;
+  std::atomic<std::size_t> num_scanned_entities;
+
+  explicit CachedQueryStats() {
+    this->num_checks = 0;
+    this->num_insertions = 0;
+    this->num_erasures = 0;
+    this->num_iterations = 0;
+    this->num_visited_entities = 0;
+    this->num_scanned_entities = 0;
+  }
+
+  CachedQueryStats(const CachedQueryStats &other) { *this = other; }
+
+  CachedQueryStats &operator=(const CachedQueryStats &other) {
+    this->num_checks = other.num_checks;
+    this->num_insertions = other.num_insertions;
+    this->num_erasures = other.num_erasures;
+    this->num_iterations.store(other.num_iterations.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    this->num_visited_entities.store(other.num_visited_entities.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+    this->num_scanned_entities.store(other.num_scanned_entities.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+    return *this;
+  }
+
+  void count_iteration(std::size_t num_visited, std::size_t num_scanned) {
+    this->num_iterations.fetch_add(1, std::memory_order_relaxed);
+    this->num_visited_entities.fetch_add(num_visited, std::memory_order_relaxed);
+    this->num_scanned_entities.fetch_add(num_scanned, std::memory_order_relaxed);
+  }
+};
+
+// The entities that have every component type of _required_signature and none of _excluded_signature, kept as a dense
+// array with the position of every entity index, so insertions and erasures are O(1). Erasures swap the last entity
+// into the hole, so the order of the entities is not stable.
+class CachedQuery {
+public:
+  static constexpr std::size_t NOT_CACHED = std::numeric_limits<std::size_t>::max();
+
+  ComponentSignature _required_signature;
+  ComponentSignature _excluded_signature;
+  std::vector<Entity> _entities;
+  std::vector<std::size_t> _entity_index_to_position;
+  CachedQueryStats _stats;
+
+  explicit CachedQuery(const ComponentSignature &required_signature, const ComponentSignature &excluded_signature) {
+    this->_required_signature = required_signature;
+    this->_excluded_signature = excluded_signature;
+    this->_entities = {};
+    this->_entity_index_to_position = {};
+    this->_stats = CachedQueryStats();
+  }
+
+  const std::vector<Entity> &entities() const { return this->_entities; }
+  const CachedQueryStats &stats() const { return this->_stats; }
+
+  bool matches(const ComponentSignature &signature) const {
+    return signature.contains(this->_required_signature) and not signature.intersects(this->_excluded_signature);
+  }
+
+  bool contains(EntityIndex entity_index) const {
+    return entity_index < this->_entity_index_to_position.size() and
+           this->_entity_index_to_position[entity_index] != NOT_CACHED;
+  }
+
+  // Inserts or erases the entity after its signature changed
+  void update(const Entity &entity, const ComponentSignature &signature) {
+    this->_stats.num_checks += 1;
+    auto matches = this->matches(signature);
+    if (matches and not this->contains(entity.index)) {
+      this->_insert(entity);
+    } else if (not matches and this->contains(entity.index)) {
+      this->_erase(entity.index);
+    }
+  }
+
+  void erase(EntityIndex entity_index) {
+    this->_stats.num_checks += 1;
+    if (this->contains(entity_index)) {
+      this->_erase(entity_index);
+    }
+  }
+
+  void _insert(const Entity &entity) {
+    if (entity.index >= this->_entity_index_to_position.size()) {
+      this->_entity_index_to_position.resize(entity.index + 1, NOT_CACHED);
+    }
+    this->_entity_index_to_position[entity.index] = this->_entities.size();
+    this->_entities.push_back(entity);
+    this->_stats.num_insertions += 1;
+  }
+
+  void _erase(EntityIndex entity_index) {
+    auto position = this->_entity_index_to_position[entity_index];
+    this->_entities[position] = this->_entities.back();
+    this->_entity_index_to_position[this->_entities[position].index] = position;
+    this->_entities.pop_back();
+    this->_entity_index_to_position[entity_index] = NOT_CACHED;
+    this->_stats.num_erasures += 1;
+  }
+};
+
+// Handle of a query registered with register_query, Terms are the query terms it was registered with
+template <typename... Terms> struct QueryHandle {
+public:
+  std::size_t index;
+};
+
+// The cached queries of an ecdb. A structural change of an entity only checks the queries whose required or excluded
+// signature has the bit that changed, so an ecdb without cached queries pays a single comparison per change.
+class CachedQueries {
+public:
+  // Unregistered queries leave an empty slot behind that the next registered query reuses
+  std::vector<std::optional<CachedQuery>> _queries;
+  // Indices of the queries that depend on every signature bit
+  std::vector<std::vector<std::size_t>> _bit_to_query_indices;
+
+  explicit CachedQueries() {
+    this->_queries = {};
+    this->_bit_to_query_indices = {};
+  }
+
+  std::size_t insert(CachedQuery query) {
+    std::size_t query_index = 0;
+    while (query_index < this->_queries.size() and this->_queries[query_index].has_value()) {
+      query_index++;
+    }
+    if (query_index == this->_queries.size()) {
+      this->_queries.emplace_back();
+    }
+
+    auto add_query_index = [this, query_index](std::size_t bit) {
+      if (bit >= this->_bit_to_query_indices.size()) {
+        this->_bit_to_query_indices.resize(bit + 1);
+      }
+      auto &query_indices = this->_bit_to_query_indices[bit];
+      if (query_indices.empty() or query_indices.back() != query_index) {
+        query_indices.push_back(query_index);
+      }
+    };
+    query._required_signature.for_each_bit(add_query_index);
+    query._excluded_signature.for_each_bit(add_query_index);
+
+    this->_queries[query_index] = std::move(query);
+    return query_index;
+  }
+
+  void erase(std::size_t query_index) {
+    this->at(query_index);
+    for (auto &query_indices : this->_bit_to_query_indices) {
+      query_indices.erase(std::remove(query_indices.begin(), query_indices.end(), query_index), query_indices.end());
+    }
+    this->_queries[query_index].reset();
+  }
+
+  CachedQuery &at(std::size_t query_index) {
+    if (query_index >= this->_queries.size() or not this->_queries[query_index].has_value()) {
+      throw std::runtime_error("Query is not registered");
+    }
+    return *this->_queries[query_index];
+  }
+
+  const CachedQuery &at(std::size_t query_index) const {
+    if (query_index >= this->_queries.size() or not this->_queries[query_index].has_value()) {
+      throw std::runtime_error("Query is not registered");
+    }
+    return *this->_queries[query_index];
+  }
+
+  // signature is the signature of the entity after bit was set or reset
+  void update(const Entity &entity, const ComponentSignature &signature, std::size_t bit) {
+    if (bit >= this->_bit_to_query_indices.size()) {
+      return;
+    }
+    for (auto query_index : this->_bit_to_query_indices[bit]) {
+      this->_queries[query_index]->update(entity, signature);
+    }
+  }
+
+  // signature is the signature of the entity before it was removed
+  void erase_entity(const Entity &entity, const ComponentSignature &signature) {
+    if (this->_bit_to_query_indices.empty()) {
+      return;
+    }
+    signature.for_each_bit([this, &entity](std::size_t bit) {
+      if (bit >= this->_bit_to_query_indices.size()) {
+        return;
+      }
+      for (auto query_index : this->_bit_to_query_indices[bit]) {
+        this->_queries[query_index]->erase(entity.index);
+      }
+    });
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Writes are stamped with the current tick of the ecdb, a change filter matches the writes with a larger tick than the
+// last run of its system
+using ChangeTick = std::uint64_t;
+
+// Ticks of the writes to one component type, indexed by entity index. Every CHUNK_SIZE consecutive entity indices also
+// keep their latest tick, so iterating the changes since a tick skips the chunks that were not written to.
+struct ComponentChangeTicks {
+public:
+  static constexpr std::size_t CHUNK_SIZE = 64;
+
+  std::vector<ChangeTick> _added_ticks;
+  std::vector<ChangeTick> _changed_ticks;
+  std::vector<ChangeTick> _chunk_ticks;
+  // Every removal of the component type, in increasing order of ticks
+  std::vector<std::pair<Entity, ChangeTick>> _removals;
+
+  explicit ComponentChangeTicks() {
+    this->_added_ticks = {};
+    this->_changed_ticks = {};
+    this->_chunk_ticks = {};
+    this->_removals = {};
+  }
+
+  void mark_added(EntityIndex entity_index, ChangeTick tick) {
+    this->mark_changed(entity_index, tick);
+    this->_added_ticks[entity_index] = tick;
+  }
+
+  void mark_changed(EntityIndex entity_index, ChangeTick tick) {
+    if (entity_index >= this->_changed_ticks.size()) {
+      this->_added_ticks.resize(entity_index + 1, 0);
+      this->_changed_ticks.resize(entity_index + 1, 0);
+      this->_chunk_ticks.resize(entity_index / CHUNK_SIZE + 1, 0);
+    }
+    this->_changed_ticks[entity_index] = tick;
+    this->_chunk_ticks[entity_index / CHUNK_SIZE] = tick;
+  }
+
+  void mark_removed(const Entity &entity, ChangeTick tick) { this->_removals.emplace_back(entity, tick); }
+
+  bool added_since(EntityIndex entity_index, ChangeTick tick) const {
+    return entity_index < this->_added_ticks.size() and this->_added_ticks[entity_index] > tick;
+  }
+
+  bool changed_since(EntityIndex entity_index, ChangeTick tick) const {
+    return entity_index < this->_changed_ticks.size() and this->_changed_ticks[entity_index] > tick;
+  }
+
+  // Calls function(entity_index) for every entity index whose component was added or changed after tick
+  template <typename Function> void for_each_changed_since(ChangeTick tick, Function &&function) const {
+    for (std::size_t chunk_index = 0; chunk_index < this->_chunk_ticks.size(); chunk_index++) {
+      if (this->_chunk_ticks[chunk_index] <= tick) {
+        continue;
+      }
+      auto end = std::min((chunk_index + 1) * CHUNK_SIZE, this->_changed_ticks.size());
+      for (auto entity_index = chunk_index * CHUNK_SIZE; entity_index < end; entity_index++) {
+        if (this->_changed_ticks[entity_index] > tick) {
+          function(static_cast<EntityIndex>(entity_index));
+        }
+      }
+    }
+  }
+
+  // Calls function(entity) for every removal after tick, an entity comes up once per removal
+  template <typename Function> void for_each_removed_since(ChangeTick tick, Function &&function) const {
+    auto removal = std::upper_bound(this->_removals.begin(), this->_removals.end(), tick,
+                                    [](ChangeTick tick, const auto &removal) { return tick < removal.second; });
+    for (; removal != this->_removals.end(); ++removal) {
+      function(removal->first);
+    }
+  }
+
+  // Forgets the removals at or before tick
+  void prune_removals(ChangeTick tick) {
+    auto removal = std::upper_bound(this->_removals.begin(), this->_removals.end(), tick,
+                                    [](ChangeTick tick, const auto &removal) { return tick < removal.second; });
+    this->_removals.erase(this->_removals.begin(), removal);
+  }
+};
+
+// ComponentChangeTicks of every component type, indexed by the bits of the ComponentTypeRegistry
+struct ChangeTicks {
+public:
+  std::vector<ComponentChangeTicks> _component_change_ticks;
+
+  explicit ChangeTicks() { this->_component_change_ticks = {}; }
+
+  ComponentChangeTicks &component(std::size_t bit) {
+    if (bit >= this->_component_change_ticks.size()) {
+      this->_component_change_ticks.resize(bit + 1);
+    }
+    return this->_component_change_ticks[bit];
+  }
+
+  const ComponentChangeTicks &component(std::size_t bit) const {
+    static const ComponentChangeTicks no_change_ticks;
+    return bit < this->_component_change_ticks.size() ? this->_component_change_ticks[bit] : no_change_ticks;
+  }
+
+  void prune_removals(ChangeTick tick) {
+    for (auto &component_change_ticks : this->_component_change_ticks) {
+      component_change_ticks.prune_removals(tick);
+    }
+  }
+};
+
+// Writes recorded with mark_changed while tasks run concurrently on a thread pool. Stamping a tick can grow the tick
+// arrays and the observers, the checksum and the spatial index are not thread-safe either, so the writes are collected
+// here and applied by the thread that joins the tasks. Every thread appends to one of NUM_SHARDS buffers picked by its
+// id, so threads rarely wait for each other.
+template <typename TypeIndexTemplate> struct DeferredChangeMarks {
+public:
+  static constexpr std::size_t NUM_SHARDS = 16;
+
+  struct Mark {
+    Entity entity;
+    std::size_t bit;
+    TypeIndexTemplate component_type;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Mark> marks;
+  };
+
+  std::vector<memory_utils::CacheAligned<Shard>> _shards;
+  // Only changed by the thread that starts and joins the tasks, while no task runs
+  bool _deferring;
+
+  explicit DeferredChangeMarks() {
+    this->_shards = std::vector<memory_utils::CacheAligned<Shard>>(NUM_SHARDS);
+    this->_deferring = false;
+  }
+
+  // The shards are not copyable, a copy starts with its own empty shards. Marks only exist while tasks run.
+  DeferredChangeMarks(const DeferredChangeMarks &) : DeferredChangeMarks() {}
+  DeferredChangeMarks &operator=(const DeferredChangeMarks &) { return *this; }
+  DeferredChangeMarks(DeferredChangeMarks &&) = default;
+  DeferredChangeMarks &operator=(DeferredChangeMarks &&) = default;
+
+  void push(const Entity &entity, std::size_t bit, const TypeIndexTemplate &component_type) {
+    auto shard_index = std::hash<std::thread::id>()(std::this_thread::get_id()) % NUM_SHARDS;
+    auto &shard = this->_shards[shard_index].value;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.marks.push_back({entity, bit, component_type});
+  }
+
+  // Calls function(mark) for every mark ordered by entity index and then bit, so the result does not depend on the
+  // scheduling, and forgets them
+  template <typename Function> void drain(Function &&function) {
+    std::vector<Mark> marks;
+    for (auto &shard : this->_shards) {
+      marks.insert(std::end(marks), std::begin(shard.value.marks), std::end(shard.value.marks));
+      shard.value.marks.clear();
+    }
+    std::stable_sort(marks.begin(), marks.end(), [](const Mark &mark, const Mark &other_mark) {
+      return std::make_pair(mark.entity.index, mark.bit) < std::make_pair(other_mark.entity.index, other_mark.bit);
+    });
+    for (auto &mark : marks) {
+      function(mark);
+    }
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
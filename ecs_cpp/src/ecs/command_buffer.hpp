@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/time_utils.hpp"
+#include "ecs/type_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+enum class ComponentCommandType : std::uint8_t { ADD, SET, REMOVE };
+
+template <typename TypeIndexTemplate, typename ComponentTemplate> struct ComponentCommand {
+public:
+  ComponentCommandType command_type;
+  Entity entity;
+  TypeIndexTemplate component_type;
+  std::optional<ComponentTemplate> component;
+};
+
+// Records structural changes and applies them to an EntityComponentDatabase in one flush:
+//  - create(components) adds a new entity, created entities are returned by flush in the order they were recorded
+//  - destroy(entity) removes the entity
+//  - add(entity, component) adds the component or overwrites it
+//  - set(entity, component) overwrites the component, it is dropped if the entity does not have the component type
+//  - remove(entity, component_type) removes the component
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>>
+struct CommandBuffer {
+public:
+  std::vector<std::vector<ComponentTemplate>> _entities_to_create;
+  std::vector<Entity> _entities_to_destroy;
+  std::vector<ComponentCommand<TypeIndexTemplate, ComponentTemplate>> _component_commands;
+
+  explicit CommandBuffer() {
+    this->_entities_to_create = {};
+    this->_entities_to_destroy = {};
+    this->_component_commands = {};
+  }
+
+  std::size_t size() const {
+    return this->_entities_to_create.size() + this->_entities_to_destroy.size() + this->_component_commands.size();
+  }
+
+  bool empty() const { return this->size() == 0; }
+
+  void clear() {
+    this->_entities_to_create.clear();
+    this->_entities_to_destroy.clear();
+    this->_component_commands.clear();
+  }
+
+  void create(const std::vector<ComponentTemplate> &components = {}) {
+    this->_entities_to_create.push_back(components);
+  }
+
+  void destroy(const Entity &entity) { this->_entities_to_destroy.push_back(entity); }
+
+  void add(const Entity &entity, const ComponentTemplate &component) {
+    this->_component_commands.push_back(
+        {ComponentCommandType::ADD, entity, GetComponentTypeFunction()(component), component});
+  }
+
+  void set(const Entity &entity, const ComponentTemplate &component) {
+    this->_component_commands.push_back(
+        {ComponentCommandType::SET, entity, GetComponentTypeFunction()(component), component});
+  }
+
+  void remove(const Entity &entity, const TypeIndexTemplate &component_type) {
+    this->_component_commands.push_back({ComponentCommandType::REMOVE, entity, component_type, std::nullopt});
+  }
+
+  // Appends the commands of other after the commands of this buffer
+  void append(CommandBuffer &&other) {
+    std::move(other._entities_to_create.begin(), other._entities_to_create.end(),
+              std::back_inserter(this->_entities_to_create));
+    std::move(other._entities_to_destroy.begin(), other._entities_to_destroy.end(),
+              std::back_inserter(this->_entities_to_destroy));
+    std::move(other._component_commands.begin(), other._component_commands.end(),
+              std::back_inserter(this->_component_commands));
+    other.clear();
+  }
+};
+
+// What a flush did and how long it took
+struct FlushReport {
+public:
+  std::vector<Entity> created_entities;
+  std::size_t num_recorded_commands;
+  std::size_t num_applied_commands;
+  // commands overwritten by a later command to the same component of the same entity
+  std::size_t num_merged_commands;
+  // commands for entities that are not alive or destroyed by the same flush and set commands for components that the
+  // entity does not have
+  std::size_t num_skipped_commands;
+  std::size_t time_in_nanoseconds;
+
+  explicit FlushReport() {
+    this->created_entities = {};
+    this->num_recorded_commands = 0;
+    this->num_applied_commands = 0;
+    this->num_merged_commands = 0;
+    this->num_skipped_commands = 0;
+    this->time_in_nanoseconds = 0;
+  }
+
+  FlushReport &operator+=(const FlushReport &other) {
+    this->created_entities.insert(this->created_entities.end(), other.created_entities.begin(),
+                                  other.created_entities.end());
+    this->num_recorded_commands += other.num_recorded_commands;
+    this->num_applied_commands += other.num_applied_commands;
+    this->num_merged_commands += other.num_merged_commands;
+    this->num_skipped_commands += other.num_skipped_commands;
+    this->time_in_nanoseconds += other.time_in_nanoseconds;
+    return *this;
+  }
+};
+
+// Applies the commands of command_buffer and clears it:
+//  1. entities are created in the order they were recorded
+//  2. component commands are sorted by component type and entity index, the commands to the same component of the
+//     same entity are merged into one write or removal in recording order. The writes of each component type are
+//     inserted into the storage with one insert_components call, removals are applied one entity at a time.
+//  3. entities are destroyed, component commands to destroyed entities are dropped
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename GetComponentTypeFunction,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, FlushReport>
+flush(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+      CommandBuffer<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction> &command_buffer) {
+  auto start = time_utils::now();
+  FlushReport flush_report;
+  flush_report.num_recorded_commands = command_buffer.size();
+
+  for (auto &components : command_buffer._entities_to_create) {
+    Entity entity;
+    std::tie(ecdb, entity) =
+        add_entity<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate>(ecdb, components);
+    flush_report.created_entities.push_back(entity);
+  }
+  flush_report.num_applied_commands += command_buffer._entities_to_create.size();
+
+  auto &entities_to_destroy = command_buffer._entities_to_destroy;
+  auto compare_entities = [](const Entity &entity_a, const Entity &entity_b) { return entity_a < entity_b; };
+  std::sort(entities_to_destroy.begin(), entities_to_destroy.end(), compare_entities);
+  auto is_destroyed = [&entities_to_destroy, &compare_entities](const Entity &entity) {
+    return std::binary_search(entities_to_destroy.begin(), entities_to_destroy.end(), entity, compare_entities);
+  };
+
+  // (signature bit of the component type, entity index, index of the command), so the commands to the same component
+  // of the same entity are next to each other in recording order and every component type is written in entity order
+  auto &component_commands = command_buffer._component_commands;
+  auto &registry = ecdb._component_type_registry;
+  std::vector<std::tuple<std::size_t, EntityIndex, std::size_t>> sort_keys;
+  sort_keys.reserve(component_commands.size());
+  for (std::size_t command_index = 0; command_index < component_commands.size(); command_index++) {
+    auto &command = component_commands[command_index];
+    sort_keys.emplace_back(registry.register_component_type(command.component_type), command.entity.index,
+                           command_index);
+  }
+  std::sort(sort_keys.begin(), sort_keys.end());
+
+  // The merged writes of the current component type, inserted into the storage in one call when the next component
+  // type starts. The components are moved out of the commands, which are cleared at the end of the flush.
+  std::size_t written_bit = NO_SIGNATURE_BIT;
+  const TypeIndexTemplate *written_component_type = nullptr;
+  std::vector<Entity> written_entities;
+  std::vector<ComponentTemplate> written_components;
+  auto insert_written_components = [&ecdb, &written_bit, &written_component_type, &written_entities,
+                                    &written_components]() {
+    if (written_entities.empty()) {
+      return;
+    }
+    ecdb._storage.insert_components(written_entities, *written_component_type, written_components);
+    for (std::size_t index = 0; index < written_entities.size(); index++) {
+      ecdb._component_written(written_entities[index], written_bit, written_components[index]);
+    }
+    written_entities.clear();
+    written_components.clear();
+  };
+
+  for (std::size_t begin = 0; begin < sort_keys.size();) {
+    auto [bit, entity_index, first_command_index] = sort_keys[begin];
+    auto end = begin + 1;
+    while (end < sort_keys.size() and std::get<0>(sort_keys[end]) == bit and
+           std::get<1>(sort_keys[end]) == entity_index) {
+      end++;
+    }
+    if (bit != written_bit) {
+      insert_written_components();
+      written_bit = bit;
+    }
+
+    // Merge the commands into the last write or removal. Only one generation of the entity index can be alive, the
+    // commands of stale generations are skipped.
+    std::optional<std::size_t> final_command_index;
+    auto final_command_type = ComponentCommandType::ADD;
+    std::size_t num_merged_commands = 0;
+    for (auto key = begin; key < end; key++) {
+      auto command_index = std::get<2>(sort_keys[key]);
+      auto &command = component_commands[command_index];
+      if (not ecdb.contains(command.entity) or is_destroyed(command.entity)) {
+        flush_report.num_skipped_commands += 1;
+        continue;
+      }
+      auto command_type = command.command_type;
+      if (final_command_index.has_value()) {
+        if (command_type == ComponentCommandType::SET and final_command_type == ComponentCommandType::REMOVE) {
+          flush_report.num_skipped_commands += 1;
+          continue;
+        }
+        if (command_type == ComponentCommandType::SET and final_command_type == ComponentCommandType::ADD) {
+          command_type = ComponentCommandType::ADD;
+        }
+        num_merged_commands += 1;
+      }
+      final_command_type = command_type;
+      final_command_index = command_index;
+    }
+    begin = end;
+    if (not final_command_index.has_value()) {
+      continue;
+    }
+    flush_report.num_merged_commands += num_merged_commands;
+
+    auto &final_command = component_commands[*final_command_index];
+    auto &entity = final_command.entity;
+    auto &entity_slot = ecdb._entity_slots[entity.index];
+    if (final_command_type == ComponentCommandType::REMOVE) {
+      if (entity_slot.signature.test(bit)) {
+        ecdb._reset_component_bit(entity, bit);
+        ecdb._storage.erase(entity, final_command.component_type);
+      }
+      flush_report.num_applied_commands += 1;
+    } else if (final_command_type == ComponentCommandType::SET and not entity_slot.signature.test(bit)) {
+      flush_report.num_skipped_commands += 1;
+    } else {
+      ecdb._set_component_bit(entity, bit);
+      written_component_type = &final_command.component_type;
+      written_entities.push_back(entity);
+      written_components.push_back(std::move(*final_command.component));
+      flush_report.num_applied_commands += 1;
+    }
+  }
+  insert_written_components();
+
+  for (std::size_t index = 0; index < entities_to_destroy.size(); index++) {
+    auto &entity = entities_to_destroy[index];
+    if (not ecdb.contains(entity) or (index > 0 and entities_to_destroy[index - 1] == entity)) {
+      flush_report.num_skipped_commands += 1;
+      continue;
+    }
+    ecdb = remove_entity(ecdb, entity);
+    flush_report.num_applied_commands += 1;
+  }
+
+  command_buffer.clear();
+  flush_report.time_in_nanoseconds = time_utils::duration<std::chrono::nanoseconds>(start, time_utils::now());
+  return std::make_tuple(std::move(ecdb), std::move(flush_report));
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+using ProcessSystemWithCommandsFunction =
+    std::function<void(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &,
+                       SystemTemplate &,
+                       CommandBuffer<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction> &)>;
+
+// Counterpart of process_systems for systems that record their changes into a CommandBuffer instead of returning
+// actions. The buffer is flushed once per priority level, the returned FlushReport sums up all flushes.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, FlushReport>
+process_systems_with_commands(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemWithCommandsFunction<
+        TypeIndexTemplate, ComponentTemplate, SystemTemplate, GetComponentTypeFunction, StorageTemplate>>::type
+        process_system) {
+  CommandBuffer<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction> command_buffer;
+  FlushReport flush_report;
+  for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
+    auto &last_run_ticks = systems._priority_to_last_run_ticks[priority];
+    for (std::size_t system_index = 0; system_index < systems_with_same_priority.size(); system_index++) {
+      ecdb._last_run_tick = last_run_ticks[system_index];
+      process_system(ecdb, systems_with_same_priority[system_index], command_buffer);
+      last_run_ticks[system_index] = advance_change_tick(ecdb);
+    }
+
+    FlushReport priority_flush_report;
+    std::tie(ecdb, priority_flush_report) = flush(ecdb, command_buffer);
+    flush_report += priority_flush_report;
+  }
+  ecdb = dispatch_events(ecdb);
+  prune_removals(ecdb, systems._min_last_run_tick());
+  return std::make_tuple(std::move(ecdb), std::move(flush_report));
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+
+#include "ecs/type_utils.hpp"
+
+namespace ecs {
+namespace type_utils {
+
+// Name of T as spelled by the compiler, e.g. "benchmarks::Component<0>". The spelling of some types, e.g. template
+// arguments, differs between compilers.
+template <typename T> constexpr std::string_view type_name() {
+#if defined(__clang__) || defined(__GNUC__)
+  std::string_view function_name = __PRETTY_FUNCTION__;
+  auto begin = function_name.find("T = ") + 4;
+  auto end = function_name.find_first_of(";]", begin);
+#elif defined(_MSC_VER)
+  std::string_view function_name = __FUNCSIG__;
+  auto begin = function_name.find("type_name<") + 10;
+  auto end = function_name.rfind(">(void)");
+#endif
+  return function_name.substr(begin, end - begin);
+}
+
+// Name that the stable type id of T is hashed from. Specialize it to keep the id of a component type that is renamed
+// or moved to another namespace, or to get the same ids from different compilers:
+//   template <> struct StableTypeName<Position> { static constexpr std::string_view value = "Position"; };
+template <typename T> struct StableTypeName {
+  static constexpr std::string_view value = type_name<T>();
+};
+
+// 64-bit FNV-1a
+constexpr std::uint64_t hash_type_name(std::string_view name) {
+  std::uint64_t hash = 0xcbf29ce484222325;
+  for (auto character : name) {
+    hash = (hash ^ static_cast<std::uint8_t>(character)) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// Unlike get_type_id, the same in every run and every binary
+template <typename T> constexpr std::uint64_t get_stable_type_id() { return hash_type_name(StableTypeName<T>::value); }
+
+// Compile-time registry of a closed set of component types: every component type has a constexpr index, its position
+// in ComponentTypes, and a stable id. Open sets of component types are left to get_type_id.
+template <typename... ComponentTypes> struct ComponentRegistry {
+public:
+  static constexpr std::size_t size = sizeof...(ComponentTypes);
+  static constexpr std::array<std::uint64_t, size> stable_type_ids = {get_stable_type_id<ComponentTypes>()...};
+
+  template <typename T> static constexpr bool contains = (std::is_same_v<T, ComponentTypes> or ...);
+
+  template <typename T> static constexpr std::size_t index() {
+    static_assert(contains<T>, "Component type is not in the registry");
+    constexpr std::array<bool, size> is_same = {std::is_same_v<T, ComponentTypes>...};
+    std::size_t index = 0;
+    while (not is_same[index]) {
+      index++;
+    }
+    return index;
+  }
+
+  template <typename T> static constexpr std::uint64_t stable_type_id() { return stable_type_ids[index<T>()]; }
+
+  // Calls function(type_identity<T>()) for every component type in order
+  template <typename Function> static void for_each_type(Function &&function) {
+    (function(type_identity<ComponentTypes>()), ...);
+  }
+
+  static constexpr bool _has_unique_stable_type_ids() {
+    for (std::size_t index_a = 0; index_a < size; index_a++) {
+      for (std::size_t index_b = index_a + 1; index_b < size; index_b++) {
+        if (stable_type_ids[index_a] == stable_type_ids[index_b]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static_assert(_has_unique_stable_type_ids(), "Component types must have unique stable type ids");
+};
+
+// ComponentRegistry of the alternatives of a std::variant, an empty registry for any other ComponentTemplate
+template <typename ComponentTemplate> struct component_registry { using type = ComponentRegistry<>; };
+
+template <typename... ComponentTypes> struct component_registry<std::variant<ComponentTypes...>> {
+  using type = ComponentRegistry<ComponentTypes...>;
+};
+
+template <typename ComponentTemplate> using component_registry_t = typename component_registry<ComponentTemplate>::type;
+
+} // namespace type_utils
+} // namespace ecs
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Bitmask of the component types of an entity, bit i is set if the entity has the component type registered as i.
+// The first NUM_INLINE_BITS component types live in a fixed-width array, so matching a query against them is a single
+// AND/compare per word. Component types registered after those spill into _overflow_words, which stays empty (and
+// does not allocate) until one of them is set.
+class ComponentSignature {
+public:
+  using Word = std::uint64_t;
+
+  static constexpr std::size_t BITS_PER_WORD = 64;
+  static constexpr std::size_t NUM_INLINE_WORDS = 2;
+  static constexpr std::size_t NUM_INLINE_BITS = NUM_INLINE_WORDS * BITS_PER_WORD;
+
+  std::array<Word, NUM_INLINE_WORDS> _inline_words;
+  std::vector<Word> _overflow_words;
+
+  explicit ComponentSignature() {
+    this->_inline_words = {};
+    this->_overflow_words = {};
+  }
+
+  ComponentSignature &set(std::size_t bit) {
+    this->_word(bit) |= _bit_in_word(bit);
+    return *this;
+  }
+
+  ComponentSignature &reset(std::size_t bit) {
+    auto word_index = bit / BITS_PER_WORD;
+    if (word_index < NUM_INLINE_WORDS or word_index - NUM_INLINE_WORDS < this->_overflow_words.size()) {
+      this->_word(bit) &= ~_bit_in_word(bit);
+    }
+    return *this;
+  }
+
+  void clear() {
+    this->_inline_words = {};
+    this->_overflow_words.clear();
+  }
+
+  bool test(std::size_t bit) const { return (this->_find_word(bit) & _bit_in_word(bit)) != 0; }
+
+  bool none() const {
+    Word any_bit = 0;
+    for (auto word : this->_inline_words) {
+      any_bit |= word;
+    }
+    for (auto word : this->_overflow_words) {
+      any_bit |= word;
+    }
+    return any_bit == 0;
+  }
+
+  // True if every bit of other is set in this signature
+  bool contains(const ComponentSignature &other) const {
+    bool contains_inline = ((this->_inline_words[0] & other._inline_words[0]) == other._inline_words[0]) and
+                           ((this->_inline_words[1] & other._inline_words[1]) == other._inline_words[1]);
+    if (other._overflow_words.empty()) {
+      return contains_inline;
+    }
+    for (std::size_t word_index = 0; word_index < other._overflow_words.size(); word_index++) {
+      auto word = word_index < this->_overflow_words.size() ? this->_overflow_words[word_index] : 0;
+      contains_inline &= (word & other._overflow_words[word_index]) == other._overflow_words[word_index];
+    }
+    return contains_inline;
+  }
+
+  // True if at least one bit is set in both signatures
+  bool intersects(const ComponentSignature &other) const {
+    bool intersects_inline = ((this->_inline_words[0] & other._inline_words[0]) |
+                              (this->_inline_words[1] & other._inline_words[1])) != 0;
+    auto num_overflow_words = std::min(this->_overflow_words.size(), other._overflow_words.size());
+    for (std::size_t word_index = 0; word_index < num_overflow_words; word_index++) {
+      intersects_inline |= (this->_overflow_words[word_index] & other._overflow_words[word_index]) != 0;
+    }
+    return intersects_inline;
+  }
+
+  // Calls function(bit) for every set bit in ascending order
+  template <typename Function> void for_each_bit(Function &&function) const {
+    auto num_words = NUM_INLINE_WORDS + this->_overflow_words.size();
+    for (std::size_t word_index = 0; word_index < num_words; word_index++) {
+      auto word = word_index < NUM_INLINE_WORDS ? this->_inline_words[word_index]
+                                                : this->_overflow_words[word_index - NUM_INLINE_WORDS];
+      for (std::size_t bit_in_word = 0; word != 0; bit_in_word++, word >>= 1) {
+        if (word & 1) {
+          function(word_index * BITS_PER_WORD + bit_in_word);
+        }
+      }
+    }
+  }
+
+  static Word _bit_in_word(std::size_t bit) { return Word(1) << (bit % BITS_PER_WORD); }
+
+  Word &_word(std::size_t bit) {
+    auto word_index = bit / BITS_PER_WORD;
+    if (word_index < NUM_INLINE_WORDS) {
+      return this->_inline_words[word_index];
+    }
+    word_index -= NUM_INLINE_WORDS;
+    if (word_index >= this->_overflow_words.size()) {
+      this->_overflow_words.resize(word_index + 1, 0);
+    }
+    return this->_overflow_words[word_index];
+  }
+
+  Word _find_word(std::size_t bit) const {
+    auto word_index = bit / BITS_PER_WORD;
+    if (word_index < NUM_INLINE_WORDS) {
+      return this->_inline_words[word_index];
+    }
+    word_index -= NUM_INLINE_WORDS;
+    return word_index < this->_overflow_words.size() ? this->_overflow_words[word_index] : 0;
+  }
+};
+
+inline bool operator==(const ComponentSignature &signature_a, const ComponentSignature &signature_b) {
+  return signature_a.contains(signature_b) and signature_b.contains(signature_a);
+}
+inline bool operator!=(const ComponentSignature &signature_a, const ComponentSignature &signature_b) {
+  return not(signature_a == signature_b);
+}
+
+constexpr std::size_t NO_SIGNATURE_BIT = std::numeric_limits<std::size_t>::max();
+
+// Assigns signature bits to component types in the order they are first added, so the most common component types
+// end up in the inline words of ComponentSignature
+template <typename TypeIndexTemplate> struct ComponentTypeRegistry {
+public:
+  std::unordered_map<TypeIndexTemplate, std::size_t> _component_type_to_bit;
+  std::vector<TypeIndexTemplate> _bit_to_component_type;
+
+  explicit ComponentTypeRegistry() {
+    this->_component_type_to_bit = {};
+    this->_bit_to_component_type = {};
+  }
+
+  std::size_t size() const { return this->_bit_to_component_type.size(); }
+
+  std::size_t register_component_type(const TypeIndexTemplate &component_type) {
+    auto bit = this->_component_type_to_bit.find(component_type);
+    if (bit != this->_component_type_to_bit.end()) {
+      return bit->second;
+    }
+    this->_bit_to_component_type.push_back(component_type);
+    this->_component_type_to_bit.emplace(component_type, this->_bit_to_component_type.size() - 1);
+    return this->_bit_to_component_type.size() - 1;
+  }
+
+  // NO_SIGNATURE_BIT if the component type was never added to any entity
+  std::size_t find_bit(const TypeIndexTemplate &component_type) const {
+    auto bit = this->_component_type_to_bit.find(component_type);
+    return bit == this->_component_type_to_bit.end() ? NO_SIGNATURE_BIT : bit->second;
+  }
+
+  const TypeIndexTemplate &component_type(std::size_t bit) const { return this->_bit_to_component_type.at(bit); }
+
+  // Sets the bits of every registered component type in component_types and returns the number of component types
+  // that are not registered. A query that requires an unregistered component type cannot match any entity.
+  template <typename ComponentTypes>
+  std::size_t make_signature(const ComponentTypes &component_types, ComponentSignature &signature) const {
+    std::size_t num_unregistered_component_types = 0;
+    for (auto &component_type : component_types) {
+      auto bit = this->find_bit(component_type);
+      if (bit == NO_SIGNATURE_BIT) {
+        num_unregistered_component_types += 1;
+        continue;
+      }
+      signature.set(bit);
+    }
+    return num_unregistered_component_types;
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace ecs {
+namespace mutable_ecs {
+
+using EntityIndex = std::uint32_t;
+using EntityGeneration = std::uint32_t;
+using UniqueId = std::uint64_t;
+
+// index is the slot of the entity in the EntityComponentDatabase and is recycled once the entity is removed.
+// generation is bumped every time the slot is recycled, so a handle to a removed entity never matches again.
+struct Entity {
+public:
+  EntityIndex index;
+  EntityGeneration generation;
+
+  explicit Entity() {}
+  explicit Entity(EntityIndex index, EntityGeneration generation = 0) {
+    this->index = index;
+    this->generation = generation;
+  }
+
+  UniqueId unique_id() const { return (static_cast<UniqueId>(this->generation) << 32) | this->index; }
+};
+
+inline bool operator<(const Entity &entity_a, const Entity &entity_b) {
+  return entity_a.unique_id() < entity_b.unique_id();
+}
+inline bool operator==(const Entity &entity_a, const Entity &entity_b) {
+  return entity_a.index == entity_b.index and entity_a.generation == entity_b.generation;
+}
+inline bool operator!=(const Entity &entity_a, const Entity &entity_b) { return not(entity_a == entity_b); }
+
+} // namespace mutable_ecs
+} // namespace ecs
+
+namespace std {
+
+template <> struct hash<ecs::mutable_ecs::Entity> {
+  std::size_t operator()(const ecs::mutable_ecs::Entity &entity) const {
+    return hash<ecs::mutable_ecs::UniqueId>{}(entity.unique_id());
+  }
+};
+
+} // namespace std
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/sparse_set.hpp"
+#include "ecs/type_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Components of one component type. The entities and their components are packed in the same order and
+// _dense_indices maps Entity::index to their position, so an entity is found by indexing and a generation compare
+// instead of hashing it. Entity indices are recycled by the ecdb, so _dense_indices stays as long as the entity slots.
+// Erasing moves the last component into the hole. The three arrays share one allocator, so with a PoolAllocator a
+// table has one pool for all of them.
+template <typename ComponentTemplate, template <typename> class AllocatorTemplate = std::allocator>
+struct ComponentTable {
+public:
+  std::vector<EntityIndex, AllocatorTemplate<EntityIndex>> _dense_indices;
+  std::vector<Entity, AllocatorTemplate<Entity>> _dense_entities;
+  std::vector<ComponentTemplate, AllocatorTemplate<ComponentTemplate>> _dense_components;
+
+  explicit ComponentTable() : ComponentTable(AllocatorTemplate<ComponentTemplate>()) {}
+  // The arrays are constructed with the allocator, a default constructed array would create its own
+  explicit ComponentTable(const AllocatorTemplate<ComponentTemplate> &allocator)
+      : _dense_indices(allocator), _dense_entities(allocator), _dense_components(allocator) {}
+  // A copy gets one new allocator instead of one per array
+  ComponentTable(const ComponentTable &other)
+      : ComponentTable(std::allocator_traits<AllocatorTemplate<ComponentTemplate>>::
+                           select_on_container_copy_construction(other._dense_components.get_allocator())) {
+    this->_dense_indices = other._dense_indices;
+    this->_dense_entities = other._dense_entities;
+    this->_dense_components = other._dense_components;
+  }
+  ComponentTable(ComponentTable &&other) = default;
+  ComponentTable &operator=(const ComponentTable &other) = default;
+  ComponentTable &operator=(ComponentTable &&other) = default;
+
+  AllocatorTemplate<ComponentTemplate> get_allocator() const { return this->_dense_components.get_allocator(); }
+
+  std::size_t size() const { return this->_dense_entities.size(); }
+
+  std::size_t capacity() const { return this->_dense_entities.capacity(); }
+
+  void reserve(std::size_t num_components) {
+    this->_dense_entities.reserve(num_components);
+    this->_dense_components.reserve(num_components);
+  }
+
+  EntityIndex dense_index(const Entity &entity) const {
+    if (entity.index >= this->_dense_indices.size()) {
+      return NO_DENSE_INDEX;
+    }
+    auto dense_index = this->_dense_indices[entity.index];
+    if (dense_index == NO_DENSE_INDEX or this->_dense_entities[dense_index] != entity) {
+      return NO_DENSE_INDEX;
+    }
+    return dense_index;
+  }
+
+  bool contains(const Entity &entity) const { return this->dense_index(entity) != NO_DENSE_INDEX; }
+
+  ComponentTemplate *find(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    return dense_index == NO_DENSE_INDEX ? nullptr : &this->_dense_components[dense_index];
+  }
+
+  const ComponentTemplate *find(const Entity &entity) const {
+    return const_cast<ComponentTable *>(this)->find(entity);
+  }
+
+  const ComponentTemplate &at(const Entity &entity) const {
+    auto component = this->find(entity);
+    if (component == nullptr) {
+      throw std::out_of_range("Entity is not in ComponentTable");
+    }
+    return *component;
+  }
+
+  // Overwrites the component if the entity is already in the table
+  void insert(const Entity &entity, const ComponentTemplate &component) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index != NO_DENSE_INDEX) {
+      this->_dense_components[dense_index] = component;
+      return;
+    }
+    if (entity.index >= this->_dense_indices.size()) {
+      this->_dense_indices.resize(entity.index + 1, NO_DENSE_INDEX);
+    }
+    this->_dense_indices[entity.index] = static_cast<EntityIndex>(this->_dense_entities.size());
+    this->_dense_entities.push_back(entity);
+    this->_dense_components.push_back(component);
+  }
+
+  bool erase(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index == NO_DENSE_INDEX) {
+      return false;
+    }
+    auto last_dense_index = static_cast<EntityIndex>(this->_dense_entities.size() - 1);
+    if (dense_index != last_dense_index) {
+      this->_dense_entities[dense_index] = this->_dense_entities[last_dense_index];
+      this->_dense_components[dense_index] = std::move(this->_dense_components[last_dense_index]);
+      this->_dense_indices[this->_dense_entities[dense_index].index] = dense_index;
+    }
+    this->_dense_indices[entity.index] = NO_DENSE_INDEX;
+    this->_dense_entities.pop_back();
+    this->_dense_components.pop_back();
+    return true;
+  }
+};
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename> class AllocatorTemplate = std::allocator>
+using ComponentTables = std::unordered_map<TypeIndexTemplate, ComponentTable<ComponentTemplate, AllocatorTemplate>>;
+
+// Stores one ComponentTable per component type in a hash map of component types, every component is kept as
+// ComponentTemplate. Only the component type is hashed, entities are found in the tables by their index.
+// AllocatorTemplate allocates the arrays of the tables.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename> class AllocatorTemplate = std::allocator>
+struct BasicHashMapStorage {
+public:
+  using ComponentTableType = ComponentTable<ComponentTemplate, AllocatorTemplate>;
+
+  // The tables have no layout per set of component types to iterate, so the ecdb matches queries against the entity
+  // signatures and looks the matching entities up with each_of()
+  static constexpr bool MATCHES_ENTITY_SIGNATURES = true;
+
+  ComponentTables<TypeIndexTemplate, ComponentTemplate, AllocatorTemplate> _component_tables;
+
+  explicit BasicHashMapStorage() { this->_component_tables = {}; }
+
+  void insert(const Entity &entity, const TypeIndexTemplate &component_type, const ComponentTemplate &component) {
+    this->_component_tables[component_type].insert(entity, component);
+  }
+
+  void erase(const Entity &entity, const TypeIndexTemplate &component_type) {
+    this->_component_tables.at(component_type).erase(entity);
+  }
+
+  void erase_entity(const Entity &entity) {
+    for (auto &&[component_type, component_table] : this->_component_tables) {
+      component_table.erase(entity);
+    }
+  }
+
+  // Inserts components[i] of component_types[i] into every one of entities, which have no components yet. Every
+  // component table is looked up and grown once.
+  void insert_entities(const std::vector<Entity> &entities, const std::vector<TypeIndexTemplate> &component_types,
+                       const std::vector<ComponentTemplate> &components) {
+    for (std::size_t index = 0; index < component_types.size(); index++) {
+      auto &component_table = this->_component_tables[component_types[index]];
+      memory_utils::reserve_for_append(component_table, entities.size());
+      for (auto &entity : entities) {
+        component_table.insert(entity, components[index]);
+      }
+    }
+  }
+
+  // Inserts or overwrites components[i] of component_type of entities[i], the component table is looked up once
+  void insert_components(const std::vector<Entity> &entities, const TypeIndexTemplate &component_type,
+                         const std::vector<ComponentTemplate> &components) {
+    auto &component_table = this->_component_tables[component_type];
+    for (std::size_t index = 0; index < entities.size(); index++) {
+      component_table.insert(entities[index], components[index]);
+    }
+  }
+
+  void erase_entities(std::span<const Entity> entities) {
+    for (auto &&[component_type, component_table] : this->_component_tables) {
+      for (auto &entity : entities) {
+        component_table.erase(entity);
+      }
+    }
+  }
+
+  void reserve(const TypeIndexTemplate &component_type, std::size_t num_components) {
+    this->_component_tables[component_type].reserve(num_components);
+  }
+
+  // The reference is valid until a component of the same component type is added or removed
+  const ComponentTemplate &get(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    return this->_component_tables.at(component_type).at(entity);
+  }
+
+  bool contains(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto component_table = this->_component_tables.find(component_type);
+    if (component_table == this->_component_tables.end()) {
+      return false;
+    }
+    return component_table->second.contains(entity);
+  }
+
+  // Component of the concrete type ComponentType or null if the entity does not have it
+  template <typename ComponentType> ComponentType *find(const Entity &entity) {
+    auto component_table = this->_find_component_table(type_utils::get_type_id<ComponentType>());
+    if (component_table == nullptr) {
+      return nullptr;
+    }
+    auto component = component_table->find(entity);
+    return component == nullptr ? nullptr : std::get_if<ComponentType>(component);
+  }
+
+  template <typename ComponentType> const ComponentType *find(const Entity &entity) const {
+    return const_cast<BasicHashMapStorage *>(this)->template find<ComponentType>(entity);
+  }
+
+  // Calls function(entity, Args &...) for every entity that has all of Args
+  template <typename... Args, typename Function> void each(Function &&function) {
+    _each<Args...>(*this, function, std::index_sequence_for<Args...>{});
+  }
+
+  template <typename... Args, typename Function> void each(Function &&function) const {
+    _each<Args...>(*this, function, std::index_sequence_for<Args...>{});
+  }
+
+  // Same as each(), but only for the entities that for_each_entity(visit) passes to visit(entity). The tables of Args
+  // are looked up once, then the components of every entity are found by its index.
+  template <typename... Args, typename ForEachEntity, typename Function>
+  void each_of(ForEachEntity &&for_each_entity, Function &&function) {
+    _each_of<Args...>(*this, for_each_entity, function, std::index_sequence_for<Args...>{});
+  }
+
+  template <typename... Args, typename ForEachEntity, typename Function>
+  void each_of(ForEachEntity &&for_each_entity, Function &&function) const {
+    _each_of<Args...>(*this, for_each_entity, function, std::index_sequence_for<Args...>{});
+  }
+
+  // Lazily iterates the table of the first of Args and looks the entities up in the tables of the others
+  template <typename... Args> class View {
+  public:
+    using ComponentTablePointers = std::array<ComponentTableType *, sizeof...(Args)>;
+
+    class Iterator {
+    public:
+      explicit Iterator(const ComponentTablePointers &component_tables, std::size_t dense_index,
+                        std::size_t end_index)
+          : _component_tables(component_tables), _dense_index(dense_index), _end_index(end_index) {
+        this->_skip_incomplete_entities();
+      }
+
+      std::tuple<Entity, Args &...> operator*() const {
+        return this->_dereference(std::index_sequence_for<Args...>{});
+      }
+
+      Iterator &operator++() {
+        this->_dense_index += 1;
+        this->_skip_incomplete_entities();
+        return *this;
+      }
+
+      bool operator==(const Iterator &other) const { return this->_dense_index == other._dense_index; }
+      bool operator!=(const Iterator &other) const { return this->_dense_index != other._dense_index; }
+
+      const Entity &_entity() const { return this->_component_tables[0]->_dense_entities[this->_dense_index]; }
+
+      template <std::size_t... Indices>
+      std::tuple<Entity, Args &...> _dereference(std::index_sequence<Indices...>) const {
+        return std::tuple<Entity, Args &...>(this->_entity(), std::get<Args>(*this->_components[Indices])...);
+      }
+
+      void _skip_incomplete_entities() {
+        for (; this->_dense_index < this->_end_index; this->_dense_index++) {
+          bool skip_entity = false;
+          for (std::size_t index = 0; index < sizeof...(Args); index++) {
+            this->_components[index] = this->_component_tables[index]->find(this->_entity());
+            skip_entity |= this->_components[index] == nullptr;
+          }
+          if (not skip_entity) {
+            return;
+          }
+        }
+      }
+
+      // A copy, so iterators stay valid when they outlive a temporary View
+      ComponentTablePointers _component_tables;
+      std::size_t _dense_index;
+      std::size_t _end_index;
+      std::array<ComponentTemplate *, sizeof...(Args)> _components;
+    };
+
+    explicit View(BasicHashMapStorage &storage) {
+      this->_component_tables = {storage._find_component_table(type_utils::get_type_id<Args>())...};
+      this->_empty = false;
+      for (auto component_table : this->_component_tables) {
+        this->_empty |= component_table == nullptr;
+      }
+    }
+
+    Iterator begin() const { return Iterator(this->_component_tables, 0, this->_size()); }
+
+    Iterator end() const { return Iterator(this->_component_tables, this->_size(), this->_size()); }
+
+    std::size_t _size() const { return this->_empty ? 0 : this->_component_tables[0]->size(); }
+
+    ComponentTablePointers _component_tables;
+    bool _empty;
+  };
+
+  template <typename... Args> View<Args...> view() { return View<Args...>(*this); }
+
+  // Splits the entities that have all of Args into chunks of about grain_size entities and calls add_chunk(chunk) for
+  // every one of them, chunk(function) calls function(entity, Args &...) for the entities of the chunk.
+  // Only the smallest table of Args is split at cache line boundaries, the components in the other tables are looked
+  // up and may share cache lines between chunks.
+  template <typename... Args, typename AddChunkFunction>
+  void chunk(std::size_t grain_size, AddChunkFunction &&add_chunk) {
+    auto found_component_tables = _find_component_tables<Args...>(*this);
+    if (not found_component_tables) {
+      return;
+    }
+    auto component_tables = *found_component_tables;
+    auto &smallest_table = *_smallest(component_tables);
+    auto chunk_size = memory_utils::cache_line_aligned_chunk_size<Entity>(grain_size);
+    for (std::size_t begin = 0; begin < smallest_table.size(); begin += chunk_size) {
+      auto end = std::min(begin + chunk_size, smallest_table.size());
+      add_chunk([component_tables, &smallest_table, begin, end](auto &function) {
+        for (std::size_t dense_index = begin; dense_index < end; dense_index++) {
+          _call_if_complete<Args...>(component_tables, smallest_table._dense_entities[dense_index], function,
+                                     std::index_sequence_for<Args...>{});
+        }
+      });
+    }
+  }
+
+  ComponentTableType *_find_component_table(const TypeIndexTemplate &component_type) {
+    auto component_table = this->_component_tables.find(component_type);
+    if (component_table == this->_component_tables.end()) {
+      return nullptr;
+    }
+    return &component_table->second;
+  }
+
+  const ComponentTableType *_find_component_table(const TypeIndexTemplate &component_type) const {
+    return const_cast<BasicHashMapStorage *>(this)->_find_component_table(component_type);
+  }
+
+  // Tables of Args, or nullopt if one of them has no table yet
+  template <typename... Args, typename Self> static auto _find_component_tables(Self &self) {
+    using ComponentTablePointers =
+        std::array<decltype(self._find_component_table(TypeIndexTemplate())), sizeof...(Args)>;
+    ComponentTablePointers component_tables = {self._find_component_table(type_utils::get_type_id<Args>())...};
+    for (auto component_table : component_tables) {
+      if (component_table == nullptr) {
+        return std::optional<ComponentTablePointers>();
+      }
+    }
+    return std::optional<ComponentTablePointers>(component_tables);
+  }
+
+  template <typename... Args, typename Self, typename Function, std::size_t... Indices>
+  static void _each(Self &self, Function &function, std::index_sequence<Indices...> indices) {
+    auto component_tables = _find_component_tables<Args...>(self);
+    if (not component_tables) {
+      return;
+    }
+    for (auto &entity : _smallest(*component_tables)->_dense_entities) {
+      _call_if_complete<Args...>(*component_tables, entity, function, indices);
+    }
+  }
+
+  template <typename... Args, typename Self, typename ForEachEntity, typename Function, std::size_t... Indices>
+  static void _each_of(Self &self, ForEachEntity &for_each_entity, Function &function,
+                       std::index_sequence<Indices...> indices) {
+    auto component_tables = _find_component_tables<Args...>(self);
+    if (not component_tables) {
+      return;
+    }
+    for_each_entity([&component_tables, &function, indices](const Entity &entity) {
+      _call_if_complete<Args...>(*component_tables, entity, function, indices);
+    });
+  }
+
+  // Calls function(entity, Args &...) if the entity is in every one of component_tables
+  template <typename... Args, typename ComponentTablePointers, typename Function, std::size_t... Indices>
+  static void _call_if_complete(const ComponentTablePointers &component_tables, const Entity &entity,
+                                Function &function, std::index_sequence<Indices...>) {
+    std::array<decltype(component_tables[0]->find(entity)), sizeof...(Args)> components = {
+        component_tables[Indices]->find(entity)...};
+    for (auto component : components) {
+      if (component == nullptr) {
+        return;
+      }
+    }
+    function(entity, std::get<Args>(*components[Indices])...);
+  }
+
+  template <typename ComponentTablePointers>
+  static auto _smallest(const ComponentTablePointers &component_tables) {
+    return *std::min_element(component_tables.begin(), component_tables.end(),
+                             [](auto table_a, auto table_b) { return table_a->size() < table_b->size(); });
+  }
+};
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+using HashMapStorage = BasicHashMapStorage<TypeIndexTemplate, ComponentTemplate>;
+
+// Allocates the arrays of every table from one BlockPool per table, so an array a table frees when it grows is reused
+// by its other arrays when they grow to that size
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+using PoolHashMapStorage = BasicHashMapStorage<TypeIndexTemplate, ComponentTemplate, memory_utils::PoolAllocator>;
+
+} // namespace mutable_ecs
+} // namespace ecs
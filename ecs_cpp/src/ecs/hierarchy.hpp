@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ecs/entity.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+constexpr EntityIndex NO_ENTITY_INDEX = std::numeric_limits<EntityIndex>::max();
+
+// An entity of a hierarchy and its parent, parent.index is NO_ENTITY_INDEX for roots
+struct HierarchyEntry {
+public:
+  Entity entity;
+  Entity parent;
+};
+
+// ChildOf(parent) relationships of the entities of an ecdb, indexed on both sides: every entity index keeps its parent
+// and an intrusive list of its children in the order they were added, so linking and unlinking are O(1) and neither
+// side is looked up by hashing. The breadth-first order of the whole forest is kept as a flat array that is rebuilt on
+// the first traversal after a change, so traversals stream through it with every parent before its children.
+class Hierarchy {
+public:
+  struct HierarchySlot {
+  public:
+    Entity entity;
+    Entity parent;
+    EntityIndex first_child;
+    EntityIndex last_child;
+    EntityIndex previous_sibling;
+    EntityIndex next_sibling;
+    std::uint32_t num_children;
+  };
+
+  std::vector<HierarchySlot> _slots;
+  std::size_t _num_relationships;
+  std::vector<HierarchyEntry> _breadth_first_order;
+  bool _is_breadth_first_order_stale;
+
+  explicit Hierarchy() {
+    this->_slots = {};
+    this->_num_relationships = 0;
+    this->_breadth_first_order = {};
+    this->_is_breadth_first_order_stale = false;
+  }
+
+  // Number of ChildOf relationships
+  std::size_t size() const { return this->_num_relationships; }
+
+  bool empty() const { return this->_num_relationships == 0; }
+
+  bool has_parent(EntityIndex entity_index) const {
+    return entity_index < this->_slots.size() and this->_slots[entity_index].parent.index != NO_ENTITY_INDEX;
+  }
+
+  bool has_children(EntityIndex entity_index) const {
+    return entity_index < this->_slots.size() and this->_slots[entity_index].num_children > 0;
+  }
+
+  const Entity &parent(EntityIndex entity_index) const { return this->_slots[entity_index].parent; }
+
+  std::size_t num_children(EntityIndex entity_index) const {
+    return entity_index < this->_slots.size() ? this->_slots[entity_index].num_children : 0;
+  }
+
+  // Calls function(child) for every child of the entity in the order they were added
+  template <typename Function> void for_each_child(EntityIndex entity_index, Function &&function) const {
+    if (entity_index >= this->_slots.size()) {
+      return;
+    }
+    for (auto child_index = this->_slots[entity_index].first_child; child_index != NO_ENTITY_INDEX;
+         child_index = this->_slots[child_index].next_sibling) {
+      function(this->_slots[child_index].entity);
+    }
+  }
+
+  // Whether ancestor is the entity or one of its ancestors
+  bool is_ancestor(EntityIndex ancestor_index, EntityIndex entity_index) const {
+    while (entity_index != ancestor_index) {
+      if (not this->has_parent(entity_index)) {
+        return false;
+      }
+      entity_index = this->_slots[entity_index].parent.index;
+    }
+    return true;
+  }
+
+  HierarchySlot &_get_slot(const Entity &entity) {
+    if (entity.index >= this->_slots.size()) {
+      this->_slots.resize(entity.index + 1, HierarchySlot{Entity(NO_ENTITY_INDEX), Entity(NO_ENTITY_INDEX),
+                                                          NO_ENTITY_INDEX, NO_ENTITY_INDEX, NO_ENTITY_INDEX,
+                                                          NO_ENTITY_INDEX, 0});
+    }
+    auto &slot = this->_slots[entity.index];
+    slot.entity = entity;
+    return slot;
+  }
+
+  // Makes child the last child of parent, replacing its previous parent. The caller checks that both are alive and
+  // that parent is not a descendant of child.
+  void set_parent(const Entity &child, const Entity &parent) {
+    this->remove_parent(child.index);
+    // Both slots exist before references to them are taken, _get_slot may grow _slots
+    this->_get_slot(parent);
+    auto &child_slot = this->_get_slot(child);
+    auto &parent_slot = this->_slots[parent.index];
+    child_slot.parent = parent;
+    child_slot.previous_sibling = parent_slot.last_child;
+    child_slot.next_sibling = NO_ENTITY_INDEX;
+    if (parent_slot.last_child == NO_ENTITY_INDEX) {
+      parent_slot.first_child = child.index;
+    } else {
+      this->_slots[parent_slot.last_child].next_sibling = child.index;
+    }
+    parent_slot.last_child = child.index;
+    parent_slot.num_children += 1;
+    this->_num_relationships += 1;
+    this->_is_breadth_first_order_stale = true;
+  }
+
+  void remove_parent(EntityIndex child_index) {
+    if (not this->has_parent(child_index)) {
+      return;
+    }
+    auto &child_slot = this->_slots[child_index];
+    auto &parent_slot = this->_slots[child_slot.parent.index];
+    if (child_slot.previous_sibling == NO_ENTITY_INDEX) {
+      parent_slot.first_child = child_slot.next_sibling;
+    } else {
+      this->_slots[child_slot.previous_sibling].next_sibling = child_slot.next_sibling;
+    }
+    if (child_slot.next_sibling == NO_ENTITY_INDEX) {
+      parent_slot.last_child = child_slot.previous_sibling;
+    } else {
+      this->_slots[child_slot.next_sibling].previous_sibling = child_slot.previous_sibling;
+    }
+    parent_slot.num_children -= 1;
+    child_slot.parent = Entity(NO_ENTITY_INDEX);
+    child_slot.previous_sibling = NO_ENTITY_INDEX;
+    child_slot.next_sibling = NO_ENTITY_INDEX;
+    this->_num_relationships -= 1;
+    this->_is_breadth_first_order_stale = true;
+  }
+
+  // Unlinks a removed entity from its parent, its remaining children become roots
+  void erase_entity(EntityIndex entity_index) {
+    if (entity_index >= this->_slots.size()) {
+      return;
+    }
+    this->remove_parent(entity_index);
+    while (this->has_children(entity_index)) {
+      this->remove_parent(this->_slots[entity_index].first_child);
+    }
+  }
+
+  // Appends the descendants of the entity in breadth-first order
+  void append_descendants(EntityIndex entity_index, std::vector<Entity> &descendants) const {
+    auto begin = descendants.size();
+    this->for_each_child(entity_index, [&descendants](const Entity &child) { descendants.push_back(child); });
+    for (auto position = begin; position < descendants.size(); position++) {
+      this->for_each_child(descendants[position].index,
+                           [&descendants](const Entity &child) { descendants.push_back(child); });
+    }
+  }
+
+  // Every entity with a parent or children, roots in the order of their indices, then their children depth by depth
+  const std::vector<HierarchyEntry> &breadth_first_order() {
+    if (not this->_is_breadth_first_order_stale) {
+      return this->_breadth_first_order;
+    }
+    this->_breadth_first_order.clear();
+    this->append_breadth_first_order(this->_breadth_first_order);
+    this->_is_breadth_first_order_stale = false;
+    return this->_breadth_first_order;
+  }
+
+  // Same as breadth_first_order, but appended to order without touching the cached one. Setting the parents of the
+  // entries with a parent in this order rebuilds the same children in the same order.
+  void append_breadth_first_order(std::vector<HierarchyEntry> &order) const {
+    auto begin = order.size();
+    for (auto &slot : this->_slots) {
+      if (slot.num_children > 0 and slot.parent.index == NO_ENTITY_INDEX) {
+        order.push_back(HierarchyEntry{slot.entity, Entity(NO_ENTITY_INDEX)});
+      }
+    }
+    for (auto position = begin; position < order.size(); position++) {
+      auto parent = order[position].entity;
+      this->for_each_child(parent.index, [&order, &parent](const Entity &child) {
+        order.push_back(HierarchyEntry{child, parent});
+      });
+    }
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/snapshot.hpp"
+
+// Journal of the frames of an EntityComponentDatabase, for replays, rollbacks and lockstep verification. A journal
+// starts at the state of the ecdb it was created for and every frame run by process_systems_with_journal appends a
+// block to its bytes:
+//   JournalFrameHeader
+//   the actions in the order they were applied
+//   the entities created by the frame in the order they were created
+// Trivially copyable actions are stored as their bytes, other action types are prefixed with their size and need a
+// SnapshotSerializer. All values are stored in native byte order.
+namespace ecs {
+namespace mutable_ecs {
+
+constexpr std::array<char, 8> JOURNAL_MAGIC = {'E', 'C', 'D', 'B', 'J', 'R', 'N', 'L'};
+constexpr std::uint32_t JOURNAL_VERSION = 1;
+
+struct JournalHeader {
+public:
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t has_checksums;
+  std::uint64_t initial_checksum;
+  std::uint64_t num_frames;
+  std::uint64_t num_bytes;
+};
+
+// size is the size of the whole frame block, checksum is the checksum of the ecdb after the frame
+struct JournalFrameHeader {
+public:
+  std::uint64_t size;
+  std::uint64_t checksum;
+  std::uint32_t num_actions;
+  std::uint32_t num_created_entities;
+};
+
+template <typename T> constexpr bool is_raw_journal_action() {
+  static_assert(std::is_trivially_copyable_v<T> or has_snapshot_serializer<T>::value,
+                "Action type is not trivially copyable and has no SnapshotSerializer");
+  return is_raw_snapshot_component<T>();
+}
+
+template <typename ActionTemplate> class Journal {
+public:
+  static constexpr std::size_t NO_FRAME = std::numeric_limits<std::size_t>::max();
+
+  // Checksums are recorded if the checksum of the ecdb was enabled when the journal was created
+  bool _has_checksums;
+  std::uint64_t _initial_checksum;
+  std::vector<char> _bytes;
+  std::vector<std::size_t> _frame_offsets;
+  // Offset of the frame that is being recorded, NO_FRAME between frames
+  std::size_t _frame_offset;
+  std::uint32_t _num_frame_actions;
+
+  explicit Journal(bool has_checksums = false, std::uint64_t initial_checksum = 0) {
+    this->_has_checksums = has_checksums;
+    this->_initial_checksum = initial_checksum;
+    this->_bytes = {};
+    this->_frame_offsets = {};
+    this->_frame_offset = NO_FRAME;
+    this->_num_frame_actions = 0;
+  }
+
+  std::size_t num_frames() const { return this->_frame_offsets.size(); }
+
+  std::size_t size_in_bytes() const { return this->_bytes.size(); }
+
+  bool has_checksums() const { return this->_has_checksums; }
+
+  std::uint64_t initial_checksum() const { return this->_initial_checksum; }
+
+  JournalFrameHeader _frame_header(std::size_t frame) const {
+    if (frame >= this->num_frames()) {
+      throw std::runtime_error("Frame " + std::to_string(frame) + " is not in the journal");
+    }
+    JournalFrameHeader frame_header;
+    std::memcpy(&frame_header, this->_bytes.data() + this->_frame_offsets[frame], sizeof(JournalFrameHeader));
+    return frame_header;
+  }
+
+  std::uint64_t checksum(std::size_t frame) const { return this->_frame_header(frame).checksum; }
+
+  std::vector<Entity> created_entities(std::size_t frame) const {
+    auto frame_header = this->_frame_header(frame);
+    std::vector<Entity> entities(frame_header.num_created_entities, Entity(0));
+    auto entities_size = entities.size() * sizeof(Entity);
+    std::memcpy(entities.data(), this->_bytes.data() + this->_frame_offsets[frame] + frame_header.size - entities_size,
+                entities_size);
+    return entities;
+  }
+
+  // Calls function(action) for every action of the frame in the order they were applied
+  template <typename Function> void for_each_action(std::size_t frame, Function &&function) const {
+    auto frame_header = this->_frame_header(frame);
+    auto bytes = this->_bytes.data() + this->_frame_offsets[frame] + sizeof(JournalFrameHeader);
+    for (std::uint32_t action_index = 0; action_index < frame_header.num_actions; action_index++) {
+      if constexpr (is_raw_journal_action<ActionTemplate>()) {
+        alignas(ActionTemplate) std::array<char, sizeof(ActionTemplate)> action_bytes;
+        std::memcpy(action_bytes.data(), bytes, sizeof(ActionTemplate));
+        function(*reinterpret_cast<ActionTemplate *>(action_bytes.data()));
+        bytes += sizeof(ActionTemplate);
+      } else {
+        std::uint32_t action_size;
+        std::memcpy(&action_size, bytes, sizeof(action_size));
+        bytes += sizeof(action_size);
+        auto action = SnapshotSerializer<ActionTemplate>::deserialize(bytes, action_size);
+        function(action);
+        bytes += action_size;
+      }
+    }
+  }
+
+  // Discards the bytes of the frame that is being recorded, e.g. because an action threw
+  void abort_frame() {
+    if (this->_frame_offset != NO_FRAME) {
+      this->_bytes.resize(this->_frame_offset);
+      this->_frame_offset = NO_FRAME;
+    }
+  }
+
+  // Starts recording a frame, a frame that was not ended is discarded
+  void begin_frame() {
+    this->abort_frame();
+    this->_frame_offset = this->_bytes.size();
+    this->_bytes.resize(this->_bytes.size() + sizeof(JournalFrameHeader));
+    this->_num_frame_actions = 0;
+  }
+
+  void record_action(const ActionTemplate &action) {
+    if constexpr (is_raw_journal_action<ActionTemplate>()) {
+      auto action_bytes = reinterpret_cast<const char *>(&action);
+      this->_bytes.insert(this->_bytes.end(), action_bytes, action_bytes + sizeof(ActionTemplate));
+    } else {
+      auto size_offset = this->_bytes.size();
+      this->_bytes.resize(size_offset + sizeof(std::uint32_t));
+      SnapshotSerializer<ActionTemplate>::serialize(action, this->_bytes);
+      auto action_size = static_cast<std::uint32_t>(this->_bytes.size() - size_offset - sizeof(std::uint32_t));
+      std::memcpy(this->_bytes.data() + size_offset, &action_size, sizeof(action_size));
+    }
+    this->_num_frame_actions += 1;
+  }
+
+  void end_frame(const std::vector<Entity> &created_entities, std::uint64_t checksum) {
+    if (this->_frame_offset == NO_FRAME) {
+      throw std::runtime_error("Journal is not recording a frame");
+    }
+    auto entities_bytes = reinterpret_cast<const char *>(created_entities.data());
+    this->_bytes.insert(this->_bytes.end(), entities_bytes, entities_bytes + created_entities.size() * sizeof(Entity));
+
+    JournalFrameHeader frame_header;
+    frame_header.size = this->_bytes.size() - this->_frame_offset;
+    frame_header.checksum = checksum;
+    frame_header.num_actions = this->_num_frame_actions;
+    frame_header.num_created_entities = static_cast<std::uint32_t>(created_entities.size());
+    std::memcpy(this->_bytes.data() + this->_frame_offset, &frame_header, sizeof(JournalFrameHeader));
+    this->_frame_offsets.push_back(this->_frame_offset);
+    this->_frame_offset = NO_FRAME;
+  }
+};
+
+// Creates a journal that starts at the current state of ecdb, a snapshot saved now is where its replays start
+template <typename ActionTemplate, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+Journal<ActionTemplate>
+create_journal(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  auto has_checksums = ecdb._checksum.enabled();
+  return Journal<ActionTemplate>(has_checksums, has_checksums ? ecdb._checksum.value() : 0);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate>
+void _begin_journal_frame(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                          Journal<ActionTemplate> &journal) {
+  journal.begin_frame();
+  ecdb._created_entities.emplace();
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate>
+void _end_journal_frame(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                        Journal<ActionTemplate> &journal) {
+  journal.end_frame(*ecdb._created_entities, journal.has_checksums() ? get_checksum(ecdb) : 0);
+  ecdb._created_entities.reset();
+}
+
+// Same as process_systems, but the frame is appended to journal. Actions are recorded before they are applied.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems_with_journal(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemIntoBufferFunction<
+        TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>>::type process_system,
+
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    Journal<ActionTemplate> &journal) {
+  using EntityComponentDatabaseType = EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>;
+  ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>
+      process_and_record_action = [&journal, &process_action](EntityComponentDatabaseType &ecdb,
+                                                              ActionTemplate &action) {
+        journal.record_action(action);
+        return process_action(ecdb, action);
+      };
+  _begin_journal_frame(ecdb, journal);
+  try {
+    ecdb = process_systems<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>(
+        ecdb, systems, std::move(process_system), std::move(process_and_record_action));
+  } catch (...) {
+    journal.abort_frame();
+    ecdb._created_entities.reset();
+    throw;
+  }
+  _end_journal_frame(ecdb, journal);
+  return std::move(ecdb);
+}
+
+// Same as above for systems that return their actions
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems_with_journal(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
+
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    Journal<ActionTemplate> &journal) {
+  using EntityComponentDatabaseType = EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>;
+  ProcessSystemIntoBufferFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>
+      process_system_into_buffer = [&process_system](EntityComponentDatabaseType &ecdb, SystemTemplate &system,
+                                                     ActionBuffer<ActionTemplate> &actions) {
+        auto system_actions = process_system(ecdb, system);
+        actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+      };
+  return process_systems_with_journal<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate,
+                                      StorageTemplate>(ecdb, systems, std::move(process_system_into_buffer),
+                                                       std::move(process_action), journal);
+}
+
+// Applies the actions of one frame of journal to ecdb, which has to be in the state before that frame. Throws if the
+// frame creates other entities than it did when it was recorded, or if the checksum differs from the recorded one
+// afterwards. Checksums are compared if they are enabled for ecdb and were enabled when the journal was recorded.
+// Only the actions are replayed, the systems are not run and the change ticks are not advanced.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> replay_journal_frame(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    const Journal<ActionTemplate> &journal,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    std::size_t frame) {
+  ecdb._created_entities.emplace();
+  try {
+    journal.for_each_action(frame, [&ecdb, &process_action](ActionTemplate &action) {
+      ecdb = process_action(ecdb, action);
+    });
+  } catch (...) {
+    ecdb._created_entities.reset();
+    throw;
+  }
+  auto created_entities = std::move(*ecdb._created_entities);
+  ecdb._created_entities.reset();
+
+  auto checks_checksums = journal.has_checksums() and ecdb._checksum.enabled();
+  if (created_entities != journal.created_entities(frame) or
+      (checks_checksums and ecdb._checksum.value() != journal.checksum(frame))) {
+    throw std::runtime_error("Replay diverged from the journal at frame " + std::to_string(frame));
+  }
+  return std::move(ecdb);
+}
+
+// Rebuilds the state after the first num_frames frames of journal by replaying them on ecdb, which has to be in the
+// state the journal was created for, e.g. loaded from a snapshot saved then. See replay_journal_frame.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> replay_journal(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    const Journal<ActionTemplate> &journal,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    std::size_t num_frames) {
+  if (num_frames > journal.num_frames()) {
+    throw std::runtime_error("Journal has only " + std::to_string(journal.num_frames()) + " frames");
+  }
+  if (journal.has_checksums() and ecdb._checksum.enabled() and ecdb._checksum.value() != journal.initial_checksum()) {
+    throw std::runtime_error("Replay does not start at the state the journal was created for");
+  }
+  for (std::size_t frame = 0; frame < num_frames; frame++) {
+    ecdb = replay_journal_frame<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>(
+        ecdb, journal, process_action, frame);
+  }
+  return std::move(ecdb);
+}
+
+// Writes journal to path and returns the size of the file in bytes
+template <typename ActionTemplate>
+std::size_t save_journal(const Journal<ActionTemplate> &journal, const std::string &path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (not file) {
+    throw std::runtime_error("Cannot open journal file for writing: " + path);
+  }
+  JournalHeader header = {};
+  header.magic = JOURNAL_MAGIC;
+  header.version = JOURNAL_VERSION;
+  header.has_checksums = journal.has_checksums();
+  header.initial_checksum = journal.initial_checksum();
+  header.num_frames = journal.num_frames();
+  // A frame that is being recorded is not written
+  header.num_bytes =
+      journal._frame_offset == Journal<ActionTemplate>::NO_FRAME ? journal._bytes.size() : journal._frame_offset;
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(journal._bytes.data(), header.num_bytes);
+  if (not file) {
+    throw std::runtime_error("Cannot write journal file: " + path);
+  }
+  return sizeof(header) + header.num_bytes;
+}
+
+// Reads a journal written by save_journal for the same ActionTemplate
+template <typename ActionTemplate> Journal<ActionTemplate> load_journal(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (not file) {
+    throw std::runtime_error("Cannot open journal file: " + path);
+  }
+  JournalHeader header;
+  if (not file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+    throw std::runtime_error("Journal file is truncated: " + path);
+  }
+  if (header.magic != JOURNAL_MAGIC) {
+    throw std::runtime_error("File is not a journal");
+  }
+  if (header.version != JOURNAL_VERSION) {
+    throw std::runtime_error("Unsupported journal version " + std::to_string(header.version));
+  }
+
+  Journal<ActionTemplate> journal(header.has_checksums != 0, header.initial_checksum);
+  journal._bytes.resize(header.num_bytes);
+  if (not file.read(journal._bytes.data(), header.num_bytes)) {
+    throw std::runtime_error("Journal file is truncated: " + path);
+  }
+  std::size_t frame_offset = 0;
+  for (std::uint64_t frame = 0; frame < header.num_frames; frame++) {
+    JournalFrameHeader frame_header;
+    if (frame_offset + sizeof(JournalFrameHeader) > journal._bytes.size()) {
+      throw std::runtime_error("Journal file is truncated: " + path);
+    }
+    std::memcpy(&frame_header, journal._bytes.data() + frame_offset, sizeof(JournalFrameHeader));
+    if (frame_header.size < sizeof(JournalFrameHeader) + frame_header.num_created_entities * sizeof(Entity) or
+        frame_offset + frame_header.size > journal._bytes.size()) {
+      throw std::runtime_error("Journal file is truncated: " + path);
+    }
+    journal._frame_offsets.push_back(frame_offset);
+    frame_offset += frame_header.size;
+  }
+  return journal;
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+namespace memory_utils {
+
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Allocates every block at the start of a cache line, so ranges of elements whose size is a multiple of
+// CACHE_LINE_SIZE never share a cache line with each other
+template <typename T> struct CacheAlignedAllocator {
+public:
+  using value_type = T;
+
+  static constexpr std::size_t ALIGNMENT = std::max(CACHE_LINE_SIZE, alignof(T));
+
+  CacheAlignedAllocator() = default;
+  template <typename U> CacheAlignedAllocator(const CacheAlignedAllocator<U> &) {}
+
+  T *allocate(std::size_t size) {
+    return static_cast<T *>(::operator new(size * sizeof(T), std::align_val_t(ALIGNMENT)));
+  }
+  void deallocate(T *pointer, std::size_t) { ::operator delete(pointer, std::align_val_t(ALIGNMENT)); }
+};
+
+template <typename T, typename U>
+bool operator==(const CacheAlignedAllocator<T> &, const CacheAlignedAllocator<U> &) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const CacheAlignedAllocator<T> &, const CacheAlignedAllocator<U> &) {
+  return false;
+}
+
+template <typename T> using CacheAlignedVector = std::vector<T, CacheAlignedAllocator<T>>;
+
+// Pads T to its own cache line, e.g. for per-thread values that are written concurrently
+template <typename T> struct alignas(CACHE_LINE_SIZE) CacheAligned {
+public:
+  T value;
+};
+
+// Smallest number of consecutive elements of every one of Ts that is a multiple of CACHE_LINE_SIZE bytes
+template <typename... Ts> constexpr std::size_t elements_per_cache_line() {
+  std::size_t num_elements = 1;
+  ((num_elements = std::lcm(num_elements, CACHE_LINE_SIZE / std::gcd(CACHE_LINE_SIZE, sizeof(Ts)))), ...);
+  return num_elements;
+}
+
+// grain_size rounded up to elements_per_cache_line<Ts...>()
+template <typename... Ts> constexpr std::size_t cache_line_aligned_chunk_size(std::size_t grain_size) {
+  constexpr auto num_elements = elements_per_cache_line<Ts...>();
+  return std::max<std::size_t>((grain_size + num_elements - 1) / num_elements, 1) * num_elements;
+}
+
+template <typename Container, typename = void> struct is_hash_table : std::false_type {};
+template <typename Container>
+struct is_hash_table<Container, std::void_t<decltype(std::declval<const Container &>().bucket_count())>>
+    : std::true_type {};
+
+// Makes room for num_elements more elements before a batch is appended to container. It only grows when the room is
+// short and then at least doubles, so many small batches stay amortized O(1) per element like single insertions,
+// instead of growing to the exact size and reallocating or rehashing on every batch.
+template <typename Container> void reserve_for_append(Container &container, std::size_t num_elements) {
+  auto size = container.size() + num_elements;
+  if constexpr (is_hash_table<Container>::value) {
+    if (size > container.bucket_count() * container.max_load_factor()) {
+      container.reserve(std::max(size, 2 * container.size()));
+    }
+  } else {
+    if (size > container.capacity()) {
+      container.reserve(std::max(size, 2 * container.capacity()));
+    }
+  }
+}
+
+// Bump allocator for memory that only lives until the end of a frame. Nothing is freed before reset(), which makes all
+// of it available again. Blocks are kept across frames and if a frame needed more than one block, reset() replaces them
+// with a single block that fits all of them, so once the arena is warmed up allocate() never touches the global heap.
+class FrameArena {
+public:
+  struct Block {
+  public:
+    std::unique_ptr<std::byte[]> data;
+    std::size_t size;
+  };
+
+  std::vector<Block> _blocks;
+  std::size_t _offset;
+  std::size_t _initial_block_size;
+
+  explicit FrameArena(std::size_t initial_block_size = 64 * 1024) {
+    this->_blocks.clear();
+    this->_offset = 0;
+    this->_initial_block_size = std::max<std::size_t>(initial_block_size, CACHE_LINE_SIZE);
+  }
+  FrameArena(FrameArena &&) = default;
+  FrameArena &operator=(FrameArena &&) = default;
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  std::size_t num_blocks() const { return this->_blocks.size(); }
+
+  std::size_t capacity() const {
+    std::size_t capacity = 0;
+    for (auto &block : this->_blocks) {
+      capacity += block.size;
+    }
+    return capacity;
+  }
+
+  void *allocate(std::size_t num_bytes, std::size_t alignment) {
+    if (not this->_blocks.empty()) {
+      auto &block = this->_blocks.back();
+      void *pointer = block.data.get() + this->_offset;
+      auto space = block.size - this->_offset;
+      if (std::align(alignment, num_bytes, pointer, space) != nullptr) {
+        this->_offset = block.size - space + num_bytes;
+        return pointer;
+      }
+    }
+    auto block_size = this->_blocks.empty() ? this->_initial_block_size : 2 * this->_blocks.back().size;
+    this->_add_block(std::max(block_size, num_bytes + alignment));
+    return this->allocate(num_bytes, alignment);
+  }
+
+  void reset() {
+    if (this->_blocks.size() > 1) {
+      auto capacity = this->capacity();
+      this->_blocks.clear();
+      this->_add_block(capacity);
+    }
+    this->_offset = 0;
+  }
+
+  void _add_block(std::size_t size) {
+    this->_blocks.push_back(Block{std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+    this->_offset = 0;
+  }
+};
+
+// Allocates from a FrameArena, deallocate() does nothing. Containers that use it must not outlive the next reset() of
+// the arena.
+template <typename T> struct ArenaAllocator {
+public:
+  using value_type = T;
+
+  FrameArena *_arena;
+
+  explicit ArenaAllocator(FrameArena &arena) { this->_arena = &arena; }
+  template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) { this->_arena = other._arena; }
+
+  FrameArena &arena() const { return *this->_arena; }
+
+  T *allocate(std::size_t size) { return static_cast<T *>(this->_arena->allocate(size * sizeof(T), alignof(T))); }
+  void deallocate(T *, std::size_t) {}
+};
+
+template <typename T, typename U> bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a._arena == b._arena;
+}
+template <typename T, typename U> bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a._arena != b._arena;
+}
+
+template <typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Free lists of blocks, one per power of two multiple of alignof(std::max_align_t) bytes, so the arrays a growing
+// container frees are handed out again when another container grows to their size. Blocks go back to the global heap
+// only when the pool is destroyed.
+class BlockPool {
+public:
+  static constexpr std::size_t SIZE_CLASS = alignof(std::max_align_t);
+  static constexpr std::size_t NUM_SIZE_CLASSES = 32;
+
+  std::array<void *, NUM_SIZE_CLASSES> _free_lists;
+
+  explicit BlockPool() { this->_free_lists = {}; }
+  BlockPool(const BlockPool &) = delete;
+  BlockPool &operator=(const BlockPool &) = delete;
+  ~BlockPool() {
+    for (auto block : this->_free_lists) {
+      while (block != nullptr) {
+        auto next_block = *static_cast<void **>(block);
+        ::operator delete(block);
+        block = next_block;
+      }
+    }
+  }
+
+  static constexpr bool pooled(std::size_t num_bytes, std::size_t alignment) {
+    return num_bytes <= (SIZE_CLASS << (NUM_SIZE_CLASSES - 1)) and alignment <= SIZE_CLASS;
+  }
+
+  void *allocate(std::size_t num_bytes) {
+    auto size_class = _size_class(num_bytes);
+    auto &free_list = this->_free_lists[size_class];
+    if (free_list == nullptr) {
+      return ::operator new(SIZE_CLASS << size_class);
+    }
+    auto block = free_list;
+    free_list = *static_cast<void **>(block);
+    return block;
+  }
+
+  void deallocate(void *block, std::size_t num_bytes) {
+    auto &free_list = this->_free_lists[_size_class(num_bytes)];
+    *static_cast<void **>(block) = free_list;
+    free_list = block;
+  }
+
+  std::size_t num_free_blocks() const {
+    std::size_t num_free_blocks = 0;
+    for (auto block : this->_free_lists) {
+      for (; block != nullptr; block = *static_cast<void **>(block)) {
+        num_free_blocks++;
+      }
+    }
+    return num_free_blocks;
+  }
+
+  static std::size_t _size_class(std::size_t num_bytes) {
+    return std::bit_width((std::max<std::size_t>(num_bytes, 1) - 1) / SIZE_CLASS);
+  }
+};
+
+// Recycles allocations through a BlockPool instead of returning them to the global heap. Copies and rebinds of an
+// allocator share its pool, so containers that share a pool must be used from one thread. A container copy gets a
+// new pool and copy assignment keeps the pool of the assigned container.
+template <typename T> struct PoolAllocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  std::shared_ptr<BlockPool> _pool;
+
+  PoolAllocator() { this->_pool = std::make_shared<BlockPool>(); }
+  // Copies instead of moving, a moved-from container still allocates from the pool
+  PoolAllocator(const PoolAllocator &other) { this->_pool = other._pool; }
+  template <typename U> PoolAllocator(const PoolAllocator<U> &other) { this->_pool = other._pool; }
+  PoolAllocator &operator=(const PoolAllocator &other) {
+    this->_pool = other._pool;
+    return *this;
+  }
+
+  BlockPool &pool() const { return *this->_pool; }
+
+  PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
+
+  T *allocate(std::size_t size) {
+    if (BlockPool::pooled(size * sizeof(T), alignof(T))) {
+      return static_cast<T *>(this->_pool->allocate(size * sizeof(T)));
+    }
+    return std::allocator<T>().allocate(size);
+  }
+
+  void deallocate(T *pointer, std::size_t size) {
+    if (BlockPool::pooled(size * sizeof(T), alignof(T))) {
+      this->_pool->deallocate(pointer, size * sizeof(T));
+    } else {
+      std::allocator<T>().deallocate(pointer, size);
+    }
+  }
+};
+
+template <typename T, typename U> bool operator==(const PoolAllocator<T> &a, const PoolAllocator<U> &b) {
+  return a._pool == b._pool;
+}
+template <typename T, typename U> bool operator!=(const PoolAllocator<T> &a, const PoolAllocator<U> &b) {
+  return a._pool != b._pool;
+}
+
+} // namespace memory_utils
+} // namespace ecs
@@ -1,28 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <optional>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <typeindex>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
+#include "ecs/archetype_storage.hpp"
+#include "ecs/cached_query.hpp"
+#include "ecs/change_ticks.hpp"
+#include "ecs/component_registry.hpp"
+#include "ecs/component_signature.hpp"
+#include "ecs/entity.hpp"
+#include "ecs/hash_map_storage.hpp"
+#include "ecs/hierarchy.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/observers.hpp"
+#include "ecs/profiler.hpp"
+#include "ecs/query_terms.hpp"
+#include "ecs/sparse_set_storage.hpp"
+#include "ecs/spatial_index.hpp"
+#include "ecs/thread_pool.hpp"
 #include "ecs/time_utils.hpp"
 #include "ecs/type_utils.hpp"
+#include "ecs/world_checksum.hpp"
 
 namespace ecs {
 namespace mutable_ecs {
 
-using UniqueId = int;
-
-struct Entity {
-public:
-  UniqueId unique_id;
-
-  explicit Entity() {}
-  explicit Entity(UniqueId unique_id) { this->unique_id = unique_id; }
-};
-
-bool operator<(const Entity &entity_a, const Entity &entity_b) { return entity_a.unique_id < entity_b.unique_id; }
-bool operator==(const Entity &entity_a, const Entity &entity_b) { return entity_a.unique_id == entity_b.unique_id; }
-
 template <typename ComponentTemplate, int ArraySize> using ArrayOfComponents = std::array<ComponentTemplate, ArraySize>;
 template <typename ComponentTemplate> using ListOfComponents = std::vector<ComponentTemplate>;
 
@@ -33,27 +48,70 @@ template <typename TypeIndexTemplate, typename ComponentTemplate>
 using MapFromEntityToMapFromComponentTypeToComponent =
     std::unordered_map<Entity, MapFromComponentTypeToComponent<TypeIndexTemplate, ComponentTemplate>>;
 
-template <typename ComponentTemplate> using ComponentTable = std::unordered_map<Entity, ComponentTemplate>;
-
-template <typename TypeIndexTemplate, typename ComponentTemplate>
-using ComponentTables = std::unordered_map<TypeIndexTemplate, ComponentTable<ComponentTemplate>>;
-
-template <typename TypeIndexTemplate> using SetOfComponentTypes = std::unordered_set<TypeIndexTemplate>;
+// signature has the bits of the component types of the entity, as assigned by the ComponentTypeRegistry of the ecdb
+struct EntitySlot {
+public:
+  EntityGeneration generation;
+  bool alive;
+  ComponentSignature signature;
+};
 
-template <typename TypeIndexTemplate>
-using MapEntityToSetOfComponentTypes = std::unordered_map<Entity, SetOfComponentTypes<TypeIndexTemplate>>;
+using ListOfEntitySlots = std::vector<EntitySlot>;
 
-template <typename TypeIndexTemplate, typename ComponentTemplate> struct EntityComponentDatabase {
+// StorageTemplate decides how components are laid out in memory:
+//  - HashMapStorage keeps one packed table of ComponentTemplate per component type, indexed by Entity::index
+//  - ArchetypeStorage keeps contiguous columns of concrete types per set of component types (std::variant only)
+//  - SparseSetStorage keeps a sparse set of concrete types per component type (std::variant only)
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+struct EntityComponentDatabase {
 public:
-  UniqueId _last_unique_id;
-  MapEntityToSetOfComponentTypes<TypeIndexTemplate> _entity_to_component_types;
-  ComponentTables<TypeIndexTemplate, ComponentTemplate> _component_tables;
+  // The declared component types of a std::variant ComponentTemplate, see _find_bit
+  using ComponentRegistryType = type_utils::component_registry_t<ComponentTemplate>;
+
+  // Entity::index indexes into _entity_slots, indices of removed entities are reused from _free_entity_indices
+  ListOfEntitySlots _entity_slots;
+  std::vector<EntityIndex> _free_entity_indices;
+  ComponentTypeRegistry<TypeIndexTemplate> _component_type_registry;
+  StorageTemplate<TypeIndexTemplate, ComponentTemplate> _storage;
+  // Writes are stamped with _change_tick, the change filters of queries match the writes after _last_run_tick
+  ChangeTicks _change_ticks;
+  ChangeTick _change_tick;
+  ChangeTick _last_run_tick;
+  // Queries registered with register_query, updated on every structural change of an entity
+  CachedQueries _cached_queries;
+  // Grid over the points of one component type, see bind_spatial_index
+  SpatialIndex<ComponentTemplate> _spatial_index;
+  // Incremental hash of the entities and their components, see enable_checksum
+  WorldChecksum<ComponentTemplate> _checksum;
+  // Entities created since a journal started recording a frame, nullopt while no frame is recorded
+  std::optional<std::vector<Entity>> _created_entities;
+  // ChildOf relationships between entities, see set_parent
+  Hierarchy _hierarchy;
+  // Observers of the additions, writes and removals of components, see register_observer
+  Observers<EntityComponentDatabase> _observers;
+  // Writes recorded with mark_changed by concurrent tasks, see _run_deferring_change_marks
+  DeferredChangeMarks<TypeIndexTemplate> _deferred_change_marks;
 
   explicit EntityComponentDatabase() {
-    this->_last_unique_id = 0;
-
-    this->_entity_to_component_types = {};
-    this->_component_tables = {};
+    this->_entity_slots = {};
+    this->_free_entity_indices = {};
+    this->_component_type_registry = ComponentTypeRegistry<TypeIndexTemplate>();
+    ComponentRegistryType::for_each_type([this](auto component_type) {
+      using ComponentType = typename decltype(component_type)::type;
+      this->_component_type_registry.register_component_type(type_utils::get_type_id<ComponentType>());
+    });
+    this->_storage = StorageTemplate<TypeIndexTemplate, ComponentTemplate>();
+    this->_change_ticks = ChangeTicks();
+    this->_change_tick = 1;
+    this->_last_run_tick = 0;
+    this->_cached_queries = CachedQueries();
+    this->_spatial_index = SpatialIndex<ComponentTemplate>();
+    this->_checksum = WorldChecksum<ComponentTemplate>();
+    this->_created_entities = std::nullopt;
+    this->_hierarchy = Hierarchy();
+    this->_observers = Observers<EntityComponentDatabase>();
+    this->_deferred_change_marks = DeferredChangeMarks<TypeIndexTemplate>();
   }
 
 #ifndef ECDB_PYTHON_WRAPPER
@@ -65,12 +123,146 @@ public:
   virtual ~EntityComponentDatabase() {}
 #endif
 
-  std::size_t size() const { return this->_entity_to_component_types.size(); }
+  std::size_t size() const { return this->_entity_slots.size() - this->_free_entity_indices.size(); }
+
+  bool contains(const Entity &entity) const {
+    if (entity.index >= this->_entity_slots.size()) {
+      return false;
+    }
+    auto &entity_slot = this->_entity_slots[entity.index];
+    return entity_slot.alive and entity_slot.generation == entity.generation;
+  }
+
+  // Hint that the ecdb is going to hold num_entities entities and num_components_per_type components of every
+  // component type registered so far, so adding them does not grow the entity slots and the component tables
+  // repeatedly. See the reserve() methods of the storages for what each of them sizes up front.
+  void reserve(std::size_t num_entities, std::size_t num_components_per_type = 0) {
+    this->_entity_slots.reserve(num_entities);
+    if (num_components_per_type == 0) {
+      return;
+    }
+    for (std::size_t bit = 0; bit < this->_component_type_registry.size(); bit++) {
+      this->_storage.reserve(this->_component_type_registry.component_type(bit), num_components_per_type);
+    }
+  }
+
+  EntitySlot &_get_entity_slot(const Entity &entity) {
+    if (not this->contains(entity)) {
+      throw std::runtime_error("Entity is not in EntityComponentDatabase");
+    }
+    return this->_entity_slots[entity.index];
+  }
+
+  // Returns an entity without components, reusing the last freed entity index if there is one
+  Entity _create_entity() {
+    Entity entity;
+    if (this->_free_entity_indices.empty()) {
+      entity = Entity(static_cast<EntityIndex>(this->_entity_slots.size()), 0);
+      this->_entity_slots.push_back(EntitySlot{entity.generation, true, ComponentSignature()});
+    } else {
+      auto &entity_slot = this->_entity_slots[this->_free_entity_indices.back()];
+      entity = Entity(this->_free_entity_indices.back(), entity_slot.generation);
+      entity_slot.alive = true;
+      this->_free_entity_indices.pop_back();
+    }
+    this->_entity_created(entity);
+    return entity;
+  }
+
+  // Creates an entity with the handle of an entity of another ecdb, e.g. to mirror it. The unused indices before it
+  // become free, throws if its index is in use.
+  void _create_entity(const Entity &entity) {
+    while (this->_entity_slots.size() <= entity.index) {
+      this->_free_entity_indices.push_back(static_cast<EntityIndex>(this->_entity_slots.size()));
+      this->_entity_slots.push_back(EntitySlot{0, false, ComponentSignature()});
+    }
+    auto &entity_slot = this->_entity_slots[entity.index];
+    if (entity_slot.alive) {
+      throw std::runtime_error("Entity index is already in use");
+    }
+    // The index is usually the last one that was freed
+    auto free_entity_index =
+        std::find(this->_free_entity_indices.rbegin(), this->_free_entity_indices.rend(), entity.index);
+    this->_free_entity_indices.erase(std::next(free_entity_index).base());
+    entity_slot.generation = entity.generation;
+    entity_slot.alive = true;
+    this->_entity_created(entity);
+  }
+
+  void _entity_created(const Entity &entity) {
+    this->_checksum.add_entity(entity);
+    if (this->_created_entities) {
+      this->_created_entities->push_back(entity);
+    }
+  }
+
+  // Stamps the removal of every component of the entity and frees its slot, its components have to be erased from the
+  // storage by the caller
+  void _destroy_entity(const Entity &entity) {
+    auto &entity_slot = this->_entity_slots[entity.index];
+    entity_slot.signature.for_each_bit([this, &entity](std::size_t bit) {
+      this->_change_ticks.component(bit).mark_removed(entity, this->_change_tick);
+    });
+    this->_cached_queries.erase_entity(entity, entity_slot.signature);
+    this->_spatial_index.erase_entity(entity.index);
+    this->_checksum.erase_entity(entity, entity_slot.signature);
+    this->_hierarchy.erase_entity(entity.index);
+    this->_observers.record_removed_entity(entity, entity_slot.signature);
+
+    entity_slot.generation += 1;
+    entity_slot.alive = false;
+    entity_slot.signature.clear();
+    this->_free_entity_indices.push_back(entity.index);
+  }
+
+  // Sets the bit of a component type that was written to the entity and stamps the write as an addition or a change
+  void _set_component_bit(const Entity &entity, std::size_t bit) {
+    auto &signature = this->_entity_slots[entity.index].signature;
+    auto &component_change_ticks = this->_change_ticks.component(bit);
+    if (signature.test(bit)) {
+      component_change_ticks.mark_changed(entity.index, this->_change_tick);
+      this->_observers.record(ObserverEvent::SET, entity, bit);
+    } else {
+      signature.set(bit);
+      component_change_ticks.mark_added(entity.index, this->_change_tick);
+      this->_cached_queries.update(entity, signature, bit);
+      this->_observers.record(ObserverEvent::ADD, entity, bit);
+    }
+  }
+
+  // Resets the bit of a component type that was removed from the entity and stamps the removal
+  void _reset_component_bit(const Entity &entity, std::size_t bit) {
+    auto &signature = this->_entity_slots[entity.index].signature;
+    if (bit != NO_SIGNATURE_BIT and signature.test(bit)) {
+      signature.reset(bit);
+      this->_change_ticks.component(bit).mark_removed(entity, this->_change_tick);
+      this->_cached_queries.update(entity, signature, bit);
+      this->_spatial_index.erase(entity.index, bit);
+      this->_checksum.erase(entity.index, bit);
+      this->_observers.record(ObserverEvent::REMOVE, entity, bit);
+    }
+  }
+
+  // Updates the checksum and the spatial index after component with bit was written to the entity, the spatial index
+  // last because it throws for points that are not finite
+  void _component_written(const Entity &entity, std::size_t bit, const ComponentTemplate &component) {
+    this->_checksum.update(entity, bit, component);
+    this->_spatial_index.update(entity, bit, component);
+  }
 };
 
-template <typename TypeIndexTemplate, typename ComponentTemplate>
-EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> create_ecdb() {
-  return EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>();
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> create_ecdb() {
+  return EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>();
+}
+
+// Cheap check for stale handles: an index lookup and a generation comparison
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+bool is_alive(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const Entity &entity) {
+  return ecdb.contains(entity);
 }
 
 template <typename ComponentTemplate> struct GetComponentType {
@@ -78,67 +270,251 @@ template <typename ComponentTemplate> struct GetComponentType {
 };
 
 template <typename TypeIndexTemplate, typename ComponentTemplate,
-          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>>
-EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
-add_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity,
-              const ComponentTemplate &component) {
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+add_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const Entity &entity, const ComponentTemplate &component) {
 
   auto component_type = GetComponentTypeFunction()(component);
 
-  ecdb._entity_to_component_types[entity].insert(component_type);
-  ecdb._component_tables[component_type][entity] = component;
+  ecdb._get_entity_slot(entity);
+  auto bit = ecdb._component_type_registry.register_component_type(component_type);
+  ecdb._set_component_bit(entity, bit);
+  ecdb._storage.insert(entity, component_type, component);
+  ecdb._component_written(entity, bit, component);
 
   return std::move(ecdb);
 }
 
 template <typename TypeIndexTemplate, typename ComponentTemplate,
-          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>>
-std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>, Entity>
-add_entity(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, Entity>
+add_entity(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
            const std::vector<ComponentTemplate> &components = {}) {
-  auto unique_id = ecdb._last_unique_id;
-  ecdb._last_unique_id += 1;
-
-  auto entity = Entity(unique_id);
-  ecdb._entity_to_component_types[entity] = {};
-
+  auto entity = ecdb._create_entity();
   for (auto &&component : components) {
-    ecdb = add_component<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction>(ecdb, entity, component);
+    ecdb = add_component<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate>(ecdb, entity,
+                                                                                                         component);
   }
 
   return std::make_tuple(std::move(ecdb), entity);
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate>
-EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
-remove_entity(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity) {
+// Erases the components of the entities and frees their slots, entities that are listed more than once are removed once
+template <typename TypeIndexTemplate, typename ComponentTemplate, template <typename, typename> class StorageTemplate>
+void _erase_entities(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                     std::span<const Entity> entities) {
+  ecdb._storage.erase_entities(entities);
+  for (auto &entity : entities) {
+    if (ecdb.contains(entity)) {
+      ecdb._destroy_entity(entity);
+    }
+  }
+}
 
-  for (auto &&component_type : ecdb._entity_to_component_types.at(entity)) {
-    ecdb._component_tables.at(component_type).erase(entity);
+// The descendants of the entity, see set_parent, are removed with it
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+remove_entity(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const Entity &entity) {
+
+  ecdb._get_entity_slot(entity);
+  if (ecdb._hierarchy.has_children(entity.index)) {
+    std::vector<Entity> entities = {entity};
+    ecdb._hierarchy.append_descendants(entity.index, entities);
+    _erase_entities(ecdb, entities);
+    return std::move(ecdb);
   }
-  auto num_erased_keys = ecdb._entity_to_component_types.erase(entity);
-  if (num_erased_keys == 0) {
-    // TODO: think about adding this kind of exceptions for all "erase" calls
-    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  ecdb._storage.erase_entity(entity);
+  ecdb._destroy_entity(entity);
+  return std::move(ecdb);
+}
+
+// Same as calling add_entity num_entities times with the same components, but the component types are resolved and
+// registered once, the entity slots and component tables are grown once and the storage writes every component type
+// in one pass (see the insert_entities() methods of the storages). Entities reuse freed indices like add_entity.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, std::vector<Entity>>
+add_entities(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+             std::size_t num_entities, const std::vector<ComponentTemplate> &components = {}) {
+  // As with add_entity, the last component of a component type wins
+  std::vector<TypeIndexTemplate> component_types;
+  std::vector<std::size_t> bits;
+  std::vector<ComponentTemplate> unique_components;
+  for (auto &component : components) {
+    auto component_type = GetComponentTypeFunction()(component);
+    auto bit = ecdb._component_type_registry.register_component_type(component_type);
+    auto index = static_cast<std::size_t>(std::find(bits.begin(), bits.end(), bit) - bits.begin());
+    if (index < bits.size()) {
+      unique_components[index] = component;
+      continue;
+    }
+    component_types.push_back(component_type);
+    bits.push_back(bit);
+    unique_components.push_back(component);
   }
+
+  auto num_new_entity_slots = num_entities - std::min(num_entities, ecdb._free_entity_indices.size());
+  memory_utils::reserve_for_append(ecdb._entity_slots, num_new_entity_slots);
+  std::vector<Entity> entities(num_entities);
+  for (auto &entity : entities) {
+    entity = ecdb._create_entity();
+    for (auto bit : bits) {
+      ecdb._set_component_bit(entity, bit);
+    }
+  }
+  ecdb._storage.insert_entities(entities, component_types, unique_components);
+
+  if (ecdb._spatial_index._bit != NO_SIGNATURE_BIT or ecdb._checksum.enabled()) {
+    for (std::size_t index = 0; index < bits.size(); index++) {
+      for (auto &entity : entities) {
+        ecdb._component_written(entity, bits[index], unique_components[index]);
+      }
+    }
+  }
+  return std::make_tuple(std::move(ecdb), std::move(entities));
+}
+
+// Same as calling remove_entity for every one of entities, but the storage erases them in one pass. Throws before
+// removing anything if one of them is not in the ecdb, entities that are listed more than once are removed once.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+remove_entities(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                std::span<const Entity> entities) {
+  for (auto &entity : entities) {
+    ecdb._get_entity_slot(entity);
+  }
+  if (not ecdb._hierarchy.empty()) {
+    std::vector<Entity> descendants;
+    for (auto &entity : entities) {
+      ecdb._hierarchy.append_descendants(entity.index, descendants);
+    }
+    if (not descendants.empty()) {
+      descendants.insert(descendants.end(), entities.begin(), entities.end());
+      _erase_entities(ecdb, descendants);
+      return std::move(ecdb);
+    }
+  }
+  _erase_entities(ecdb, entities);
   return std::move(ecdb);
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate>
-EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
-remove_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity,
-                 TypeIndexTemplate component_type) {
+// Same as remove_entities(ecdb, span), so a braced list of entities can be passed
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+remove_entities(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                std::initializer_list<Entity> entities) {
+  return remove_entities(ecdb, std::span<const Entity>(entities));
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+remove_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                 const Entity &entity, TypeIndexTemplate component_type) {
 
-  ecdb._entity_to_component_types.at(entity).erase(component_type);
-  ecdb._component_tables.at(component_type).erase(entity);
+  ecdb._get_entity_slot(entity);
+  ecdb._reset_component_bit(entity, ecdb._component_type_registry.find_bit(component_type));
+  ecdb._storage.erase(entity, component_type);
 
   return std::move(ecdb);
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate>
-const ComponentTemplate &get_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
-                                       const Entity &entity, TypeIndexTemplate component_type) {
-  return ecdb._component_tables.at(component_type).at(entity);
+// Returns a const reference for HashMapStorage and a copy for storages that do not keep ComponentTemplate around
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+decltype(auto) get_component(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                             const Entity &entity, TypeIndexTemplate component_type) {
+  return ecdb._storage.get(entity, component_type);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+void _mark_changed(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                   const Entity &entity, std::size_t bit, const TypeIndexTemplate &component_type) {
+  ecdb._change_ticks.component(bit).mark_changed(entity.index, ecdb._change_tick);
+  ecdb._observers.record(ObserverEvent::SET, entity, bit);
+  if (bit == ecdb._spatial_index._bit or ecdb._checksum.enabled()) {
+    ecdb._component_written(entity, bit, ecdb._storage.get(entity, component_type));
+  }
+}
+
+// Records an in-place write to a component of the entity, e.g. through each, for changed<...> filters, the spatial
+// index, the checksum and the SET observers. Writes recorded by the tasks of parallel_each and the parallel process
+// functions are applied once all tasks are done, with the tick of those tasks.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+void mark_changed(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                  const Entity &entity, const TypeIndexTemplate &component_type) {
+  auto &entity_slot = ecdb._get_entity_slot(entity);
+  auto bit = ecdb._component_type_registry.find_bit(component_type);
+  if (bit == NO_SIGNATURE_BIT or not entity_slot.signature.test(bit)) {
+    throw std::runtime_error("Entity does not have the component type");
+  }
+  if (ecdb._deferred_change_marks._deferring) {
+    ecdb._deferred_change_marks.push(entity, bit, component_type);
+    return;
+  }
+  _mark_changed(ecdb, entity, bit, component_type);
+}
+
+// Runs tasks on thread_pool and applies the writes they recorded with mark_changed after all of them are done, also
+// if one of them threw. Nested calls from inside a task leave the writes to the outermost call.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+void _run_deferring_change_marks(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                                 std::vector<ThreadPool::Task> &tasks, ThreadPool &thread_pool) {
+  auto &deferred_change_marks = ecdb._deferred_change_marks;
+  if (deferred_change_marks._deferring) {
+    thread_pool.run(tasks);
+    return;
+  }
+
+  auto apply_change_marks = [&ecdb, &deferred_change_marks] {
+    deferred_change_marks._deferring = false;
+    deferred_change_marks.drain([&ecdb](const auto &mark) {
+      _mark_changed(ecdb, mark.entity, mark.bit, mark.component_type);
+    });
+  };
+  deferred_change_marks._deferring = true;
+  try {
+    thread_pool.run(tasks);
+  } catch (...) {
+    apply_change_marks();
+    throw;
+  }
+  apply_change_marks();
+}
+
+// Returns the tick of the writes so far and starts a new one. process_systems does this after every system, outside of
+// it the returned tick can be passed to set_last_run_tick later to see the writes after this call.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+ChangeTick advance_change_tick(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  return ecdb._change_tick++;
+}
+
+// Change filters match the writes after last_run_tick, process_systems sets it to the last run of every system
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+void set_last_run_tick(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                       ChangeTick last_run_tick) {
+  ecdb._last_run_tick = last_run_tick;
+}
+
+// Forgets the removals at or before tick, process_systems forgets the removals that every system has seen
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+void prune_removals(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                    ChangeTick tick) {
+  ecdb._change_ticks.prune_removals(tick);
 }
 
 template <typename TypeIndexTemplate, typename ComponentTemplate>
@@ -146,91 +522,812 @@ bool DefaultFilterFunction(const MapFromComponentTypeToComponent<TypeIndexTempla
   return true;
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate>
+// queried_entities is a vector of std::tuple<Entity, vector of ComponentTemplate>, the vectors of components use the
+// allocator of queried_entities
+template <typename TypeIndexTemplate, typename ComponentTemplate, template <typename, typename> class StorageTemplate,
+          typename QueriedEntities>
+void _query_into(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                 const std::vector<TypeIndexTemplate> &component_types, QueriedEntities &queried_entities) {
+  using RequestedComponents = std::tuple_element_t<1, typename QueriedEntities::value_type>;
+
+  // The signature of the query is built once, then every entity is matched with a single AND/compare
+  auto &registry = ecdb._component_type_registry;
+  ComponentSignature query_signature;
+  if (registry.make_signature(component_types, query_signature) > 0) {
+    return;
+  }
+
+  auto &storage = ecdb._storage;
+  for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+    auto &[generation, alive, signature] = ecdb._entity_slots[entity_index];
+    if (not alive or not signature.contains(query_signature)) {
+      continue;
+    }
+    auto entity = Entity(entity_index, generation);
+
+    RequestedComponents requested_components(
+        typename RequestedComponents::allocator_type(queried_entities.get_allocator()));
+    if (component_types.size() == 0) {
+      signature.for_each_bit([&](std::size_t bit) {
+        requested_components.emplace_back(storage.get(entity, registry.component_type(bit)));
+      });
+    } else {
+      requested_components.reserve(component_types.size());
+      for (auto &component_type : component_types) {
+        requested_components.emplace_back(storage.get(entity, component_type));
+      }
+    }
+
+    queried_entities.emplace_back(entity, std::move(requested_components));
+  }
+  profiler::count_visited_entities(queried_entities.size());
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
 std::vector<std::tuple<Entity, ListOfComponents<ComponentTemplate>>>
-query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
+query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
       const std::vector<TypeIndexTemplate> &component_types = {}) {
   std::vector<std::tuple<Entity, ListOfComponents<ComponentTemplate>>> queried_entities;
+  _query_into(ecdb, component_types, queried_entities);
+  return queried_entities;
+}
 
-  auto &component_tables = ecdb._component_tables;
-  for (auto &&[entity, entity_component_types] : ecdb._entity_to_component_types) {
+// Same as query, but the result is allocated from frame_arena
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+memory_utils::ArenaVector<std::tuple<Entity, memory_utils::ArenaVector<ComponentTemplate>>>
+query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+      const std::vector<TypeIndexTemplate> &component_types, memory_utils::FrameArena &frame_arena) {
+  using QueriedEntity = std::tuple<Entity, memory_utils::ArenaVector<ComponentTemplate>>;
+  memory_utils::ArenaVector<QueriedEntity> queried_entities{memory_utils::ArenaAllocator<QueriedEntity>(frame_arena)};
+  _query_into(ecdb, component_types, queried_entities);
+  return queried_entities;
+}
 
-    ListOfComponents<ComponentTemplate> requested_components;
-    if (component_types.size() == 0) {
-      for (auto &component_type : entity_component_types) {
-        requested_components.emplace_back(component_tables.at(component_type).at(entity));
-      }
+// The declared component types are registered in order when the ecdb is created, so their bits are their constexpr
+// indices in the ComponentRegistryType of the ecdb. Other component types are looked up by get_type_id.
+template <typename ComponentType, typename EntityComponentDatabaseType>
+std::size_t _find_bit(const EntityComponentDatabaseType &ecdb) {
+  using ComponentRegistryType = typename EntityComponentDatabaseType::ComponentRegistryType;
+  if constexpr (ComponentRegistryType::template contains<ComponentType>) {
+    return ComponentRegistryType::template index<ComponentType>();
+  } else {
+    return ecdb._component_type_registry.find_bit(type_utils::get_type_id<ComponentType>());
+  }
+}
+
+// Same as ComponentTypeRegistry::make_signature for the component types ComponentTypes
+template <typename... ComponentTypes, typename EntityComponentDatabaseType>
+std::size_t _make_signature(const EntityComponentDatabaseType &ecdb, ComponentSignature &signature) {
+  std::array<std::size_t, sizeof...(ComponentTypes)> bits = {_find_bit<ComponentTypes>(ecdb)...};
+  std::size_t num_unregistered_component_types = 0;
+  for (auto bit : bits) {
+    if (bit == NO_SIGNATURE_BIT) {
+      num_unregistered_component_types += 1;
     } else {
-      for (auto &component_type : component_types) {
-        if (component_tables.at(component_type).count(entity) == 0) {
-          continue;
+      signature.set(bit);
+    }
+  }
+  return num_unregistered_component_types;
+}
+
+// Calls function(entity, Required &..., Optional *...) for the entities that have all of Required and whose signature
+// does not intersect the signature of Excluded. Storages with MATCHES_ENTITY_SIGNATURES only look up the entities whose
+// signature matches the signature of Required with a single AND/compare, the other storages yield the entities that
+// have all of Required from their own archetypes or pools.
+template <typename... Required, typename... Excluded, typename... Optional, typename EntityComponentDatabaseType,
+          typename Function>
+void _each_filtered(EntityComponentDatabaseType &ecdb, Function &function, type_utils::type_list<Required...>,
+                    type_utils::type_list<Excluded...>, type_utils::type_list<Optional...>) {
+  static_assert(sizeof...(Required) > 0, "Query needs at least one component type that is not in without<> or maybe<>");
+
+  ComponentSignature excluded_signature;
+  _make_signature<Excluded...>(ecdb, excluded_signature);
+
+  auto &storage = ecdb._storage;
+  if constexpr (std::decay_t<decltype(storage)>::MATCHES_ENTITY_SIGNATURES) {
+    ComponentSignature required_signature;
+    if (_make_signature<Required...>(ecdb, required_signature) > 0) {
+      return;
+    }
+    auto for_each_matching_entity = [&ecdb, &required_signature, &excluded_signature](auto &&visit) {
+      for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+        auto &entity_slot = ecdb._entity_slots[entity_index];
+        if (entity_slot.alive and entity_slot.signature.contains(required_signature) and
+            not entity_slot.signature.intersects(excluded_signature)) {
+          visit(Entity(entity_index, entity_slot.generation));
         }
-        requested_components.emplace_back(component_tables.at(component_type).at(entity));
       }
+    };
+    storage.template each_of<Required...>(for_each_matching_entity, [&](const Entity &entity, auto &... components) {
+      function(entity, components..., storage.template find<Optional>(entity)...);
+    });
+    return;
+  }
+
+  storage.template each<Required...>([&](const Entity &entity, auto &... components) {
+    if (ecdb._entity_slots[entity.index].signature.intersects(excluded_signature)) {
+      return;
+    }
+    function(entity, components..., storage.template find<Optional>(entity)...);
+  });
+}
 
-      bool skip_entity = requested_components.size() < component_types.size();
-      if (skip_entity) {
-        continue;
+// Same as _each_filtered for queries with added<> or changed<> terms. Only the entities whose first component type in
+// Added or Changed was written since ecdb._last_run_tick are visited, so the cost follows the number of changes.
+template <typename... Required, typename... Excluded, typename... Optional, typename... Added, typename... Changed,
+          typename EntityComponentDatabaseType, typename Function>
+void _each_changed(EntityComponentDatabaseType &ecdb, Function &function, type_utils::type_list<Required...>,
+                   type_utils::type_list<Excluded...>, type_utils::type_list<Optional...>,
+                   type_utils::type_list<Added...>, type_utils::type_list<Changed...>) {
+  ComponentSignature required_signature;
+  if (_make_signature<Required...>(ecdb, required_signature) > 0) {
+    return;
+  }
+  ComponentSignature excluded_signature;
+  _make_signature<Excluded...>(ecdb, excluded_signature);
+
+  const auto &change_ticks = ecdb._change_ticks;
+  auto last_run_tick = ecdb._last_run_tick;
+  std::array<const ComponentChangeTicks *, sizeof...(Added)> added_ticks = {
+      &change_ticks.component(_find_bit<Added>(ecdb))...};
+  std::array<const ComponentChangeTicks *, sizeof...(Changed)> changed_ticks = {
+      &change_ticks.component(_find_bit<Changed>(ecdb))...};
+  const ComponentChangeTicks *first_ticks;
+  if constexpr (sizeof...(Added) > 0) {
+    first_ticks = added_ticks[0];
+  } else {
+    first_ticks = changed_ticks[0];
+  }
+
+  auto &storage = ecdb._storage;
+  first_ticks->for_each_changed_since(last_run_tick, [&](EntityIndex entity_index) {
+    auto &entity_slot = ecdb._entity_slots[entity_index];
+    if (not entity_slot.alive or not entity_slot.signature.contains(required_signature) or
+        entity_slot.signature.intersects(excluded_signature)) {
+      return;
+    }
+    for (auto component_change_ticks : added_ticks) {
+      if (not component_change_ticks->added_since(entity_index, last_run_tick)) {
+        return;
+      }
+    }
+    for (auto component_change_ticks : changed_ticks) {
+      if (not component_change_ticks->changed_since(entity_index, last_run_tick)) {
+        return;
       }
     }
+    auto entity = Entity(entity_index, entity_slot.generation);
+    function(entity, *storage.template find<Required>(entity)..., storage.template find<Optional>(entity)...);
+  });
+}
+
+// Same as _each_filtered for queries with a removed<> term, visits the removals of Removed since ecdb._last_run_tick
+template <typename... Required, typename... Excluded, typename... Optional, typename Removed,
+          typename EntityComponentDatabaseType, typename Function>
+void _each_removed(EntityComponentDatabaseType &ecdb, Function &function, type_utils::type_list<Required...>,
+                   type_utils::type_list<Excluded...>, type_utils::type_list<Optional...>,
+                   type_utils::type_list<Removed>) {
+  auto removed_bit = _find_bit<Removed>(ecdb);
+  ComponentSignature required_signature;
+  if (removed_bit == NO_SIGNATURE_BIT or _make_signature<Required...>(ecdb, required_signature) > 0) {
+    return;
+  }
+  ComponentSignature excluded_signature;
+  _make_signature<Excluded...>(ecdb, excluded_signature);
+
+  auto &storage = ecdb._storage;
+  ecdb._change_ticks.component(removed_bit).for_each_removed_since(ecdb._last_run_tick, [&](const Entity &entity) {
+    if (not ecdb.contains(entity)) {
+      if constexpr (sizeof...(Required) == 0) {
+        function(entity, static_cast<decltype(storage.template find<Optional>(entity))>(nullptr)...);
+      }
+      return;
+    }
+    auto &signature = ecdb._entity_slots[entity.index].signature;
+    if (not signature.contains(required_signature) or signature.intersects(excluded_signature)) {
+      return;
+    }
+    function(entity, *storage.template find<Required>(entity)..., storage.template find<Optional>(entity)...);
+  });
+}
 
-    queried_entities.push_back(std::make_pair(entity, requested_components));
+// Calls function(entity, Required &..., Optional *...) for the entities that match Terms (see query_terms.hpp)
+template <typename... Terms, typename EntityComponentDatabaseType, typename Function>
+void _each_terms(EntityComponentDatabaseType &ecdb, Function &function) {
+  using QueryTermsType = QueryTerms<Terms...>;
+  if constexpr (QueryTermsType::plain and not std::decay_t<decltype(ecdb._storage)>::MATCHES_ENTITY_SIGNATURES) {
+    ecdb._storage.template each<Terms...>(function);
+  } else if constexpr (QueryTermsType::removed::size > 0) {
+    _each_removed(ecdb, function, typename QueryTermsType::required{}, typename QueryTermsType::excluded{},
+                  typename QueryTermsType::optional{}, typename QueryTermsType::removed{});
+  } else if constexpr (QueryTermsType::tracks_changes) {
+    _each_changed(ecdb, function, typename QueryTermsType::required{}, typename QueryTermsType::excluded{},
+                  typename QueryTermsType::optional{}, typename QueryTermsType::added{},
+                  typename QueryTermsType::changed{});
+  } else {
+    _each_filtered(ecdb, function, typename QueryTermsType::required{}, typename QueryTermsType::excluded{},
+                   typename QueryTermsType::optional{});
   }
+}
+
+template <typename... Terms, typename EntityComponentDatabaseType, typename QueriedEntities>
+void _query_terms_into(const EntityComponentDatabaseType &ecdb, QueriedEntities &queried_entities) {
+  using QueryTermsType = QueryTerms<Terms...>;
+  using RequestedComponents = std::tuple_element_t<1, typename QueriedEntities::value_type>;
+  using ComponentTemplate = typename RequestedComponents::value_type;
+  static_assert(QueryTermsType::optional::size == 0, "maybe<> terms are only supported by each()");
+
+  auto push_entity = [&queried_entities](const Entity &entity, const auto &... components) {
+    RequestedComponents requested_components = {ComponentTemplate(components)...};
+    queried_entities.emplace_back(entity, std::move(requested_components));
+  };
+  _each_terms<Terms...>(ecdb, push_entity);
+  profiler::count_visited_entities(queried_entities.size());
+}
+
+// Terms are component types, without<...> or maybe<...> (see query_terms.hpp).
+// Every queried entity comes with a copy of each of its plain component types as ComponentTemplate.
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+auto query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+           std::size_t num_entities_to_reserve = 128) {
+  constexpr auto num_components = QueryTerms<Terms...>::required::size;
+  std::vector<std::tuple<Entity, ArrayOfComponents<ComponentTemplate, num_components>>> queried_entities;
+  queried_entities.reserve(num_entities_to_reserve);
+  _query_terms_into<Terms...>(ecdb, queried_entities);
   return queried_entities;
 }
 
-template <typename TypeIndexTemplate, int ArraySize, typename Arg>
-bool IsComponentMissing(const Entity &entity, const SetOfComponentTypes<TypeIndexTemplate> &entity_component_types) {
-  return entity_component_types.count(ecs::type_utils::get_type_id<Arg>()) == 0;
+// Same as query<Terms...>, but the result is allocated from frame_arena
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+auto query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+           memory_utils::FrameArena &frame_arena, std::size_t num_entities_to_reserve = 128) {
+  constexpr auto num_components = QueryTerms<Terms...>::required::size;
+  using QueriedEntity = std::tuple<Entity, ArrayOfComponents<ComponentTemplate, num_components>>;
+  memory_utils::ArenaVector<QueriedEntity> queried_entities{memory_utils::ArenaAllocator<QueriedEntity>(frame_arena)};
+  queried_entities.reserve(num_entities_to_reserve);
+  _query_terms_into<Terms...>(ecdb, queried_entities);
+  return queried_entities;
+}
+
+// Lazily iterates the entities that have all of Args without allocating. Every element is a
+// std::tuple<Entity, Args &...> referencing the components inside the storage, so they can be modified in place.
+// Adding or removing entities or components invalidates the view.
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+auto view(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  return ecdb._storage.template view<Args...>();
+}
+
+// Calls function(entity, Args &...) for every entity that has all of Args, components can be modified in place.
+// Args can also contain without<...> and maybe<...> terms, e.g. each<A, B, without<C>, maybe<D>> calls
+// function(entity, A &, B &, D *) for every entity that has A and B but not C, D is null if it is missing.
+// added<...>, changed<...> and removed<...> terms only visit the changes since the last run of the system.
+// function must not add or remove entities or components, writes to components are not seen by changed<...> unless
+// they are recorded with mark_changed.
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename Function>
+void each(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb, Function &&function) {
+  if constexpr (profiler::COUNT_VISITED_ENTITIES) {
+    std::size_t num_visited_entities = 0;
+    auto counting_function = [&num_visited_entities, &function](auto &&... arguments) {
+      num_visited_entities++;
+      function(std::forward<decltype(arguments)>(arguments)...);
+    };
+    _each_terms<Args...>(ecdb, counting_function);
+    profiler::count_visited_entities(num_visited_entities);
+  } else {
+    _each_terms<Args...>(ecdb, function);
+  }
 }
 
-template <typename TypeIndexTemplate, int ArraySize, typename Arg, typename... Args,
-          typename std::enable_if<0 != sizeof...(Args), int>::type = 0>
-bool IsComponentMissing(const Entity &entity, const SetOfComponentTypes<TypeIndexTemplate> &entity_component_types) {
-  auto skip_entity = IsComponentMissing<TypeIndexTemplate, ArraySize, Arg>(entity, entity_component_types);
-  skip_entity |= IsComponentMissing<TypeIndexTemplate, ArraySize, Args...>(entity, entity_component_types);
-  return skip_entity;
+// Cached queries
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, template <typename, typename> class StorageTemplate>
+std::size_t _register_query(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                            const std::vector<TypeIndexTemplate> &component_types,
+                            const std::vector<TypeIndexTemplate> &excluded_component_types) {
+  if (component_types.empty()) {
+    throw std::runtime_error("Cached queries need at least one component type");
+  }
+
+  // The component types get their bits now, so the query is updated when they are added for the first time
+  auto &registry = ecdb._component_type_registry;
+  ComponentSignature required_signature;
+  for (auto &component_type : component_types) {
+    required_signature.set(registry.register_component_type(component_type));
+  }
+  ComponentSignature excluded_signature;
+  for (auto &component_type : excluded_component_types) {
+    excluded_signature.set(registry.register_component_type(component_type));
+  }
+
+  CachedQuery cached_query(required_signature, excluded_signature);
+  for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+    auto &[generation, alive, signature] = ecdb._entity_slots[entity_index];
+    if (alive) {
+      cached_query.update(Entity(entity_index, generation), signature);
+    }
+  }
+  return ecdb._cached_queries.insert(std::move(cached_query));
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, int ArraySize, typename Arg>
-void GetRequestedComponents(const Entity &entity,
-                            const ComponentTables<TypeIndexTemplate, ComponentTemplate> &component_tables,
-                            ArrayOfComponents<ComponentTemplate, ArraySize> &requested_components, int index) {
-  requested_components[index] = component_tables.at(ecs::type_utils::get_type_id<Arg>()).at(entity);
+template <typename TypeIndexTemplate, typename... ComponentTypes>
+std::vector<TypeIndexTemplate> _get_component_types(type_utils::type_list<ComponentTypes...>) {
+  std::vector<TypeIndexTemplate> component_types;
+  (component_types.push_back(type_utils::get_type_id<ComponentTypes>()), ...);
+  return component_types;
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, int ArraySize, typename Arg, typename... Args,
-          typename std::enable_if<0 != sizeof...(Args), int>::type = 0>
-void GetRequestedComponents(const Entity &entity,
-                            const ComponentTables<TypeIndexTemplate, ComponentTemplate> &component_tables,
-                            ArrayOfComponents<ComponentTemplate, ArraySize> &requested_components, int index) {
-  GetRequestedComponents<TypeIndexTemplate, ComponentTemplate, ArraySize, Arg>(entity, component_tables,
-                                                                               requested_components, index++);
-  GetRequestedComponents<TypeIndexTemplate, ComponentTemplate, ArraySize, Args...>(entity, component_tables,
-                                                                                   requested_components, index);
+// Registers a query whose entities are kept up to date by add_component, remove_component, add_entity and
+// remove_entity, so iterating it with each(ecdb, query_handle, function) costs O(matches) instead of a scan of every
+// entity. Terms are component types, without<...> and maybe<...> (see query_terms.hpp), but no change filters.
+// Every registered query is checked on the structural changes of its component types, get_query_stats tells whether
+// that pays off. HashMapStorage gains the most, ArchetypeStorage and SparseSetStorage already skip most non-matches.
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, QueryHandle<Terms...>>
+register_query(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  using QueryTermsType = QueryTerms<Terms...>;
+  static_assert(QueryTermsType::required::size > 0,
+                "Query needs at least one component type that is not in without<> or maybe<>");
+  static_assert(not QueryTermsType::tracks_changes, "Cached queries do not support added<>, changed<> and removed<>");
+
+  auto query_index =
+      _register_query(ecdb, _get_component_types<TypeIndexTemplate>(typename QueryTermsType::required{}),
+                      _get_component_types<TypeIndexTemplate>(typename QueryTermsType::excluded{}));
+  return std::make_tuple(std::move(ecdb), QueryHandle<Terms...>{query_index});
 }
 
-template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate>
-std::vector<std::tuple<Entity, ArrayOfComponents<ComponentTemplate, sizeof...(Args)>>>
-query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
-      std::size_t num_entities_to_reserve = 128) {
-  std::vector<std::tuple<Entity, ArrayOfComponents<ComponentTemplate, sizeof...(Args)>>> queried_entities;
-  queried_entities.reserve(num_entities_to_reserve);
+// Same as register_query<Terms...> for component types known at run time, the entities are read with
+// get_cached_entities
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, QueryHandle<>>
+register_query(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+               const std::vector<TypeIndexTemplate> &component_types,
+               const std::vector<TypeIndexTemplate> &excluded_component_types = {}) {
+  auto query_index = _register_query(ecdb, component_types, excluded_component_types);
+  return std::make_tuple(std::move(ecdb), QueryHandle<>{query_index});
+}
+
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+unregister_query(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                 const QueryHandle<Terms...> &query_handle) {
+  ecdb._cached_queries.erase(query_handle.index);
+  return std::move(ecdb);
+}
+
+// The entities of a registered query, in no particular order. Adding or removing entities or components invalidates
+// the reference. Counts as an iteration in the stats of the query, also when called concurrently.
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+const std::vector<Entity> &
+get_cached_entities(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                    const QueryHandle<Terms...> &query_handle) {
+  auto &cached_query = ecdb._cached_queries.at(query_handle.index);
+  cached_query._stats.count_iteration(cached_query._entities.size(), ecdb._entity_slots.size());
+  profiler::count_visited_entities(cached_query._entities.size());
+  return cached_query._entities;
+}
 
-  auto &component_tables = ecdb._component_tables;
-  for (auto &&[entity, entity_component_types] : ecdb._entity_to_component_types) {
-    bool skip_entity = IsComponentMissing<TypeIndexTemplate, sizeof...(Args), Args...>(entity, entity_component_types);
-    if (skip_entity) {
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+const CachedQueryStats &
+get_query_stats(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                const QueryHandle<Terms...> &query_handle) {
+  return ecdb._cached_queries.at(query_handle.index)._stats;
+}
+
+template <typename... Required, typename... Optional, typename EntityComponentDatabaseType, typename Function>
+void _each_cached(EntityComponentDatabaseType &ecdb, const std::vector<Entity> &entities, Function &function,
+                  type_utils::type_list<Required...>, type_utils::type_list<Optional...>) {
+  auto &storage = ecdb._storage;
+  for (auto &entity : entities) {
+    function(entity, *storage.template find<Required>(entity)..., storage.template find<Optional>(entity)...);
+  }
+}
+
+// Same as each<Terms...>, but only visits the entities of the query registered with register_query<Terms...>
+template <typename... Terms, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename Function>
+void each(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+          const QueryHandle<Terms...> &query_handle, Function &&function) {
+  using QueryTermsType = QueryTerms<Terms...>;
+  _each_cached(ecdb, get_cached_entities(ecdb, query_handle), function, typename QueryTermsType::required{},
+               typename QueryTermsType::optional{});
+}
+
+// Spatial index
+
+// Binds the spatial index of the ecdb to component_type, get_point gives the point of a component of that type. The
+// index is kept up to date by add_component, remove_component, remove_entity and CommandBuffer flushes, in-place
+// writes move an entity only once they are recorded with mark_changed. Replaces the previous binding.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+bind_spatial_index(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                   TypeIndexTemplate component_type, float cell_size,
+                   typename SpatialIndex<ComponentTemplate>::GetPointFunction get_point) {
+  auto bit = ecdb._component_type_registry.register_component_type(component_type);
+  SpatialIndex<ComponentTemplate> spatial_index(bit, cell_size, std::move(get_point));
+  for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+    auto &[generation, alive, signature] = ecdb._entity_slots[entity_index];
+    if (alive and signature.test(bit)) {
+      auto entity = Entity(entity_index, generation);
+      spatial_index.update(entity, bit, ecdb._storage.get(entity, component_type));
+    }
+  }
+  ecdb._spatial_index = std::move(spatial_index);
+  return std::move(ecdb);
+}
+
+// Same as above for a component type PositionType of a std::variant, get_point takes a const PositionType &
+template <typename PositionType, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename GetPointFunction>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+bind_spatial_index(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                   float cell_size, GetPointFunction get_point) {
+  return bind_spatial_index<TypeIndexTemplate, ComponentTemplate, StorageTemplate>(
+      ecdb, type_utils::get_type_id<PositionType>(), cell_size,
+      [get_point](const ComponentTemplate &component) { return get_point(std::get<PositionType>(component)); });
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+unbind_spatial_index(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  ecdb._spatial_index = SpatialIndex<ComponentTemplate>();
+  return std::move(ecdb);
+}
+
+// Appends std::tuple<Entity, Args &...> to entity_views if the entity has all of Args
+template <typename... Args, typename StorageType, typename EntityViews>
+void _push_entity_view(StorageType &storage, const Entity &entity, EntityViews &entity_views) {
+  std::tuple<Args *...> components = {storage.template find<Args>(entity)...};
+  std::apply(
+      [&entity, &entity_views](auto *... components) {
+        if (((components != nullptr) and ...)) {
+          entity_views.emplace_back(entity, *components...);
+        }
+      },
+      components);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, template <typename, typename> class StorageTemplate>
+const SpatialIndex<ComponentTemplate> &
+_get_spatial_index(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  if (ecdb._spatial_index._bit == NO_SIGNATURE_BIT) {
+    throw std::runtime_error("Spatial index is not bound, see bind_spatial_index");
+  }
+  return ecdb._spatial_index;
+}
+
+// The entities of the spatial index at most radius away from center that have all of Args, as std::tuple<Entity,
+// Args &...> like the elements of view. Adding or removing entities or components invalidates the references.
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+std::vector<std::tuple<Entity, Args &...>>
+query_radius(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+             const SpatialPoint &center, float radius) {
+  std::vector<std::tuple<Entity, Args &...>> entity_views;
+  auto &storage = ecdb._storage;
+  _get_spatial_index(ecdb).for_each_in_radius(center, radius, [&](const Entity &entity, const SpatialPoint &) {
+    _push_entity_view<Args...>(storage, entity, entity_views);
+  });
+  profiler::count_visited_entities(entity_views.size());
+  return entity_views;
+}
+
+// Same as query_radius for the entities inside box
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+std::vector<std::tuple<Entity, Args &...>>
+query_aabb(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+           const SpatialBox &box) {
+  std::vector<std::tuple<Entity, Args &...>> entity_views;
+  auto &storage = ecdb._storage;
+  _get_spatial_index(ecdb).for_each_in_box(box, [&](const Entity &entity, const SpatialPoint &) {
+    _push_entity_view<Args...>(storage, entity, entity_views);
+  });
+  profiler::count_visited_entities(entity_views.size());
+  return entity_views;
+}
+
+// Checksum
+
+// Adds every alive entity of the ecdb and its components to checksum
+template <typename TypeIndexTemplate, typename ComponentTemplate, template <typename, typename> class StorageTemplate>
+void _add_to_checksum(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                      WorldChecksum<ComponentTemplate> &checksum) {
+  for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+    auto &[generation, alive, signature] = ecdb._entity_slots[entity_index];
+    if (not alive) {
       continue;
     }
+    auto entity = Entity(entity_index, generation);
+    checksum.add_entity(entity);
+    signature.for_each_bit([&](std::size_t bit) {
+      checksum.update(entity, bit, ecdb._storage.get(entity, ecdb._component_type_registry.component_type(bit)));
+    });
+  }
+}
+
+// Enables the checksum of the ecdb, hash_component gives the hash of a component. The checksum is kept up to date by
+// the same writes as the spatial index, in-place writes change it only once they are recorded with mark_changed.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+enable_checksum(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                typename WorldChecksum<ComponentTemplate>::HashComponentFunction hash_component) {
+  if (hash_component == nullptr) {
+    throw std::runtime_error("hash_component of the checksum must not be nullptr!");
+  }
+  WorldChecksum<ComponentTemplate> checksum(hash_component);
+  _add_to_checksum(ecdb, checksum);
+  ecdb._checksum = std::move(checksum);
+  return std::move(ecdb);
+}
+
+// Same as above for a std::variant ComponentTemplate, its alternatives are hashed with ChecksumHasher
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+enable_checksum(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  return enable_checksum(ecdb, &hash_variant_component<ComponentTemplate>);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+disable_checksum(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  ecdb._checksum = WorldChecksum<ComponentTemplate>();
+  return std::move(ecdb);
+}
 
-    ArrayOfComponents<ComponentTemplate, sizeof...(Args)> requested_components;
-    GetRequestedComponents<TypeIndexTemplate, ComponentTemplate, sizeof...(Args), Args...>(entity, component_tables,
-                                                                                           requested_components, 0);
+// Returns the checksum of the ecdb in O(1). Two ecdbs with the same entities and components have the same checksum,
+// regardless of the order of the writes that got them there.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::uint64_t get_checksum(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  if (not ecdb._checksum.enabled()) {
+    throw std::runtime_error("Checksum is not enabled, see enable_checksum");
+  }
+  return ecdb._checksum.value();
+}
 
-    queried_entities.push_back(std::make_tuple(std::move(entity), std::move(requested_components)));
+// Recomputes the checksum of the ecdb from scratch in O(n). It differs from get_checksum after in-place writes that
+// were not recorded with mark_changed.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::uint64_t compute_checksum(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  if (not ecdb._checksum.enabled()) {
+    throw std::runtime_error("Checksum is not enabled, see enable_checksum");
   }
-  return queried_entities;
+  WorldChecksum<ComponentTemplate> checksum(ecdb._checksum._hash_component);
+  _add_to_checksum(ecdb, checksum);
+  return checksum.value();
+}
+
+// Hierarchy
+
+// Makes child a child of parent, replacing its previous parent. Throws if either is not in the ecdb or if parent is
+// child or one of its descendants. Removing an entity removes its descendants too.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+set_parent(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb, const Entity &child,
+           const Entity &parent) {
+  ecdb._get_entity_slot(child);
+  ecdb._get_entity_slot(parent);
+  if (ecdb._hierarchy.is_ancestor(child.index, parent.index)) {
+    throw std::runtime_error("Parent is the child or one of its descendants");
+  }
+  ecdb._hierarchy.set_parent(child, parent);
+  return std::move(ecdb);
+}
+
+// Makes child a root, it keeps its own children
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+remove_parent(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const Entity &child) {
+  ecdb._get_entity_slot(child);
+  ecdb._hierarchy.remove_parent(child.index);
+  return std::move(ecdb);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::optional<Entity>
+get_parent(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+           const Entity &entity) {
+  if (not ecdb.contains(entity)) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+  if (not ecdb._hierarchy.has_parent(entity.index)) {
+    return std::nullopt;
+  }
+  return ecdb._hierarchy.parent(entity.index);
+}
+
+// The children of the entity in the order they were added
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::vector<Entity>
+get_children(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+             const Entity &entity) {
+  if (not ecdb.contains(entity)) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+  std::vector<Entity> children;
+  children.reserve(ecdb._hierarchy.num_children(entity.index));
+  ecdb._hierarchy.for_each_child(entity.index, [&children](const Entity &child) { children.push_back(child); });
+  return children;
+}
+
+// The descendants of the entity in breadth-first order
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::vector<Entity>
+get_descendants(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                const Entity &entity) {
+  if (not ecdb.contains(entity)) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+  std::vector<Entity> descendants;
+  ecdb._hierarchy.append_descendants(entity.index, descendants);
+  return descendants;
+}
+
+// Calls function(entity, parent, components...) for every entity of the hierarchies that has all of Args, parent is
+// nullptr for roots. Roots come first, then every level of the hierarchies in turn, so a parent is always visited
+// before its children, e.g. to propagate transforms in one pass. Entities without all of Args are skipped, but not
+// their children. The order is cached between traversals until a relationship changes.
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename Function>
+void each_breadth_first(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                        Function &&function) {
+  auto &storage = ecdb._storage;
+  for (auto &[entity, parent] : ecdb._hierarchy.breadth_first_order()) {
+    std::tuple<Args *...> components = {storage.template find<Args>(entity)...};
+    std::apply(
+        [&function, &entity = entity, &parent = parent](auto *... components) {
+          if (((components != nullptr) and ...)) {
+            function(entity, parent.index == NO_ENTITY_INDEX ? nullptr : &parent, *components...);
+          }
+        },
+        components);
+  }
+}
+
+// Observers
+
+// Registers function(ecdb, entities) to be called by dispatch_events with the entities that had event for
+// component_type since the previous dispatch, in the order the events happened. An entity is listed once per event,
+// so the entities of ADD and SET events can have lost the component or have been removed since, and the entities of
+// REMOVE events are usually no longer in the ecdb. process_systems, process_systems_in_parallel,
+// process_systems_with_commands, run_pipeline and run_pipeline_in_parallel dispatch the events at the end of every
+// frame.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, ObserverHandle>
+register_observer(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    const TypeIndexTemplate &component_type, ObserverEvent event,
+    typename type_utils::type_identity<typename Observers<EntityComponentDatabase<
+        TypeIndexTemplate, ComponentTemplate, StorageTemplate>>::ObserverFunction>::type function) {
+  auto bit = ecdb._component_type_registry.register_component_type(component_type);
+  auto observer_index = ecdb._observers.insert(bit, event, std::move(function));
+  return std::make_tuple(std::move(ecdb), ObserverHandle{observer_index});
+}
+
+// Same as above for a component type ComponentType of a std::variant
+template <typename ComponentType, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>, ObserverHandle>
+register_observer(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb, ObserverEvent event,
+    typename type_utils::type_identity<typename Observers<EntityComponentDatabase<
+        TypeIndexTemplate, ComponentTemplate, StorageTemplate>>::ObserverFunction>::type function) {
+  return register_observer<TypeIndexTemplate, ComponentTemplate, StorageTemplate>(
+      ecdb, type_utils::get_type_id<ComponentType>(), event, std::move(function));
+}
+
+// The events that were recorded for the observer and not dispatched yet are dropped
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+unregister_observer(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                    const ObserverHandle &observer_handle) {
+  ecdb._observers.erase(observer_handle.index);
+  return std::move(ecdb);
+}
+
+// Calls every observer with the entities of its events since the previous dispatch. Events caused by the observers
+// themselves are delivered by the next dispatch, and observers cannot be registered or unregistered meanwhile.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+dispatch_events(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  ecdb._observers.dispatch(ecdb);
+  return std::move(ecdb);
+}
+
+constexpr std::size_t DEFAULT_GRAIN_SIZE = 1024;
+
+// Data-parallel each: the entities that have all of Args are split into chunks of about grain_size entities that run on
+// thread_pool. Chunk boundaries are aligned to cache lines of the components (see the chunk() method of the storages),
+// so writing to the components of an entity never causes false sharing with another chunk.
+// function is called concurrently and must only modify the components it is given, it may record the writes with
+// mark_changed.
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename Function>
+void parallel_each(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                   Function &&function, std::size_t grain_size = DEFAULT_GRAIN_SIZE,
+                   ThreadPool &thread_pool = default_thread_pool()) {
+  static_assert(QueryTerms<Args...>::plain, "parallel_each does not support without<> and maybe<> terms");
+
+  std::vector<ThreadPool::Task> tasks;
+  ecdb._storage.template chunk<Args...>(grain_size, [&tasks, &function](auto chunk) {
+    tasks.emplace_back([chunk, &function]() mutable { chunk(function); });
+  });
+  _run_deferring_change_marks(ecdb, tasks, thread_pool);
+}
+
+// Same as parallel_each, but function(entity, Args &..., std::vector<ActionTemplate> &actions) can also emit actions.
+// Every chunk has its own cache line aligned buffer of actions, the buffers are concatenated in chunk order after all
+// chunks are done, so the result is the same as calling function sequentially.
+template <typename ActionTemplate, typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate, typename Function>
+std::vector<ActionTemplate>
+parallel_each_with_actions(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                           Function &&function, std::size_t grain_size = DEFAULT_GRAIN_SIZE,
+                           ThreadPool &thread_pool = default_thread_pool()) {
+  static_assert(QueryTerms<Args...>::plain, "parallel_each does not support without<> and maybe<> terms");
+
+  using ActionBuffer = memory_utils::CacheAligned<std::vector<ActionTemplate>>;
+  std::vector<ThreadPool::Task> tasks;
+  std::vector<ActionBuffer> action_buffers;
+  ecdb._storage.template chunk<Args...>(grain_size, [&tasks, &action_buffers, &function](auto chunk) {
+    auto chunk_index = tasks.size();
+    tasks.emplace_back([chunk, chunk_index, &action_buffers, &function]() mutable {
+      auto &actions = action_buffers[chunk_index].value;
+      auto function_with_actions = [&function, &actions](const Entity &entity, Args &... components) {
+        function(entity, components..., actions);
+      };
+      chunk(function_with_actions);
+    });
+  });
+  action_buffers.resize(tasks.size());
+  _run_deferring_change_marks(ecdb, tasks, thread_pool);
+
+  std::size_t num_actions = 0;
+  for (auto &action_buffer : action_buffers) {
+    num_actions += action_buffer.value.size();
+  }
+  std::vector<ActionTemplate> actions;
+  actions.reserve(num_actions);
+  for (auto &action_buffer : action_buffers) {
+    std::move(action_buffer.value.begin(), action_buffer.value.end(), std::back_inserter(actions));
+  }
+  return actions;
+}
+
+// SparseSetStorage only: entities that have all of Args are kept packed and aligned at the front of the pools of Args,
+// so query<Args...> walks them linearly without probing
+template <typename... Args, typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+create_owned_group(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb) {
+  ecdb._storage.template create_owned_group<Args...>();
+  return std::move(ecdb);
 }
 
 // Systems
@@ -238,14 +1335,84 @@ using SystemPriority = int;
 
 template <typename SystemTemplate> using ListOfSystems = std::vector<SystemTemplate>;
 
+// Ordered, so priority levels run in ascending order of priority
 template <typename SystemTemplate>
-using MapFromPriorityToListOfSystems = std::unordered_map<SystemPriority, ListOfSystems<SystemTemplate>>;
+using MapFromPriorityToListOfSystems = std::map<SystemPriority, ListOfSystems<SystemTemplate>>;
+
+template <typename... ComponentTypes> struct reads {};
+template <typename... ComponentTypes> struct writes {};
+
+// Component types a system reads and writes in place, the bits are type_utils::get_type_id of the component types.
+// A system that does not declare its access is assumed to conflict with every other system.
+struct SystemAccess {
+public:
+  ComponentSignature read_signature;
+  ComponentSignature write_signature;
+  bool declared;
+
+  explicit SystemAccess() {
+    this->read_signature = ComponentSignature();
+    this->write_signature = ComponentSignature();
+    this->declared = false;
+  }
+  explicit SystemAccess(const ComponentSignature &read_signature, const ComponentSignature &write_signature) {
+    this->read_signature = read_signature;
+    this->write_signature = write_signature;
+    this->declared = true;
+  }
+};
+
+template <typename... ReadComponentTypes, typename... WriteComponentTypes>
+SystemAccess system_access(reads<ReadComponentTypes...> = {}, writes<WriteComponentTypes...> = {}) {
+  ComponentSignature read_signature;
+  (read_signature.set(type_utils::get_type_id<ReadComponentTypes>()), ...);
+  ComponentSignature write_signature;
+  (write_signature.set(type_utils::get_type_id<WriteComponentTypes>()), ...);
+  return SystemAccess(read_signature, write_signature);
+}
+
+// Two systems conflict if one of them writes a component type that the other one reads or writes
+inline bool conflicts(const SystemAccess &access_a, const SystemAccess &access_b) {
+  if (not access_a.declared or not access_b.declared) {
+    return true;
+  }
+  return access_a.write_signature.intersects(access_b.read_signature) or
+         access_a.write_signature.intersects(access_b.write_signature) or
+         access_b.write_signature.intersects(access_a.read_signature);
+}
+
+using ListOfSystemAccesses = std::vector<SystemAccess>;
+using MapFromPriorityToListOfSystemAccesses = std::unordered_map<SystemPriority, ListOfSystemAccesses>;
+using MapFromPriorityToListOfChangeTicks = std::unordered_map<SystemPriority, std::vector<ChangeTick>>;
 
 template <typename SystemTemplate> class Systems {
 public:
   MapFromPriorityToListOfSystems<SystemTemplate> _priority_to_systems;
+  // same shape as _priority_to_systems
+  MapFromPriorityToListOfSystemAccesses _priority_to_system_accesses;
+  // same shape as _priority_to_systems, the change tick of the last run of every system
+  MapFromPriorityToListOfChangeTicks _priority_to_last_run_ticks;
+  // Holds the actions of process_systems and is reset at the end of it, systems can allocate their per-frame
+  // temporaries from it as well, e.g. with query<...>(ecdb, systems._frame_arena)
+  memory_utils::FrameArena _frame_arena;
+
+  explicit Systems() {
+    this->_priority_to_systems = {};
+    this->_priority_to_system_accesses = {};
+    this->_priority_to_last_run_ticks = {};
+    this->_frame_arena = memory_utils::FrameArena();
+  }
 
-  explicit Systems() { this->_priority_to_systems = {}; }
+  // Every system has seen the changes at or before this tick
+  ChangeTick _min_last_run_tick() const {
+    ChangeTick min_last_run_tick = std::numeric_limits<ChangeTick>::max();
+    for (auto &&[priority, last_run_ticks] : this->_priority_to_last_run_ticks) {
+      for (auto last_run_tick : last_run_ticks) {
+        min_last_run_tick = std::min(min_last_run_tick, last_run_tick);
+      }
+    }
+    return min_last_run_tick;
+  }
   Systems(Systems &&) = default;
   Systems &operator=(Systems &&) = default;
   Systems(const Systems &) = delete;
@@ -255,72 +1422,311 @@ public:
 
 template <typename SystemTemplate> Systems<SystemTemplate> create_systems() { return Systems<SystemTemplate>(); }
 
+// access is only used by process_systems_in_parallel
 template <typename SystemTemplate>
-Systems<SystemTemplate> add_system(Systems<SystemTemplate> &systems, SystemTemplate system, SystemPriority priority) {
+Systems<SystemTemplate> add_system(Systems<SystemTemplate> &systems, SystemTemplate system, SystemPriority priority,
+                                   const SystemAccess &access = SystemAccess()) {
   if (priority < 0) {
     throw std::runtime_error("Priority must be a positive number!");
   }
 
   auto &priority_to_systems = systems._priority_to_systems;
   priority_to_systems[priority].push_back(system);
+  systems._priority_to_system_accesses[priority].push_back(access);
+  systems._priority_to_last_run_ticks[priority].push_back(0);
   return std::move(systems);
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate>
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
 using ProcessSystemFunction = std::function<std::vector<ActionTemplate>(
-    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &, SystemTemplate &)>;
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &, SystemTemplate &)>;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+using ProcessActionFunction =
+    std::function<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>(
+        EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &, ActionTemplate &)>;
+
+template <typename ActionTemplate> using ActionBuffer = memory_utils::ArenaVector<ActionTemplate>;
+
+// Appends the actions of the system to the buffer instead of returning them, so they can live in the frame arena
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+using ProcessSystemIntoBufferFunction =
+    std::function<void(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &,
+                       SystemTemplate &, ActionBuffer<ActionTemplate> &)>;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage,
+          typename ProfilerTemplate = profiler::NullProfiler>
+void _get_actions_from_systems_with_same_priority(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    ListOfSystems<SystemTemplate> &systems_with_same_priority,
+    ProcessSystemIntoBufferFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate,
+                                    StorageTemplate> &process_system,
+    std::vector<ChangeTick> &last_run_ticks, SystemPriority priority, ProfilerTemplate &profiler,
+    ActionBuffer<ActionTemplate> &actions) {
+  for (std::size_t system_index = 0; system_index < systems_with_same_priority.size(); system_index++) {
+    auto num_actions = actions.size();
+    profiler.begin_system();
+    ecdb._last_run_tick = last_run_ticks[system_index];
+    process_system(ecdb, systems_with_same_priority[system_index], actions);
+    last_run_ticks[system_index] = advance_change_tick(ecdb);
+    profiler.end_system(priority, system_index, actions.size() - num_actions);
+  }
+}
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate>
-using ProcessActionFunction = std::function<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>(
-    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &, ActionTemplate &)>;
+// profiler is a policy with the hooks of profiler::NullProfiler, e.g. profiler::FrameProfiler.
+// Every call of process_systems is one frame of the profiler. The actions are kept in systems._frame_arena, which is
+// reset before returning, so a frame does not allocate from the global heap once the arena is warmed up.
+// The change filters of every system see the writes since its previous run, including the actions it returned then.
+// The events of the frame are dispatched to the observers at the end of it, see register_observer.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage, typename ProfilerTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemIntoBufferFunction<
+        TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>>::type process_system,
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate>
-std::vector<ActionTemplate> _get_actions_from_systems_with_same_priority(
-    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
-    ListOfSystems<SystemTemplate> &systems_with_same_priority,
-    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
-                                                             ActionTemplate>>::type process_system
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    ProfilerTemplate &profiler
 
 ) {
-  std::vector<ActionTemplate> actions;
-  for (auto &system : systems_with_same_priority) {
-    auto system_actions = process_system(ecdb, system);
-    actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+  profiler.begin_frame();
+  // The arena is also reset when a system or an action throws, the actions are destroyed before either reset
+  try {
+    ActionBuffer<ActionTemplate> actions(memory_utils::ArenaAllocator<ActionTemplate>(systems._frame_arena));
+    for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
+      actions.clear();
+      _get_actions_from_systems_with_same_priority<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                   ActionTemplate, StorageTemplate>(
+          ecdb, systems_with_same_priority, process_system, systems._priority_to_last_run_ticks[priority], priority,
+          profiler, actions);
+
+      profiler.begin_apply();
+      for (auto &action : actions) {
+        ecdb = process_action(ecdb, action);
+      }
+      profiler.end_apply(priority, actions.size());
+    }
+  } catch (...) {
+    systems._frame_arena.reset();
+    throw;
   }
-  return actions;
+  systems._frame_arena.reset();
+  ecdb = dispatch_events(ecdb);
+  prune_removals(ecdb, systems._min_last_run_tick());
+  profiler.end_frame();
+  return std::move(ecdb);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemIntoBufferFunction<
+        TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>>::type process_system,
+
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action
+
+) {
+  profiler::NullProfiler null_profiler;
+  return process_systems<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>(
+      ecdb, systems, std::move(process_system), std::move(process_action), null_profiler);
 }
 
-template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate>
-EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> process_systems(
-    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, Systems<SystemTemplate> &systems,
+// Same as above for systems that return their actions, every system allocates the vector it returns
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage, typename ProfilerTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
     typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
-                                                             ActionTemplate>>::type process_system,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
 
     typename type_utils::type_identity<
-        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate>>::type process_action
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    ProfilerTemplate &profiler
 
 ) {
-  for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
-    std::vector<ActionTemplate> actions =
-        _get_actions_from_systems_with_same_priority<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
-                                                     ActionTemplate>(ecdb, systems_with_same_priority, process_system);
+  using EntityComponentDatabaseType = EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>;
+  ProcessSystemIntoBufferFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>
+      process_system_into_buffer = [&process_system](EntityComponentDatabaseType &ecdb, SystemTemplate &system,
+                                                     ActionBuffer<ActionTemplate> &actions) {
+        auto system_actions = process_system(ecdb, system);
+        actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+      };
+  return process_systems<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>(
+      ecdb, systems, std::move(process_system_into_buffer), std::move(process_action), profiler);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
 
-    for (auto &action : actions) {
-      ecdb = process_action(ecdb, action);
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action
+
+) {
+  profiler::NullProfiler null_profiler;
+  return process_systems<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>(
+      ecdb, systems, std::move(process_system), std::move(process_action), null_profiler);
+}
+
+// Splits systems into batches that run one after another. Systems in the same batch do not conflict with each other,
+// and a system always runs in a later batch than the systems added before it that it conflicts with.
+inline std::vector<std::vector<std::size_t>> schedule_systems(const ListOfSystemAccesses &system_accesses) {
+  std::vector<std::vector<std::size_t>> batches;
+  std::vector<std::size_t> system_to_batch(system_accesses.size());
+  for (std::size_t system_index = 0; system_index < system_accesses.size(); system_index++) {
+    std::size_t batch_index = 0;
+    for (std::size_t previous_system_index = 0; previous_system_index < system_index; previous_system_index++) {
+      if (conflicts(system_accesses[system_index], system_accesses[previous_system_index])) {
+        batch_index = std::max(batch_index, system_to_batch[previous_system_index] + 1);
+      }
     }
+    system_to_batch[system_index] = batch_index;
+    if (batch_index == batches.size()) {
+      batches.emplace_back();
+    }
+    batches[batch_index].push_back(system_index);
   }
-  return std::move(ecdb);
+  return batches;
 }
 
-} // namespace mutable_ecs
-} // namespace ecs
+// Same as _get_actions_from_systems_with_same_priority, but the systems of every batch run on thread_pool.
+// The actions are merged in the order the systems were added, so the result does not depend on the scheduling.
+// Every system measures itself on the thread it runs on, the measurements go to profiler after its batch is done.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage,
+          typename ProfilerTemplate = profiler::NullProfiler>
+void _get_actions_from_systems_with_same_priority_in_parallel(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    ListOfSystems<SystemTemplate> &systems_with_same_priority, const ListOfSystemAccesses &system_accesses,
+    ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>
+        &process_system,
+    std::vector<ChangeTick> &last_run_ticks, SystemPriority priority, ProfilerTemplate &profiler,
+    ThreadPool &thread_pool, ActionBuffer<ActionTemplate> &actions) {
+  struct SystemMeasurement {
+    profiler::TimePoint start;
+    profiler::TimePoint end;
+    std::size_t num_visited_entities;
+  };
+
+  std::vector<std::vector<ActionTemplate>> actions_per_system(systems_with_same_priority.size());
+  std::vector<SystemMeasurement> measurements(ProfilerTemplate::enabled ? systems_with_same_priority.size() : 0);
+  for (auto &batch : schedule_systems(system_accesses)) {
+    std::vector<ThreadPool::Task> tasks;
+    tasks.reserve(batch.size());
+    // The systems of a batch share the earliest last run of the batch, so they may see a change again
+    ecdb._last_run_tick = std::numeric_limits<ChangeTick>::max();
+    for (auto system_index : batch) {
+      ecdb._last_run_tick = std::min(ecdb._last_run_tick, last_run_ticks[system_index]);
+      tasks.emplace_back([&, system_index] {
+        if constexpr (ProfilerTemplate::enabled) {
+          auto &measurement = measurements[system_index];
+          auto num_visited_entities = profiler::visited_entities_counter();
+          measurement.start = time_utils::now();
+          actions_per_system[system_index] = process_system(ecdb, systems_with_same_priority[system_index]);
+          measurement.end = time_utils::now();
+          measurement.num_visited_entities = profiler::visited_entities_counter() - num_visited_entities;
+        } else {
+          actions_per_system[system_index] = process_system(ecdb, systems_with_same_priority[system_index]);
+        }
+      });
+    }
+    _run_deferring_change_marks(ecdb, tasks, thread_pool);
+    auto change_tick = advance_change_tick(ecdb);
+    for (auto system_index : batch) {
+      last_run_ticks[system_index] = change_tick;
+      if constexpr (ProfilerTemplate::enabled) {
+        auto &measurement = measurements[system_index];
+        profiler.record_system(priority, system_index, measurement.start, measurement.end,
+                               measurement.num_visited_entities, actions_per_system[system_index].size());
+      }
+    }
+  }
 
-namespace std {
+  for (auto &system_actions : actions_per_system) {
+    actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+  }
+}
+
+// Parallel counterpart of process_systems: systems with the same priority that do not conflict according to their
+// SystemAccess run at the same time on thread_pool. process_system is called concurrently, so it must only modify the
+// component types its system declared as written. Actions are still applied sequentially in the same order as
+// process_systems applies them. The profiler and the frame arena are used like process_systems uses them, the hooks
+// are only called from the thread that calls process_systems_in_parallel.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage, typename ProfilerTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems_in_parallel(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
 
-template <> struct hash<ecs::mutable_ecs::Entity> {
-  std::size_t operator()(const ecs::mutable_ecs::Entity &entity) const {
-    return hash<ecs::mutable_ecs::UniqueId>{}(entity.unique_id);
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    ThreadPool &thread_pool, ProfilerTemplate &profiler) {
+  profiler.begin_frame();
+  // The arena is also reset when a system or an action throws, the actions are destroyed before either reset
+  try {
+    ActionBuffer<ActionTemplate> actions(memory_utils::ArenaAllocator<ActionTemplate>(systems._frame_arena));
+    for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
+      actions.clear();
+      _get_actions_from_systems_with_same_priority_in_parallel<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                               ActionTemplate, StorageTemplate>(
+          ecdb, systems_with_same_priority, systems._priority_to_system_accesses.at(priority), process_system,
+          systems._priority_to_last_run_ticks[priority], priority, profiler, thread_pool, actions);
+
+      profiler.begin_apply();
+      for (auto &action : actions) {
+        ecdb = process_action(ecdb, action);
+      }
+      profiler.end_apply(priority, actions.size());
+    }
+  } catch (...) {
+    systems._frame_arena.reset();
+    throw;
   }
-};
+  systems._frame_arena.reset();
+  ecdb = dispatch_events(ecdb);
+  prune_removals(ecdb, systems._min_last_run_tick());
+  profiler.end_frame();
+  return std::move(ecdb);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> process_systems_in_parallel(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
 
-} // namespace std
\ No newline at end of file
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    ThreadPool &thread_pool) {
+  profiler::NullProfiler null_profiler;
+  return process_systems_in_parallel<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate,
+                                     StorageTemplate>(ecdb, systems, std::move(process_system),
+                                                      std::move(process_action), thread_pool, null_profiler);
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ecs/component_signature.hpp"
+#include "ecs/entity.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// ADD: the component type was added to the entity
+// SET: a component the entity already had was overwritten or marked as changed
+// REMOVE: the component type was removed from the entity, or the entity was removed
+enum class ObserverEvent : std::size_t { ADD = 0, SET = 1, REMOVE = 2 };
+
+constexpr std::size_t NUM_OBSERVER_EVENTS = 3;
+
+// Handle of an observer registered with register_observer
+struct ObserverHandle {
+public:
+  std::size_t index;
+};
+
+// The observers of an ecdb. Writes only append the entity to the buffer of their event and component type, the
+// observers are called with whole batches when dispatch runs, so nothing is called per write. A component type
+// without observers has no buffer, so an ecdb without observers pays a single comparison per write.
+template <typename EntityComponentDatabaseType> class Observers {
+public:
+  using ObserverFunction = std::function<void(EntityComponentDatabaseType &, const std::vector<Entity> &)>;
+
+  struct Observer {
+  public:
+    std::size_t bit;
+    ObserverEvent event;
+    ObserverFunction function;
+  };
+
+  // Entities of the events recorded since the last dispatch, dispatched_entities is the batch that is being delivered
+  struct EventBuffer {
+  public:
+    std::size_t num_observers;
+    std::vector<Entity> entities;
+    std::vector<Entity> dispatched_entities;
+  };
+
+  // Unregistered observers leave an empty slot behind that the next registered observer reuses
+  std::vector<std::optional<Observer>> _observers;
+  // Slots of the registered observers in the order they were registered, a reused slot moves to the end
+  std::vector<std::size_t> _registration_order;
+  // Buffer of every event of every signature bit up to the highest bit with an observer
+  std::vector<std::array<EventBuffer, NUM_OBSERVER_EVENTS>> _event_buffers;
+  bool _is_dispatching;
+
+  explicit Observers() {
+    this->_observers = {};
+    this->_registration_order = {};
+    this->_event_buffers = {};
+    this->_is_dispatching = false;
+  }
+
+  void _check_not_dispatching() const {
+    if (this->_is_dispatching) {
+      throw std::runtime_error("Observers cannot be registered or unregistered while events are dispatched");
+    }
+  }
+
+  std::size_t insert(std::size_t bit, ObserverEvent event, ObserverFunction function) {
+    this->_check_not_dispatching();
+    std::size_t observer_index = 0;
+    while (observer_index < this->_observers.size() and this->_observers[observer_index].has_value()) {
+      observer_index++;
+    }
+    if (observer_index == this->_observers.size()) {
+      this->_observers.emplace_back();
+    }
+
+    if (bit >= this->_event_buffers.size()) {
+      this->_event_buffers.resize(bit + 1);
+    }
+    this->_event_buffers[bit][static_cast<std::size_t>(event)].num_observers += 1;
+
+    this->_observers[observer_index] = Observer{bit, event, std::move(function)};
+    this->_registration_order.push_back(observer_index);
+    return observer_index;
+  }
+
+  void erase(std::size_t observer_index) {
+    this->_check_not_dispatching();
+    if (observer_index >= this->_observers.size() or not this->_observers[observer_index].has_value()) {
+      throw std::runtime_error("Observer is not registered");
+    }
+    auto &observer = *this->_observers[observer_index];
+    auto &event_buffer = this->_event_buffers[observer.bit][static_cast<std::size_t>(observer.event)];
+    event_buffer.num_observers -= 1;
+    if (event_buffer.num_observers == 0) {
+      event_buffer.entities.clear();
+    }
+    this->_observers[observer_index].reset();
+    this->_registration_order.erase(
+        std::find(this->_registration_order.begin(), this->_registration_order.end(), observer_index));
+  }
+
+  void record(ObserverEvent event, const Entity &entity, std::size_t bit) {
+    if (bit >= this->_event_buffers.size()) {
+      return;
+    }
+    auto &event_buffer = this->_event_buffers[bit][static_cast<std::size_t>(event)];
+    if (event_buffer.num_observers > 0) {
+      event_buffer.entities.push_back(entity);
+    }
+  }
+
+  // Records a REMOVE event for every bit of signature, the signature of the entity before it was removed
+  void record_removed_entity(const Entity &entity, const ComponentSignature &signature) {
+    if (this->_event_buffers.empty()) {
+      return;
+    }
+    signature.for_each_bit([this, &entity](std::size_t bit) { this->record(ObserverEvent::REMOVE, entity, bit); });
+  }
+
+  // Calls every observer with the entities of its events in the order they were recorded, observers of the same
+  // event and component type are called in the order they were registered. Events recorded by the observers are
+  // delivered by the next dispatch, a dispatch from inside an observer does nothing.
+  void dispatch(EntityComponentDatabaseType &ecdb) {
+    if (this->_is_dispatching or this->_event_buffers.empty()) {
+      return;
+    }
+    this->_is_dispatching = true;
+    for (auto &event_buffers : this->_event_buffers) {
+      for (auto &event_buffer : event_buffers) {
+        std::swap(event_buffer.entities, event_buffer.dispatched_entities);
+      }
+    }
+    auto clear_dispatched_entities = [this]() {
+      for (auto &event_buffers : this->_event_buffers) {
+        for (auto &event_buffer : event_buffers) {
+          event_buffer.dispatched_entities.clear();
+        }
+      }
+      this->_is_dispatching = false;
+    };
+    try {
+      for (auto observer_index : this->_registration_order) {
+        auto &observer = this->_observers[observer_index];
+        auto &event_buffer = this->_event_buffers[observer->bit][static_cast<std::size_t>(observer->event)];
+        if (not event_buffer.dispatched_entities.empty()) {
+          observer->function(ecdb, event_buffer.dispatched_entities);
+        }
+      }
+    } catch (...) {
+      clear_dispatched_entities();
+      throw;
+    }
+    clear_dispatched_entities();
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
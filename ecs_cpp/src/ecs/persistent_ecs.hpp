@@ -0,0 +1,195 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/persistent_map.hpp"
+#include "ecs/type_utils.hpp"
+
+// Immutable counterpart of mutable_ecs with the semantics of ecs/ecs.py: every function takes the database by const
+// reference and returns a new one. Databases share all unchanged parts through PersistentMap, so copying one (e.g. to
+// keep a snapshot of a frame) is O(1) and an edit copies O(log n) nodes.
+namespace ecs {
+namespace persistent_ecs {
+
+using Entity = mutable_ecs::Entity;
+using EntityIndex = mutable_ecs::EntityIndex;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+using MapFromComponentTypeToComponent = PersistentMap<TypeIndexTemplate, ComponentTemplate>;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+using MapFromEntityToMapFromComponentTypeToComponent =
+    PersistentMap<Entity, MapFromComponentTypeToComponent<TypeIndexTemplate, ComponentTemplate>>;
+
+template <typename ComponentTemplate> using ListOfComponents = std::vector<ComponentTemplate>;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate> struct EntityComponentDatabase {
+public:
+  // entity indices are never reused, so Entity::generation is always 0
+  EntityIndex _last_entity_index;
+  MapFromEntityToMapFromComponentTypeToComponent<TypeIndexTemplate, ComponentTemplate> _entities;
+
+  explicit EntityComponentDatabase() {
+    this->_last_entity_index = 0;
+    this->_entities = MapFromEntityToMapFromComponentTypeToComponent<TypeIndexTemplate, ComponentTemplate>();
+  }
+
+  std::size_t size() const { return this->_entities.size(); }
+
+  bool contains(const Entity &entity) const { return this->_entities.contains(entity); }
+};
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> create_ecdb() {
+  return EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>();
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = mutable_ecs::GetComponentType<ComponentTemplate>>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
+add_component(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity,
+              const ComponentTemplate &component) {
+  auto component_type = GetComponentTypeFunction()(component);
+
+  auto entity_components = ecdb._entities.find(entity);
+  if (entity_components == nullptr) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+
+  auto new_ecdb = ecdb;
+  new_ecdb._entities = ecdb._entities.set(entity, entity_components->set(component_type, component));
+  return new_ecdb;
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = mutable_ecs::GetComponentType<ComponentTemplate>>
+std::tuple<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>, Entity>
+add_entity(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
+           const std::vector<ComponentTemplate> &components = {}) {
+  auto entity = Entity(ecdb._last_entity_index);
+
+  MapFromComponentTypeToComponent<TypeIndexTemplate, ComponentTemplate> entity_components;
+  for (auto &component : components) {
+    entity_components = entity_components.set(GetComponentTypeFunction()(component), component);
+  }
+
+  auto new_ecdb = ecdb;
+  new_ecdb._last_entity_index = ecdb._last_entity_index + 1;
+  new_ecdb._entities = ecdb._entities.set(entity, entity_components);
+  return std::make_tuple(std::move(new_ecdb), entity);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
+remove_entity(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity) {
+  if (not ecdb.contains(entity)) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+
+  auto new_ecdb = ecdb;
+  new_ecdb._entities = ecdb._entities.erase(entity);
+  return new_ecdb;
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>
+remove_component(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity,
+                 const TypeIndexTemplate &component_type) {
+  auto entity_components = ecdb._entities.find(entity);
+  if (entity_components == nullptr) {
+    throw std::runtime_error("Entity is not in EntityComponentDatabase");
+  }
+
+  auto new_ecdb = ecdb;
+  new_ecdb._entities = ecdb._entities.set(entity, entity_components->erase(component_type));
+  return new_ecdb;
+}
+
+// std::nullopt if the entity does not have the component type
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+std::optional<ComponentTemplate>
+get_component(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, const Entity &entity,
+              const TypeIndexTemplate &component_type) {
+  auto entity_components = ecdb._entities.find(entity);
+  if (entity_components == nullptr) {
+    return std::nullopt;
+  }
+  auto component = entity_components->find(component_type);
+  if (component == nullptr) {
+    return std::nullopt;
+  }
+  return *component;
+}
+
+// Entities that have all of component_types, or every entity with all of its components if component_types is empty
+template <typename TypeIndexTemplate, typename ComponentTemplate>
+std::vector<std::tuple<Entity, ListOfComponents<ComponentTemplate>>>
+query(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb,
+      const std::vector<TypeIndexTemplate> &component_types = {}) {
+  std::vector<std::tuple<Entity, ListOfComponents<ComponentTemplate>>> queried_entities;
+  ecdb._entities.for_each([&](const Entity &entity, const auto &entity_components) {
+    ListOfComponents<ComponentTemplate> requested_components;
+    if (component_types.empty()) {
+      entity_components.for_each(
+          [&requested_components](const TypeIndexTemplate &, const ComponentTemplate &component) {
+            requested_components.push_back(component);
+          });
+    } else {
+      for (auto &component_type : component_types) {
+        auto component = entity_components.find(component_type);
+        if (component == nullptr) {
+          return;
+        }
+        requested_components.push_back(*component);
+      }
+    }
+    queried_entities.emplace_back(entity, std::move(requested_components));
+  });
+  return queried_entities;
+}
+
+// Systems are shared with mutable_ecs
+using mutable_ecs::add_system;
+using mutable_ecs::create_systems;
+using mutable_ecs::Systems;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate>
+using ProcessSystemFunction = std::function<std::vector<ActionTemplate>(
+    const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &, SystemTemplate &)>;
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename ActionTemplate>
+using ProcessActionFunction = std::function<EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate>(
+    const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &, ActionTemplate &)>;
+
+// All systems with the same priority see the same snapshot of the database, their actions are applied afterwards
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> process_systems(
+    const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate> &ecdb, Systems<SystemTemplate> &systems,
+    typename type_utils::type_identity<
+        ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate>>::type
+        process_system,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate>>::type process_action) {
+  auto new_ecdb = ecdb;
+  for (auto &&[priority, systems_with_same_priority] : systems._priority_to_systems) {
+    std::vector<ActionTemplate> actions;
+    for (auto &system : systems_with_same_priority) {
+      auto system_actions = process_system(new_ecdb, system);
+      actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+    }
+
+    for (auto &action : actions) {
+      new_ecdb = process_action(new_ecdb, action);
+    }
+  }
+  return new_ecdb;
+}
+
+} // namespace persistent_ecs
+} // namespace ecs
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ecs {
+namespace persistent_ecs {
+
+// Immutable hash array mapped trie (HAMT) in the CHAMP layout. Every node has two bitmaps over the 32 slots of its
+// level: entry_bitmap marks the slots that hold a key-value pair inline and node_bitmap marks the slots that hold a
+// child node. Nodes are never modified once built, so:
+//  - copying a PersistentMap copies one pointer
+//  - set and erase copy only the O(log32 n) nodes on the path to the key, all other nodes are shared with the original
+// Keys whose hashes are equal in all 64 bits end up in a collision node at the bottom of the trie.
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class PersistentMap {
+public:
+  using Entry = std::pair<Key, Value>;
+  using Bitmap = std::uint32_t;
+
+  static constexpr std::size_t BITS_PER_LEVEL = 5;
+  static constexpr std::size_t HASH_BITS = 64;
+
+  struct Node;
+  using NodePointer = std::shared_ptr<const Node>;
+
+  struct Node {
+  public:
+    Bitmap entry_bitmap;
+    Bitmap node_bitmap;
+    std::vector<Entry> entries;
+    std::vector<NodePointer> children;
+    // entries of a collision node share the same hash and are searched linearly
+    bool collision;
+  };
+
+  NodePointer _root;
+  std::size_t _size;
+
+  explicit PersistentMap() {
+    this->_root = std::make_shared<const Node>(Node{0, 0, {}, {}, false});
+    this->_size = 0;
+  }
+
+  std::size_t size() const { return this->_size; }
+  bool empty() const { return this->_size == 0; }
+
+  // Null if key is not in the map. The pointer stays valid as long as any map sharing the entry is alive.
+  const Value *find(const Key &key) const { return _find(*this->_root, _hash(key), 0, key); }
+
+  bool contains(const Key &key) const { return this->find(key) != nullptr; }
+
+  const Value &at(const Key &key) const {
+    auto value = this->find(key);
+    if (value == nullptr) {
+      throw std::out_of_range("Key is not in PersistentMap");
+    }
+    return *value;
+  }
+
+  // New map with key set to value
+  PersistentMap set(const Key &key, const Value &value) const {
+    bool inserted = false;
+    PersistentMap map;
+    map._root = _set(*this->_root, _hash(key), 0, Entry(key, value), inserted);
+    map._size = this->_size + (inserted ? 1 : 0);
+    return map;
+  }
+
+  // New map without key, shares the root with this map if key is not in it
+  PersistentMap erase(const Key &key) const {
+    if (not this->contains(key)) {
+      return *this;
+    }
+    PersistentMap map;
+    map._root = _erase(*this->_root, _hash(key), 0, key);
+    map._size = this->_size - 1;
+    return map;
+  }
+
+  // Calls function(key, value) for every entry, in hash order
+  template <typename Function> void for_each(Function &&function) const { _for_each(*this->_root, function); }
+
+  static std::uint64_t _hash(const Key &key) { return static_cast<std::uint64_t>(Hash()(key)); }
+
+  static Bitmap _bit(std::uint64_t hash, std::size_t shift) {
+    return Bitmap(1) << ((hash >> shift) & ((1 << BITS_PER_LEVEL) - 1));
+  }
+
+  static std::size_t _index(Bitmap bitmap, Bitmap bit) { return std::bitset<32>(bitmap & (bit - 1)).count(); }
+
+  static const Value *_find(const Node &node, std::uint64_t hash, std::size_t shift, const Key &key) {
+    if (node.collision) {
+      for (auto &entry : node.entries) {
+        if (KeyEqual()(entry.first, key)) {
+          return &entry.second;
+        }
+      }
+      return nullptr;
+    }
+
+    auto bit = _bit(hash, shift);
+    if (node.entry_bitmap & bit) {
+      auto &entry = node.entries[_index(node.entry_bitmap, bit)];
+      return KeyEqual()(entry.first, key) ? &entry.second : nullptr;
+    }
+    if (node.node_bitmap & bit) {
+      return _find(*node.children[_index(node.node_bitmap, bit)], hash, shift + BITS_PER_LEVEL, key);
+    }
+    return nullptr;
+  }
+
+  static NodePointer _set(const Node &node, std::uint64_t hash, std::size_t shift, Entry entry, bool &inserted) {
+    Node new_node = node;
+    if (node.collision) {
+      for (auto &existing_entry : new_node.entries) {
+        if (KeyEqual()(existing_entry.first, entry.first)) {
+          existing_entry.second = std::move(entry.second);
+          return std::make_shared<const Node>(std::move(new_node));
+        }
+      }
+      new_node.entries.push_back(std::move(entry));
+      inserted = true;
+      return std::make_shared<const Node>(std::move(new_node));
+    }
+
+    auto bit = _bit(hash, shift);
+    if (node.entry_bitmap & bit) {
+      auto entry_index = _index(node.entry_bitmap, bit);
+      auto &existing_entry = new_node.entries[entry_index];
+      if (KeyEqual()(existing_entry.first, entry.first)) {
+        existing_entry.second = std::move(entry.second);
+        return std::make_shared<const Node>(std::move(new_node));
+      }
+
+      // Both entries move one level down
+      auto existing_hash = _hash(existing_entry.first);
+      auto child = _merge(std::move(existing_entry), existing_hash, std::move(entry), hash, shift + BITS_PER_LEVEL);
+      new_node.entries.erase(new_node.entries.begin() + entry_index);
+      new_node.entry_bitmap &= ~bit;
+      new_node.children.insert(new_node.children.begin() + _index(node.node_bitmap, bit), std::move(child));
+      new_node.node_bitmap |= bit;
+      inserted = true;
+      return std::make_shared<const Node>(std::move(new_node));
+    }
+
+    if (node.node_bitmap & bit) {
+      auto &child = new_node.children[_index(node.node_bitmap, bit)];
+      child = _set(*child, hash, shift + BITS_PER_LEVEL, std::move(entry), inserted);
+      return std::make_shared<const Node>(std::move(new_node));
+    }
+
+    new_node.entries.insert(new_node.entries.begin() + _index(node.entry_bitmap, bit), std::move(entry));
+    new_node.entry_bitmap |= bit;
+    inserted = true;
+    return std::make_shared<const Node>(std::move(new_node));
+  }
+
+  static NodePointer _merge(Entry entry_a, std::uint64_t hash_a, Entry entry_b, std::uint64_t hash_b,
+                            std::size_t shift) {
+    if (shift >= HASH_BITS) {
+      std::vector<Entry> entries;
+      entries.push_back(std::move(entry_a));
+      entries.push_back(std::move(entry_b));
+      return std::make_shared<const Node>(Node{0, 0, std::move(entries), {}, true});
+    }
+
+    auto bit_a = _bit(hash_a, shift);
+    auto bit_b = _bit(hash_b, shift);
+    if (bit_a == bit_b) {
+      auto child = _merge(std::move(entry_a), hash_a, std::move(entry_b), hash_b, shift + BITS_PER_LEVEL);
+      return std::make_shared<const Node>(Node{0, bit_a, {}, {std::move(child)}, false});
+    }
+
+    std::vector<Entry> entries;
+    if (bit_a < bit_b) {
+      entries.push_back(std::move(entry_a));
+      entries.push_back(std::move(entry_b));
+    } else {
+      entries.push_back(std::move(entry_b));
+      entries.push_back(std::move(entry_a));
+    }
+    return std::make_shared<const Node>(Node{bit_a | bit_b, 0, std::move(entries), {}, false});
+  }
+
+  // key has to be in the subtrie of node
+  static NodePointer _erase(const Node &node, std::uint64_t hash, std::size_t shift, const Key &key) {
+    Node new_node = node;
+    if (node.collision) {
+      for (auto entry = new_node.entries.begin(); entry != new_node.entries.end(); ++entry) {
+        if (KeyEqual()(entry->first, key)) {
+          new_node.entries.erase(entry);
+          break;
+        }
+      }
+      return std::make_shared<const Node>(std::move(new_node));
+    }
+
+    auto bit = _bit(hash, shift);
+    if (node.entry_bitmap & bit) {
+      new_node.entries.erase(new_node.entries.begin() + _index(node.entry_bitmap, bit));
+      new_node.entry_bitmap &= ~bit;
+      return std::make_shared<const Node>(std::move(new_node));
+    }
+
+    auto child_index = _index(node.node_bitmap, bit);
+    auto child = _erase(*node.children[child_index], hash, shift + BITS_PER_LEVEL, key);
+    if (child->children.empty() and child->entries.size() <= 1) {
+      // Keep the trie canonical: a child with a single entry is pulled up into this node
+      new_node.children.erase(new_node.children.begin() + child_index);
+      new_node.node_bitmap &= ~bit;
+      if (child->entries.size() == 1) {
+        new_node.entries.insert(new_node.entries.begin() + _index(node.entry_bitmap, bit), child->entries.front());
+        new_node.entry_bitmap |= bit;
+      }
+    } else {
+      new_node.children[child_index] = child;
+    }
+    return std::make_shared<const Node>(std::move(new_node));
+  }
+
+  template <typename Function> static void _for_each(const Node &node, Function &function) {
+    for (auto &entry : node.entries) {
+      function(entry.first, entry.second);
+    }
+    for (auto &child : node.children) {
+      _for_each(*child, function);
+    }
+  }
+};
+
+} // namespace persistent_ecs
+} // namespace ecs
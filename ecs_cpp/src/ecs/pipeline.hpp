@@ -0,0 +1,497 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ecs/memory_utils.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/profiler.hpp"
+#include "ecs/thread_pool.hpp"
+#include "ecs/time_utils.hpp"
+
+// Pipelines are the dependency-aware counterpart of Systems: systems are named, belong to one of the stages of the
+// pipeline and can be ordered with before/after constraints. build_pipeline compiles the stages into a static DAG
+// once, run_pipeline walks it in topological order and run_pipeline_in_parallel overlaps its independent branches.
+// As with the priority levels of Systems, the actions of a stage are applied once all of its systems ran.
+namespace ecs {
+namespace mutable_ecs {
+
+// Names of the systems that a system runs after and before. Constraints on systems of other stages must agree with
+// the order of the stages.
+struct SystemOrder {
+public:
+  std::vector<std::string> _after;
+  std::vector<std::string> _before;
+
+  explicit SystemOrder() {
+    this->_after = {};
+    this->_before = {};
+  }
+
+  SystemOrder &after(const std::string &name) {
+    this->_after.push_back(name);
+    return *this;
+  }
+
+  SystemOrder &before(const std::string &name) {
+    this->_before.push_back(name);
+    return *this;
+  }
+};
+
+enum class PipelineEdgeKind {
+  // declared with SystemOrder
+  ORDER,
+  // added by build_pipeline between systems whose SystemAccess conflicts, in topological order
+  CONFLICT
+};
+
+struct PipelineEdge {
+public:
+  std::size_t from;
+  std::size_t to;
+  PipelineEdgeKind kind;
+};
+
+template <typename SystemTemplate> struct PipelineNode {
+public:
+  std::string name;
+  SystemTemplate system;
+  std::size_t stage_index;
+  SystemAccess access;
+  SystemOrder order;
+  // Set by build_pipeline
+  std::vector<std::size_t> successors;
+  std::size_t num_predecessors;
+  // Change tick of the last run of the system
+  ChangeTick last_run_tick;
+  // Wall time of the last runs of the system
+  profiler::RollingSamples times;
+  std::size_t num_runs;
+};
+
+template <typename SystemTemplate> class Pipeline {
+public:
+  std::vector<std::string> _stages;
+  std::vector<PipelineNode<SystemTemplate>> _nodes;
+  std::unordered_map<std::string, std::size_t> _name_to_node_index;
+  std::size_t _timing_window_size;
+
+  // Set by build_pipeline, cleared when a stage or a system is added
+  bool _built;
+  // Node indices of every stage in topological order
+  std::vector<std::vector<std::size_t>> _stage_to_node_indices;
+  std::vector<PipelineEdge> _edges;
+
+  // Holds the actions of run_pipeline and is reset at the end of it
+  memory_utils::FrameArena _frame_arena;
+
+  explicit Pipeline(std::size_t timing_window_size = 120) {
+    this->_stages = {};
+    this->_nodes = {};
+    this->_name_to_node_index = {};
+    this->_timing_window_size = timing_window_size;
+    this->_built = false;
+    this->_stage_to_node_indices = {};
+    this->_edges = {};
+    this->_frame_arena = memory_utils::FrameArena();
+  }
+
+  Pipeline(Pipeline &&) = default;
+  Pipeline &operator=(Pipeline &&) = default;
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+  ~Pipeline() = default;
+
+  std::size_t size() const { return this->_nodes.size(); }
+
+  std::size_t node_index(const std::string &name) const {
+    auto node_index = this->_name_to_node_index.find(name);
+    if (node_index == this->_name_to_node_index.end()) {
+      throw std::runtime_error("Pipeline has no system named " + name);
+    }
+    return node_index->second;
+  }
+
+  // Percentile of the wall time of the last runs of the system in nanoseconds, see profiler::RollingSamples
+  double time_percentile(const std::string &name, double percentile) const {
+    return this->_nodes[this->node_index(name)].times.percentile(percentile);
+  }
+
+  // Every system has seen the changes at or before this tick
+  ChangeTick _min_last_run_tick() const {
+    ChangeTick min_last_run_tick = std::numeric_limits<ChangeTick>::max();
+    for (auto &node : this->_nodes) {
+      min_last_run_tick = std::min(min_last_run_tick, node.last_run_tick);
+    }
+    return min_last_run_tick;
+  }
+
+  // Graphviz graph with a cluster per stage, conflict edges are dashed and systems are labeled with their median time
+  void write_dot(std::ostream &stream) const {
+    stream << "digraph pipeline {\n  rankdir=LR;\n";
+    for (std::size_t stage_index = 0; stage_index < this->_stages.size(); stage_index++) {
+      stream << "  subgraph cluster_" << stage_index << " {\n    label=\"";
+      _write_escaped(stream, this->_stages[stage_index]);
+      stream << "\";\n";
+      for (std::size_t node_index = 0; node_index < this->_nodes.size(); node_index++) {
+        auto &node = this->_nodes[node_index];
+        if (node.stage_index != stage_index) {
+          continue;
+        }
+        stream << "    node_" << node_index << " [label=\"";
+        _write_escaped(stream, node.name);
+        stream << "\\n" << node.times.percentile(50) / 1e3 << " us\"];\n";
+      }
+      stream << "  }\n";
+    }
+    for (auto &edge : this->_edges) {
+      stream << "  node_" << edge.from << " -> node_" << edge.to
+             << (edge.kind == PipelineEdgeKind::CONFLICT ? " [style=dashed];\n" : ";\n");
+    }
+    stream << "}\n";
+  }
+
+  // Stages with their systems in topological order, the edges and the timings of every system in nanoseconds
+  void write_json(std::ostream &stream) const {
+    stream << "{\"stages\": [";
+    for (std::size_t stage_index = 0; stage_index < this->_stages.size(); stage_index++) {
+      stream << (stage_index > 0 ? ", " : "") << "{\"name\": \"";
+      _write_escaped(stream, this->_stages[stage_index]);
+      stream << "\", \"systems\": [";
+      auto &node_indices = this->_stage_to_node_indices.at(stage_index);
+      for (std::size_t position = 0; position < node_indices.size(); position++) {
+        auto &node = this->_nodes[node_indices[position]];
+        stream << (position > 0 ? ", " : "") << "\n    {\"name\": \"";
+        _write_escaped(stream, node.name);
+        stream << "\", \"runs\": " << node.num_runs << ", \"p50\": " << node.times.percentile(50)
+               << ", \"p95\": " << node.times.percentile(95) << ", \"max\": " << node.times.percentile(100) << "}";
+      }
+      stream << "]}";
+    }
+    stream << "],\n \"edges\": [";
+    for (std::size_t edge_index = 0; edge_index < this->_edges.size(); edge_index++) {
+      auto &edge = this->_edges[edge_index];
+      stream << (edge_index > 0 ? ", " : "") << "\n    {\"from\": \"";
+      _write_escaped(stream, this->_nodes[edge.from].name);
+      stream << "\", \"to\": \"";
+      _write_escaped(stream, this->_nodes[edge.to].name);
+      stream << "\", \"kind\": \"" << (edge.kind == PipelineEdgeKind::CONFLICT ? "conflict" : "order") << "\"}";
+    }
+    stream << "]}\n";
+  }
+
+  static void _write_escaped(std::ostream &stream, const std::string &name) {
+    for (auto character : name) {
+      stream << (character == '"' or character == '\\' ? "\\" : "") << character;
+    }
+  }
+};
+
+template <typename SystemTemplate>
+Pipeline<SystemTemplate> create_pipeline(std::size_t timing_window_size = 120) {
+  return Pipeline<SystemTemplate>(timing_window_size);
+}
+
+// Stages run in the order they are added
+template <typename SystemTemplate>
+Pipeline<SystemTemplate> add_stage(Pipeline<SystemTemplate> &pipeline, const std::string &stage) {
+  if (std::find(pipeline._stages.begin(), pipeline._stages.end(), stage) != pipeline._stages.end()) {
+    throw std::runtime_error("Pipeline already has a stage named " + stage);
+  }
+  pipeline._stages.push_back(stage);
+  pipeline._built = false;
+  return std::move(pipeline);
+}
+
+// access decides which systems of a stage can overlap in run_pipeline_in_parallel, systems that do not declare it
+// conflict with every other system
+template <typename SystemTemplate>
+Pipeline<SystemTemplate> add_system(Pipeline<SystemTemplate> &pipeline, const std::string &name, SystemTemplate system,
+                                    const std::string &stage, const SystemAccess &access = SystemAccess(),
+                                    const SystemOrder &order = SystemOrder()) {
+  auto stage_index = static_cast<std::size_t>(
+      std::distance(pipeline._stages.begin(), std::find(pipeline._stages.begin(), pipeline._stages.end(), stage)));
+  if (stage_index == pipeline._stages.size()) {
+    throw std::runtime_error("Pipeline has no stage named " + stage);
+  }
+  if (pipeline._name_to_node_index.count(name) > 0) {
+    throw std::runtime_error("Pipeline already has a system named " + name);
+  }
+  pipeline._name_to_node_index.emplace(name, pipeline._nodes.size());
+  pipeline._nodes.push_back(PipelineNode<SystemTemplate>{name, std::move(system), stage_index, access, order, {}, 0, 0,
+                                                         profiler::RollingSamples(pipeline._timing_window_size), 0});
+  pipeline._built = false;
+  return std::move(pipeline);
+}
+
+// Compiles the pipeline into a DAG per stage: the edges of the SystemOrder constraints, and edges between the systems
+// whose SystemAccess conflicts, in the topological order of the constraints. Ties are broken by the order in which
+// the systems were added. Throws if a constraint names an unknown system, contradicts the order of the stages or
+// closes a cycle.
+template <typename SystemTemplate> Pipeline<SystemTemplate> build_pipeline(Pipeline<SystemTemplate> &pipeline) {
+  auto &nodes = pipeline._nodes;
+  std::vector<PipelineEdge> order_edges;
+  auto add_order_edge = [&pipeline, &nodes, &order_edges](std::size_t from, std::size_t to) {
+    if (nodes[from].stage_index > nodes[to].stage_index) {
+      throw std::runtime_error("System " + nodes[from].name + " cannot run before " + nodes[to].name +
+                               " of an earlier stage");
+    }
+    if (nodes[from].stage_index == nodes[to].stage_index) {
+      order_edges.push_back(PipelineEdge{from, to, PipelineEdgeKind::ORDER});
+    }
+  };
+  for (std::size_t node_index = 0; node_index < nodes.size(); node_index++) {
+    for (auto &name : nodes[node_index].order._after) {
+      add_order_edge(pipeline.node_index(name), node_index);
+    }
+    for (auto &name : nodes[node_index].order._before) {
+      add_order_edge(node_index, pipeline.node_index(name));
+    }
+  }
+
+  std::vector<std::vector<std::size_t>> order_successors(nodes.size());
+  std::vector<std::size_t> num_order_predecessors(nodes.size(), 0);
+  for (auto &edge : order_edges) {
+    order_successors[edge.from].push_back(edge.to);
+    num_order_predecessors[edge.to] += 1;
+  }
+
+  std::vector<std::vector<std::size_t>> stage_to_node_indices(pipeline._stages.size());
+  for (std::size_t stage_index = 0; stage_index < pipeline._stages.size(); stage_index++) {
+    std::priority_queue<std::size_t, std::vector<std::size_t>, std::greater<>> ready_node_indices;
+    std::size_t num_stage_nodes = 0;
+    for (std::size_t node_index = 0; node_index < nodes.size(); node_index++) {
+      if (nodes[node_index].stage_index == stage_index) {
+        num_stage_nodes += 1;
+        if (num_order_predecessors[node_index] == 0) {
+          ready_node_indices.push(node_index);
+        }
+      }
+    }
+    auto &node_indices = stage_to_node_indices[stage_index];
+    while (not ready_node_indices.empty()) {
+      auto node_index = ready_node_indices.top();
+      ready_node_indices.pop();
+      node_indices.push_back(node_index);
+      for (auto successor : order_successors[node_index]) {
+        if (--num_order_predecessors[successor] == 0) {
+          ready_node_indices.push(successor);
+        }
+      }
+    }
+    if (node_indices.size() != num_stage_nodes) {
+      throw std::runtime_error("Systems of stage " + pipeline._stages[stage_index] + " have cyclic constraints");
+    }
+  }
+
+  auto edges = order_edges;
+  for (auto &node_indices : stage_to_node_indices) {
+    for (std::size_t position = 0; position < node_indices.size(); position++) {
+      for (std::size_t previous_position = 0; previous_position < position; previous_position++) {
+        auto from = node_indices[previous_position];
+        auto to = node_indices[position];
+        auto &successors = order_successors[from];
+        if (conflicts(nodes[from].access, nodes[to].access) and
+            std::find(successors.begin(), successors.end(), to) == successors.end()) {
+          edges.push_back(PipelineEdge{from, to, PipelineEdgeKind::CONFLICT});
+        }
+      }
+    }
+  }
+
+  for (auto &node : nodes) {
+    node.successors.clear();
+    node.num_predecessors = 0;
+  }
+  for (auto &edge : edges) {
+    nodes[edge.from].successors.push_back(edge.to);
+    nodes[edge.to].num_predecessors += 1;
+  }
+  pipeline._stage_to_node_indices = std::move(stage_to_node_indices);
+  pipeline._edges = std::move(edges);
+  pipeline._built = true;
+  return std::move(pipeline);
+}
+
+template <typename SystemTemplate, typename Function>
+void _run_pipeline_node(PipelineNode<SystemTemplate> &node, Function &&function) {
+  auto start = time_utils::now();
+  function();
+  node.times.add(time_utils::duration<std::chrono::nanoseconds>(start, time_utils::now()));
+  node.num_runs += 1;
+}
+
+// Runs the systems of every stage in topological order and applies the actions of the stage afterwards. Builds the
+// pipeline first if it changed since the last build_pipeline. The actions are kept in pipeline._frame_arena.
+// The change filters of every system see the writes since its previous run.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> run_pipeline(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Pipeline<SystemTemplate> &pipeline,
+    typename type_utils::type_identity<ProcessSystemIntoBufferFunction<
+        TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>>::type process_system,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action) {
+  if (not pipeline._built) {
+    pipeline = build_pipeline(pipeline);
+  }
+  // The arena is also reset when a system or an action throws, the actions are destroyed before either reset
+  try {
+    ActionBuffer<ActionTemplate> actions(memory_utils::ArenaAllocator<ActionTemplate>(pipeline._frame_arena));
+    for (auto &node_indices : pipeline._stage_to_node_indices) {
+      actions.clear();
+      for (auto node_index : node_indices) {
+        auto &node = pipeline._nodes[node_index];
+        ecdb._last_run_tick = node.last_run_tick;
+        _run_pipeline_node(node, [&] { process_system(ecdb, node.system, actions); });
+        node.last_run_tick = advance_change_tick(ecdb);
+      }
+      for (auto &action : actions) {
+        ecdb = process_action(ecdb, action);
+      }
+    }
+  } catch (...) {
+    pipeline._frame_arena.reset();
+    throw;
+  }
+  pipeline._frame_arena.reset();
+  ecdb = dispatch_events(ecdb);
+  prune_removals(ecdb, pipeline._min_last_run_tick());
+  return std::move(ecdb);
+}
+
+// Same as above for systems that return their actions
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> run_pipeline(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Pipeline<SystemTemplate> &pipeline,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action) {
+  using EntityComponentDatabaseType = EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>;
+  ProcessSystemIntoBufferFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>
+      process_system_into_buffer = [&process_system](EntityComponentDatabaseType &ecdb, SystemTemplate &system,
+                                                     ActionBuffer<ActionTemplate> &actions) {
+        auto system_actions = process_system(ecdb, system);
+        actions.insert(std::end(actions), std::begin(system_actions), std::end(system_actions));
+      };
+  return run_pipeline<TypeIndexTemplate, ComponentTemplate, SystemTemplate, ActionTemplate, StorageTemplate>(
+      ecdb, pipeline, std::move(process_system_into_buffer), std::move(process_action));
+}
+
+// Parallel counterpart of run_pipeline: a system of a stage starts as soon as the systems it depends on in the DAG are
+// done, so independent branches overlap on thread_pool. process_system is called concurrently and must only modify
+// the component types its system declared as written. The actions are applied in the same order as run_pipeline
+// applies them. The systems of a stage share the earliest last run of the stage, so they may see a change again.
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename SystemTemplate, typename ActionTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> run_pipeline_in_parallel(
+    EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+    Pipeline<SystemTemplate> &pipeline,
+    typename type_utils::type_identity<ProcessSystemFunction<TypeIndexTemplate, ComponentTemplate, SystemTemplate,
+                                                             ActionTemplate, StorageTemplate>>::type process_system,
+    typename type_utils::type_identity<
+        ProcessActionFunction<TypeIndexTemplate, ComponentTemplate, ActionTemplate, StorageTemplate>>::type
+        process_action,
+    ThreadPool &thread_pool) {
+  if (not pipeline._built) {
+    pipeline = build_pipeline(pipeline);
+  }
+  auto &nodes = pipeline._nodes;
+  std::vector<std::vector<ActionTemplate>> actions_per_node(nodes.size());
+  for (auto &node_indices : pipeline._stage_to_node_indices) {
+    ecdb._last_run_tick = std::numeric_limits<ChangeTick>::max();
+    for (auto node_index : node_indices) {
+      ecdb._last_run_tick = std::min(ecdb._last_run_tick, nodes[node_index].last_run_tick);
+    }
+
+    // Every worker takes the next ready node until the stage is done or a system threw
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::size_t> ready_node_indices;
+    std::vector<std::size_t> num_remaining_predecessors(nodes.size());
+    for (auto node_index : node_indices) {
+      num_remaining_predecessors[node_index] = nodes[node_index].num_predecessors;
+      if (nodes[node_index].num_predecessors == 0) {
+        ready_node_indices.push_back(node_index);
+      }
+    }
+    std::size_t num_done_nodes = 0;
+    bool failed = false;
+
+    auto work = [&] {
+      while (true) {
+        std::size_t node_index;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          condition.wait(lock, [&] {
+            return failed or num_done_nodes == node_indices.size() or not ready_node_indices.empty();
+          });
+          if (failed or num_done_nodes == node_indices.size()) {
+            return;
+          }
+          node_index = ready_node_indices.front();
+          ready_node_indices.pop_front();
+        }
+
+        auto &node = nodes[node_index];
+        try {
+          _run_pipeline_node(node, [&] { actions_per_node[node_index] = process_system(ecdb, node.system); });
+        } catch (...) {
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+          }
+          condition.notify_all();
+          throw;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          num_done_nodes += 1;
+          for (auto successor : node.successors) {
+            if (--num_remaining_predecessors[successor] == 0) {
+              ready_node_indices.push_back(successor);
+            }
+          }
+        }
+        condition.notify_all();
+      }
+    };
+    std::vector<ThreadPool::Task> tasks(std::min(node_indices.size(), thread_pool.size() + 1), work);
+    _run_deferring_change_marks(ecdb, tasks, thread_pool);
+
+    auto change_tick = advance_change_tick(ecdb);
+    for (auto node_index : node_indices) {
+      nodes[node_index].last_run_tick = change_tick;
+      for (auto &action : actions_per_node[node_index]) {
+        ecdb = process_action(ecdb, action);
+      }
+      actions_per_node[node_index].clear();
+    }
+  }
+  ecdb = dispatch_events(ecdb);
+  prune_removals(ecdb, pipeline._min_last_run_tick());
+  return std::move(ecdb);
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "ecs/time_utils.hpp"
+
+namespace ecs {
+namespace profiler {
+
+// Counting the entities that each and query visit costs an increment per entity, so it is only compiled in with
+// ECS_ENABLE_PROFILER. The flag must be the same in every translation unit of a program.
+#ifdef ECS_ENABLE_PROFILER
+constexpr bool COUNT_VISITED_ENTITIES = true;
+#else
+constexpr bool COUNT_VISITED_ENTITIES = false;
+#endif
+
+inline std::size_t &visited_entities_counter() {
+  thread_local std::size_t num_visited_entities = 0;
+  return num_visited_entities;
+}
+
+inline void count_visited_entities(std::size_t num_visited_entities) {
+  if constexpr (COUNT_VISITED_ENTITIES) {
+    visited_entities_counter() += num_visited_entities;
+  }
+}
+
+using Priority = int;
+using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+// Default policy of process_systems, every hook is empty so instrumentation compiles to nothing.
+// record_system is end_system for a system that ran on another thread, which measured it itself.
+struct NullProfiler {
+public:
+  static constexpr bool enabled = false;
+
+  void begin_frame() {}
+  void end_frame() {}
+  void begin_system() {}
+  void end_system(Priority, std::size_t, std::size_t) {}
+  void record_system(Priority, std::size_t, TimePoint, TimePoint, std::size_t, std::size_t) {}
+  void begin_apply() {}
+  void end_apply(Priority, std::size_t) {}
+};
+
+// Samples of the last window_size frames
+class RollingSamples {
+public:
+  std::vector<double> _samples;
+  std::size_t _window_size;
+  std::size_t _next_index;
+
+  explicit RollingSamples(std::size_t window_size = 0) {
+    this->_samples = {};
+    this->_window_size = std::max<std::size_t>(window_size, 1);
+    this->_next_index = 0;
+  }
+
+  std::size_t size() const { return this->_samples.size(); }
+
+  void add(double sample) {
+    if (this->_samples.size() < this->_window_size) {
+      this->_samples.push_back(sample);
+    } else {
+      this->_samples[this->_next_index] = sample;
+    }
+    this->_next_index = (this->_next_index + 1) % this->_window_size;
+  }
+
+  // Nearest-rank percentile, percentile is in [0, 100]. 0 if there are no samples.
+  double percentile(double percentile) const {
+    if (this->_samples.empty()) {
+      return 0;
+    }
+    auto samples = this->_samples;
+    auto rank = static_cast<std::size_t>(std::clamp(percentile, 0.0, 100.0) / 100.0 * (samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+  }
+};
+
+struct SystemRecord {
+public:
+  Priority priority;
+  std::size_t system_index;
+  std::size_t start_in_nanoseconds;
+  std::size_t time_in_nanoseconds;
+  std::size_t num_visited_entities;
+  std::size_t num_actions;
+};
+
+struct ApplyRecord {
+public:
+  Priority priority;
+  std::size_t start_in_nanoseconds;
+  std::size_t time_in_nanoseconds;
+  std::size_t num_actions;
+};
+
+// Start times are relative to the start of the capture
+struct FrameRecord {
+public:
+  std::size_t frame_index;
+  std::size_t start_in_nanoseconds;
+  std::size_t time_in_nanoseconds;
+  std::vector<SystemRecord> systems;
+  std::vector<ApplyRecord> applies;
+};
+
+// Records the wall time, visited entities and emitted actions of every system and the time it took to apply the
+// actions of every priority level. Keeps rolling percentiles over the last window_size frames and the full records of
+// the frames captured with capture(num_frames), which can be exported as a Chrome trace.
+// Systems are identified by their priority and their index among the systems with the same priority.
+class FrameProfiler {
+public:
+  static constexpr bool enabled = true;
+
+  using SystemKey = std::pair<Priority, std::size_t>;
+
+  std::size_t _window_size;
+  std::size_t _num_frames;
+  std::map<SystemKey, RollingSamples> _system_times;
+  std::map<SystemKey, RollingSamples> _system_visited_entities;
+  std::map<SystemKey, RollingSamples> _system_actions;
+  std::map<Priority, RollingSamples> _apply_times;
+  RollingSamples _frame_times;
+  std::map<SystemKey, std::string> _system_names;
+
+  std::size_t _num_frames_to_capture;
+  std::vector<FrameRecord> _captured_frames;
+  TimePoint _capture_start;
+
+  FrameRecord _frame;
+  TimePoint _frame_start;
+  TimePoint _section_start;
+  std::size_t _num_visited_entities_at_section_start;
+
+  explicit FrameProfiler(std::size_t window_size = 120) {
+    this->_window_size = window_size;
+    this->_num_frames = 0;
+    this->_system_times = {};
+    this->_system_visited_entities = {};
+    this->_system_actions = {};
+    this->_apply_times = {};
+    this->_frame_times = RollingSamples(window_size);
+    this->_system_names = {};
+    this->_num_frames_to_capture = 0;
+    this->_captured_frames = {};
+    this->_capture_start = time_utils::now();
+    this->_frame = FrameRecord{};
+    this->_frame_start = this->_capture_start;
+    this->_section_start = this->_capture_start;
+    this->_num_visited_entities_at_section_start = 0;
+  }
+
+  std::size_t num_frames() const { return this->_num_frames; }
+
+  void set_system_name(Priority priority, std::size_t system_index, std::string name) {
+    this->_system_names[{priority, system_index}] = std::move(name);
+  }
+
+  std::string system_name(Priority priority, std::size_t system_index) const {
+    auto name = this->_system_names.find({priority, system_index});
+    if (name != this->_system_names.end()) {
+      return name->second;
+    }
+    return "priority " + std::to_string(priority) + " system " + std::to_string(system_index);
+  }
+
+  // Keeps the records of the next num_frames frames, replaces the frames captured before
+  void capture(std::size_t num_frames) {
+    this->_num_frames_to_capture = num_frames;
+    this->_captured_frames.clear();
+    this->_capture_start = time_utils::now();
+  }
+
+  bool capturing() const { return this->_num_frames_to_capture > 0; }
+  const std::vector<FrameRecord> &captured_frames() const { return this->_captured_frames; }
+
+  double system_time_percentile(Priority priority, std::size_t system_index, double percentile) const {
+    return _percentile(this->_system_times, {priority, system_index}, percentile);
+  }
+  double system_visited_entities_percentile(Priority priority, std::size_t system_index, double percentile) const {
+    return _percentile(this->_system_visited_entities, {priority, system_index}, percentile);
+  }
+  double system_actions_percentile(Priority priority, std::size_t system_index, double percentile) const {
+    return _percentile(this->_system_actions, {priority, system_index}, percentile);
+  }
+  double apply_time_percentile(Priority priority, double percentile) const {
+    return _percentile(this->_apply_times, priority, percentile);
+  }
+  double frame_time_percentile(double percentile) const { return this->_frame_times.percentile(percentile); }
+
+  void begin_frame() {
+    this->_frame_start = time_utils::now();
+    this->_frame.frame_index = this->_num_frames;
+    this->_frame.start_in_nanoseconds = this->_since_capture_start(this->_frame_start);
+    this->_frame.systems.clear();
+    this->_frame.applies.clear();
+  }
+
+  void end_frame() {
+    auto end = time_utils::now();
+    this->_frame.time_in_nanoseconds = time_utils::duration<std::chrono::nanoseconds>(this->_frame_start, end);
+    this->_frame_times.add(this->_frame.time_in_nanoseconds);
+    this->_num_frames += 1;
+    if (this->_num_frames_to_capture > 0) {
+      this->_captured_frames.push_back(this->_frame);
+      this->_num_frames_to_capture -= 1;
+    }
+  }
+
+  void begin_system() {
+    this->_num_visited_entities_at_section_start = visited_entities_counter();
+    this->_section_start = time_utils::now();
+  }
+
+  void end_system(Priority priority, std::size_t system_index, std::size_t num_actions) {
+    auto num_visited_entities = visited_entities_counter() - this->_num_visited_entities_at_section_start;
+    this->record_system(priority, system_index, this->_section_start, time_utils::now(), num_visited_entities,
+                        num_actions);
+  }
+
+  void record_system(Priority priority, std::size_t system_index, TimePoint start, TimePoint end,
+                     std::size_t num_visited_entities, std::size_t num_actions) {
+    auto time = time_utils::duration<std::chrono::nanoseconds>(start, end);
+    SystemKey key = {priority, system_index};
+    this->_samples(this->_system_times, key).add(time);
+    this->_samples(this->_system_visited_entities, key).add(num_visited_entities);
+    this->_samples(this->_system_actions, key).add(num_actions);
+    this->_frame.systems.push_back(SystemRecord{priority, system_index, this->_since_capture_start(start), time,
+                                                num_visited_entities, num_actions});
+  }
+
+  void begin_apply() { this->_section_start = time_utils::now(); }
+
+  void end_apply(Priority priority, std::size_t num_actions) {
+    auto time = time_utils::duration<std::chrono::nanoseconds>(this->_section_start, time_utils::now());
+    this->_samples(this->_apply_times, priority).add(time);
+    this->_frame.applies.push_back(
+        ApplyRecord{priority, this->_since_capture_start(this->_section_start), time, num_actions});
+  }
+
+  // Trace Event Format, can be opened in chrome://tracing or Perfetto
+  void write_chrome_trace(std::ostream &stream) const {
+    auto write_event = [&stream](bool first, const std::string &name, std::size_t start, std::size_t time,
+                                 const std::vector<std::pair<std::string, std::size_t>> &args) {
+      stream << (first ? "\n" : ",\n") << "    {\"name\": \"";
+      for (auto character : name) {
+        stream << (character == '"' or character == '\\' ? "\\" : "") << character;
+      }
+      stream << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0"
+             << ", \"ts\": " << start / 1e3 << ", \"dur\": " << time / 1e3 << ", \"args\": {";
+      for (std::size_t index = 0; index < args.size(); index++) {
+        stream << (index > 0 ? ", " : "") << "\"" << args[index].first << "\": " << args[index].second;
+      }
+      stream << "}}";
+    };
+
+    stream << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [" << std::fixed;
+    bool first = true;
+    for (auto &frame : this->_captured_frames) {
+      write_event(first, "frame " + std::to_string(frame.frame_index), frame.start_in_nanoseconds,
+                  frame.time_in_nanoseconds, {});
+      first = false;
+      for (auto &system : frame.systems) {
+        write_event(false, this->system_name(system.priority, system.system_index), system.start_in_nanoseconds,
+                    system.time_in_nanoseconds,
+                    {{"visited_entities", system.num_visited_entities}, {"actions", system.num_actions}});
+      }
+      for (auto &apply : frame.applies) {
+        write_event(false, "apply priority " + std::to_string(apply.priority), apply.start_in_nanoseconds,
+                    apply.time_in_nanoseconds, {{"actions", apply.num_actions}});
+      }
+    }
+    stream << "\n]}\n" << std::defaultfloat;
+  }
+
+  template <typename Key> RollingSamples &_samples(std::map<Key, RollingSamples> &samples, const Key &key) {
+    auto samples_of_key = samples.find(key);
+    if (samples_of_key == samples.end()) {
+      samples_of_key = samples.emplace(key, RollingSamples(this->_window_size)).first;
+    }
+    return samples_of_key->second;
+  }
+
+  template <typename Key>
+  static double _percentile(const std::map<Key, RollingSamples> &samples, const Key &key, double percentile) {
+    auto samples_of_key = samples.find(key);
+    return samples_of_key == samples.end() ? 0 : samples_of_key->second.percentile(percentile);
+  }
+
+  std::size_t _since_capture_start(TimePoint time_point) const {
+    return time_point < this->_capture_start
+               ? 0
+               : time_utils::duration<std::chrono::nanoseconds>(this->_capture_start, time_point);
+  }
+};
+
+} // namespace profiler
+} // namespace ecs
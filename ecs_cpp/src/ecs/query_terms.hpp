@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ecs/type_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Query terms that can be mixed with plain component types, e.g. each<A, B, without<C>, maybe<D>>:
+//  - without<Ts...> skips entities that have any of Ts
+//  - maybe<Ts...> does not affect which entities match, Ts are passed as pointers that are null when missing
+// Change filters are relative to the last run of the system that runs the query (see EntityComponentDatabase):
+//  - added<Ts...> requires Ts like plain component types and only matches entities that got all of them since then
+//  - changed<Ts...> is the same for entities whose Ts were added or written since then
+//  - removed<T> matches once per removal of T since then, also for removed entities if there are no other
+//    required component types. It cannot be combined with added<> or changed<>.
+template <typename... ComponentTypes> struct without {};
+template <typename... ComponentTypes> struct maybe {};
+template <typename... ComponentTypes> struct added {};
+template <typename... ComponentTypes> struct changed {};
+template <typename ComponentType> struct removed {};
+
+struct EmptyQueryTerm {
+  using required = type_utils::type_list<>;
+  using excluded = type_utils::type_list<>;
+  using optional = type_utils::type_list<>;
+  using added = type_utils::type_list<>;
+  using changed = type_utils::type_list<>;
+  using removed = type_utils::type_list<>;
+};
+
+template <typename Term> struct QueryTerm : EmptyQueryTerm {
+  using required = type_utils::type_list<Term>;
+};
+
+template <typename... ComponentTypes> struct QueryTerm<without<ComponentTypes...>> : EmptyQueryTerm {
+  using excluded = type_utils::type_list<ComponentTypes...>;
+};
+
+template <typename... ComponentTypes> struct QueryTerm<maybe<ComponentTypes...>> : EmptyQueryTerm {
+  using optional = type_utils::type_list<ComponentTypes...>;
+};
+
+template <typename... ComponentTypes> struct QueryTerm<added<ComponentTypes...>> : EmptyQueryTerm {
+  using required = type_utils::type_list<ComponentTypes...>;
+  using added = type_utils::type_list<ComponentTypes...>;
+};
+
+template <typename... ComponentTypes> struct QueryTerm<changed<ComponentTypes...>> : EmptyQueryTerm {
+  using required = type_utils::type_list<ComponentTypes...>;
+  using changed = type_utils::type_list<ComponentTypes...>;
+};
+
+template <typename ComponentType> struct QueryTerm<removed<ComponentType>> : EmptyQueryTerm {
+  using removed = type_utils::type_list<ComponentType>;
+};
+
+template <typename... Terms> struct QueryTerms {
+  using required = type_utils::concat_t<typename QueryTerm<Terms>::required...>;
+  using excluded = type_utils::concat_t<typename QueryTerm<Terms>::excluded...>;
+  using optional = type_utils::concat_t<typename QueryTerm<Terms>::optional...>;
+  using added = type_utils::concat_t<typename QueryTerm<Terms>::added...>;
+  using changed = type_utils::concat_t<typename QueryTerm<Terms>::changed...>;
+  using removed = type_utils::concat_t<typename QueryTerm<Terms>::removed...>;
+
+  static constexpr bool tracks_changes = added::size > 0 or changed::size > 0 or removed::size > 0;
+  static constexpr bool plain = excluded::size == 0 and optional::size == 0 and not tracks_changes;
+
+  static_assert(removed::size <= 1, "Queries support a single removed<> term");
+  static_assert(removed::size == 0 or (added::size == 0 and changed::size == 0),
+                "removed<> cannot be combined with added<> or changed<>");
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
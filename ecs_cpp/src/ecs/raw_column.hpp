@@ -0,0 +1,289 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/sparse_set.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Thrown instead of moving the records or entities of a RawColumn while they are exported, see export_records()
+struct RecordsExportedError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Sparse set of fixed-size records whose layout is only known at runtime, e.g. components described by a NumPy dtype.
+// The records are packed back to back in the order of _dense_entities, so the whole column can be handed out as one
+// strided array without copying. Inserting or erasing records may move all of them, so like a bytearray the column
+// counts the arrays it has handed out and refuses to insert or erase records while any of them is alive.
+struct RawColumn {
+public:
+  using SparsePage = std::array<EntityIndex, SparseSet<std::byte>::PAGE_SIZE>;
+
+  std::size_t _record_size;
+  std::vector<std::unique_ptr<SparsePage>> _sparse_pages;
+  std::vector<Entity> _dense_entities;
+  memory_utils::CacheAlignedVector<std::byte> _dense_records;
+  std::size_t _num_exports;
+
+  explicit RawColumn(std::size_t record_size = 0) {
+    this->_record_size = record_size;
+    this->_sparse_pages = std::vector<std::unique_ptr<SparsePage>>();
+    this->_dense_entities = {};
+    this->_dense_records = memory_utils::CacheAlignedVector<std::byte>();
+    this->_num_exports = 0;
+  }
+
+  // The exports follow the records they point to
+  RawColumn(RawColumn &&other) noexcept
+      : _record_size(other._record_size), _sparse_pages(std::move(other._sparse_pages)),
+        _dense_entities(std::move(other._dense_entities)), _dense_records(std::move(other._dense_records)),
+        _num_exports(other._num_exports) {
+    other._num_exports = 0;
+  }
+
+  RawColumn &operator=(RawColumn &&other) {
+    if (this == &other) {
+      return *this;
+    }
+    this->_check_not_exported();
+    this->_record_size = other._record_size;
+    this->_sparse_pages = std::move(other._sparse_pages);
+    this->_dense_entities = std::move(other._dense_entities);
+    this->_dense_records = std::move(other._dense_records);
+    this->_num_exports = other._num_exports;
+    other._num_exports = 0;
+    return *this;
+  }
+
+  // Deep copy, only used by the Python wrapper build where the ecdb is copyable: pybind11 copies the ecdb that
+  // process_systems passes by reference to the Python process_system and process_action callbacks, and the ecdb that
+  // process_action returns. The copy has no exports.
+  RawColumn(const RawColumn &other) {
+    this->_num_exports = 0;
+    *this = other;
+  }
+
+  RawColumn &operator=(const RawColumn &other) {
+    if (this == &other) {
+      return *this;
+    }
+    this->_check_not_exported();
+    this->_record_size = other._record_size;
+    this->_sparse_pages.clear();
+    for (auto &page : other._sparse_pages) {
+      this->_sparse_pages.push_back(page == nullptr ? nullptr : std::make_unique<SparsePage>(*page));
+    }
+    this->_dense_entities = other._dense_entities;
+    this->_dense_records = other._dense_records;
+    return *this;
+  }
+
+  std::size_t record_size() const { return this->_record_size; }
+  std::size_t size() const { return this->_dense_entities.size(); }
+
+  const std::vector<Entity> &entities() const { return this->_dense_entities; }
+  std::byte *data() { return this->_dense_records.data(); }
+  const std::byte *data() const { return this->_dense_records.data(); }
+
+  std::size_t capacity() const { return this->_dense_entities.capacity(); }
+
+  // An array handed out over entities() or data() is alive until the matching release_records()
+  void export_records() { this->_num_exports += 1; }
+  void release_records() { this->_num_exports -= 1; }
+  bool exported() const { return this->_num_exports > 0; }
+
+  // Throws RecordsExportedError if inserting a record for the entity would have to move the records
+  void check_insert(const Entity &entity) const {
+    if (this->exported() and not this->contains(entity)) {
+      throw RecordsExportedError("Cannot add a component to a column while arrays of the column are alive");
+    }
+  }
+
+  // Throws RecordsExportedError if erasing the record of the entity would have to move the records
+  void check_erase(const Entity &entity) const {
+    if (this->exported() and this->contains(entity)) {
+      throw RecordsExportedError("Cannot remove a component from a column while arrays of the column are alive");
+    }
+  }
+
+  void reserve(std::size_t size) {
+    if (size > this->capacity()) {
+      this->_check_not_exported();
+    }
+    this->_dense_entities.reserve(size);
+    this->_dense_records.reserve(size * this->_record_size);
+  }
+
+  EntityIndex dense_index(const Entity &entity) const {
+    auto page_index = entity.index / SparseSet<std::byte>::PAGE_SIZE;
+    if (page_index >= this->_sparse_pages.size() or this->_sparse_pages[page_index] == nullptr) {
+      return NO_DENSE_INDEX;
+    }
+    auto dense_index = (*this->_sparse_pages[page_index])[entity.index % SparseSet<std::byte>::PAGE_SIZE];
+    if (dense_index == NO_DENSE_INDEX or this->_dense_entities[dense_index] != entity) {
+      return NO_DENSE_INDEX;
+    }
+    return dense_index;
+  }
+
+  bool contains(const Entity &entity) const { return this->dense_index(entity) != NO_DENSE_INDEX; }
+
+  const std::byte *find(const Entity &entity) const {
+    auto dense_index = this->dense_index(entity);
+    return dense_index == NO_DENSE_INDEX ? nullptr : this->_record(dense_index);
+  }
+
+  std::byte *find(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    return dense_index == NO_DENSE_INDEX ? nullptr : this->_record(dense_index);
+  }
+
+  const std::byte *at(const Entity &entity) const {
+    auto record = this->find(entity);
+    if (record == nullptr) {
+      throw std::out_of_range("Entity is not in RawColumn");
+    }
+    return record;
+  }
+
+  // Record of the entity to write to, a new record is zero-initialized
+  std::byte *insert(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index != NO_DENSE_INDEX) {
+      return this->_record(dense_index);
+    }
+    this->_check_not_exported();
+    dense_index = static_cast<EntityIndex>(this->_dense_entities.size());
+    this->_sparse_index(entity) = dense_index;
+    this->_dense_entities.push_back(entity);
+    this->_dense_records.resize(this->_dense_records.size() + this->_record_size);
+    return this->_record(dense_index);
+  }
+
+  // Copies record_size bytes from record, overwrites the record if the entity is already in the column
+  void insert(const Entity &entity, const void *record) {
+    std::memcpy(this->insert(entity), record, this->_record_size);
+  }
+
+  // Swap-and-pop removal, the last record takes the place of the removed one
+  bool erase(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index == NO_DENSE_INDEX) {
+      return false;
+    }
+    this->_check_not_exported();
+    auto last_dense_index = static_cast<EntityIndex>(this->_dense_entities.size() - 1);
+    if (dense_index != last_dense_index) {
+      auto &last_entity = this->_dense_entities[last_dense_index];
+      std::memcpy(this->_record(dense_index), this->_record(last_dense_index), this->_record_size);
+      this->_dense_entities[dense_index] = last_entity;
+      this->_sparse_index(last_entity) = dense_index;
+    }
+    this->_sparse_index(entity) = NO_DENSE_INDEX;
+    this->_dense_entities.pop_back();
+    this->_dense_records.resize(this->_dense_records.size() - this->_record_size);
+    return true;
+  }
+
+  void _check_not_exported() const {
+    if (this->exported()) {
+      throw RecordsExportedError("Cannot move the records of a column while arrays of the column are alive");
+    }
+  }
+
+  std::byte *_record(EntityIndex dense_index) { return this->_dense_records.data() + dense_index * this->_record_size; }
+
+  const std::byte *_record(EntityIndex dense_index) const {
+    return this->_dense_records.data() + dense_index * this->_record_size;
+  }
+
+  EntityIndex &_sparse_index(const Entity &entity) {
+    auto page_index = entity.index / SparseSet<std::byte>::PAGE_SIZE;
+    if (page_index >= this->_sparse_pages.size()) {
+      this->_sparse_pages.resize(page_index + 1);
+    }
+    auto &page = this->_sparse_pages[page_index];
+    if (page == nullptr) {
+      page = std::make_unique<SparsePage>();
+      page->fill(NO_DENSE_INDEX);
+    }
+    return (*page)[entity.index % SparseSet<std::byte>::PAGE_SIZE];
+  }
+};
+
+enum class RawCommandType : std::uint8_t { SET, REMOVE, DESTROY };
+
+// record_offset is the offset of the record of a SET command in RawCommandBuffer::_records
+template <typename TypeIndexTemplate> struct RawCommand {
+public:
+  RawCommandType command_type;
+  Entity entity;
+  TypeIndexTemplate component_type;
+  std::size_t record_offset;
+};
+
+// Commands for RawColumn components, recorded in batches of entities. The records of all SET commands are copied back
+// to back into one buffer, so recording a batch is one memcpy and no allocation per command.
+template <typename TypeIndexTemplate> struct RawCommandBuffer {
+public:
+  std::vector<RawCommand<TypeIndexTemplate>> _commands;
+  memory_utils::CacheAlignedVector<std::byte> _records;
+
+  explicit RawCommandBuffer() {
+    this->_commands = {};
+    this->_records = memory_utils::CacheAlignedVector<std::byte>();
+  }
+
+  std::size_t size() const { return this->_commands.size(); }
+  bool empty() const { return this->_commands.empty(); }
+
+  void clear() {
+    this->_commands.clear();
+    this->_records.clear();
+  }
+
+  const std::vector<RawCommand<TypeIndexTemplate>> &commands() const { return this->_commands; }
+
+  const std::byte *record(const RawCommand<TypeIndexTemplate> &command) const {
+    return this->_records.data() + command.record_offset;
+  }
+
+  // records holds num_entities records of record_size bytes, records[i] is the component of entities[i]
+  void set(const Entity *entities, std::size_t num_entities, const TypeIndexTemplate &component_type,
+           const std::byte *records, std::size_t record_size) {
+    auto record_offset = this->_records.size();
+    this->_records.insert(this->_records.end(), records, records + num_entities * record_size);
+    memory_utils::reserve_for_append(this->_commands, num_entities);
+    for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+      this->_commands.push_back({RawCommandType::SET, entities[entity_index], component_type,
+                                 record_offset + entity_index * record_size});
+    }
+  }
+
+  void remove(const Entity *entities, std::size_t num_entities, const TypeIndexTemplate &component_type) {
+    memory_utils::reserve_for_append(this->_commands, num_entities);
+    for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+      this->_commands.push_back({RawCommandType::REMOVE, entities[entity_index], component_type, 0});
+    }
+  }
+
+  void destroy(const Entity *entities, std::size_t num_entities) {
+    memory_utils::reserve_for_append(this->_commands, num_entities);
+    for (std::size_t entity_index = 0; entity_index < num_entities; entity_index++) {
+      this->_commands.push_back({RawCommandType::DESTROY, entities[entity_index], TypeIndexTemplate(), 0});
+    }
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,503 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ecs/component_registry.hpp"
+#include "ecs/entity.hpp"
+#include "ecs/hierarchy.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/variant_utils.hpp"
+
+// Binary snapshots of an EntityComponentDatabase whose ComponentTemplate is a std::variant. A snapshot file is laid out
+// as blocks that start at multiples of SNAPSHOT_ALIGNMENT:
+//   SnapshotHeader
+//   entity table: SnapshotEntitySlot per entity slot, followed by the free entity indices
+//   per alternative of the variant: the entities that have it (sorted by index) and their components
+//   SnapshotColumnHeader per alternative of the variant
+//   hierarchy: HierarchyEntry per entity with a parent, in breadth-first order so the children keep their order
+// Trivially copyable components are stored as a plain array, so a mapped snapshot hands out references into the file
+// without copying. Other component types need a SnapshotSerializer. All values are stored in native byte order.
+namespace ecs {
+namespace mutable_ecs {
+
+constexpr std::array<char, 8> SNAPSHOT_MAGIC = {'E', 'C', 'D', 'B', 'S', 'N', 'A', 'P'};
+constexpr std::uint32_t SNAPSHOT_VERSION = 3;
+constexpr std::size_t SNAPSHOT_ALIGNMENT = memory_utils::CACHE_LINE_SIZE;
+
+struct SnapshotHeader {
+public:
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t num_columns;
+  std::uint64_t file_size;
+  std::uint64_t num_entity_slots;
+  std::uint64_t num_free_entity_indices;
+  std::uint64_t entity_slots_offset;
+  std::uint64_t free_entity_indices_offset;
+  std::uint64_t columns_offset;
+  std::uint64_t num_hierarchy_entries;
+  std::uint64_t hierarchy_offset;
+};
+
+struct SnapshotEntitySlot {
+public:
+  std::uint32_t generation;
+  std::uint32_t alive;
+};
+
+enum class SnapshotColumnEncoding : std::uint32_t { RAW, SERIALIZED };
+
+// RAW columns store T[num_components], SERIALIZED columns store std::uint64_t offsets[num_components + 1] into the
+// bytes that follow them. stable_type_id is type_utils::get_stable_type_id<T>, so a snapshot is not loaded into a
+// variant whose alternatives were reordered or replaced.
+struct SnapshotColumnHeader {
+public:
+  SnapshotColumnEncoding encoding;
+  std::uint32_t component_size;
+  std::uint64_t stable_type_id;
+  std::uint64_t num_components;
+  std::uint64_t entities_offset;
+  std::uint64_t components_offset;
+  std::uint64_t components_size;
+};
+
+static_assert(sizeof(Entity) == 8 and std::is_trivially_copyable_v<Entity>, "Entities are mapped directly");
+static_assert(sizeof(HierarchyEntry) == 16 and std::is_trivially_copyable_v<HierarchyEntry>,
+              "Hierarchy entries are mapped directly");
+
+// (De)serializer of a component type that is not trivially copyable, specialize it as:
+//   template <> struct SnapshotSerializer<T> {
+//     static void serialize(const T &component, std::vector<char> &bytes); // appends the bytes of component
+//     static T deserialize(const char *bytes, std::size_t size);
+//   };
+// A specialization for a trivially copyable type replaces the raw encoding.
+template <typename T> struct SnapshotSerializer {};
+
+template <typename T, typename = void> struct has_snapshot_serializer : std::false_type {};
+template <typename T>
+struct has_snapshot_serializer<T, std::void_t<decltype(&SnapshotSerializer<T>::deserialize)>> : std::true_type {};
+
+template <typename T> constexpr bool is_raw_snapshot_component() {
+  return std::is_trivially_copyable_v<T> and not has_snapshot_serializer<T>::value;
+}
+
+template <typename T> constexpr SnapshotColumnEncoding snapshot_column_encoding() {
+  static_assert(std::is_trivially_copyable_v<T> or has_snapshot_serializer<T>::value,
+                "Component type is not trivially copyable and has no SnapshotSerializer");
+  static_assert(alignof(T) <= SNAPSHOT_ALIGNMENT, "Component type is aligned stricter than SNAPSHOT_ALIGNMENT");
+  return is_raw_snapshot_component<T>() ? SnapshotColumnEncoding::RAW : SnapshotColumnEncoding::SERIALIZED;
+}
+
+inline void _write_padding(std::ofstream &file, std::uint64_t &offset) {
+  static const std::array<char, SNAPSHOT_ALIGNMENT> padding = {};
+  auto padding_size = (SNAPSHOT_ALIGNMENT - offset % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT;
+  file.write(padding.data(), padding_size);
+  offset += padding_size;
+}
+
+// Writes an aligned block and returns its offset
+inline std::uint64_t _write_block(std::ofstream &file, std::uint64_t &offset, const void *data, std::size_t size) {
+  _write_padding(file, offset);
+  auto block_offset = offset;
+  file.write(static_cast<const char *>(data), size);
+  offset += size;
+  return block_offset;
+}
+
+template <typename T, typename EntityComponentDatabaseType>
+SnapshotColumnHeader _write_column(std::ofstream &file, std::uint64_t &offset,
+                                   const EntityComponentDatabaseType &ecdb) {
+  std::vector<std::pair<Entity, const T *>> entries;
+  ecdb._storage.template each<T>(
+      [&entries](const Entity &entity, const T &component) { entries.emplace_back(entity, &component); });
+  std::sort(entries.begin(), entries.end(),
+            [](const auto &entry_a, const auto &entry_b) { return entry_a.first.index < entry_b.first.index; });
+
+  std::vector<Entity> entities;
+  entities.reserve(entries.size());
+  for (auto &entry : entries) {
+    entities.push_back(entry.first);
+  }
+
+  SnapshotColumnHeader column_header;
+  column_header.encoding = snapshot_column_encoding<T>();
+  column_header.component_size = sizeof(T);
+  column_header.stable_type_id = type_utils::get_stable_type_id<T>();
+  column_header.num_components = entries.size();
+  column_header.entities_offset = _write_block(file, offset, entities.data(), entities.size() * sizeof(Entity));
+
+  if constexpr (is_raw_snapshot_component<T>()) {
+    std::vector<T> components;
+    components.reserve(entries.size());
+    for (auto &entry : entries) {
+      components.push_back(*entry.second);
+    }
+    column_header.components_size = components.size() * sizeof(T);
+    column_header.components_offset = _write_block(file, offset, components.data(), column_header.components_size);
+  } else {
+    std::vector<std::uint64_t> component_offsets = {0};
+    std::vector<char> bytes;
+    for (auto &entry : entries) {
+      SnapshotSerializer<T>::serialize(*entry.second, bytes);
+      component_offsets.push_back(bytes.size());
+    }
+    column_header.components_offset =
+        _write_block(file, offset, component_offsets.data(), component_offsets.size() * sizeof(std::uint64_t));
+    file.write(bytes.data(), bytes.size());
+    offset += bytes.size();
+    column_header.components_size = offset - column_header.components_offset;
+  }
+  return column_header;
+}
+
+template <typename EntityComponentDatabaseType, typename... Ts>
+std::vector<SnapshotColumnHeader> _write_columns(std::ofstream &file, std::uint64_t &offset,
+                                                 const EntityComponentDatabaseType &ecdb, std::variant<Ts...> *) {
+  return {_write_column<Ts>(file, offset, ecdb)...};
+}
+
+// Writes ecdb to path and returns the size of the snapshot in bytes
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::size_t save_snapshot(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                          const std::string &path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (not file) {
+    throw std::runtime_error("Cannot open snapshot file for writing: " + path);
+  }
+
+  SnapshotHeader header = {};
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.num_columns = std::variant_size_v<ComponentTemplate>;
+  header.num_entity_slots = ecdb._entity_slots.size();
+  header.num_free_entity_indices = ecdb._free_entity_indices.size();
+
+  // The header is written again once all offsets are known
+  std::uint64_t offset = 0;
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  offset += sizeof(header);
+
+  std::vector<SnapshotEntitySlot> entity_slots;
+  entity_slots.reserve(ecdb._entity_slots.size());
+  for (auto &entity_slot : ecdb._entity_slots) {
+    entity_slots.push_back(SnapshotEntitySlot{entity_slot.generation, entity_slot.alive});
+  }
+  header.entity_slots_offset =
+      _write_block(file, offset, entity_slots.data(), entity_slots.size() * sizeof(SnapshotEntitySlot));
+  header.free_entity_indices_offset = _write_block(file, offset, ecdb._free_entity_indices.data(),
+                                                   ecdb._free_entity_indices.size() * sizeof(EntityIndex));
+
+  auto column_headers = _write_columns(file, offset, ecdb, static_cast<ComponentTemplate *>(nullptr));
+  header.columns_offset =
+      _write_block(file, offset, column_headers.data(), column_headers.size() * sizeof(SnapshotColumnHeader));
+
+  // The roots of the breadth-first order have no parent to restore
+  std::vector<HierarchyEntry> hierarchy_entries;
+  ecdb._hierarchy.append_breadth_first_order(hierarchy_entries);
+  auto is_root = [](const HierarchyEntry &entry) { return entry.parent.index == NO_ENTITY_INDEX; };
+  hierarchy_entries.erase(std::remove_if(hierarchy_entries.begin(), hierarchy_entries.end(), is_root),
+                          hierarchy_entries.end());
+  header.num_hierarchy_entries = hierarchy_entries.size();
+  header.hierarchy_offset = _write_block(file, offset, hierarchy_entries.data(),
+                                         hierarchy_entries.size() * sizeof(HierarchyEntry));
+  header.file_size = offset;
+
+  file.seekp(0);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  if (not file) {
+    throw std::runtime_error("Cannot write snapshot file: " + path);
+  }
+  return offset;
+}
+
+// Components of one alternative of the variant inside a mapped snapshot, ordered by entity index.
+// component(i) is a reference into the mapping for raw columns and a deserialized copy otherwise.
+template <typename T> struct SnapshotColumn {
+public:
+  const Entity *_entities;
+  const char *_components;
+  std::size_t _size;
+
+  std::size_t size() const { return this->_size; }
+
+  const Entity &entity(std::size_t position) const { return this->_entities[position]; }
+
+  decltype(auto) component(std::size_t position) const {
+    if constexpr (is_raw_snapshot_component<T>()) {
+      return static_cast<const T &>(reinterpret_cast<const T *>(this->_components)[position]);
+    } else {
+      auto component_offsets = reinterpret_cast<const std::uint64_t *>(this->_components);
+      auto bytes = this->_components + (this->_size + 1) * sizeof(std::uint64_t);
+      return SnapshotSerializer<T>::deserialize(bytes + component_offsets[position],
+                                                component_offsets[position + 1] - component_offsets[position]);
+    }
+  }
+};
+
+enum class SnapshotLoadMode {
+  // pages are read when the snapshot is mapped
+  EAGER,
+  // pages are read on first access without read-ahead, so a query only reads the pages of its columns
+  LAZY
+};
+
+// Read-only memory mapping of a snapshot written by save_snapshot for the same ComponentTemplate
+template <typename ComponentTemplate> class MappedSnapshot {
+public:
+  static constexpr std::size_t NUM_COLUMNS = std::variant_size_v<ComponentTemplate>;
+
+  const char *_data;
+  std::size_t _size;
+
+  explicit MappedSnapshot(const std::string &path, SnapshotLoadMode load_mode = SnapshotLoadMode::EAGER) {
+    this->_data = nullptr;
+    this->_size = 0;
+
+    auto file_descriptor = ::open(path.c_str(), O_RDONLY);
+    if (file_descriptor < 0) {
+      throw std::runtime_error("Cannot open snapshot file: " + path);
+    }
+    struct stat file_status;
+    if (::fstat(file_descriptor, &file_status) != 0 or
+        static_cast<std::size_t>(file_status.st_size) < sizeof(SnapshotHeader)) {
+      ::close(file_descriptor);
+      throw std::runtime_error("Snapshot file is truncated: " + path);
+    }
+    this->_size = file_status.st_size;
+
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (load_mode == SnapshotLoadMode::EAGER) {
+      flags |= MAP_POPULATE;
+    }
+#endif
+    auto data = ::mmap(nullptr, this->_size, PROT_READ, flags, file_descriptor, 0);
+    ::close(file_descriptor);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("Cannot map snapshot file: " + path);
+    }
+    this->_data = static_cast<const char *>(data);
+    ::madvise(data, this->_size, load_mode == SnapshotLoadMode::EAGER ? MADV_WILLNEED : MADV_RANDOM);
+
+    try {
+      this->_validate();
+    } catch (...) {
+      ::munmap(data, this->_size);
+      throw;
+    }
+  }
+
+  MappedSnapshot(MappedSnapshot &&other) {
+    this->_data = std::exchange(other._data, nullptr);
+    this->_size = std::exchange(other._size, 0);
+  }
+  MappedSnapshot &operator=(MappedSnapshot &&) = delete;
+  MappedSnapshot(const MappedSnapshot &) = delete;
+  MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+  ~MappedSnapshot() {
+    if (this->_data != nullptr) {
+      ::munmap(const_cast<char *>(this->_data), this->_size);
+    }
+  }
+
+  const SnapshotHeader &header() const { return *reinterpret_cast<const SnapshotHeader *>(this->_data); }
+
+  // Number of entities in the snapshot
+  std::size_t size() const { return this->header().num_entity_slots - this->header().num_free_entity_indices; }
+
+  const SnapshotEntitySlot *_entity_slots() const {
+    return reinterpret_cast<const SnapshotEntitySlot *>(this->_data + this->header().entity_slots_offset);
+  }
+
+  const EntityIndex *_free_entity_indices() const {
+    return reinterpret_cast<const EntityIndex *>(this->_data + this->header().free_entity_indices_offset);
+  }
+
+  const HierarchyEntry *_hierarchy_entries() const {
+    return reinterpret_cast<const HierarchyEntry *>(this->_data + this->header().hierarchy_offset);
+  }
+
+  const SnapshotColumnHeader &_column_header(std::size_t column_index) const {
+    return reinterpret_cast<const SnapshotColumnHeader *>(this->_data + this->header().columns_offset)[column_index];
+  }
+
+  template <typename T> SnapshotColumn<T> column() const {
+    auto &column_header = this->_column_header(variant_utils::index_of<T, ComponentTemplate>::value);
+    return SnapshotColumn<T>{reinterpret_cast<const Entity *>(this->_data + column_header.entities_offset),
+                             this->_data + column_header.components_offset, column_header.num_components};
+  }
+
+  // Calls function(entity, component...) for every entity that has all of Args. Only the columns of Args are read.
+  template <typename... Args, typename Function> void each(Function &&function) const {
+    static_assert(sizeof...(Args) > 0, "each needs at least one component type");
+    this->_each(function, std::make_tuple(this->template column<Args>()...),
+                std::make_index_sequence<sizeof...(Args)>());
+  }
+
+  // Intersects the columns, which are all sorted by entity index, by walking them in lockstep
+  template <typename Function, typename Columns, std::size_t... Indices>
+  void _each(Function &function, const Columns &columns, std::index_sequence<Indices...>) const {
+    std::array<std::size_t, sizeof...(Indices)> positions = {};
+    auto &first_column = std::get<0>(columns);
+    for (; positions[0] < first_column.size(); positions[0]++) {
+      auto entity_index = first_column.entity(positions[0]).index;
+      auto advance = [entity_index](const auto &column, std::size_t &position) {
+        while (position < column.size() and column.entity(position).index < entity_index) {
+          position++;
+        }
+        return position < column.size() and column.entity(position).index == entity_index;
+      };
+      if ((advance(std::get<Indices>(columns), positions[Indices]) and ...)) {
+        function(first_column.entity(positions[0]), std::get<Indices>(columns).component(positions[Indices])...);
+      }
+    }
+  }
+
+  void _validate() const {
+    auto &header = this->header();
+    if (header.magic != SNAPSHOT_MAGIC) {
+      throw std::runtime_error("File is not a snapshot");
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+      throw std::runtime_error("Unsupported snapshot version " + std::to_string(header.version));
+    }
+    if (header.num_columns != NUM_COLUMNS) {
+      throw std::runtime_error("Snapshot was written for a different component type");
+    }
+    if (header.file_size != this->_size or
+        header.columns_offset + NUM_COLUMNS * sizeof(SnapshotColumnHeader) > this->_size or
+        header.entity_slots_offset + header.num_entity_slots * sizeof(SnapshotEntitySlot) > this->_size or
+        header.free_entity_indices_offset + header.num_free_entity_indices * sizeof(EntityIndex) > this->_size or
+        header.hierarchy_offset + header.num_hierarchy_entries * sizeof(HierarchyEntry) > this->_size) {
+      throw std::runtime_error("Snapshot file is truncated");
+    }
+    this->_validate_columns(static_cast<ComponentTemplate *>(nullptr));
+  }
+
+  template <typename... Ts> void _validate_columns(std::variant<Ts...> *) const {
+    (this->_validate_column<Ts>(), ...);
+  }
+
+  template <typename T> void _validate_column() const {
+    auto &column_header = this->_column_header(variant_utils::index_of<T, ComponentTemplate>::value);
+    if (column_header.stable_type_id != type_utils::get_stable_type_id<T>()) {
+      throw std::runtime_error("Snapshot was written for a different component type");
+    }
+    if (column_header.encoding != snapshot_column_encoding<T>() or
+        (column_header.encoding == SnapshotColumnEncoding::RAW and column_header.component_size != sizeof(T))) {
+      throw std::runtime_error("Snapshot was written for a different layout of a component type");
+    }
+    auto min_components_size = column_header.encoding == SnapshotColumnEncoding::RAW
+                                   ? column_header.num_components * sizeof(T)
+                                   : (column_header.num_components + 1) * sizeof(std::uint64_t);
+    if (column_header.entities_offset + column_header.num_components * sizeof(Entity) > this->_size or
+        column_header.components_offset + column_header.components_size > this->_size or
+        column_header.components_size < min_components_size) {
+      throw std::runtime_error("Snapshot file is truncated");
+    }
+    if (column_header.encoding == SnapshotColumnEncoding::SERIALIZED) {
+      this->_validate_component_offsets(column_header);
+    }
+  }
+
+  // component() trusts the offsets of SERIALIZED columns, so they have to start at 0, never decrease and end within
+  // the bytes of the column
+  void _validate_component_offsets(const SnapshotColumnHeader &column_header) const {
+    auto component_offsets = reinterpret_cast<const std::uint64_t *>(this->_data + column_header.components_offset);
+    auto num_bytes = column_header.components_size - (column_header.num_components + 1) * sizeof(std::uint64_t);
+    if (component_offsets[0] != 0) {
+      throw std::runtime_error("Snapshot file is corrupted");
+    }
+    for (std::size_t position = 0; position < column_header.num_components; position++) {
+      if (component_offsets[position + 1] < component_offsets[position]) {
+        throw std::runtime_error("Snapshot file is corrupted");
+      }
+    }
+    if (component_offsets[column_header.num_components] > num_bytes) {
+      throw std::runtime_error("Snapshot file is corrupted");
+    }
+  }
+};
+
+template <std::size_t... Indices, typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction, template <typename, typename> class StorageTemplate>
+void _load_columns(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                   const MappedSnapshot<ComponentTemplate> &snapshot, GetComponentTypeFunction,
+                   std::index_sequence<Indices...>) {
+  auto load_column = [&ecdb, &snapshot](auto index) {
+    using T = std::variant_alternative_t<decltype(index)::value, ComponentTemplate>;
+    auto column = snapshot.template column<T>();
+    for (std::size_t position = 0; position < column.size(); position++) {
+      ecdb = add_component<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate>(
+          ecdb, column.entity(position), ComponentTemplate(std::in_place_index<decltype(index)::value>,
+                                                           column.component(position)));
+    }
+  };
+  (load_column(std::integral_constant<std::size_t, Indices>()), ...);
+}
+
+// Copies a mapped snapshot into ecdb, which has to be empty. Entity handles, generations, the order in which indices
+// are reused and the parents and the order of the children of the entities are the same as in the saved ecdb.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+load_snapshot(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const MappedSnapshot<ComponentTemplate> &snapshot) {
+  if (not ecdb._entity_slots.empty()) {
+    throw std::runtime_error("Snapshots can only be loaded into an empty EntityComponentDatabase");
+  }
+
+  auto &header = snapshot.header();
+  ecdb._entity_slots.reserve(header.num_entity_slots);
+  for (std::size_t entity_index = 0; entity_index < header.num_entity_slots; entity_index++) {
+    auto &entity_slot = snapshot._entity_slots()[entity_index];
+    ecdb._entity_slots.push_back(EntitySlot{entity_slot.generation, entity_slot.alive != 0, ComponentSignature()});
+  }
+  ecdb._free_entity_indices.assign(snapshot._free_entity_indices(),
+                                   snapshot._free_entity_indices() + header.num_free_entity_indices);
+
+  _load_columns(ecdb, snapshot, GetComponentTypeFunction(),
+                std::make_index_sequence<MappedSnapshot<ComponentTemplate>::NUM_COLUMNS>());
+  for (std::size_t position = 0; position < header.num_hierarchy_entries; position++) {
+    auto &hierarchy_entry = snapshot._hierarchy_entries()[position];
+    ecdb = set_parent(ecdb, hierarchy_entry.entity, hierarchy_entry.parent);
+  }
+  // The entity slots were not created through the ecdb, so their entities are missing from the checksum
+  if (ecdb._checksum.enabled()) {
+    ecdb = enable_checksum(ecdb, ecdb._checksum._hash_component);
+  }
+  return std::move(ecdb);
+}
+
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+load_snapshot(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+              const std::string &path) {
+  return load_snapshot<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate>(
+      ecdb, MappedSnapshot<ComponentTemplate>(path, SnapshotLoadMode::EAGER));
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+constexpr EntityIndex NO_DENSE_INDEX = std::numeric_limits<EntityIndex>::max();
+
+// Sparse set of entities with one value per entity:
+//  - _dense_entities and _dense_values are packed and share the same order
+//  - the sparse index maps Entity::index to the position in the dense arrays and is allocated in pages,
+//    so ranges of indices that never had a value cost nothing
+template <typename ValueType> struct SparseSet {
+public:
+  static constexpr std::size_t PAGE_SIZE = 4096;
+
+  using SparsePage = std::array<EntityIndex, PAGE_SIZE>;
+
+  std::vector<std::unique_ptr<SparsePage>> _sparse_pages;
+  std::vector<Entity> _dense_entities;
+  memory_utils::CacheAlignedVector<ValueType> _dense_values;
+
+  explicit SparseSet() {
+    this->_sparse_pages = std::vector<std::unique_ptr<SparsePage>>();
+    this->_dense_entities = {};
+    this->_dense_values = memory_utils::CacheAlignedVector<ValueType>();
+  }
+  SparseSet(SparseSet &&) = default;
+  SparseSet &operator=(SparseSet &&) = default;
+  SparseSet(const SparseSet &) = delete;
+  SparseSet &operator=(const SparseSet &) = delete;
+
+  std::size_t size() const { return this->_dense_entities.size(); }
+
+  std::size_t capacity() const { return this->_dense_entities.capacity(); }
+
+  // Sizes the dense arrays for num_values values, the sparse pages are still allocated on first use
+  void reserve(std::size_t num_values) {
+    this->_dense_entities.reserve(num_values);
+    this->_dense_values.reserve(num_values);
+  }
+
+  EntityIndex dense_index(const Entity &entity) const {
+    auto page_index = entity.index / PAGE_SIZE;
+    if (page_index >= this->_sparse_pages.size() or this->_sparse_pages[page_index] == nullptr) {
+      return NO_DENSE_INDEX;
+    }
+    auto dense_index = (*this->_sparse_pages[page_index])[entity.index % PAGE_SIZE];
+    if (dense_index == NO_DENSE_INDEX or this->_dense_entities[dense_index] != entity) {
+      return NO_DENSE_INDEX;
+    }
+    return dense_index;
+  }
+
+  bool contains(const Entity &entity) const { return this->dense_index(entity) != NO_DENSE_INDEX; }
+
+  const ValueType *find(const Entity &entity) const {
+    auto dense_index = this->dense_index(entity);
+    return dense_index == NO_DENSE_INDEX ? nullptr : &this->_dense_values[dense_index];
+  }
+
+  ValueType *find(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    return dense_index == NO_DENSE_INDEX ? nullptr : &this->_dense_values[dense_index];
+  }
+
+  const ValueType &at(const Entity &entity) const {
+    auto value = this->find(entity);
+    if (value == nullptr) {
+      throw std::out_of_range("Entity is not in SparseSet");
+    }
+    return *value;
+  }
+
+  // Overwrites the value if the entity is already in the set
+  void insert(const Entity &entity, const ValueType &value) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index != NO_DENSE_INDEX) {
+      this->_dense_values[dense_index] = value;
+      return;
+    }
+    this->_sparse_index(entity) = static_cast<EntityIndex>(this->_dense_entities.size());
+    this->_dense_entities.push_back(entity);
+    this->_dense_values.push_back(value);
+  }
+
+  // Swap-and-pop removal, the last value takes the place of the removed one
+  bool erase(const Entity &entity) {
+    auto dense_index = this->dense_index(entity);
+    if (dense_index == NO_DENSE_INDEX) {
+      return false;
+    }
+    this->swap_dense(dense_index, static_cast<EntityIndex>(this->_dense_entities.size() - 1));
+    this->_sparse_index(entity) = NO_DENSE_INDEX;
+    this->_dense_entities.pop_back();
+    this->_dense_values.pop_back();
+    return true;
+  }
+
+  void swap_dense(EntityIndex dense_index_a, EntityIndex dense_index_b) {
+    if (dense_index_a == dense_index_b) {
+      return;
+    }
+    std::swap(this->_dense_entities[dense_index_a], this->_dense_entities[dense_index_b]);
+    std::swap(this->_dense_values[dense_index_a], this->_dense_values[dense_index_b]);
+    this->_sparse_index(this->_dense_entities[dense_index_a]) = dense_index_a;
+    this->_sparse_index(this->_dense_entities[dense_index_b]) = dense_index_b;
+  }
+
+  EntityIndex &_sparse_index(const Entity &entity) {
+    auto page_index = entity.index / PAGE_SIZE;
+    if (page_index >= this->_sparse_pages.size()) {
+      this->_sparse_pages.resize(page_index + 1);
+    }
+    auto &page = this->_sparse_pages[page_index];
+    if (page == nullptr) {
+      page = std::make_unique<SparsePage>();
+      page->fill(NO_DENSE_INDEX);
+    }
+    return (*page)[entity.index % PAGE_SIZE];
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
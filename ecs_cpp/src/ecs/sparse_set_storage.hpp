@@ -0,0 +1,458 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ecs/entity.hpp"
+#include "ecs/memory_utils.hpp"
+#include "ecs/sparse_set.hpp"
+#include "ecs/type_utils.hpp"
+#include "ecs/variant_utils.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+template <typename TypeIndexTemplate, typename ComponentTemplate> struct SparseSetStorage;
+
+// Every component type is stored in its own SparseSet pool of the concrete type, so ComponentTemplate has to be a
+// std::variant. Adding, removing and looking up a component are O(1) and do not move the other components of the
+// entity around.
+template <typename TypeIndexTemplate, typename... ComponentTypes>
+struct SparseSetStorage<TypeIndexTemplate, std::variant<ComponentTypes...>> {
+public:
+  using ComponentTemplate = std::variant<ComponentTypes...>;
+  using ComponentMask = std::bitset<sizeof...(ComponentTypes)>;
+
+  // Entities that have every component type of the group are kept in the first `size` slots of each owned pool and in
+  // the same order, so iterating the group is a linear walk over aligned arrays. A pool is owned by one group at most.
+  struct OwnedGroup {
+    ComponentMask mask;
+    std::size_t size;
+  };
+
+  static constexpr std::size_t NO_OWNED_GROUP = std::numeric_limits<std::size_t>::max();
+
+  // Queries walk owned groups or the smallest pool instead, see each()
+  static constexpr bool MATCHES_ENTITY_SIGNATURES = false;
+
+  std::tuple<SparseSet<ComponentTypes>...> _pools;
+  std::vector<OwnedGroup> _owned_groups;
+  std::array<std::size_t, sizeof...(ComponentTypes)> _pool_to_owned_group;
+  std::unordered_map<TypeIndexTemplate, std::size_t> _component_type_to_pool_index;
+
+  explicit SparseSetStorage() {
+    this->_pools = std::tuple<SparseSet<ComponentTypes>...>();
+    this->_owned_groups = {};
+    this->_pool_to_owned_group.fill(NO_OWNED_GROUP);
+    this->_component_type_to_pool_index = {
+        {type_utils::get_type_id<ComponentTypes>(), pool_index<ComponentTypes>()}...};
+  }
+
+  template <typename ComponentType> static constexpr std::size_t pool_index() {
+    return variant_utils::index_of<ComponentType, ComponentTemplate>::value;
+  }
+
+  template <typename ComponentType> SparseSet<ComponentType> &pool() {
+    return std::get<SparseSet<ComponentType>>(this->_pools);
+  }
+
+  template <typename ComponentType> const SparseSet<ComponentType> &pool() const {
+    return std::get<SparseSet<ComponentType>>(this->_pools);
+  }
+
+  void insert(const Entity &entity, const TypeIndexTemplate &, const ComponentTemplate &component) {
+    std::visit(
+        [this, &entity](const auto &value) {
+          using ComponentType = std::decay_t<decltype(value)>;
+          this->pool<ComponentType>().insert(entity, value);
+        },
+        component);
+
+    auto owned_group_index = this->_pool_to_owned_group[component.index()];
+    if (owned_group_index != NO_OWNED_GROUP) {
+      this->_enter_owned_group(owned_group_index, entity);
+    }
+  }
+
+  void erase(const Entity &entity, const TypeIndexTemplate &component_type) {
+    this->_erase(this->_component_type_to_pool_index.at(component_type), entity);
+  }
+
+  void erase_entity(const Entity &entity) {
+    for (std::size_t pool_index = 0; pool_index < sizeof...(ComponentTypes); pool_index++) {
+      this->_erase(pool_index, entity);
+    }
+  }
+
+  // Inserts components[i] into every one of entities, which have no components yet, one pool at a time. The entities
+  // enter the owned groups of the pools once all of their components are in.
+  void insert_entities(const std::vector<Entity> &entities, const std::vector<TypeIndexTemplate> &,
+                       const std::vector<ComponentTemplate> &components) {
+    for (auto &component : components) {
+      std::visit(
+          [this, &entities](const auto &value) {
+            using ComponentType = std::decay_t<decltype(value)>;
+            auto &pool = this->pool<ComponentType>();
+            memory_utils::reserve_for_append(pool, entities.size());
+            for (auto &entity : entities) {
+              pool.insert(entity, value);
+            }
+          },
+          component);
+    }
+
+    std::vector<std::size_t> owned_group_indices;
+    for (auto &component : components) {
+      auto owned_group_index = this->_pool_to_owned_group[component.index()];
+      if (owned_group_index != NO_OWNED_GROUP and
+          std::find(owned_group_indices.begin(), owned_group_indices.end(), owned_group_index) ==
+              owned_group_indices.end()) {
+        owned_group_indices.push_back(owned_group_index);
+      }
+    }
+    for (auto owned_group_index : owned_group_indices) {
+      for (auto &entity : entities) {
+        this->_enter_owned_group(owned_group_index, entity);
+      }
+    }
+  }
+
+  // Inserts or overwrites components[i] of component_type of entities[i], the pool is resolved once for all of them
+  void insert_components(const std::vector<Entity> &entities, const TypeIndexTemplate &,
+                         const std::vector<ComponentTemplate> &components) {
+    if (components.empty()) {
+      return;
+    }
+    std::visit(
+        [this, &entities, &components](const auto &first_value) {
+          using ComponentType = std::decay_t<decltype(first_value)>;
+          auto &pool = this->pool<ComponentType>();
+          for (std::size_t index = 0; index < entities.size(); index++) {
+            pool.insert(entities[index], std::get<ComponentType>(components[index]));
+          }
+        },
+        components.front());
+
+    auto owned_group_index = this->_pool_to_owned_group[components.front().index()];
+    if (owned_group_index != NO_OWNED_GROUP) {
+      for (auto &entity : entities) {
+        this->_enter_owned_group(owned_group_index, entity);
+      }
+    }
+  }
+
+  void erase_entities(std::span<const Entity> entities) {
+    for (auto &entity : entities) {
+      this->erase_entity(entity);
+    }
+  }
+
+  void reserve(const TypeIndexTemplate &component_type, std::size_t num_components) {
+    _for_each_pool(this->_pools, ComponentMask().set(this->_component_type_to_pool_index.at(component_type)),
+                   [num_components](auto &pool) { pool.reserve(num_components); });
+  }
+
+  ComponentTemplate get(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    using GetComponentFunction = ComponentTemplate (*)(const SparseSetStorage &, const Entity &);
+    static constexpr std::array<GetComponentFunction, sizeof...(ComponentTypes)> get_component_functions = {
+        &_get_component<ComponentTypes>...};
+
+    return get_component_functions[this->_component_type_to_pool_index.at(component_type)](*this, entity);
+  }
+
+  bool contains(const Entity &entity, const TypeIndexTemplate &component_type) const {
+    auto pool_index = this->_component_type_to_pool_index.find(component_type);
+    if (pool_index == this->_component_type_to_pool_index.end()) {
+      return false;
+    }
+    bool contains_entity = false;
+    _for_each_pool(this->_pools, ComponentMask().set(pool_index->second),
+                   [&contains_entity, &entity](const auto &pool) { contains_entity = pool.contains(entity); });
+    return contains_entity;
+  }
+
+  // Component of the concrete type ComponentType or null if the entity does not have it
+  template <typename ComponentType> ComponentType *find(const Entity &entity) {
+    return this->pool<ComponentType>().find(entity);
+  }
+
+  template <typename ComponentType> const ComponentType *find(const Entity &entity) const {
+    return this->pool<ComponentType>().find(entity);
+  }
+
+  template <typename... Args> static ComponentMask mask_of() {
+    ComponentMask mask;
+    (mask.set(pool_index<Args>()), ...);
+    return mask;
+  }
+
+  // Index of the owned group whose component types are exactly Args
+  template <typename... Args> std::size_t owned_group_of() const {
+    std::array<std::size_t, sizeof...(Args)> pool_indices = {pool_index<Args>()...};
+    auto owned_group_index = this->_pool_to_owned_group[pool_indices[0]];
+    if (owned_group_index != NO_OWNED_GROUP and this->_owned_groups[owned_group_index].mask != mask_of<Args...>()) {
+      return NO_OWNED_GROUP;
+    }
+    return owned_group_index;
+  }
+
+  // Calls function(entity, Args &...) for every entity that has all of Args.
+  // If Args are exactly the types of an owned group, the group is walked directly. Otherwise the smallest pool is
+  // iterated and the other pools are probed.
+  template <typename... Args, typename Function> void each(Function &&function) {
+    _each<Args...>(*this, function);
+  }
+
+  template <typename... Args, typename Function> void each(Function &&function) const {
+    _each<Args...>(*this, function);
+  }
+
+  // Lazily iterates the same entities as each()
+  template <typename... Args> class View {
+  public:
+    class Iterator {
+    public:
+      explicit Iterator(SparseSetStorage &storage, const std::vector<Entity> &entities, bool owned,
+                        std::size_t dense_index, std::size_t end_index)
+          : _storage(storage), _entities(entities), _owned(owned), _dense_index(dense_index), _end_index(end_index) {
+        this->_skip_incomplete_entities();
+      }
+
+      std::tuple<Entity, Args &...> operator*() const {
+        return std::tuple<Entity, Args &...>(this->_entities[this->_dense_index],
+                                             *std::get<Args *>(this->_components)...);
+      }
+
+      Iterator &operator++() {
+        this->_dense_index += 1;
+        this->_skip_incomplete_entities();
+        return *this;
+      }
+
+      bool operator==(const Iterator &other) const { return this->_dense_index == other._dense_index; }
+      bool operator!=(const Iterator &other) const { return this->_dense_index != other._dense_index; }
+
+      void _skip_incomplete_entities() {
+        if (this->_owned) {
+          if (this->_dense_index < this->_end_index) {
+            this->_components =
+                std::make_tuple(&this->_storage.template pool<Args>()._dense_values[this->_dense_index]...);
+          }
+          return;
+        }
+        for (; this->_dense_index < this->_end_index; this->_dense_index++) {
+          auto &entity = this->_entities[this->_dense_index];
+          this->_components = std::make_tuple(this->_storage.template pool<Args>().find(entity)...);
+          bool skip_entity = ((std::get<Args *>(this->_components) == nullptr) or ...);
+          if (not skip_entity) {
+            return;
+          }
+        }
+      }
+
+      SparseSetStorage &_storage;
+      const std::vector<Entity> &_entities;
+      bool _owned;
+      std::size_t _dense_index;
+      std::size_t _end_index;
+      std::tuple<Args *...> _components;
+    };
+
+    explicit View(SparseSetStorage &storage) : _storage(storage) {
+      std::array<const std::vector<Entity> *, sizeof...(Args)> entities = {&storage.pool<Args>()._dense_entities...};
+      auto owned_group_index = storage.template owned_group_of<Args...>();
+      this->_owned = owned_group_index != NO_OWNED_GROUP;
+      if (this->_owned) {
+        this->_entities = entities[0];
+        this->_size = storage._owned_groups[owned_group_index].size;
+      } else {
+        this->_entities = _smallest(entities);
+        this->_size = this->_entities->size();
+      }
+    }
+
+    Iterator begin() const { return Iterator(this->_storage, *this->_entities, this->_owned, 0, this->_size); }
+    Iterator end() const {
+      return Iterator(this->_storage, *this->_entities, this->_owned, this->_size, this->_size);
+    }
+
+    SparseSetStorage &_storage;
+    const std::vector<Entity> *_entities;
+    bool _owned;
+    std::size_t _size;
+  };
+
+  template <typename... Args> View<Args...> view() { return View<Args...>(*this); }
+
+  // Splits the entities that have all of Args into chunks of about grain_size entities and calls add_chunk(chunk) for
+  // every one of them, chunk(function) calls function(entity, Args &...) for the entities of the chunk.
+  // Owned groups are split at cache line boundaries of every pool of Args. Otherwise only the smallest pool is split
+  // at cache line boundaries, components in the other pools are probed and may share cache lines between chunks.
+  template <typename... Args, typename AddChunkFunction>
+  void chunk(std::size_t grain_size, AddChunkFunction &&add_chunk) {
+    auto owned_group_index = this->template owned_group_of<Args...>();
+    if (owned_group_index != NO_OWNED_GROUP) {
+      auto chunk_size = memory_utils::cache_line_aligned_chunk_size<Args...>(grain_size);
+      auto group_size = this->_owned_groups[owned_group_index].size;
+      for (std::size_t begin = 0; begin < group_size; begin += chunk_size) {
+        auto end = std::min(begin + chunk_size, group_size);
+        add_chunk([this, begin, end](auto &function) {
+          auto &group_entities = this->pool<std::tuple_element_t<0, std::tuple<Args...>>>()._dense_entities;
+          [&group_entities, &function, begin, end](auto &... values) {
+            for (std::size_t dense_index = begin; dense_index < end; dense_index++) {
+              function(group_entities[dense_index], values[dense_index]...);
+            }
+          }(this->pool<Args>()._dense_values...);
+        });
+      }
+      return;
+    }
+
+    std::array<const std::vector<Entity> *, sizeof...(Args)> entities = {&this->pool<Args>()._dense_entities...};
+    auto &smallest_entities = *_smallest(entities);
+    auto chunk_size = memory_utils::cache_line_aligned_chunk_size<Entity>(grain_size);
+    for (std::size_t begin = 0; begin < smallest_entities.size(); begin += chunk_size) {
+      auto end = std::min(begin + chunk_size, smallest_entities.size());
+      add_chunk([this, &smallest_entities, begin, end](auto &function) {
+        for (std::size_t dense_index = begin; dense_index < end; dense_index++) {
+          auto &entity = smallest_entities[dense_index];
+          auto components = std::make_tuple(this->pool<Args>().find(entity)...);
+          bool skip_entity =
+              std::apply([](auto... components) { return ((components == nullptr) or ...); }, components);
+          if (skip_entity) {
+            continue;
+          }
+          std::apply([&function, &entity](auto... components) { function(entity, *components...); }, components);
+        }
+      });
+    }
+  }
+
+  template <typename... Args, typename Self, typename Function> static void _each(Self &self, Function &function) {
+    std::array<const std::vector<Entity> *, sizeof...(Args)> entities = {
+        &self.template pool<Args>()._dense_entities...};
+    auto owned_group_index = self.template owned_group_of<Args...>();
+    if (owned_group_index != NO_OWNED_GROUP) {
+      auto group_size = self._owned_groups[owned_group_index].size;
+      auto &group_entities = *entities[0];
+      [&function, &group_entities, group_size](auto &... values) {
+        for (std::size_t dense_index = 0; dense_index < group_size; dense_index++) {
+          function(group_entities[dense_index], values[dense_index]...);
+        }
+      }(self.template pool<Args>()._dense_values...);
+      return;
+    }
+
+    for (auto &entity : *_smallest(entities)) {
+      auto components = std::make_tuple(self.template pool<Args>().find(entity)...);
+      bool skip_entity = std::apply([](auto... components) { return ((components == nullptr) or ...); }, components);
+      if (skip_entity) {
+        continue;
+      }
+      std::apply([&function, &entity](auto... components) { function(entity, *components...); }, components);
+    }
+  }
+
+  template <std::size_t NumPools>
+  static const std::vector<Entity> *_smallest(const std::array<const std::vector<Entity> *, NumPools> &entities) {
+    return *std::min_element(entities.begin(), entities.end(), [](auto entities_a, auto entities_b) {
+      return entities_a->size() < entities_b->size();
+    });
+  }
+
+  // Makes Args an owned group and sorts the entities that already have all of Args into it
+  template <typename... Args> void create_owned_group() {
+    ComponentMask mask;
+    (mask.set(pool_index<Args>()), ...);
+    for (std::size_t pool_index = 0; pool_index < sizeof...(ComponentTypes); pool_index++) {
+      if (mask.test(pool_index) and this->_pool_to_owned_group[pool_index] != NO_OWNED_GROUP) {
+        throw std::runtime_error("Component type is already owned by a group");
+      }
+    }
+
+    auto owned_group_index = this->_owned_groups.size();
+    this->_owned_groups.push_back(OwnedGroup{mask, 0});
+    for (std::size_t pool_index = 0; pool_index < sizeof...(ComponentTypes); pool_index++) {
+      if (mask.test(pool_index)) {
+        this->_pool_to_owned_group[pool_index] = owned_group_index;
+      }
+    }
+
+    std::array<const std::vector<Entity> *, sizeof...(Args)> entities = {&this->pool<Args>()._dense_entities...};
+    auto candidates = *entities[0];
+    for (auto &entity : candidates) {
+      this->_enter_owned_group(owned_group_index, entity);
+    }
+  }
+
+  template <typename ComponentType>
+  static ComponentTemplate _get_component(const SparseSetStorage &storage, const Entity &entity) {
+    return storage.pool<ComponentType>().at(entity);
+  }
+
+  template <typename Pools, typename Function>
+  static void _for_each_pool(Pools &pools, const ComponentMask &mask, Function &&function) {
+    _for_each_pool(pools, mask, function, std::index_sequence_for<ComponentTypes...>{});
+  }
+
+  template <typename Pools, typename Function, std::size_t... Indices>
+  static void _for_each_pool(Pools &pools, const ComponentMask &mask, Function &function,
+                             std::index_sequence<Indices...>) {
+    ((mask.test(Indices) ? (void)function(std::get<Indices>(pools)) : void()), ...);
+  }
+
+  void _erase(std::size_t pool_index, const Entity &entity) {
+    auto owned_group_index = this->_pool_to_owned_group[pool_index];
+    if (owned_group_index != NO_OWNED_GROUP) {
+      this->_leave_owned_group(owned_group_index, entity);
+    }
+    _for_each_pool(this->_pools, ComponentMask().set(pool_index), [&entity](auto &pool) { pool.erase(entity); });
+  }
+
+  void _enter_owned_group(std::size_t owned_group_index, const Entity &entity) {
+    auto &owned_group = this->_owned_groups[owned_group_index];
+
+    bool has_all_components = true;
+    auto dense_index = NO_DENSE_INDEX;
+    _for_each_pool(this->_pools, owned_group.mask, [&](auto &pool) {
+      dense_index = pool.dense_index(entity);
+      has_all_components &= dense_index != NO_DENSE_INDEX;
+    });
+    if (not has_all_components or dense_index < owned_group.size) {
+      return;
+    }
+
+    _for_each_pool(this->_pools, owned_group.mask,
+                   [&](auto &pool) { pool.swap_dense(pool.dense_index(entity), owned_group.size); });
+    owned_group.size += 1;
+  }
+
+  void _leave_owned_group(std::size_t owned_group_index, const Entity &entity) {
+    auto &owned_group = this->_owned_groups[owned_group_index];
+
+    bool in_owned_group = true;
+    _for_each_pool(this->_pools, owned_group.mask, [&](auto &pool) {
+      auto dense_index = pool.dense_index(entity);
+      in_owned_group &= dense_index != NO_DENSE_INDEX and dense_index < owned_group.size;
+    });
+    if (not in_owned_group) {
+      return;
+    }
+
+    _for_each_pool(this->_pools, owned_group.mask,
+                   [&](auto &pool) { pool.swap_dense(pool.dense_index(entity), owned_group.size - 1); });
+    owned_group.size -= 1;
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
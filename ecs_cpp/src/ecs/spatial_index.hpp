@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ecs/component_signature.hpp"
+#include "ecs/entity.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+struct SpatialPoint {
+public:
+  float x;
+  float y;
+};
+
+// Axis-aligned box, min and max are inclusive
+struct SpatialBox {
+public:
+  SpatialPoint min;
+  SpatialPoint max;
+};
+
+// Uniform grid over the points of the entities that have the component type with signature bit _bit. Every cell keeps
+// its entities with their points in a dense array and every entity index keeps its cell and position in it, so
+// updates and erasures are O(1). Cells are kept when they become empty, so entities moving between cells do not
+// allocate once the cells they move through exist.
+// cell_size should be about the radius of the typical query: a query visits the cells its box overlaps.
+template <typename ComponentTemplate> class SpatialIndex {
+public:
+  using GetPointFunction = std::function<SpatialPoint(const ComponentTemplate &)>;
+  using CellKey = std::uint64_t;
+
+  static constexpr std::size_t NOT_INDEXED = std::numeric_limits<std::size_t>::max();
+
+  struct SpatialEntry {
+  public:
+    Entity entity;
+    SpatialPoint point;
+  };
+
+  struct SpatialSlot {
+  public:
+    CellKey cell_key;
+    std::size_t position;
+  };
+
+  // NO_SIGNATURE_BIT while the index is not bound, every write then costs a single comparison
+  std::size_t _bit;
+  float _cell_size;
+  GetPointFunction _get_point;
+  std::unordered_map<CellKey, std::vector<SpatialEntry>> _cells;
+  std::vector<SpatialSlot> _entity_index_to_slot;
+  std::size_t _size;
+
+  explicit SpatialIndex() {
+    this->_bit = NO_SIGNATURE_BIT;
+    this->_cell_size = 1;
+    this->_get_point = {};
+    this->_cells = {};
+    this->_entity_index_to_slot = {};
+    this->_size = 0;
+  }
+
+  explicit SpatialIndex(std::size_t bit, float cell_size, GetPointFunction get_point) {
+    if (not(cell_size > 0)) {
+      throw std::runtime_error("Cell size of SpatialIndex must be a positive number!");
+    }
+    this->_bit = bit;
+    this->_cell_size = cell_size;
+    this->_get_point = std::move(get_point);
+    this->_cells = {};
+    this->_entity_index_to_slot = {};
+    this->_size = 0;
+  }
+
+  std::size_t size() const { return this->_size; }
+
+  bool contains(EntityIndex entity_index) const {
+    return entity_index < this->_entity_index_to_slot.size() and
+           this->_entity_index_to_slot[entity_index].position != NOT_INDEXED;
+  }
+
+  // Coordinates beyond the grid, e.g. the bounds of an unbounded query, fall in its outermost cells, NaN in the lowest
+  std::int32_t _cell_coordinate(float coordinate) const {
+    auto cell_coordinate = std::floor(static_cast<double>(coordinate) / this->_cell_size);
+    if (not(cell_coordinate >= std::numeric_limits<std::int32_t>::min())) {
+      return std::numeric_limits<std::int32_t>::min();
+    }
+    if (cell_coordinate > std::numeric_limits<std::int32_t>::max()) {
+      return std::numeric_limits<std::int32_t>::max();
+    }
+    return static_cast<std::int32_t>(cell_coordinate);
+  }
+
+  static CellKey _cell_key(std::int64_t cell_x, std::int64_t cell_y) {
+    return (static_cast<CellKey>(static_cast<std::uint32_t>(cell_x)) << 32) | static_cast<std::uint32_t>(cell_y);
+  }
+
+  // Inserts or moves the entity after the component with bit was written to it. Throws if the point of the component
+  // is not finite, the entity is then left out of the index.
+  void update(const Entity &entity, std::size_t bit, const ComponentTemplate &component) {
+    if (bit != this->_bit) {
+      return;
+    }
+    auto point = this->_get_point(component);
+    if (not std::isfinite(point.x) or not std::isfinite(point.y)) {
+      this->erase_entity(entity.index);
+      throw std::runtime_error("Point of SpatialIndex must be finite!");
+    }
+    auto cell_key = _cell_key(this->_cell_coordinate(point.x), this->_cell_coordinate(point.y));
+    if (this->contains(entity.index)) {
+      auto &slot = this->_entity_index_to_slot[entity.index];
+      if (slot.cell_key == cell_key) {
+        this->_cells[cell_key][slot.position] = SpatialEntry{entity, point};
+        return;
+      }
+      this->_erase(entity.index);
+    }
+    if (entity.index >= this->_entity_index_to_slot.size()) {
+      this->_entity_index_to_slot.resize(entity.index + 1, SpatialSlot{0, NOT_INDEXED});
+    }
+    auto &cell = this->_cells[cell_key];
+    this->_entity_index_to_slot[entity.index] = SpatialSlot{cell_key, cell.size()};
+    cell.push_back(SpatialEntry{entity, point});
+    this->_size += 1;
+  }
+
+  // Erases the entity after the component with bit was removed from it
+  void erase(EntityIndex entity_index, std::size_t bit) {
+    if (bit == this->_bit and this->contains(entity_index)) {
+      this->_erase(entity_index);
+    }
+  }
+
+  void erase_entity(EntityIndex entity_index) {
+    if (this->contains(entity_index)) {
+      this->_erase(entity_index);
+    }
+  }
+
+  void _erase(EntityIndex entity_index) {
+    auto &slot = this->_entity_index_to_slot[entity_index];
+    auto &cell = this->_cells[slot.cell_key];
+    cell[slot.position] = cell.back();
+    this->_entity_index_to_slot[cell[slot.position].entity.index].position = slot.position;
+    cell.pop_back();
+    slot.position = NOT_INDEXED;
+    this->_size -= 1;
+  }
+
+  // Calls function(entity, point) for every entity whose point is inside box, the bounds of box may be infinite
+  template <typename Function> void for_each_in_box(const SpatialBox &box, Function &&function) const {
+    // Also true if a bound is NaN, which no point is inside of
+    if (not(box.min.x <= box.max.x and box.min.y <= box.max.y)) {
+      return;
+    }
+    auto visit_cell = [&box, &function](const std::vector<SpatialEntry> &cell) {
+      for (auto &[entity, point] : cell) {
+        if (point.x >= box.min.x and point.x <= box.max.x and point.y >= box.min.y and point.y <= box.max.y) {
+          function(entity, point);
+        }
+      }
+    };
+
+    auto min_x = this->_cell_coordinate(box.min.x);
+    auto max_x = this->_cell_coordinate(box.max.x);
+    auto min_y = this->_cell_coordinate(box.min.y);
+    auto max_y = this->_cell_coordinate(box.max.y);
+    // Boxes that overlap more cells than exist are answered by visiting every cell instead
+    auto num_overlapped_cells = (static_cast<double>(max_x) - min_x + 1) * (static_cast<double>(max_y) - min_y + 1);
+    if (num_overlapped_cells > this->_cells.size()) {
+      for (auto &[cell_key, cell] : this->_cells) {
+        visit_cell(cell);
+      }
+      return;
+    }
+    // 64 bit, so the loops end at the outermost cells
+    for (std::int64_t cell_x = min_x; cell_x <= max_x; cell_x++) {
+      for (std::int64_t cell_y = min_y; cell_y <= max_y; cell_y++) {
+        auto cell = this->_cells.find(_cell_key(cell_x, cell_y));
+        if (cell != this->_cells.end()) {
+          visit_cell(cell->second);
+        }
+      }
+    }
+  }
+
+  // Calls function(entity, point) for every entity whose point is at most radius away from center
+  template <typename Function>
+  void for_each_in_radius(const SpatialPoint &center, float radius, Function &&function) const {
+    auto squared_radius = radius * radius;
+    SpatialBox box{{center.x - radius, center.y - radius}, {center.x + radius, center.y + radius}};
+    this->for_each_in_box(box, [&](const Entity &entity, const SpatialPoint &point) {
+      auto dx = point.x - center.x;
+      auto dy = point.y - center.y;
+      if (dx * dx + dy * dy <= squared_radius) {
+        function(entity, point);
+      }
+    });
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
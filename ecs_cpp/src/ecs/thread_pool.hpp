@@ -0,0 +1,194 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ecs {
+namespace mutable_ecs {
+
+// Work-stealing thread pool. Every worker owns a deque of tasks: it pops its own tasks from the back and, once it
+// runs out, steals from the front of the other deques. The thread that calls run() helps with the tasks until none of
+// them is left to take, so run() can be called from inside a task without deadlocking, and then sleeps until the last
+// of them is done.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<TaskQueue>> _task_queues;
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::atomic<std::size_t> _num_queued_tasks;
+  std::atomic<std::size_t> _next_task_queue;
+  bool _stop;
+
+  // A pool without threads runs every task on the thread that calls run()
+  explicit ThreadPool(std::size_t num_threads = std::thread::hardware_concurrency()) {
+    this->_task_queues = std::vector<std::unique_ptr<TaskQueue>>();
+    this->_threads = std::vector<std::thread>();
+    this->_num_queued_tasks = 0;
+    this->_next_task_queue = 0;
+    this->_stop = false;
+
+    for (std::size_t thread_index = 0; thread_index < num_threads; thread_index++) {
+      this->_task_queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (std::size_t thread_index = 0; thread_index < num_threads; thread_index++) {
+      this->_threads.emplace_back([this, thread_index] { this->_work(thread_index); });
+    }
+  }
+
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(this->_mutex);
+      this->_stop = true;
+    }
+    this->_condition.notify_all();
+    for (auto &thread : this->_threads) {
+      thread.join();
+    }
+  }
+
+  std::size_t size() const { return this->_threads.size(); }
+
+  // Runs every task and returns once all of them are done. If tasks throw, the first exception is rethrown.
+  void run(std::vector<Task> &tasks) {
+    if (tasks.empty()) {
+      return;
+    }
+    if (this->_task_queues.empty()) {
+      for (auto &task : tasks) {
+        task();
+      }
+      return;
+    }
+
+    // Guards num_remaining_tasks and exception. The last task notifies while holding the mutex, so run() cannot
+    // return and destroy the condition variable before the notification is done.
+    std::mutex mutex;
+    std::condition_variable done_condition;
+    std::size_t num_remaining_tasks = tasks.size();
+    std::exception_ptr exception = nullptr;
+
+    for (auto &task : tasks) {
+      this->_push([&task, &mutex, &done_condition, &num_remaining_tasks, &exception] {
+        std::exception_ptr task_exception = nullptr;
+        try {
+          task();
+        } catch (...) {
+          task_exception = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (exception == nullptr) {
+          exception = task_exception;
+        }
+        num_remaining_tasks -= 1;
+        if (num_remaining_tasks == 0) {
+          done_condition.notify_all();
+        }
+      });
+    }
+
+    // Every task of this call is queued before the first steal, so once nothing can be stolen the remaining tasks
+    // are running on other threads and waiting for them cannot deadlock
+    Task task;
+    while (this->_steal(this->_task_queues.size(), task)) {
+      task();
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done_condition.wait(lock, [&num_remaining_tasks] { return num_remaining_tasks == 0; });
+
+    if (exception != nullptr) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  void _push(Task task) {
+    auto &task_queue = *this->_task_queues[this->_next_task_queue++ % this->_task_queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(task_queue.mutex);
+      task_queue.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(this->_mutex);
+      this->_num_queued_tasks += 1;
+    }
+    this->_condition.notify_one();
+  }
+
+  bool _pop(std::size_t thread_index, Task &task) {
+    auto &task_queue = *this->_task_queues[thread_index];
+    std::lock_guard<std::mutex> lock(task_queue.mutex);
+    if (task_queue.tasks.empty()) {
+      return false;
+    }
+    task = std::move(task_queue.tasks.back());
+    task_queue.tasks.pop_back();
+    this->_num_queued_tasks -= 1;
+    return true;
+  }
+
+  // Takes the oldest task of any queue other than the one of thread_index
+  bool _steal(std::size_t thread_index, Task &task) {
+    auto num_task_queues = this->_task_queues.size();
+    for (std::size_t offset = 1; offset <= num_task_queues; offset++) {
+      auto victim_index = (thread_index + offset) % num_task_queues;
+      if (victim_index == thread_index) {
+        continue;
+      }
+      auto &task_queue = *this->_task_queues[victim_index];
+      std::lock_guard<std::mutex> lock(task_queue.mutex);
+      if (task_queue.tasks.empty()) {
+        continue;
+      }
+      task = std::move(task_queue.tasks.front());
+      task_queue.tasks.pop_front();
+      this->_num_queued_tasks -= 1;
+      return true;
+    }
+    return false;
+  }
+
+  void _work(std::size_t thread_index) {
+    while (true) {
+      Task task;
+      if (this->_pop(thread_index, task) or this->_steal(thread_index, task)) {
+        task();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_condition.wait(lock, [this] { return this->_stop or this->_num_queued_tasks > 0; });
+      if (this->_stop) {
+        return;
+      }
+    }
+  }
+};
+
+// Thread pool shared by the parallel algorithms that are not given one explicitly
+inline ThreadPool &default_thread_pool() {
+  static ThreadPool thread_pool;
+  return thread_pool;
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
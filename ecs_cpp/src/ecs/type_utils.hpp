@@ -1,22 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <variant>
+
 namespace ecs {
 namespace type_utils {
 
+inline std::atomic_int TypeIdCounter;
 
-std::atomic_int TypeIdCounter;
-
-template<typename T>
-std::size_t get_type_id() {
-    static std::size_t id = TypeIdCounter++;
-    return id;
+// Ids in the order of first use, so they differ between runs and binaries. This is the fallback for open sets of
+// component types, the alternatives of a std::variant also have constexpr indices and stable ids in ComponentRegistry.
+template <typename T> std::size_t get_type_id() {
+  static std::size_t id = TypeIdCounter++;
+  return id;
 }
 
 struct GetTypeIndexVisitor {
-  template <typename T> std::size_t operator()(T &&) { return get_type_id<T>(); }
+  template <typename T> std::size_t operator()(T &&) { return get_type_id<std::decay_t<T>>(); }
 };
 
 template <class V> std::size_t get_variant_type(V const &v) { return std::visit(GetTypeIndexVisitor{}, v); }
 
 template <typename T> struct type_identity { using type = T; };
 
+template <typename... Ts> struct type_list { static constexpr std::size_t size = sizeof...(Ts); };
+
+template <typename... TypeLists> struct concat;
+
+template <> struct concat<> { using type = type_list<>; };
+
+template <typename... Ts> struct concat<type_list<Ts...>> { using type = type_list<Ts...>; };
+
+template <typename... Ts, typename... Us, typename... TypeLists>
+struct concat<type_list<Ts...>, type_list<Us...>, TypeLists...> {
+  using type = typename concat<type_list<Ts..., Us...>, TypeLists...>::type;
+};
+
+template <typename... TypeLists> using concat_t = typename concat<TypeLists...>::type;
+
 } // namespace type_utils
 } // namespace ecs
\ No newline at end of file
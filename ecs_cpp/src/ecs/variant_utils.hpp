@@ -1,3 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <variant>
+
 namespace ecs {
 namespace variant_utils {
 
@@ -6,5 +12,15 @@ template <class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 // explicit deduction guide (not needed as of C++20)
 template <class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
+// index of the alternative T in std::variant<Ts...>
+template <typename T, typename Variant> struct index_of;
+
+template <typename T, typename... Ts>
+struct index_of<T, std::variant<T, Ts...>> : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename U, typename... Ts>
+struct index_of<T, std::variant<U, Ts...>>
+    : std::integral_constant<std::size_t, 1 + index_of<T, std::variant<Ts...>>::value> {};
+
 } // namespace variant_utils
 } // namespace ecs
\ No newline at end of file
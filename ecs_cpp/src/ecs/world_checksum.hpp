@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ecs/component_registry.hpp"
+#include "ecs/component_signature.hpp"
+#include "ecs/entity.hpp"
+
+namespace ecs {
+namespace mutable_ecs {
+
+// splitmix64 finalizer
+constexpr std::uint64_t mix_hash(std::uint64_t hash) {
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111eb;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+constexpr std::uint64_t combine_hashes(std::uint64_t seed, std::uint64_t hash) {
+  return mix_hash(seed ^ (hash + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2)));
+}
+
+inline std::uint64_t hash_bytes(const void *data, std::size_t size) {
+  auto bytes = static_cast<const char *>(data);
+  std::uint64_t hash = size;
+  for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), bytes += sizeof(std::uint64_t)) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes, sizeof(std::uint64_t));
+    hash = combine_hashes(hash, word);
+  }
+  if (size > 0) {
+    std::uint64_t word = 0;
+    std::memcpy(&word, bytes, size);
+    hash = combine_hashes(hash, word);
+  }
+  return hash;
+}
+
+// Hash of a component for the checksum of an ecdb. Trivially copyable types are hashed by their bytes, so a type with
+// padding bytes needs a specialization, and other types by std::hash, which differs between standard libraries.
+// Specialize it as:
+//   template <> struct ChecksumHasher<T> {
+//     static std::uint64_t hash(const T &component);
+//   };
+template <typename T> struct ChecksumHasher {
+  static std::uint64_t hash(const T &component) {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      return hash_bytes(&component, sizeof(T));
+    } else {
+      return std::hash<T>()(component);
+    }
+  }
+};
+
+// Hash of an alternative of a std::variant ComponentTemplate, salted with its stable type id
+template <typename ComponentTemplate> std::uint64_t hash_variant_component(const ComponentTemplate &component) {
+  return std::visit(
+      [](const auto &value) {
+        using T = std::decay_t<decltype(value)>;
+        return combine_hashes(type_utils::get_stable_type_id<T>(), ChecksumHasher<T>::hash(value));
+      },
+      component);
+}
+
+// Order-independent hash of the alive entities and their components: the sum of a hash per entity and a hash per
+// component, each salted with the entity handle. Every write replaces the hash of the component it overwrites, so the
+// checksum is kept up to date in O(1) per write instead of rehashing the ecdb every frame.
+template <typename ComponentTemplate> class WorldChecksum {
+public:
+  using HashComponentFunction = std::uint64_t (*)(const ComponentTemplate &);
+
+  // nullptr while the checksum is disabled, every write then costs a single comparison
+  HashComponentFunction _hash_component;
+  std::uint64_t _value;
+  // Hash of every component in _value indexed by signature bit and entity index, 0 if the entity does not have it
+  std::vector<std::vector<std::uint64_t>> _component_hashes;
+
+  explicit WorldChecksum() {
+    this->_hash_component = nullptr;
+    this->_value = 0;
+    this->_component_hashes = {};
+  }
+
+  explicit WorldChecksum(HashComponentFunction hash_component) {
+    this->_hash_component = hash_component;
+    this->_value = 0;
+    this->_component_hashes = {};
+  }
+
+  bool enabled() const { return this->_hash_component != nullptr; }
+
+  std::uint64_t value() const { return this->_value; }
+
+  static std::uint64_t _hash_entity(const Entity &entity) { return mix_hash(entity.unique_id() + 1); }
+
+  void add_entity(const Entity &entity) {
+    if (this->enabled()) {
+      this->_value += _hash_entity(entity);
+    }
+  }
+
+  // Subtracts the entity and the components with the bits of signature
+  void erase_entity(const Entity &entity, const ComponentSignature &signature) {
+    if (not this->enabled()) {
+      return;
+    }
+    signature.for_each_bit([this, &entity](std::size_t bit) { this->erase(entity.index, bit); });
+    this->_value -= _hash_entity(entity);
+  }
+
+  // Replaces the hash of the component with bit after it was written to the entity
+  void update(const Entity &entity, std::size_t bit, const ComponentTemplate &component) {
+    if (not this->enabled()) {
+      return;
+    }
+    if (bit >= this->_component_hashes.size()) {
+      this->_component_hashes.resize(bit + 1);
+    }
+    auto &component_hashes = this->_component_hashes[bit];
+    if (entity.index >= component_hashes.size()) {
+      component_hashes.resize(entity.index + 1, 0);
+    }
+    auto hash = combine_hashes(entity.unique_id() * 0x9e3779b97f4a7c15 + bit, this->_hash_component(component));
+    this->_value += hash - component_hashes[entity.index];
+    component_hashes[entity.index] = hash;
+  }
+
+  // Subtracts the component with bit after it was removed from the entity
+  void erase(EntityIndex entity_index, std::size_t bit) {
+    if (not this->enabled() or bit >= this->_component_hashes.size() or
+        entity_index >= this->_component_hashes[bit].size()) {
+      return;
+    }
+    this->_value -= std::exchange(this->_component_hashes[bit][entity_index], 0);
+  }
+};
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -0,0 +1,508 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ecs/component_registry.hpp"
+#include "ecs/entity.hpp"
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/snapshot.hpp"
+
+// Delta-encoded differences between two states of an EntityComponentDatabase whose ComponentTemplate is a std::variant,
+// e.g. to replicate it to clients. The sender keeps a WorldDiffBaseline with the state a receiver has, and every diff
+// written with write_world_diff holds what changed since then:
+//   WorldDiffHeader
+//   the destroyed entities, then the created entities
+//   per alternative of the variant: WorldDiffColumnHeader, the entities that lost the component type, then the written
+//   components as their entity, a WorldDiffEncoding and the component
+// Trivially copyable components are written in FULL as their bytes or as a PATCH of the words that changed, see
+// WorldDiffPatch. Other component types are always written in FULL as their size and the bytes of their
+// SnapshotSerializer. Nothing is aligned and all values are stored in native byte order.
+namespace ecs {
+namespace mutable_ecs {
+
+constexpr std::array<char, 8> WORLD_DIFF_MAGIC = {'E', 'C', 'D', 'B', 'D', 'I', 'F', 'F'};
+constexpr std::uint32_t WORLD_DIFF_VERSION = 1;
+constexpr std::size_t WORLD_DIFF_WORD_SIZE = 4;
+
+// size is the size of the whole diff, sequence counts the diffs written from the same baseline before this one
+struct WorldDiffHeader {
+public:
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t num_columns;
+  std::uint64_t size;
+  std::uint64_t sequence;
+  std::uint32_t num_destroyed_entities;
+  std::uint32_t num_created_entities;
+};
+
+// stable_type_id is type_utils::get_stable_type_id of the alternative, like in snapshots
+struct WorldDiffColumnHeader {
+public:
+  std::uint64_t stable_type_id;
+  std::uint32_t num_removed_components;
+  std::uint32_t num_written_components;
+};
+
+enum class WorldDiffEncoding : std::uint8_t { FULL, PATCH };
+
+// Appends to a caller-provided buffer and throws instead of growing it
+class WorldDiffWriter {
+public:
+  char *_data;
+  std::size_t _capacity;
+  std::size_t _size;
+
+  explicit WorldDiffWriter(char *data, std::size_t capacity) {
+    this->_data = data;
+    this->_capacity = capacity;
+    this->_size = 0;
+  }
+
+  std::size_t size() const { return this->_size; }
+
+  // Returns the next size bytes of the buffer, to be filled in by the caller
+  char *reserve(std::size_t size) {
+    if (size > this->_capacity - this->_size) {
+      throw std::runtime_error("World diff does not fit into the buffer");
+    }
+    auto bytes = this->_data + this->_size;
+    this->_size += size;
+    return bytes;
+  }
+
+  void write(const void *data, std::size_t size) { std::memcpy(this->reserve(size), data, size); }
+
+  template <typename T> void write_value(const T &value) { this->write(&value, sizeof(T)); }
+};
+
+class WorldDiffReader {
+public:
+  const char *_data;
+  std::size_t _size;
+  std::size_t _offset;
+
+  explicit WorldDiffReader(const char *data, std::size_t size) {
+    this->_data = data;
+    this->_size = size;
+    this->_offset = 0;
+  }
+
+  bool at_end() const { return this->_offset == this->_size; }
+
+  const char *read(std::size_t size) {
+    if (size > this->_size - this->_offset) {
+      throw std::runtime_error("World diff is truncated");
+    }
+    auto bytes = this->_data + this->_offset;
+    this->_offset += size;
+    return bytes;
+  }
+
+  template <typename T> T read_value() {
+    alignas(T) std::array<char, sizeof(T)> value_bytes;
+    std::memcpy(value_bytes.data(), this->read(sizeof(T)), sizeof(T));
+    return *reinterpret_cast<T *>(value_bytes.data());
+  }
+};
+
+// Byte-level diff of a trivially copyable component: a mask with a bit per WORLD_DIFF_WORD_SIZE bytes of T, followed by
+// the words whose bit is set, so writing one float of a large component costs a few bytes. Padding bytes are compared
+// too, so a type with padding may get patches that do not change any of its fields.
+template <typename T> struct WorldDiffPatch {
+public:
+  static constexpr std::size_t NUM_WORDS = (sizeof(T) + WORLD_DIFF_WORD_SIZE - 1) / WORLD_DIFF_WORD_SIZE;
+  static constexpr std::size_t MASK_SIZE = (NUM_WORDS + 7) / 8;
+
+  // The last word is shorter if sizeof(T) is not a multiple of WORLD_DIFF_WORD_SIZE
+  static constexpr std::size_t _word_size(std::size_t word) {
+    return std::min(WORLD_DIFF_WORD_SIZE, sizeof(T) - word * WORLD_DIFF_WORD_SIZE);
+  }
+
+  static bool _word_changed(const T &old_component, const T &new_component, std::size_t word) {
+    auto offset = word * WORLD_DIFF_WORD_SIZE;
+    return std::memcmp(reinterpret_cast<const char *>(&old_component) + offset,
+                       reinterpret_cast<const char *>(&new_component) + offset, _word_size(word)) != 0;
+  }
+
+  static bool _is_set(const char *mask, std::size_t word) {
+    return (static_cast<unsigned char>(mask[word / 8]) >> (word % 8)) & 1;
+  }
+
+  // Size of the patch from old_component to new_component, 0 if they are equal
+  static std::size_t size(const T &old_component, const T &new_component) {
+    std::size_t words_size = 0;
+    for (std::size_t word = 0; word < NUM_WORDS; word++) {
+      if (_word_changed(old_component, new_component, word)) {
+        words_size += _word_size(word);
+      }
+    }
+    return words_size == 0 ? 0 : MASK_SIZE + words_size;
+  }
+
+  static void write(WorldDiffWriter &writer, const T &old_component, const T &new_component) {
+    auto mask = writer.reserve(MASK_SIZE);
+    std::memset(mask, 0, MASK_SIZE);
+    for (std::size_t word = 0; word < NUM_WORDS; word++) {
+      if (_word_changed(old_component, new_component, word)) {
+        mask[word / 8] = static_cast<char>(static_cast<unsigned char>(mask[word / 8]) | (1u << (word % 8)));
+        writer.write(reinterpret_cast<const char *>(&new_component) + word * WORLD_DIFF_WORD_SIZE, _word_size(word));
+      }
+    }
+  }
+
+  // Size of the words that follow mask
+  static std::size_t words_size(const char *mask) {
+    std::size_t words_size = 0;
+    for (std::size_t word = 0; word < NUM_WORDS; word++) {
+      if (_is_set(mask, word)) {
+        words_size += _word_size(word);
+      }
+    }
+    return words_size;
+  }
+
+  static void apply(T &component, const char *patch) {
+    auto words = patch + MASK_SIZE;
+    for (std::size_t word = 0; word < NUM_WORDS; word++) {
+      if (_is_set(patch, word)) {
+        std::memcpy(reinterpret_cast<char *>(&component) + word * WORLD_DIFF_WORD_SIZE, words, _word_size(word));
+        words += _word_size(word);
+      }
+    }
+  }
+};
+
+template <typename T> constexpr bool is_raw_world_diff_component() {
+  static_assert(std::is_trivially_copyable_v<T> or has_snapshot_serializer<T>::value,
+                "Component type is not trivially copyable and has no SnapshotSerializer");
+  return is_raw_snapshot_component<T>();
+}
+
+template <typename ComponentTemplate> class WorldDiffBaseline;
+
+// The state of an ecdb that a receiver of its diffs has, every write_world_diff moves it to the state of the ecdb.
+// Components that are not trivially copyable are compared with operator==.
+template <typename... Ts> class WorldDiffBaseline<std::variant<Ts...>> {
+public:
+  std::uint64_t _sequence;
+  std::vector<SnapshotEntitySlot> _entity_slots;
+  // Component of every alternative by entity index
+  std::tuple<std::vector<std::optional<Ts>>...> _columns;
+  // Reused by the SnapshotSerializers of components that are not trivially copyable
+  std::vector<char> _serialized_bytes;
+
+  explicit WorldDiffBaseline() {
+    this->_sequence = 0;
+    this->_entity_slots = {};
+    this->_columns = {};
+    this->_serialized_bytes = {};
+  }
+
+  // Number of diffs written from this baseline
+  std::uint64_t sequence() const { return this->_sequence; }
+
+  bool contains(const Entity &entity) const {
+    return entity.index < this->_entity_slots.size() and this->_entity_slots[entity.index].alive != 0 and
+           this->_entity_slots[entity.index].generation == entity.generation;
+  }
+
+  template <typename T> std::vector<std::optional<T>> &column() {
+    return std::get<std::vector<std::optional<T>>>(this->_columns);
+  }
+
+  template <typename T> const std::vector<std::optional<T>> &column() const {
+    return std::get<std::vector<std::optional<T>>>(this->_columns);
+  }
+
+  template <typename T> const T *find(const Entity &entity) const {
+    auto &column = this->template column<T>();
+    return entity.index < column.size() and column[entity.index].has_value() ? &*column[entity.index] : nullptr;
+  }
+
+  // The baseline is updated by reading the diff that was written from it, see _read_world_diff
+
+  void destroy(const Entity &entity) {
+    this->_entity_slots[entity.index].alive = 0;
+    std::apply(
+        [&entity](auto &... columns) {
+          ((entity.index < columns.size() ? columns[entity.index].reset() : void()), ...);
+        },
+        this->_columns);
+  }
+
+  void create(const Entity &entity) {
+    if (entity.index >= this->_entity_slots.size()) {
+      this->_entity_slots.resize(entity.index + 1, SnapshotEntitySlot{0, 0});
+    }
+    this->_entity_slots[entity.index] = SnapshotEntitySlot{entity.generation, 1};
+  }
+
+  template <typename T> void remove(const Entity &entity) { this->template column<T>()[entity.index].reset(); }
+
+  template <typename T> void write(const Entity &entity, T component) {
+    auto &column = this->template column<T>();
+    if (entity.index >= column.size()) {
+      column.resize(entity.index + 1);
+    }
+    column[entity.index] = std::move(component);
+  }
+
+  template <typename T> void patch(const Entity &entity, const char *patch) {
+    WorldDiffPatch<T>::apply(*this->template column<T>()[entity.index], patch);
+  }
+};
+
+template <typename T, typename EntityComponentDatabaseType, typename ComponentTemplate>
+void _write_world_diff_column(WorldDiffWriter &writer, const EntityComponentDatabaseType &ecdb,
+                              WorldDiffBaseline<ComponentTemplate> &baseline) {
+  auto column_header_bytes = writer.reserve(sizeof(WorldDiffColumnHeader));
+  WorldDiffColumnHeader column_header = {type_utils::get_stable_type_id<T>(), 0, 0};
+
+  // Components of destroyed entities are not listed, the receiver removes them with their entities
+  auto bit = _find_bit<T>(ecdb);
+  auto &baseline_column = baseline.template column<T>();
+  for (EntityIndex entity_index = 0; entity_index < baseline_column.size(); entity_index++) {
+    auto entity = Entity(entity_index, baseline._entity_slots[entity_index].generation);
+    if (baseline_column[entity_index].has_value() and ecdb.contains(entity) and
+        not ecdb._entity_slots[entity_index].signature.test(bit)) {
+      writer.write_value(entity);
+      column_header.num_removed_components += 1;
+    }
+  }
+
+  ecdb._storage.template each<T>([&writer, &baseline, &column_header](const Entity &entity, const T &component) {
+    auto baseline_component = baseline.contains(entity) ? baseline.template find<T>(entity) : nullptr;
+    if constexpr (is_raw_world_diff_component<T>()) {
+      if (baseline_component != nullptr) {
+        auto patch_size = WorldDiffPatch<T>::size(*baseline_component, component);
+        if (patch_size == 0) {
+          return;
+        }
+        if (patch_size < sizeof(T)) {
+          writer.write_value(entity);
+          writer.write_value(WorldDiffEncoding::PATCH);
+          WorldDiffPatch<T>::write(writer, *baseline_component, component);
+          column_header.num_written_components += 1;
+          return;
+        }
+      }
+      writer.write_value(entity);
+      writer.write_value(WorldDiffEncoding::FULL);
+      writer.write_value(component);
+    } else {
+      if (baseline_component != nullptr and *baseline_component == component) {
+        return;
+      }
+      auto &bytes = baseline._serialized_bytes;
+      bytes.clear();
+      SnapshotSerializer<T>::serialize(component, bytes);
+      writer.write_value(entity);
+      writer.write_value(WorldDiffEncoding::FULL);
+      writer.write_value(static_cast<std::uint32_t>(bytes.size()));
+      writer.write(bytes.data(), bytes.size());
+    }
+    column_header.num_written_components += 1;
+  });
+  std::memcpy(column_header_bytes, &column_header, sizeof(WorldDiffColumnHeader));
+}
+
+template <typename EntityComponentDatabaseType, typename... Ts>
+void _write_world_diff_columns(WorldDiffWriter &writer, const EntityComponentDatabaseType &ecdb,
+                               WorldDiffBaseline<std::variant<Ts...>> &baseline) {
+  (_write_world_diff_column<Ts>(writer, ecdb, baseline), ...);
+}
+
+template <typename T, typename Visitor> void _read_world_diff_column(WorldDiffReader &reader, Visitor &visitor) {
+  auto column_header = reader.read_value<WorldDiffColumnHeader>();
+  if (column_header.stable_type_id != type_utils::get_stable_type_id<T>()) {
+    throw std::runtime_error("World diff was written for a different component type");
+  }
+  for (std::uint32_t position = 0; position < column_header.num_removed_components; position++) {
+    visitor.template remove<T>(reader.read_value<Entity>());
+  }
+  for (std::uint32_t position = 0; position < column_header.num_written_components; position++) {
+    auto entity = reader.read_value<Entity>();
+    auto encoding = reader.read_value<WorldDiffEncoding>();
+    if constexpr (is_raw_world_diff_component<T>()) {
+      if (encoding == WorldDiffEncoding::FULL) {
+        visitor.template write<T>(entity, reader.read_value<T>());
+        continue;
+      }
+      if (encoding == WorldDiffEncoding::PATCH) {
+        auto patch = reader.read(WorldDiffPatch<T>::MASK_SIZE);
+        reader.read(WorldDiffPatch<T>::words_size(patch));
+        visitor.template patch<T>(entity, patch);
+        continue;
+      }
+    } else {
+      if (encoding == WorldDiffEncoding::FULL) {
+        auto size = reader.read_value<std::uint32_t>();
+        auto bytes = reader.read(size);
+        visitor.template write<T>(entity, SnapshotSerializer<T>::deserialize(bytes, size));
+        continue;
+      }
+    }
+    throw std::runtime_error("World diff has an unknown component encoding");
+  }
+}
+
+template <typename Visitor, typename... Ts>
+void _read_world_diff_columns(WorldDiffReader &reader, Visitor &visitor, std::variant<Ts...> *) {
+  (_read_world_diff_column<Ts>(reader, visitor), ...);
+}
+
+// Returns the header of a diff written by write_world_diff for the same ComponentTemplate, throws if it is not one
+template <typename ComponentTemplate> WorldDiffHeader read_world_diff_header(const char *data, std::size_t size) {
+  auto header = WorldDiffReader(data, size).read_value<WorldDiffHeader>();
+  if (header.magic != WORLD_DIFF_MAGIC) {
+    throw std::runtime_error("Data is not a world diff");
+  }
+  if (header.version != WORLD_DIFF_VERSION) {
+    throw std::runtime_error("Unsupported world diff version " + std::to_string(header.version));
+  }
+  if (header.num_columns != std::variant_size_v<ComponentTemplate>) {
+    throw std::runtime_error("World diff was written for a different component type");
+  }
+  if (header.size > size) {
+    throw std::runtime_error("World diff is truncated");
+  }
+  return header;
+}
+
+// Calls visitor.destroy(entity) for the destroyed entities, visitor.create(entity) for the created entities, then per
+// alternative T visitor.remove<T>(entity), visitor.write<T>(entity, component) and visitor.patch<T>(entity, patch)
+template <typename ComponentTemplate, typename Visitor>
+void _read_world_diff(const char *data, std::size_t size, Visitor &visitor) {
+  auto header = read_world_diff_header<ComponentTemplate>(data, size);
+  WorldDiffReader reader(data, header.size);
+  reader.read(sizeof(WorldDiffHeader));
+  for (std::uint32_t position = 0; position < header.num_destroyed_entities; position++) {
+    visitor.destroy(reader.read_value<Entity>());
+  }
+  for (std::uint32_t position = 0; position < header.num_created_entities; position++) {
+    visitor.create(reader.read_value<Entity>());
+  }
+  _read_world_diff_columns(reader, visitor, static_cast<ComponentTemplate *>(nullptr));
+  if (not reader.at_end()) {
+    throw std::runtime_error("World diff has trailing bytes");
+  }
+}
+
+// Writes the changes of ecdb since baseline into buffer, which holds capacity bytes, and returns the size of the diff.
+// baseline then has the state of ecdb. Throws if the diff does not fit, baseline is left as it was so the diff can be
+// written again into a larger buffer. Every component is compared with the baseline, so writing a diff costs
+// O(entities + components) and allocates only when the baseline grows. Only entities and components are diffed.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+std::size_t write_world_diff(const EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                             WorldDiffBaseline<ComponentTemplate> &baseline, char *buffer, std::size_t capacity) {
+  WorldDiffWriter writer(buffer, capacity);
+  writer.reserve(sizeof(WorldDiffHeader));
+  WorldDiffHeader header = {};
+  header.magic = WORLD_DIFF_MAGIC;
+  header.version = WORLD_DIFF_VERSION;
+  header.num_columns = std::variant_size_v<ComponentTemplate>;
+  header.sequence = baseline._sequence;
+
+  for (EntityIndex entity_index = 0; entity_index < baseline._entity_slots.size(); entity_index++) {
+    auto &entity_slot = baseline._entity_slots[entity_index];
+    auto entity = Entity(entity_index, entity_slot.generation);
+    if (entity_slot.alive != 0 and not ecdb.contains(entity)) {
+      writer.write_value(entity);
+      header.num_destroyed_entities += 1;
+    }
+  }
+  for (EntityIndex entity_index = 0; entity_index < ecdb._entity_slots.size(); entity_index++) {
+    auto &entity_slot = ecdb._entity_slots[entity_index];
+    auto entity = Entity(entity_index, entity_slot.generation);
+    if (entity_slot.alive and not baseline.contains(entity)) {
+      writer.write_value(entity);
+      header.num_created_entities += 1;
+    }
+  }
+  _write_world_diff_columns(writer, ecdb, baseline);
+
+  header.size = writer.size();
+  std::memcpy(buffer, &header, sizeof(WorldDiffHeader));
+  _read_world_diff<ComponentTemplate>(buffer, writer.size(), baseline);
+  baseline._sequence += 1;
+  return writer.size();
+}
+
+// Walks a diff without applying it, so a malformed diff is rejected before ecdb is changed
+struct WorldDiffValidator {
+public:
+  void destroy(const Entity &) {}
+  void create(const Entity &) {}
+  template <typename T> void remove(const Entity &) {}
+  template <typename T> void write(const Entity &, const T &) {}
+  template <typename T> void patch(const Entity &, const char *) {}
+};
+
+template <typename TypeIndexTemplate, typename ComponentTemplate, typename GetComponentTypeFunction,
+          template <typename, typename> class StorageTemplate>
+struct WorldDiffApplier {
+public:
+  EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb;
+
+  void destroy(const Entity &entity) {
+    this->ecdb._get_entity_slot(entity);
+    this->ecdb._storage.erase_entity(entity);
+    this->ecdb._destroy_entity(entity);
+  }
+
+  void create(const Entity &entity) { this->ecdb._create_entity(entity); }
+
+  template <typename T> void remove(const Entity &entity) {
+    this->ecdb = remove_component(this->ecdb, entity, type_utils::get_type_id<T>());
+  }
+
+  template <typename T> void write(const Entity &entity, T component) {
+    this->ecdb = add_component<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate>(
+        this->ecdb, entity, ComponentTemplate(std::in_place_type<T>, std::move(component)));
+  }
+
+  template <typename T> void patch(const Entity &entity, const char *patch) {
+    this->ecdb._get_entity_slot(entity);
+    auto component = this->ecdb._storage.template find<T>(entity);
+    if (component == nullptr) {
+      throw std::runtime_error("Entity does not have the component type");
+    }
+    auto patched_component = *component;
+    WorldDiffPatch<T>::apply(patched_component, patch);
+    this->template write<T>(entity, std::move(patched_component));
+  }
+};
+
+// Applies a diff written by write_world_diff to ecdb, which has to be in the state of the baseline the diff was written
+// from, i.e. the receiver applies every diff in the order of their sequence and does not change ecdb otherwise.
+// Entities get the same handles as in the sender. Writes go through add_component and remove_component, so change
+// filters, cached queries, the checksum and observers see them like local writes. Throws before changing ecdb if the
+// diff is malformed.
+template <typename TypeIndexTemplate, typename ComponentTemplate,
+          typename GetComponentTypeFunction = GetComponentType<ComponentTemplate>,
+          template <typename, typename> class StorageTemplate = HashMapStorage>
+EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate>
+apply_world_diff(EntityComponentDatabase<TypeIndexTemplate, ComponentTemplate, StorageTemplate> &ecdb,
+                 const char *data, std::size_t size) {
+  WorldDiffValidator validator;
+  _read_world_diff<ComponentTemplate>(data, size, validator);
+  WorldDiffApplier<TypeIndexTemplate, ComponentTemplate, GetComponentTypeFunction, StorageTemplate> applier{ecdb};
+  _read_world_diff<ComponentTemplate>(data, size, applier);
+  return std::move(ecdb);
+}
+
+} // namespace mutable_ecs
+} // namespace ecs
@@ -1,10 +1,31 @@
+#include <array>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
 #include <variant>
 
 #include <catch2/catch.hpp>
 
+#include "ecs/command_buffer.hpp"
+#include "ecs/journal.hpp"
 #include "ecs/mutable_ecs.hpp"
+#include "ecs/pipeline.hpp"
+#include "ecs/raw_column.hpp"
+#include "ecs/snapshot.hpp"
 #include "ecs/variant_utils.hpp"
+#include "ecs/world_diff.hpp"
+
+template <> struct ecs::mutable_ecs::SnapshotSerializer<std::string> {
+  static void serialize(const std::string &component, std::vector<char> &bytes) {
+    bytes.insert(bytes.end(), component.begin(), component.end());
+  }
+  static std::string deserialize(const char *bytes, std::size_t size) { return std::string(bytes, size); }
+};
 
 namespace test_basics {
 using TypeIndex = std::size_t;
@@ -13,8 +34,13 @@ using ComponentType = std::variant<int, float>;
 constexpr int INT_COMPONENT = 6;
 constexpr float FLOAT_COMPONENT = 2.3;
 
-TEST_CASE("Test EntityComponentDataBase Move-Only Semantics") {
-  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType>();
+#define ECDB_TYPES                                                                                                     \
+  (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::HashMapStorage>),             \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::ArchetypeStorage>),     \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::SparseSetStorage>)
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Move-Only Semantics", "", ECDB_TYPES) {
+  auto ecdb = TestType();
 
   auto [tmp_ecdb_0, tmp_entity_0] = add_entity(ecdb);
   REQUIRE(ecdb.size() == 0);
@@ -31,8 +57,8 @@ TEST_CASE("Test EntityComponentDataBase Move-Only Semantics") {
   REQUIRE(tmp_ecdb_1.size() == 0);
 }
 
-TEST_CASE("Test EntityComponentDataBase APIs") {
-  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType>();
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase APIs", "", ECDB_TYPES) {
+  auto ecdb = TestType();
 
   ecs::mutable_ecs::Entity entity_0;
   std::tie(ecdb, entity_0) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
@@ -68,6 +94,807 @@ TEST_CASE("Test EntityComponentDataBase APIs") {
   ecdb = remove_entity(ecdb, entity_1);
   REQUIRE(ecdb.size() == 0);
 }
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Component Removal", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(3);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+  }
+
+  ecdb = remove_component(ecdb, entities[0], ecs::type_utils::get_type_id<float>());
+  REQUIRE(ecs::mutable_ecs::query<int>(ecdb).size() == 3);
+  REQUIRE(ecs::mutable_ecs::query<int, float>(ecdb).size() == 2);
+  REQUIRE(std::get<float>(get_component(ecdb, entities[2], ecs::type_utils::get_type_id<float>())) ==
+          Approx(FLOAT_COMPONENT));
+
+  ecdb = add_component(ecdb, entities[0], ComponentType{FLOAT_COMPONENT * 2});
+  REQUIRE(ecs::mutable_ecs::query<int, float>(ecdb).size() == 3);
+  REQUIRE(std::get<float>(get_component(ecdb, entities[0], ecs::type_utils::get_type_id<float>())) ==
+          Approx(FLOAT_COMPONENT * 2));
+
+  ecdb = add_component(ecdb, entities[1], ComponentType{INT_COMPONENT + 1});
+  REQUIRE(std::get<int>(get_component(ecdb, entities[1], ecs::type_utils::get_type_id<int>())) == INT_COMPONENT + 1);
+
+  ecdb = remove_entity(ecdb, entities[1]);
+  REQUIRE(ecs::mutable_ecs::query<int, float>(ecdb).size() == 2);
+  REQUIRE(std::get<int>(get_component(ecdb, entities[2], ecs::type_utils::get_type_id<int>())) == INT_COMPONENT);
+
+  // Removing a component from an entity without components does nothing on every storage
+  ecs::mutable_ecs::Entity entity_without_components;
+  std::tie(ecdb, entity_without_components) = add_entity(ecdb);
+  ecdb = remove_component(ecdb, entity_without_components, ecs::type_utils::get_type_id<int>());
+  ecdb = add_component(ecdb, entity_without_components, ComponentType{INT_COMPONENT});
+  ecdb = remove_component(ecdb, entity_without_components, ecs::type_utils::get_type_id<int>());
+  ecdb = remove_component(ecdb, entity_without_components, ecs::type_utils::get_type_id<int>());
+  REQUIRE(is_alive(ecdb, entity_without_components));
+  REQUIRE(ecs::mutable_ecs::query<int>(ecdb).size() == 2);
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Views", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+
+  for (auto i = 0; i < 4; i++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+  }
+
+  ecs::mutable_ecs::each<int, float>(
+      ecdb, [](const ecs::mutable_ecs::Entity &, int &int_component, float &) { int_component += 1; });
+
+  std::size_t num_viewed_entities = 0;
+  for (auto [entity, int_component, float_component] : ecs::mutable_ecs::view<int, float>(ecdb)) {
+    REQUIRE(int_component == INT_COMPONENT + 1);
+    REQUIRE(float_component == Approx(FLOAT_COMPONENT));
+    float_component = 0;
+    num_viewed_entities += 1;
+  }
+  REQUIRE(num_viewed_entities == 4);
+
+  std::size_t num_entities_with_int = 0;
+  for (auto [entity, int_component] : ecs::mutable_ecs::view<int>(ecdb)) {
+    REQUIRE(int_component >= INT_COMPONENT);
+    num_entities_with_int += 1;
+  }
+  REQUIRE(num_entities_with_int == 8);
+
+  // Iterators outlive the temporary views they come from
+  auto view_begin = ecs::mutable_ecs::view<int, float>(ecdb).begin();
+  auto view_end = ecs::mutable_ecs::view<int, float>(ecdb).end();
+  num_viewed_entities = 0;
+  for (auto view_iterator = view_begin; view_iterator != view_end; ++view_iterator) {
+    REQUIRE(std::get<1>(*view_iterator) == INT_COMPONENT + 1);
+    num_viewed_entities += 1;
+  }
+  REQUIRE(num_viewed_entities == 4);
+
+  for (auto &&[entity, components] : ecs::mutable_ecs::query<float>(ecdb)) {
+    REQUIRE(std::get<float>(components.at(0)) == Approx(0));
+  }
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Entity Recycling", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+
+  ecs::mutable_ecs::Entity entity_0;
+  std::tie(ecdb, entity_0) = add_entity(ecdb, {INT_COMPONENT});
+  ecs::mutable_ecs::Entity entity_1;
+  std::tie(ecdb, entity_1) = add_entity(ecdb, {INT_COMPONENT});
+
+  ecdb = remove_entity(ecdb, entity_0);
+  REQUIRE_FALSE(is_alive(ecdb, entity_0));
+  REQUIRE(is_alive(ecdb, entity_1));
+  REQUIRE_THROWS_AS(remove_entity(ecdb, entity_0), std::runtime_error);
+
+  ecs::mutable_ecs::Entity entity_2;
+  std::tie(ecdb, entity_2) = add_entity(ecdb, {FLOAT_COMPONENT});
+  REQUIRE(entity_2.index == entity_0.index);
+  REQUIRE(entity_2.generation == entity_0.generation + 1);
+  REQUIRE_FALSE(is_alive(ecdb, entity_0));
+  REQUIRE(is_alive(ecdb, entity_2));
+  REQUIRE_THROWS_AS(add_component(ecdb, entity_0, ComponentType{INT_COMPONENT}), std::runtime_error);
+
+  REQUIRE(ecdb.size() == 2);
+  REQUIRE(ecs::mutable_ecs::query<int>(ecdb).size() == 1);
+  REQUIRE(ecs::mutable_ecs::query<float>(ecdb).size() == 1);
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Bulk Entities", "", ECDB_TYPES) {
+  // add_entities and remove_entities leave the ecdb in the same state as add_entity and remove_entity
+  auto bulk_ecdb = TestType();
+  auto ecdb = TestType();
+  bulk_ecdb.reserve(1000, 1000);
+
+  std::vector<ecs::mutable_ecs::Entity> bulk_entities;
+  std::tie(bulk_ecdb, bulk_entities) = add_entities(bulk_ecdb, 600, {INT_COMPONENT, FLOAT_COMPONENT});
+  std::vector<ecs::mutable_ecs::Entity> entities(600);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+  }
+  REQUIRE(bulk_entities == entities);
+
+  std::vector<ecs::mutable_ecs::Entity> removed_entities;
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index += 3) {
+    removed_entities.push_back(entities[entity_index]);
+    ecdb = remove_entity(ecdb, entities[entity_index]);
+  }
+  removed_entities.push_back(removed_entities.front());
+  bulk_ecdb = remove_entities(bulk_ecdb, removed_entities);
+  REQUIRE(bulk_ecdb.size() == 400);
+  REQUIRE_FALSE(is_alive(bulk_ecdb, removed_entities.front()));
+  REQUIRE_THROWS_AS(remove_entities(bulk_ecdb, {entities[1], entities[0]}), std::runtime_error);
+  REQUIRE(is_alive(bulk_ecdb, entities[1]));
+
+  // Freed indices are reused first, the last component of a component type wins
+  auto last_run_tick = advance_change_tick(bulk_ecdb);
+  set_last_run_tick(bulk_ecdb, last_run_tick);
+  std::tie(bulk_ecdb, bulk_entities) = add_entities(bulk_ecdb, 300, {INT_COMPONENT, INT_COMPONENT + 1});
+  entities.clear();
+  entities.resize(300);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, INT_COMPONENT + 1});
+  }
+  REQUIRE(bulk_entities == entities);
+  REQUIRE(bulk_ecdb.size() == ecdb.size());
+  for (auto &entity : bulk_entities) {
+    REQUIRE(std::get<int>(get_component(bulk_ecdb, entity, ecs::type_utils::get_type_id<int>())) == INT_COMPONENT + 1);
+  }
+  REQUIRE(ecs::mutable_ecs::query<int, float>(bulk_ecdb).size() == 400);
+  REQUIRE(ecs::mutable_ecs::query<int, ecs::mutable_ecs::without<float>>(bulk_ecdb).size() == 300);
+  REQUIRE(ecs::mutable_ecs::query<ecs::mutable_ecs::added<int>>(bulk_ecdb).size() == 300);
+
+  std::tie(bulk_ecdb, bulk_entities) = add_entities(bulk_ecdb, 5);
+  REQUIRE(bulk_entities.size() == 5);
+  REQUIRE(bulk_ecdb.size() == 705);
+
+  // Many small batches grow the entity slots geometrically, like add_entity does
+  std::size_t num_reallocations = 0;
+  for (int batch = 0; batch < 4000; batch++) {
+    auto capacity = bulk_ecdb._entity_slots.capacity();
+    std::tie(bulk_ecdb, bulk_entities) = add_entities(bulk_ecdb, 1, {INT_COMPONENT});
+    num_reallocations += bulk_ecdb._entity_slots.capacity() != capacity;
+  }
+  REQUIRE(bulk_ecdb.size() == 4705);
+  REQUIRE(num_reallocations <= 4);
+
+  // A sub-range of an array is removed without copying it into a vector
+  std::array<ecs::mutable_ecs::Entity, 3> removed_array = {entities[0], entities[1], entities[2]};
+  bulk_ecdb = remove_entities(bulk_ecdb, std::span<const ecs::mutable_ecs::Entity>(removed_array).subspan(1));
+  REQUIRE(bulk_ecdb.size() == 4703);
+  REQUIRE(is_alive(bulk_ecdb, entities[0]));
+  REQUIRE_FALSE(is_alive(bulk_ecdb, entities[2]));
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Query Filters", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::maybe;
+  using ecs::mutable_ecs::without;
+
+  auto ecdb = TestType();
+
+  for (auto i = 0; i < 3; i++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+  }
+  ecs::mutable_ecs::Entity float_entity;
+  std::tie(ecdb, float_entity) = add_entity(ecdb, {FLOAT_COMPONENT});
+
+  REQUIRE(ecs::mutable_ecs::query<int, without<float>>(ecdb).size() == 3);
+  REQUIRE(ecs::mutable_ecs::query<float, without<int>>(ecdb).size() == 1);
+  REQUIRE(ecs::mutable_ecs::query<int, float, without<float>>(ecdb).size() == 0);
+
+  std::size_t num_entities_with_float = 0;
+  std::size_t num_entities_without_float = 0;
+  ecs::mutable_ecs::each<int, maybe<float>>(
+      ecdb, [&](const ecs::mutable_ecs::Entity &, int &int_component, float *float_component) {
+        REQUIRE(int_component == INT_COMPONENT);
+        if (float_component == nullptr) {
+          num_entities_without_float += 1;
+        } else {
+          REQUIRE(*float_component == Approx(FLOAT_COMPONENT));
+          num_entities_with_float += 1;
+        }
+      });
+  REQUIRE(num_entities_with_float == 3);
+  REQUIRE(num_entities_without_float == 3);
+
+  std::size_t num_filtered_entities = 0;
+  ecs::mutable_ecs::each<float, without<int>, maybe<int>>(
+      ecdb, [&](const ecs::mutable_ecs::Entity &entity, float &, int *int_component) {
+        REQUIRE(entity == float_entity);
+        REQUIRE(int_component == nullptr);
+        num_filtered_entities += 1;
+      });
+  REQUIRE(num_filtered_entities == 1);
+
+  // The runtime query matches the signatures as well and returns nothing for component types that were never added
+  auto run_time_queried_entities = ecs::mutable_ecs::query(ecdb, std::vector{ecs::type_utils::get_type_id<float>()});
+  REQUIRE(run_time_queried_entities.size() == 4);
+  REQUIRE(ecs::mutable_ecs::query(ecdb, std::vector{ecs::type_utils::get_type_id<double>()}).size() == 0);
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Parallel Each", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(1000);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+  }
+  ecs::mutable_ecs::Entity entity;
+  std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+
+  ecs::mutable_ecs::ThreadPool thread_pool(4);
+  ecs::mutable_ecs::parallel_each<int, float>(
+      ecdb, [](const ecs::mutable_ecs::Entity &, int &int_component, float &) { int_component += 1; }, 10,
+      thread_pool);
+  for (auto &&[entity, components] : ecs::mutable_ecs::query<int, float>(ecdb)) {
+    REQUIRE(std::get<int>(components.at(0)) == INT_COMPONENT + 1);
+  }
+
+  // Writes recorded by the chunks are applied after all chunks are done, ordered by entity index
+  std::vector<ecs::mutable_ecs::Entity> set_entities;
+  ecs::mutable_ecs::ObserverHandle observer_handle;
+  std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<int>(
+      ecdb, ecs::mutable_ecs::ObserverEvent::SET,
+      [&set_entities](TestType &, const std::vector<ecs::mutable_ecs::Entity> &observed_entities) {
+        set_entities = observed_entities;
+      });
+  set_last_run_tick(ecdb, advance_change_tick(ecdb));
+  ecs::mutable_ecs::parallel_each<int, float>(
+      ecdb,
+      [&ecdb](const ecs::mutable_ecs::Entity &entity, int &int_component, float &) {
+        int_component += 1;
+        mark_changed(ecdb, entity, ecs::type_utils::get_type_id<int>());
+      },
+      10, thread_pool);
+  REQUIRE(ecs::mutable_ecs::query<ecs::mutable_ecs::changed<int>>(ecdb).size() == entities.size());
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(set_entities == entities);
+
+  // Actions are merged in the same order as each() visits the entities
+  std::vector<ecs::mutable_ecs::Entity> sequential_entities;
+  ecs::mutable_ecs::each<int, float>(ecdb, [&sequential_entities](const ecs::mutable_ecs::Entity &entity, int &,
+                                                                  float &) { sequential_entities.push_back(entity); });
+  auto parallel_entities = ecs::mutable_ecs::parallel_each_with_actions<ecs::mutable_ecs::Entity, int, float>(
+      ecdb,
+      [](const ecs::mutable_ecs::Entity &entity, int &, float &, std::vector<ecs::mutable_ecs::Entity> &actions) {
+        actions.push_back(entity);
+      },
+      10, thread_pool);
+  REQUIRE(parallel_entities.size() == entities.size());
+  REQUIRE(parallel_entities == sequential_entities);
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Command Buffer", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(3);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+  }
+
+  ecs::mutable_ecs::CommandBuffer<TypeIndex, ComponentType> command_buffer;
+  command_buffer.create({INT_COMPONENT, FLOAT_COMPONENT});
+  command_buffer.set(entities[0], ComponentType{INT_COMPONENT + 1});
+  command_buffer.set(entities[0], ComponentType{INT_COMPONENT + 2});
+  command_buffer.set(entities[0], ComponentType{FLOAT_COMPONENT});
+  command_buffer.add(entities[1], ComponentType{FLOAT_COMPONENT});
+  command_buffer.remove(entities[1], ecs::type_utils::get_type_id<float>());
+  command_buffer.remove(entities[2], ecs::type_utils::get_type_id<int>());
+  command_buffer.add(entities[2], ComponentType{INT_COMPONENT + 3});
+  command_buffer.add(entities[2], ComponentType{FLOAT_COMPONENT});
+  command_buffer.destroy(entities[1]);
+  command_buffer.destroy(entities[1]);
+  REQUIRE(command_buffer.size() == 11);
+
+  ecs::mutable_ecs::FlushReport flush_report;
+  std::tie(ecdb, flush_report) = flush(ecdb, command_buffer);
+  REQUIRE(command_buffer.empty());
+  REQUIRE(flush_report.num_recorded_commands == 11);
+  REQUIRE(flush_report.created_entities.size() == 1);
+  // create, set of int on entities[0], int and float on entities[2] and the first destroy
+  REQUIRE(flush_report.num_applied_commands == 5);
+  REQUIRE(flush_report.num_merged_commands == 2);
+  // set of float on entities[0], commands to the destroyed entities[1] and the second destroy
+  REQUIRE(flush_report.num_skipped_commands == 4);
+
+  REQUIRE(ecdb.size() == 3);
+  REQUIRE_FALSE(is_alive(ecdb, entities[1]));
+  REQUIRE(std::get<int>(get_component(ecdb, entities[0], ecs::type_utils::get_type_id<int>())) == INT_COMPONENT + 2);
+  REQUIRE(std::get<int>(get_component(ecdb, entities[2], ecs::type_utils::get_type_id<int>())) == INT_COMPONENT + 3);
+  REQUIRE(ecs::mutable_ecs::query<int, float>(ecdb).size() == 2);
+  REQUIRE(ecs::mutable_ecs::query<float, ecs::mutable_ecs::without<int>>(ecdb).size() == 0);
+
+  // Commands to a stale handle of a recycled index are skipped, the commands to the live entity are still merged
+  ecs::mutable_ecs::Entity recycled_entity;
+  ecdb = remove_entity(ecdb, entities[2]);
+  std::tie(ecdb, recycled_entity) = add_entity(ecdb, {INT_COMPONENT});
+  REQUIRE(recycled_entity.index == entities[2].index);
+  command_buffer.set(recycled_entity, ComponentType{INT_COMPONENT + 4});
+  command_buffer.set(entities[2], ComponentType{INT_COMPONENT + 5});
+  command_buffer.set(recycled_entity, ComponentType{INT_COMPONENT + 6});
+  command_buffer.set(entities[0], ComponentType{INT_COMPONENT + 7});
+  std::tie(ecdb, flush_report) = flush(ecdb, command_buffer);
+  REQUIRE(flush_report.num_applied_commands == 2);
+  REQUIRE(flush_report.num_merged_commands == 1);
+  REQUIRE(flush_report.num_skipped_commands == 1);
+  REQUIRE(std::get<int>(get_component(ecdb, recycled_entity, ecs::type_utils::get_type_id<int>())) ==
+          INT_COMPONENT + 6);
+  REQUIRE(std::get<int>(get_component(ecdb, entities[0], ecs::type_utils::get_type_id<int>())) == INT_COMPONENT + 7);
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Change Detection", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::added;
+  using ecs::mutable_ecs::changed;
+  using ecs::mutable_ecs::removed;
+
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(200);
+  for (auto &entity : entities) {
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+  }
+  REQUIRE(ecs::mutable_ecs::query<added<int>>(ecdb).size() == entities.size());
+  REQUIRE(ecs::mutable_ecs::query<changed<int>>(ecdb).size() == entities.size());
+  REQUIRE(ecs::mutable_ecs::query<added<float>>(ecdb).size() == 0);
+
+  auto last_run_tick = advance_change_tick(ecdb);
+  set_last_run_tick(ecdb, last_run_tick);
+  REQUIRE(ecs::mutable_ecs::query<changed<int>>(ecdb).size() == 0);
+
+  ecdb = add_component(ecdb, entities[3], ComponentType{FLOAT_COMPONENT});
+  ecdb = add_component(ecdb, entities[150], ComponentType{INT_COMPONENT + 1});
+  mark_changed(ecdb, entities[70], ecs::type_utils::get_type_id<int>());
+  REQUIRE_THROWS(mark_changed(ecdb, entities[70], ecs::type_utils::get_type_id<float>()));
+  ecdb = remove_entity(ecdb, entities[199]);
+
+  REQUIRE(ecs::mutable_ecs::query<added<float>>(ecdb).size() == 1);
+  REQUIRE(ecs::mutable_ecs::query<added<int>>(ecdb).size() == 0);
+  REQUIRE(ecs::mutable_ecs::query<added<int, float>>(ecdb).size() == 0);
+  REQUIRE(ecs::mutable_ecs::query<changed<int, float>>(ecdb).size() == 0);
+  std::vector<ecs::mutable_ecs::Entity> changed_entities;
+  ecs::mutable_ecs::each<changed<int>>(ecdb, [&](const ecs::mutable_ecs::Entity &entity, int &) {
+    changed_entities.push_back(entity);
+  });
+  REQUIRE(changed_entities == std::vector{entities[70], entities[150]});
+  REQUIRE(ecs::mutable_ecs::query<changed<int>, ecs::mutable_ecs::without<float>>(ecdb).size() == 2);
+
+  std::vector<ecs::mutable_ecs::Entity> removed_entities;
+  ecs::mutable_ecs::each<removed<int>>(ecdb, [&](const ecs::mutable_ecs::Entity &entity) {
+    removed_entities.push_back(entity);
+  });
+  REQUIRE(removed_entities == std::vector{entities[199]});
+  // The removed entity does not have the required component types anymore
+  REQUIRE(ecs::mutable_ecs::query<removed<int>, float>(ecdb).size() == 0);
+
+  ecdb = remove_component(ecdb, entities[3], ecs::type_utils::get_type_id<float>());
+  std::size_t num_removals = 0;
+  ecs::mutable_ecs::each<removed<float>, int>(ecdb, [&](const ecs::mutable_ecs::Entity &entity, int &int_component) {
+    REQUIRE(entity == entities[3]);
+    REQUIRE(int_component == INT_COMPONENT);
+    num_removals += 1;
+  });
+  REQUIRE(num_removals == 1);
+
+  prune_removals(ecdb, advance_change_tick(ecdb));
+  REQUIRE(ecs::mutable_ecs::query<removed<int>>(ecdb).size() == 0);
+  REQUIRE(ecs::mutable_ecs::query<removed<float>>(ecdb).size() == 0);
+
+  // Every system sees the writes since its previous run, including the ones of the systems after it
+  enum class System { COUNT_CHANGES, TOUCH_ENTITY };
+  using Action = ecs::mutable_ecs::Entity;
+  std::vector<std::size_t> num_seen_changes;
+  auto process_system = [&](TestType &ecdb, System &system) {
+    if (system == System::COUNT_CHANGES) {
+      num_seen_changes.push_back(ecs::mutable_ecs::query<changed<int>>(ecdb).size());
+    } else {
+      mark_changed(ecdb, entities[0], ecs::type_utils::get_type_id<int>());
+    }
+    return std::vector<Action>{};
+  };
+  auto process_action = [](TestType &ecdb, const Action &) { return std::move(ecdb); };
+
+  auto systems = ecs::mutable_ecs::create_systems<System>();
+  systems = ecs::mutable_ecs::add_system<System>(systems, System::COUNT_CHANGES, 0);
+  systems = ecs::mutable_ecs::add_system<System>(systems, System::TOUCH_ENTITY, 0);
+  systems = ecs::mutable_ecs::add_system<System>(systems, System::COUNT_CHANGES, 0);
+  for (auto frame_index = 0; frame_index < 2; frame_index++) {
+    ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, System, Action>(ecdb, systems, process_system,
+                                                                                        process_action);
+  }
+  // The first run of a system sees every entity
+  REQUIRE(num_seen_changes == std::vector<std::size_t>{entities.size() - 1, entities.size() - 1, 1, 1});
+}
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Cached Queries", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::maybe;
+  using ecs::mutable_ecs::without;
+
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(100);
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index++) {
+    if (entity_index % 2 == 0) {
+      std::tie(ecdb, entities[entity_index]) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+    } else {
+      std::tie(ecdb, entities[entity_index]) = add_entity(ecdb, {INT_COMPONENT});
+    }
+  }
+
+  // Queries registered before and after the entities were added see the same entities
+  ecs::mutable_ecs::QueryHandle<int, without<float>> int_query;
+  std::tie(ecdb, int_query) = ecs::mutable_ecs::register_query<int, without<float>>(ecdb);
+  ecs::mutable_ecs::QueryHandle<> run_time_query;
+  std::tie(ecdb, run_time_query) =
+      register_query(ecdb, std::vector{ecs::type_utils::get_type_id<float>(), ecs::type_utils::get_type_id<int>()});
+  ecs::mutable_ecs::QueryHandle<float, maybe<int>> float_query;
+  std::tie(ecdb, float_query) = ecs::mutable_ecs::register_query<float, maybe<int>>(ecdb);
+
+  auto require_same_entities = [&ecdb, &int_query, &run_time_query, &float_query]() {
+    auto sorted = [](std::vector<ecs::mutable_ecs::Entity> entities) {
+      std::sort(entities.begin(), entities.end(), [](auto &entity_a, auto &entity_b) {
+        return entity_a.index < entity_b.index;
+      });
+      return entities;
+    };
+    auto queried_entities = [&sorted](const auto &queried_entities) {
+      std::vector<ecs::mutable_ecs::Entity> entities;
+      for (auto &&[entity, components] : queried_entities) {
+        entities.push_back(entity);
+      }
+      return sorted(entities);
+    };
+    REQUIRE(sorted(get_cached_entities(ecdb, int_query)) ==
+            queried_entities(ecs::mutable_ecs::query<int, without<float>>(ecdb)));
+    REQUIRE(sorted(get_cached_entities(ecdb, run_time_query)) ==
+            queried_entities(ecs::mutable_ecs::query<float, int>(ecdb)));
+    REQUIRE(sorted(get_cached_entities(ecdb, float_query)) == queried_entities(ecs::mutable_ecs::query<float>(ecdb)));
+  };
+  require_same_entities();
+
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index += 3) {
+    ecdb = add_component(ecdb, entities[entity_index], ComponentType{FLOAT_COMPONENT});
+  }
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index += 5) {
+    ecdb = remove_component(ecdb, entities[entity_index], ecs::type_utils::get_type_id<int>());
+  }
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index += 7) {
+    ecdb = remove_entity(ecdb, entities[entity_index]);
+  }
+  for (auto i = 0; i < 5; i++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {INT_COMPONENT});
+  }
+  require_same_entities();
+
+  auto int_bit = ecdb._component_type_registry.find_bit(ecs::type_utils::get_type_id<int>());
+  std::size_t num_visited_entities = 0;
+  ecs::mutable_ecs::each(
+      ecdb, float_query, [&](const ecs::mutable_ecs::Entity &entity, float &float_component, int *int_component) {
+        REQUIRE(float_component == Approx(FLOAT_COMPONENT));
+        REQUIRE((int_component != nullptr) == ecdb._entity_slots[entity.index].signature.test(int_bit));
+        num_visited_entities += 1;
+      });
+  REQUIRE(num_visited_entities == ecs::mutable_ecs::query<float>(ecdb).size());
+
+  auto &stats = get_query_stats(ecdb, float_query);
+  REQUIRE(stats.num_iterations == 3);
+  REQUIRE(stats.num_visited_entities < stats.num_scanned_entities);
+  REQUIRE(stats.num_insertions - stats.num_erasures == num_visited_entities);
+  // Removing int only checks the queries that depend on it
+  auto num_checks = stats.num_checks;
+  REQUIRE(get_query_stats(ecdb, int_query).num_checks > 0);
+
+  ecdb = unregister_query(ecdb, int_query);
+  REQUIRE_THROWS(get_cached_entities(ecdb, int_query));
+  ecdb = remove_component(ecdb, entities[1], ecs::type_utils::get_type_id<int>());
+  REQUIRE(get_query_stats(ecdb, float_query).num_checks == num_checks);
+  REQUIRE(get_query_stats(ecdb, run_time_query).num_checks > 0);
+  REQUIRE(get_cached_entities(ecdb, run_time_query).size() == ecs::mutable_ecs::query<float, int>(ecdb).size());
+}
+#undef ECDB_TYPES
+
+using SnapshotComponentType = std::variant<int, float, std::string>;
+
+#define SNAPSHOT_ECDB_TYPES                                                                                            \
+  (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, SnapshotComponentType, ecs::mutable_ecs::HashMapStorage>),     \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, SnapshotComponentType,                                     \
+                                                 ecs::mutable_ecs::ArchetypeStorage>),                                 \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, SnapshotComponentType,                                     \
+                                                 ecs::mutable_ecs::SparseSetStorage>)
+
+TEMPLATE_TEST_CASE("Test EntityComponentDataBase Snapshot", "", SNAPSHOT_ECDB_TYPES) {
+  const std::string path = "test_snapshot.ecdb";
+  auto ecdb = TestType();
+
+  std::vector<ecs::mutable_ecs::Entity> entities(100);
+  for (std::size_t index = 0; index < entities.size(); index++) {
+    std::vector<SnapshotComponentType> components = {static_cast<int>(index)};
+    if (index % 2 == 0) {
+      components.push_back(static_cast<float>(index) / 2);
+    }
+    if (index % 3 == 0) {
+      components.push_back(std::string(index, 'e'));
+    }
+    std::tie(ecdb, entities[index]) = add_entity(ecdb, components);
+  }
+  for (std::size_t index = 0; index < entities.size(); index += 10) {
+    ecdb = remove_entity(ecdb, entities[index]);
+  }
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, entities[3], entities[1]);
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, entities[2], entities[1]);
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, entities[4], entities[3]);
+
+  auto snapshot_size = ecs::mutable_ecs::save_snapshot(ecdb, path);
+
+  {
+    ecs::mutable_ecs::MappedSnapshot<SnapshotComponentType> snapshot(path, ecs::mutable_ecs::SnapshotLoadMode::LAZY);
+    REQUIRE(snapshot.header().file_size == snapshot_size);
+    REQUIRE(snapshot.size() == 90);
+
+    // raw columns are read in place
+    auto int_column = snapshot.column<int>();
+    REQUIRE(int_column.size() == 90);
+    REQUIRE(reinterpret_cast<std::uintptr_t>(&int_column.component(0)) % ecs::mutable_ecs::SNAPSHOT_ALIGNMENT == 0);
+
+    std::size_t num_entities = 0;
+    snapshot.each<int, float>([&](const ecs::mutable_ecs::Entity &entity, const int &int_component,
+                                  const float &float_component) {
+      REQUIRE(entity == entities[int_component]);
+      REQUIRE(float_component == Approx(static_cast<float>(int_component) / 2));
+      num_entities += 1;
+    });
+    REQUIRE(num_entities == 40);
+
+    num_entities = 0;
+    snapshot.each<std::string, int>(
+        [&](const ecs::mutable_ecs::Entity &, const std::string &string_component, const int &int_component) {
+          REQUIRE(string_component == std::string(int_component, 'e'));
+          num_entities += 1;
+        });
+    REQUIRE(num_entities == 30);
+  }
+
+  auto loaded_ecdb = TestType();
+  loaded_ecdb = ecs::mutable_ecs::load_snapshot(loaded_ecdb, path);
+  REQUIRE(loaded_ecdb.size() == ecdb.size());
+  REQUIRE(ecs::mutable_ecs::query<int, float>(loaded_ecdb).size() == 40);
+  REQUIRE(ecs::mutable_ecs::query<std::string>(loaded_ecdb).size() == 30);
+  for (std::size_t index = 0; index < entities.size(); index++) {
+    REQUIRE(is_alive(loaded_ecdb, entities[index]) == (index % 10 != 0));
+  }
+  REQUIRE(std::get<std::string>(get_component(loaded_ecdb, entities[9], ecs::type_utils::get_type_id<std::string>())) ==
+          std::string(9, 'e'));
+
+  // the hierarchy is restored with the children in the same order, so removals cascade the same way
+  REQUIRE(ecs::mutable_ecs::get_children(loaded_ecdb, entities[1]) == std::vector{entities[3], entities[2]});
+  REQUIRE(ecs::mutable_ecs::get_parent(loaded_ecdb, entities[4]) == entities[3]);
+  REQUIRE(loaded_ecdb._hierarchy.size() == 3);
+
+  // indices of removed entities are reused in the same order
+  ecs::mutable_ecs::Entity entity;
+  ecs::mutable_ecs::Entity loaded_entity;
+  std::tie(ecdb, entity) = add_entity(ecdb);
+  std::tie(loaded_ecdb, loaded_entity) = add_entity(loaded_ecdb);
+  REQUIRE(entity == loaded_entity);
+  ecdb = remove_entity(ecdb, entities[1]);
+  loaded_ecdb = remove_entity(loaded_ecdb, entities[1]);
+  REQUIRE(loaded_ecdb.size() == ecdb.size());
+  REQUIRE_FALSE(is_alive(loaded_ecdb, entities[4]));
+
+  // int and float have the same size, the stable type ids tell them apart
+  REQUIRE_THROWS_AS((ecs::mutable_ecs::MappedSnapshot<std::variant<float, int, std::string>>(path)),
+                    std::runtime_error);
+
+  // the offsets of serialized components are validated before any of them is read
+  std::uint64_t string_offsets_offset = 0;
+  {
+    ecs::mutable_ecs::MappedSnapshot<SnapshotComponentType> snapshot(path);
+    string_offsets_offset = snapshot._column_header(2).components_offset;
+  }
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    std::uint64_t corrupted_offset = snapshot_size;
+    file.seekp(string_offsets_offset + sizeof(std::uint64_t));
+    file.write(reinterpret_cast<const char *>(&corrupted_offset), sizeof(corrupted_offset));
+  }
+  REQUIRE_THROWS_AS(ecs::mutable_ecs::MappedSnapshot<SnapshotComponentType>(path), std::runtime_error);
+
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    file.write("NOTECDB!", 8);
+  }
+  REQUIRE_THROWS_AS(ecs::mutable_ecs::MappedSnapshot<SnapshotComponentType>(path), std::runtime_error);
+  REQUIRE_THROWS_AS((ecs::mutable_ecs::MappedSnapshot<std::variant<int, float>>(path)), std::runtime_error);
+  std::remove(path.c_str());
+}
+#undef SNAPSHOT_ECDB_TYPES
+
+TEST_CASE("Test Cache Line Aligned Chunks") {
+  using ecs::memory_utils::cache_line_aligned_chunk_size;
+  using ecs::memory_utils::elements_per_cache_line;
+
+  REQUIRE(elements_per_cache_line<std::uint64_t>() == 8);
+  REQUIRE(elements_per_cache_line<std::uint64_t, std::uint32_t>() == 16);
+  REQUIRE(elements_per_cache_line<std::array<char, 12>>() == 16);
+  REQUIRE(cache_line_aligned_chunk_size<std::uint64_t>(0) == 8);
+  REQUIRE(cache_line_aligned_chunk_size<std::uint64_t>(20) == 24);
+
+  ecs::memory_utils::CacheAlignedVector<float> column(3);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(column.data()) % ecs::memory_utils::CACHE_LINE_SIZE == 0);
+}
+
+TEST_CASE("Test Pool Allocator") {
+  ecs::memory_utils::PoolAllocator<std::uint64_t> allocator;
+  std::vector<std::uint64_t, ecs::memory_utils::PoolAllocator<std::uint64_t>> grown(allocator);
+  for (std::uint64_t value = 0; value < 100; value++) {
+    grown.push_back(value);
+  }
+  // the arrays freed while growing stay in the pool and are handed out again
+  auto num_free_blocks = allocator.pool().num_free_blocks();
+  REQUIRE(num_free_blocks > 0);
+  std::vector<std::uint64_t, ecs::memory_utils::PoolAllocator<std::uint64_t>> reused(allocator);
+  reused.push_back(0);
+  REQUIRE(allocator.pool().num_free_blocks() == num_free_blocks - 1);
+
+  ecs::mutable_ecs::ComponentTable<ComponentType, ecs::memory_utils::PoolAllocator> table;
+  for (ecs::mutable_ecs::EntityIndex index = 0; index < 10; index++) {
+    table.insert(ecs::mutable_ecs::Entity(index, 1), static_cast<int>(index));
+  }
+  REQUIRE(table._dense_indices.get_allocator() == table.get_allocator());
+  REQUIRE(table._dense_entities.get_allocator() == table.get_allocator());
+  auto copied_table = table;
+  REQUIRE(copied_table.get_allocator() != table.get_allocator());
+  REQUIRE(copied_table._dense_entities.get_allocator() == copied_table.get_allocator());
+  REQUIRE(copied_table.size() == 10);
+  auto moved_table = std::move(copied_table);
+  REQUIRE(moved_table._dense_indices.get_allocator() == moved_table.get_allocator());
+  REQUIRE(moved_table.contains(ecs::mutable_ecs::Entity(3, 1)));
+}
+
+TEST_CASE("Test RawColumn") {
+  struct Record {
+    float y;
+    float x;
+    std::int32_t id;
+  };
+
+  ecs::mutable_ecs::RawColumn column(sizeof(Record));
+  std::vector<ecs::mutable_ecs::Entity> entities;
+  for (ecs::mutable_ecs::EntityIndex index = 0; index < 10; index++) {
+    entities.emplace_back(index * 1000, 1);
+    Record record{static_cast<float>(index), -static_cast<float>(index), static_cast<std::int32_t>(index)};
+    column.insert(entities.back(), &record);
+  }
+  REQUIRE(column.size() == 10);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(column.data()) % ecs::memory_utils::CACHE_LINE_SIZE == 0);
+  REQUIRE_FALSE(column.contains(ecs::mutable_ecs::Entity(0, 0)));
+
+  // records are packed in insertion order until one is erased
+  auto records = reinterpret_cast<const Record *>(column.data());
+  REQUIRE(records[3].id == 3);
+  REQUIRE(records[3].x == -3);
+
+  REQUIRE(column.erase(entities[3]));
+  REQUIRE_FALSE(column.erase(entities[3]));
+  REQUIRE(column.size() == 9);
+  REQUIRE(reinterpret_cast<const Record *>(column.find(entities[9]))->id == 9);
+  REQUIRE(column.find(entities[3]) == nullptr);
+  REQUIRE_THROWS_AS(column.at(entities[3]), std::out_of_range);
+
+  auto copied_column = column;
+  reinterpret_cast<Record *>(column.insert(entities[0]))->id = 100;
+  REQUIRE(reinterpret_cast<const Record *>(column.at(entities[0]))->id == 100);
+  REQUIRE(reinterpret_cast<const Record *>(copied_column.at(entities[0]))->id == 0);
+  REQUIRE(copied_column.size() == 9);
+
+  // while the records are exported, records can be overwritten but not inserted or erased
+  column.export_records();
+  auto exported_data = column.data();
+  reinterpret_cast<Record *>(column.insert(entities[0]))->id = 200;
+  REQUIRE_THROWS_AS(column.insert(entities[3]), ecs::mutable_ecs::RecordsExportedError);
+  REQUIRE_THROWS_AS(column.erase(entities[0]), ecs::mutable_ecs::RecordsExportedError);
+  REQUIRE_THROWS_AS(column.reserve(column.capacity() + 1), ecs::mutable_ecs::RecordsExportedError);
+  REQUIRE_THROWS_AS(column = copied_column, ecs::mutable_ecs::RecordsExportedError);
+  REQUIRE(column.data() == exported_data);
+  REQUIRE(column.size() == 9);
+  REQUIRE_FALSE(decltype(column)(column).exported());
+  column.release_records();
+  REQUIRE(column.erase(entities[0]));
+}
+
+TEST_CASE("Test RawCommandBuffer") {
+  std::vector<ecs::mutable_ecs::Entity> entities = {ecs::mutable_ecs::Entity(0, 0), ecs::mutable_ecs::Entity(5, 2)};
+  std::vector<std::int64_t> records = {10, 20};
+
+  ecs::mutable_ecs::RawCommandBuffer<TypeIndex> command_buffer;
+  command_buffer.set(entities.data(), entities.size(), 3, reinterpret_cast<const std::byte *>(records.data()),
+                     sizeof(std::int64_t));
+  records = {30, 40};
+  command_buffer.set(entities.data(), 1, 4, reinterpret_cast<const std::byte *>(records.data()),
+                     sizeof(std::int64_t));
+  command_buffer.remove(entities.data() + 1, 1, 3);
+  command_buffer.destroy(entities.data(), entities.size());
+  REQUIRE(command_buffer.size() == 6);
+
+  // records are copied when they are recorded
+  auto &commands = command_buffer.commands();
+  auto record = [&command_buffer](const ecs::mutable_ecs::RawCommand<TypeIndex> &command) {
+    return *reinterpret_cast<const std::int64_t *>(command_buffer.record(command));
+  };
+  REQUIRE(record(commands[0]) == 10);
+  REQUIRE(record(commands[1]) == 20);
+  REQUIRE(commands[1].entity == entities[1]);
+  REQUIRE(record(commands[2]) == 30);
+  REQUIRE(commands[2].component_type == 4);
+  REQUIRE(commands[3].command_type == ecs::mutable_ecs::RawCommandType::REMOVE);
+  REQUIRE(commands[3].entity == entities[1]);
+  REQUIRE(commands[5].command_type == ecs::mutable_ecs::RawCommandType::DESTROY);
+
+  command_buffer.clear();
+  REQUIRE(command_buffer.empty());
+
+  // Batches of one entity grow the commands geometrically instead of by one per batch
+  std::size_t num_reallocations = 0;
+  auto capacity = command_buffer.commands().capacity();
+  for (std::size_t batch_index = 0; batch_index < 4000; batch_index++) {
+    command_buffer.destroy(entities.data(), 1);
+    if (command_buffer.commands().capacity() != capacity) {
+      capacity = command_buffer.commands().capacity();
+      num_reallocations++;
+    }
+  }
+  REQUIRE(command_buffer.size() == 4000);
+  REQUIRE(num_reallocations <= 12);
+}
+
+TEST_CASE("Test ComponentSignature") {
+  ecs::mutable_ecs::ComponentSignature signature;
+  signature.set(1).set(70).set(300);
+  REQUIRE(signature.test(1));
+  REQUIRE(signature.test(300));
+  REQUIRE_FALSE(signature.test(2));
+  REQUIRE_FALSE(signature.test(1000));
+
+  ecs::mutable_ecs::ComponentSignature query_signature;
+  query_signature.set(1).set(300);
+  REQUIRE(signature.contains(query_signature));
+  REQUIRE(signature.intersects(query_signature));
+
+  query_signature.set(200);
+  REQUIRE_FALSE(signature.contains(query_signature));
+
+  std::vector<std::size_t> bits;
+  signature.for_each_bit([&bits](std::size_t bit) { bits.push_back(bit); });
+  REQUIRE(bits == std::vector<std::size_t>{1, 70, 300});
+
+  signature.reset(300).reset(1000);
+  REQUIRE_FALSE(signature.intersects(ecs::mutable_ecs::ComponentSignature().set(300)));
+  signature.clear();
+  REQUIRE(signature.none());
+}
+
+TEST_CASE("Test ComponentRegistry") {
+  using Registry = ecs::type_utils::component_registry_t<ComponentType>;
+  static_assert(Registry::size == 2);
+  static_assert(Registry::index<int>() == 0 and Registry::index<float>() == 1);
+  static_assert(Registry::contains<float> and not Registry::contains<double>);
+  static_assert(ecs::type_utils::type_name<float>() == "float");
+  static_assert(Registry::stable_type_id<int>() == ecs::type_utils::hash_type_name("int"));
+  static_assert(ecs::type_utils::component_registry_t<int>::size == 0);
+
+  // The declared component types take the first bits in order, whatever order they are added in
+  auto ecdb = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType>();
+  ecs::mutable_ecs::Entity entity;
+  std::tie(ecdb, entity) = add_entity(ecdb, {FLOAT_COMPONENT, INT_COMPONENT});
+  REQUIRE(ecdb._component_type_registry.find_bit(ecs::type_utils::get_type_id<float>()) == Registry::index<float>());
+  REQUIRE(ecdb._component_type_registry.find_bit(ecs::type_utils::get_type_id<int>()) == Registry::index<int>());
+  REQUIRE(ecs::mutable_ecs::_find_bit<double>(ecdb) == ecs::mutable_ecs::NO_SIGNATURE_BIT);
+  REQUIRE(ecs::mutable_ecs::query<int, ecs::mutable_ecs::without<float>>(ecdb).size() == 0);
+  REQUIRE(ecs::mutable_ecs::query<float, ecs::mutable_ecs::without<double>>(ecdb).size() == 1);
+}
 } // namespace test_basics
 
 namespace test_mutable_ecs_cpp {
@@ -104,7 +931,6 @@ PositionComponent operator+(const PositionComponent &a, const VelocityComponent
 };
 
 using ComponentType = std::variant<PositionComponent, VelocityComponent>;
-using EntityComponentDatabase = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
 
 struct AddComponentAction {
   ecs::mutable_ecs::Entity entity;
@@ -117,6 +943,7 @@ struct RemoveEntityAction {
 
 using ActionUnion = std::variant<AddComponentAction, RemoveEntityAction>;
 
+template <typename EntityComponentDatabase>
 EntityComponentDatabase process_action(EntityComponentDatabase &ecdb, ActionUnion &action) {
   ecdb = std::visit(
       ecs::variant_utils::overloaded{
@@ -129,13 +956,11 @@ EntityComponentDatabase process_action(EntityComponentDatabase &ecdb, ActionUnio
 
 struct MovementSystem {
 
+  template <typename EntityComponentDatabase>
   std::vector<ActionUnion> operator()(EntityComponentDatabase &ecdb) const {
     std::vector<ActionUnion> actions;
-    auto queried_entities = ecs::mutable_ecs::query<PositionComponent, VelocityComponent>(ecdb);
-    for (auto &&[entity, components] : queried_entities) {
-      auto position_component = std::get<PositionComponent>(components.at(0));
-      auto velocity_component = std::get<VelocityComponent>(components.at(1));
-
+    for (auto [entity, position_component, velocity_component] :
+         ecs::mutable_ecs::view<PositionComponent, VelocityComponent>(ecdb)) {
       actions.emplace_back(AddComponentAction{.entity{entity}, .component{position_component + velocity_component}});
       actions.emplace_back(AddComponentAction{.entity{entity}, .component{VelocityComponent{.y = 0, .x = 0}}});
     }
@@ -145,10 +970,12 @@ struct MovementSystem {
 
 struct RemoveRandomEntitySystem {
 
+  template <typename EntityComponentDatabase>
   std::vector<ActionUnion> operator()(EntityComponentDatabase &ecdb) const {
     std::vector<ActionUnion> actions;
-    auto &entities = ecdb._entity_to_component_types;
-    auto &first_entity = entities.begin()->first;
+    // not so random after all :)
+    auto queried_entities = ecs::mutable_ecs::query(ecdb, std::vector<TypeIndex>{});
+    auto first_entity = std::get<0>(queried_entities.front());
     actions.emplace_back(RemoveEntityAction{.entity{first_entity}});
     return actions;
   }
@@ -156,6 +983,7 @@ struct RemoveRandomEntitySystem {
 
 using SystemUnion = std::variant<MovementSystem, RemoveRandomEntitySystem>;
 
+template <typename EntityComponentDatabase>
 std::vector<ActionUnion> process_system(EntityComponentDatabase &ecdb, SystemUnion &system) {
   auto actions = std::visit(ecs::variant_utils::overloaded{
                                 [&ecdb](const MovementSystem &system) { return system(ecdb); },
@@ -166,24 +994,57 @@ std::vector<ActionUnion> process_system(EntityComponentDatabase &ecdb, SystemUni
   return actions;
 }
 
-TEST_CASE("Test Mutable C++ Ecs") {
+template <typename EntityComponentDatabase>
+void record_system_commands(EntityComponentDatabase &ecdb, SystemUnion &system,
+                            ecs::mutable_ecs::CommandBuffer<TypeIndex, ComponentType> &command_buffer) {
+  for (auto &action : process_system(ecdb, system)) {
+    std::visit(ecs::variant_utils::overloaded{
+                   [&command_buffer](const AddComponentAction &action) {
+                     command_buffer.add(action.entity, action.component);
+                   },
+                   [&command_buffer](const RemoveEntityAction &action) { command_buffer.destroy(action.entity); },
+               },
+               action);
+  }
+}
+
+enum class SystemsExecution { SEQUENTIAL, PARALLEL, COMMAND_BUFFER };
 
-  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType>();
+template <typename EntityComponentDatabase>
+void test_mutable_ecs(EntityComponentDatabase ecdb, SystemsExecution systems_execution = SystemsExecution::SEQUENTIAL) {
+  ecs::mutable_ecs::ThreadPool thread_pool(systems_execution == SystemsExecution::PARALLEL ? 4 : 0);
 
-  auto num_original_entities = 10;
-  for (auto i = 0; i < num_original_entities; i++) {
+  int num_original_entities = ecdb.size() + 10;
+  for (auto i = 0; i < 10; i++) {
     ecs::mutable_ecs::Entity entity;
     std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 0, .x = 0}});
   }
 
   auto systems = ecs::mutable_ecs::create_systems<SystemUnion>();
-  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
-  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 0);
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(
+      systems, MovementSystem(), 0,
+      ecs::mutable_ecs::system_access(ecs::mutable_ecs::reads<PositionComponent, VelocityComponent>{}));
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 0,
+                                                      ecs::mutable_ecs::system_access());
 
   int loop_index = 0;
   while (true) {
-    ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
-        ecdb, systems, process_system, process_action);
+    if (systems_execution == SystemsExecution::SEQUENTIAL) {
+      ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+          ecdb, systems, process_system<EntityComponentDatabase>, process_action<EntityComponentDatabase>);
+    } else if (systems_execution == SystemsExecution::PARALLEL) {
+      ecdb = ecs::mutable_ecs::process_systems_in_parallel<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+          ecdb, systems, process_system<EntityComponentDatabase>, process_action<EntityComponentDatabase>,
+          thread_pool);
+    } else {
+      ecs::mutable_ecs::FlushReport flush_report;
+      std::tie(ecdb, flush_report) =
+          ecs::mutable_ecs::process_systems_with_commands<TypeIndex, ComponentType, SystemUnion>(
+              ecdb, systems, record_system_commands<EntityComponentDatabase>);
+      // the two components written to the removed entity are dropped
+      REQUIRE(flush_report.num_skipped_commands == 2);
+      REQUIRE(flush_report.num_applied_commands == flush_report.num_recorded_commands - 2);
+    }
 
     REQUIRE(ecdb.size() == num_original_entities - loop_index - 1);
 
@@ -194,4 +1055,909 @@ TEST_CASE("Test Mutable C++ Ecs") {
     loop_index += 1;
   }
 }
+
+#define ECDB_TYPES                                                                                                     \
+  (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::HashMapStorage>),             \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::ArchetypeStorage>),     \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::SparseSetStorage>)
+
+TEMPLATE_TEST_CASE("Test Mutable C++ Ecs", "", ECDB_TYPES) {
+  test_mutable_ecs(TestType());
+}
+
+TEMPLATE_TEST_CASE("Test Mutable C++ Ecs In Parallel", "", ECDB_TYPES) {
+  test_mutable_ecs(TestType(), SystemsExecution::PARALLEL);
+}
+
+TEMPLATE_TEST_CASE("Test Mutable C++ Ecs With Command Buffer", "", ECDB_TYPES) {
+  test_mutable_ecs(TestType(), SystemsExecution::COMMAND_BUFFER);
+}
+
+TEMPLATE_TEST_CASE("Test Mutable C++ Ecs With Frame Profiler", "", ECDB_TYPES) {
+  static_assert(std::is_empty_v<ecs::profiler::NullProfiler>);
+
+  auto ecdb = TestType();
+  for (auto i = 0; i < 10; i++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 0, .x = 0}});
+  }
+
+  auto systems = ecs::mutable_ecs::create_systems<SystemUnion>();
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 0);
+
+  ecs::profiler::FrameProfiler profiler(4);
+  profiler.set_system_name(0, 0, "MovementSystem");
+  for (auto frame_index = 0; frame_index < 5; frame_index++) {
+    if (frame_index == 2) {
+      profiler.capture(2);
+    }
+    ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+        ecdb, systems, process_system<TestType>, process_action<TestType>, profiler);
+  }
+  REQUIRE(ecdb.size() == 5);
+  REQUIRE(profiler.num_frames() == 5);
+  REQUIRE_FALSE(profiler.capturing());
+
+  // the third frame starts with 8 entities
+  auto &frames = profiler.captured_frames();
+  REQUIRE(frames.size() == 2);
+  REQUIRE(frames[0].frame_index == 2);
+  REQUIRE(frames[0].systems.size() == 2);
+  REQUIRE(frames[0].systems[0].num_actions == 16);
+  REQUIRE(frames[0].systems[1].system_index == 1);
+  REQUIRE(frames[0].systems[1].num_actions == 1);
+  REQUIRE(frames[0].applies.size() == 1);
+  REQUIRE(frames[0].applies[0].num_actions == 17);
+  REQUIRE(frames[1].start_in_nanoseconds >= frames[0].start_in_nanoseconds + frames[0].time_in_nanoseconds);
+  if constexpr (ecs::profiler::COUNT_VISITED_ENTITIES) {
+    REQUIRE(frames[0].systems[1].num_visited_entities == 8);
+  }
+
+  // percentiles are over the last 4 frames, which start with 9, 8, 7 and 6 entities
+  REQUIRE(profiler.system_actions_percentile(0, 0, 0) == 12);
+  REQUIRE(profiler.system_actions_percentile(0, 0, 50) == 16);
+  REQUIRE(profiler.system_actions_percentile(0, 0, 100) == 18);
+  REQUIRE(profiler.system_actions_percentile(1, 0, 50) == 0);
+  REQUIRE(profiler.frame_time_percentile(100) >= profiler.system_time_percentile(0, 0, 0));
+  REQUIRE(profiler.frame_time_percentile(100) >= profiler.apply_time_percentile(0, 0));
+
+  std::ostringstream trace;
+  profiler.write_chrome_trace(trace);
+  REQUIRE(trace.str().find("\"name\": \"MovementSystem\"") != std::string::npos);
+  REQUIRE(trace.str().find("\"name\": \"priority 0 system 1\"") != std::string::npos);
+  std::size_t num_events = 0;
+  for (auto position = trace.str().find("\"ph\""); position != std::string::npos;
+       position = trace.str().find("\"ph\"", position + 1)) {
+    num_events++;
+  }
+  // a frame, two systems and an apply per captured frame
+  REQUIRE(num_events == 8);
+
+  // process_systems_in_parallel records the systems once their batch is done, they conflict so they run one by one
+  ecs::mutable_ecs::ThreadPool thread_pool(2);
+  ecs::profiler::FrameProfiler parallel_profiler(4);
+  parallel_profiler.capture(1);
+  ecdb = ecs::mutable_ecs::process_systems_in_parallel<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+      ecdb, systems, process_system<TestType>, process_action<TestType>, thread_pool, parallel_profiler);
+  REQUIRE(ecdb.size() == 4);
+  auto &parallel_frames = parallel_profiler.captured_frames();
+  REQUIRE(parallel_frames.size() == 1);
+  REQUIRE(parallel_frames[0].systems.size() == 2);
+  REQUIRE(parallel_frames[0].systems[0].num_actions == 10);
+  REQUIRE(parallel_frames[0].systems[1].system_index == 1);
+  REQUIRE(parallel_frames[0].systems[1].start_in_nanoseconds >=
+          parallel_frames[0].systems[0].start_in_nanoseconds + parallel_frames[0].systems[0].time_in_nanoseconds);
+  REQUIRE(parallel_frames[0].applies.size() == 1);
+  REQUIRE(parallel_frames[0].applies[0].num_actions == 11);
+  if constexpr (ecs::profiler::COUNT_VISITED_ENTITIES) {
+    REQUIRE(parallel_frames[0].systems[1].num_visited_entities == 5);
+  }
+
+  // The frame arena is reset when an action throws
+  auto throw_in_action = [](TestType &, ActionUnion &) -> TestType { throw std::runtime_error("action failed"); };
+  REQUIRE_THROWS(ecs::mutable_ecs::process_systems_in_parallel<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+      ecdb, systems, process_system<TestType>, throw_in_action, thread_pool, parallel_profiler));
+  REQUIRE(systems._frame_arena._offset == 0);
+  REQUIRE(parallel_profiler.num_frames() == 1);
+}
+
+TEST_CASE("Test System Scheduling") {
+  using ecs::mutable_ecs::reads;
+  using ecs::mutable_ecs::system_access;
+  using ecs::mutable_ecs::writes;
+
+  auto batches = ecs::mutable_ecs::schedule_systems({
+      system_access(reads<VelocityComponent>{}, writes<PositionComponent>{}),
+      system_access(reads<VelocityComponent>{}),
+      system_access(reads<PositionComponent>{}),
+      system_access(reads<>{}, writes<VelocityComponent>{}),
+      ecs::mutable_ecs::SystemAccess(),
+  });
+  REQUIRE(batches == std::vector<std::vector<std::size_t>>{{0, 1}, {2, 3}, {4}});
+}
+
+TEST_CASE("Test Pipeline") {
+  using ecs::mutable_ecs::reads;
+  using ecs::mutable_ecs::system_access;
+  using ecs::mutable_ecs::SystemOrder;
+  using ecs::mutable_ecs::writes;
+  using EntityComponentDatabase = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
+
+  enum class System { INPUT, MOVE, AI, AUDIO, RENDER };
+
+  auto create_pipeline = [] {
+    auto pipeline = ecs::mutable_ecs::create_pipeline<System>();
+    pipeline = ecs::mutable_ecs::add_stage(pipeline, "update");
+    pipeline = ecs::mutable_ecs::add_stage(pipeline, "render");
+    pipeline = ecs::mutable_ecs::add_system(pipeline, "move", System::MOVE, "update",
+                                            system_access(reads<VelocityComponent>{}, writes<PositionComponent>{}),
+                                            SystemOrder().after("input"));
+    pipeline = ecs::mutable_ecs::add_system(pipeline, "input", System::INPUT, "update",
+                                            system_access(reads<>{}, writes<VelocityComponent>{}));
+    pipeline = ecs::mutable_ecs::add_system(pipeline, "ai", System::AI, "update",
+                                            system_access(reads<PositionComponent>{}));
+    pipeline = ecs::mutable_ecs::add_system(pipeline, "audio", System::AUDIO, "update", system_access());
+    // Constraints on the systems of earlier stages are implied by the order of the stages
+    pipeline = ecs::mutable_ecs::add_system(pipeline, "render", System::RENDER, "render",
+                                            system_access(reads<PositionComponent>{}), SystemOrder().after("move"));
+    return pipeline;
+  };
+
+  auto pipeline = create_pipeline();
+  pipeline = ecs::mutable_ecs::build_pipeline(pipeline);
+  // ai reads the positions that move writes, audio depends on nothing
+  REQUIRE(pipeline._stage_to_node_indices == std::vector<std::vector<std::size_t>>{{1, 0, 2, 3}, {4}});
+  REQUIRE(pipeline._nodes[pipeline.node_index("audio")].num_predecessors == 0);
+  REQUIRE(pipeline._nodes[pipeline.node_index("ai")].num_predecessors == 1);
+
+  for (auto systems_execution : {SystemsExecution::SEQUENTIAL, SystemsExecution::PARALLEL}) {
+    auto pipeline = create_pipeline();
+    ecs::mutable_ecs::ThreadPool thread_pool(4);
+    auto ecdb = EntityComponentDatabase();
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}});
+    // Every frame dispatches the events of its actions
+    std::size_t num_set_batches = 0;
+    ecs::mutable_ecs::ObserverHandle observer_handle;
+    std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<PositionComponent>(
+        ecdb, ecs::mutable_ecs::ObserverEvent::SET,
+        [&num_set_batches, &entity](EntityComponentDatabase &, const std::vector<ecs::mutable_ecs::Entity> &entities) {
+          REQUIRE(entities == std::vector{entity});
+          num_set_batches += 1;
+        });
+
+    std::mutex mutex;
+    std::vector<System> processed_systems;
+    std::vector<int> rendered_positions;
+    auto process_system = [&](EntityComponentDatabase &ecdb, System &system) {
+      std::vector<ActionUnion> actions;
+      if (system == System::MOVE) {
+        auto position = std::get<PositionComponent>(
+            get_component(ecdb, entity, ecs::type_utils::get_type_id<PositionComponent>()));
+        actions.emplace_back(AddComponentAction{.entity{entity}, .component{PositionComponent{position.y + 1, 0}}});
+      } else if (system == System::RENDER) {
+        // The actions of a stage are applied before the next stage
+        rendered_positions.push_back(std::get<PositionComponent>(
+            get_component(ecdb, entity, ecs::type_utils::get_type_id<PositionComponent>())).y);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      processed_systems.push_back(system);
+      return actions;
+    };
+
+    for (auto frame_index = 0; frame_index < 3; frame_index++) {
+      if (systems_execution == SystemsExecution::SEQUENTIAL) {
+        ecdb = ecs::mutable_ecs::run_pipeline<TypeIndex, ComponentType, System, ActionUnion>(
+            ecdb, pipeline, process_system, process_action<EntityComponentDatabase>);
+      } else {
+        ecdb = ecs::mutable_ecs::run_pipeline_in_parallel<TypeIndex, ComponentType, System, ActionUnion>(
+            ecdb, pipeline, process_system, process_action<EntityComponentDatabase>, thread_pool);
+      }
+    }
+    REQUIRE(rendered_positions == std::vector<int>{1, 2, 3});
+    REQUIRE(num_set_batches == 3);
+
+    REQUIRE(processed_systems.size() == 15);
+    for (std::size_t frame_index = 0; frame_index < 3; frame_index++) {
+      auto frame_begin = processed_systems.begin() + frame_index * 5;
+      auto position = [&](System system) { return std::find(frame_begin, frame_begin + 5, system) - frame_begin; };
+      if (systems_execution == SystemsExecution::SEQUENTIAL) {
+        REQUIRE(std::vector<System>(frame_begin, frame_begin + 5) ==
+                std::vector<System>{System::INPUT, System::MOVE, System::AI, System::AUDIO, System::RENDER});
+      }
+      REQUIRE(position(System::INPUT) < position(System::MOVE));
+      REQUIRE(position(System::MOVE) < position(System::AI));
+      REQUIRE(position(System::RENDER) == 4);
+    }
+
+    REQUIRE(pipeline._nodes[pipeline.node_index("render")].num_runs == 3);
+    REQUIRE(pipeline.time_percentile("move", 100) > 0);
+    std::stringstream json;
+    pipeline.write_json(json);
+    REQUIRE(json.str().find("{\"name\": \"move\", \"runs\": 3") != std::string::npos);
+    REQUIRE(json.str().find("{\"from\": \"move\", \"to\": \"ai\", \"kind\": \"conflict\"}") != std::string::npos);
+    std::stringstream dot;
+    pipeline.write_dot(dot);
+    REQUIRE(dot.str().find("node_1 -> node_0;") != std::string::npos);
+    REQUIRE(dot.str().find("node_0 -> node_2 [style=dashed];") != std::string::npos);
+
+    // The frame arena is reset when a system throws
+    if (systems_execution == SystemsExecution::SEQUENTIAL) {
+      auto throw_in_render = [&process_system](EntityComponentDatabase &ecdb, System &system) {
+        if (system == System::RENDER) {
+          throw std::runtime_error("render failed");
+        }
+        return process_system(ecdb, system);
+      };
+      REQUIRE_THROWS(ecs::mutable_ecs::run_pipeline<TypeIndex, ComponentType, System, ActionUnion>(
+          ecdb, pipeline, throw_in_render, process_action<EntityComponentDatabase>));
+      REQUIRE(pipeline._frame_arena._offset == 0);
+    }
+  }
+
+  auto invalid_pipeline = create_pipeline();
+  invalid_pipeline = ecs::mutable_ecs::add_system(invalid_pipeline, "spawn", System::AI, "update", system_access(),
+                                                  SystemOrder().after("render"));
+  REQUIRE_THROWS(ecs::mutable_ecs::build_pipeline(invalid_pipeline));
+
+  invalid_pipeline = create_pipeline();
+  invalid_pipeline = ecs::mutable_ecs::add_system(invalid_pipeline, "spawn", System::AI, "update", system_access(),
+                                                  SystemOrder().after("move").before("input"));
+  REQUIRE_THROWS(ecs::mutable_ecs::build_pipeline(invalid_pipeline));
+
+  invalid_pipeline = create_pipeline();
+  invalid_pipeline = ecs::mutable_ecs::add_system(invalid_pipeline, "spawn", System::AI, "update", system_access(),
+                                                  SystemOrder().after("physics"));
+  REQUIRE_THROWS(ecs::mutable_ecs::build_pipeline(invalid_pipeline));
+  REQUIRE_THROWS(ecs::mutable_ecs::add_system(invalid_pipeline, "spawn", System::AI, "update"));
+  REQUIRE_THROWS(ecs::mutable_ecs::add_system(invalid_pipeline, "present", System::AI, "present"));
+}
+
+// Priority levels of Systems run in ascending order of priority
+TEST_CASE("Test System Priorities") {
+  using EntityComponentDatabase = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
+
+  auto systems = ecs::mutable_ecs::create_systems<int>();
+  for (auto priority : {2, 0, 3, 1}) {
+    systems = ecs::mutable_ecs::add_system<int>(systems, priority, priority);
+  }
+  std::vector<int> processed_systems;
+  auto process_system = [&](EntityComponentDatabase &, int &system) {
+    processed_systems.push_back(system);
+    return std::vector<ActionUnion>{};
+  };
+  auto ecdb = EntityComponentDatabase();
+  ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, int, ActionUnion>(
+      ecdb, systems, process_system, process_action<EntityComponentDatabase>);
+  REQUIRE(processed_systems == std::vector<int>{0, 1, 2, 3});
+
+  // The frame arena is reset when a system throws
+  ecs::mutable_ecs::Entity entity;
+  std::tie(ecdb, entity) = add_entity(ecdb);
+  auto throw_at_priority_2 = [&entity](EntityComponentDatabase &, int &system) {
+    if (system == 2) {
+      throw std::runtime_error("system failed");
+    }
+    return std::vector<ActionUnion>{AddComponentAction{.entity{entity}, .component{PositionComponent{system, 0}}}};
+  };
+  REQUIRE_THROWS(ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, int, ActionUnion>(
+      ecdb, systems, throw_at_priority_2, process_action<EntityComponentDatabase>));
+  REQUIRE(systems._frame_arena._offset == 0);
+}
+
+TEST_CASE("Test ThreadPool") {
+  for (std::size_t num_threads : {0, 1, 4}) {
+    ecs::mutable_ecs::ThreadPool thread_pool(num_threads);
+    REQUIRE(thread_pool.size() == num_threads);
+
+    std::vector<int> results(100, 0);
+    std::vector<ecs::mutable_ecs::ThreadPool::Task> tasks;
+    for (std::size_t index = 0; index < results.size(); index++) {
+      tasks.emplace_back([&results, &thread_pool, index] {
+        // nested run() calls are executed by the calling task
+        std::vector<ecs::mutable_ecs::ThreadPool::Task> nested_tasks = {[&results, index] { results[index] += 1; }};
+        thread_pool.run(nested_tasks);
+        results[index] += 1;
+      });
+    }
+    thread_pool.run(tasks);
+    REQUIRE(results == std::vector<int>(100, 2));
+
+    std::vector<ecs::mutable_ecs::ThreadPool::Task> throwing_tasks = {
+        [] {}, [] { throw std::runtime_error("Task failed"); }};
+    REQUIRE_THROWS_AS(thread_pool.run(throwing_tasks), std::runtime_error);
+  }
+}
+
+TEST_CASE("Test Mutable C++ Ecs With Owned Group") {
+  auto ecdb = ecs::mutable_ecs::create_ecdb<TypeIndex, ComponentType, ecs::mutable_ecs::SparseSetStorage>();
+
+  // entities added before the group is created are sorted into it
+  ecs::mutable_ecs::Entity entity;
+  std::tie(ecdb, entity) = add_entity(ecdb, {VelocityComponent{.y = 1, .x = 1}});
+  std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 1, .x = 1}});
+  ecdb = ecs::mutable_ecs::create_owned_group<PositionComponent, VelocityComponent>(ecdb);
+  std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}});
+  ecdb = add_component(ecdb, entity, ComponentType{VelocityComponent{.y = 1, .x = 1}});
+
+  auto &storage = ecdb._storage;
+  auto &owned_group = storage._owned_groups.at(0);
+  REQUIRE(owned_group.size == 2);
+  for (std::size_t dense_index = 0; dense_index < owned_group.size; dense_index++) {
+    REQUIRE(storage.pool<PositionComponent>()._dense_entities[dense_index] ==
+            storage.pool<VelocityComponent>()._dense_entities[dense_index]);
+  }
+  REQUIRE(ecs::mutable_ecs::query<PositionComponent, VelocityComponent>(ecdb).size() == 2);
+
+  ecdb = remove_component(ecdb, entity, ecs::type_utils::get_type_id<PositionComponent>());
+  REQUIRE(owned_group.size == 1);
+  REQUIRE(ecs::mutable_ecs::query<PositionComponent, VelocityComponent>(ecdb).size() == 1);
+  REQUIRE(ecs::mutable_ecs::query<VelocityComponent>(ecdb).size() == 3);
+
+  std::vector<ecs::mutable_ecs::Entity> entities;
+  std::tie(ecdb, entities) =
+      add_entities(ecdb, 3, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 1, .x = 1}});
+  REQUIRE(owned_group.size == 4);
+  ecdb = remove_entities(ecdb, {entities[0], entities[2]});
+  REQUIRE(owned_group.size == 2);
+  test_mutable_ecs(std::move(ecdb));
+}
+
+TEMPLATE_TEST_CASE("Test Spatial Index", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::Entity;
+  using ecs::mutable_ecs::SpatialBox;
+  using ecs::mutable_ecs::SpatialPoint;
+
+  auto ecdb = TestType();
+  REQUIRE_THROWS(ecs::mutable_ecs::query_radius(ecdb, SpatialPoint{0, 0}, 1));
+
+  // A 10x10 grid of entities, every other one of them moves
+  std::vector<Entity> entities(100);
+  for (int entity_index = 0; entity_index < 100; entity_index++) {
+    std::vector<ComponentType> components = {PositionComponent{.y = entity_index / 10, .x = entity_index % 10}};
+    if (entity_index % 2 == 0) {
+      components.push_back(VelocityComponent{.y = 1, .x = 1});
+    }
+    std::tie(ecdb, entities[entity_index]) = add_entity(ecdb, components);
+  }
+  ecdb = ecs::mutable_ecs::bind_spatial_index<PositionComponent>(ecdb, 3, [](const PositionComponent &position) {
+    return SpatialPoint{static_cast<float>(position.x), static_cast<float>(position.y)};
+  });
+  REQUIRE(ecdb._spatial_index.size() == 100);
+
+  auto get_entities = [](const auto &entity_views) {
+    std::vector<Entity> entities;
+    for (auto &entity_view : entity_views) {
+      entities.push_back(std::get<0>(entity_view));
+    }
+    std::sort(entities.begin(), entities.end(),
+              [](const Entity &a, const Entity &b) { return a.index < b.index; });
+    return entities;
+  };
+  auto brute_force_radius = [&ecdb](SpatialPoint center, float radius) {
+    std::vector<Entity> entities;
+    for (auto &[entity, components] : ecs::mutable_ecs::query<PositionComponent>(ecdb)) {
+      auto position = std::get<PositionComponent>(components[0]);
+      auto dx = position.x - center.x;
+      auto dy = position.y - center.y;
+      if (dx * dx + dy * dy <= radius * radius) {
+        entities.push_back(entity);
+      }
+    }
+    std::sort(entities.begin(), entities.end(),
+              [](const Entity &a, const Entity &b) { return a.index < b.index; });
+    return entities;
+  };
+
+  for (auto [center, radius] : std::vector<std::tuple<SpatialPoint, float>>{
+           {{0, 0}, 0}, {{4.5, 4.5}, 2}, {{-3, 2}, 4}, {{9, 9}, 1.5}, {{5, 5}, 100}, {{50, 50}, 1}}) {
+    REQUIRE(get_entities(ecs::mutable_ecs::query_radius(ecdb, center, radius)) == brute_force_radius(center, radius));
+  }
+  REQUIRE(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{2, 3}, {4, 4}}).size() == 6);
+  REQUIRE(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{4, 4}, {2, 3}}).size() == 0);
+
+  // Only the entities that have all of the requested component types, their components can be modified in place
+  auto moving_entities = ecs::mutable_ecs::query_radius<PositionComponent, VelocityComponent>(ecdb, {0, 0}, 0.5);
+  REQUIRE(get_entities(moving_entities) == std::vector{entities[0]});
+  auto &[moving_entity, position, velocity] = moving_entities[0];
+  position.x = 20;
+  REQUIRE(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, 1).size() == 3);
+  ecs::mutable_ecs::mark_changed(ecdb, moving_entity, ecs::type_utils::get_type_id<PositionComponent>());
+  REQUIRE(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, 1).size() == 2);
+  REQUIRE(get_entities(ecs::mutable_ecs::query_radius(ecdb, {20, 0}, 0)) == std::vector{entities[0]});
+
+  // Structural changes and flushes update the index
+  ecdb = add_component(ecdb, entities[1], ComponentType{PositionComponent{.y = 30, .x = 30}});
+  ecdb = remove_component(ecdb, entities[10], ecs::type_utils::get_type_id<PositionComponent>());
+  ecdb = remove_entity(ecdb, entities[11]);
+  REQUIRE(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, 1.5).size() == 0);
+  REQUIRE(get_entities(ecs::mutable_ecs::query_radius(ecdb, {30, 30}, 0)) == std::vector{entities[1]});
+
+  ecs::mutable_ecs::CommandBuffer<TypeIndex, ComponentType> command_buffer;
+  command_buffer.set(entities[1], ComponentType{PositionComponent{.y = 0, .x = 0}});
+  command_buffer.create({PositionComponent{.y = 0, .x = 1}});
+  ecs::mutable_ecs::FlushReport flush_report;
+  std::tie(ecdb, flush_report) = flush(ecdb, command_buffer);
+  REQUIRE(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, 1).size() == 2);
+  REQUIRE(ecdb._spatial_index.size() == 99);
+  REQUIRE(get_entities(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{-100, -100}, {100, 100}})) ==
+          brute_force_radius({0, 0}, 1000));
+
+  // Unbounded queries visit every cell, bounds beyond the grid fall in its outermost cells
+  auto infinity = std::numeric_limits<float>::infinity();
+  REQUIRE(get_entities(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, infinity)) == brute_force_radius({0, 0}, 1000));
+  REQUIRE(get_entities(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{-infinity, -infinity}, {infinity, infinity}})) ==
+          brute_force_radius({0, 0}, 1000));
+  REQUIRE(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{-infinity, -infinity}, {0.5, 0.5}}).size() == 1);
+  REQUIRE(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{1e30f, 1e30f}, {infinity, infinity}}).size() == 0);
+  REQUIRE(ecs::mutable_ecs::query_radius(ecdb, {0, 0}, std::numeric_limits<float>::quiet_NaN()).size() == 0);
+
+  // Points that are not finite are rejected and left out of the index
+  ecdb = ecs::mutable_ecs::bind_spatial_index<PositionComponent>(ecdb, 3, [infinity](const PositionComponent &position) {
+    return SpatialPoint{position.x < 1000 ? static_cast<float>(position.x) : infinity, static_cast<float>(position.y)};
+  });
+  REQUIRE_THROWS_AS(add_component(ecdb, entities[10], ComponentType{PositionComponent{.y = 0, .x = 1000}}),
+                    std::runtime_error);
+  REQUIRE_FALSE(ecdb._spatial_index.contains(entities[10].index));
+  REQUIRE(ecdb._spatial_index.size() == 99);
+
+  ecdb = ecs::mutable_ecs::unbind_spatial_index(ecdb);
+  REQUIRE_THROWS(ecs::mutable_ecs::query_aabb(ecdb, SpatialBox{{0, 0}, {1, 1}}));
+}
+
+TEMPLATE_TEST_CASE("Test Checksum", "", ECDB_TYPES) {
+  auto ecdb = TestType();
+  REQUIRE_THROWS(ecs::mutable_ecs::get_checksum(ecdb));
+
+  std::vector<ecs::mutable_ecs::Entity> entities(10);
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index++) {
+    std::tie(ecdb, entities[entity_index]) =
+        add_entity(ecdb, {PositionComponent{.y = static_cast<int>(entity_index), .x = 0}});
+  }
+  ecdb = ecs::mutable_ecs::enable_checksum(ecdb);
+  auto checksum = ecs::mutable_ecs::get_checksum(ecdb);
+  REQUIRE(checksum == ecs::mutable_ecs::compute_checksum(ecdb));
+
+  // Writes that restore the components restore the checksum
+  ecdb = add_component(ecdb, entities[3], ComponentType{VelocityComponent{.y = 1, .x = 1}});
+  ecdb = add_component(ecdb, entities[4], ComponentType{PositionComponent{.y = 7, .x = 7}});
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) != checksum);
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) == ecs::mutable_ecs::compute_checksum(ecdb));
+  ecdb = remove_component(ecdb, entities[3], ecs::type_utils::get_type_id<VelocityComponent>());
+  ecdb = add_component(ecdb, entities[4], ComponentType{PositionComponent{.y = 4, .x = 0}});
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) == checksum);
+
+  // In-place writes are seen once they are recorded with mark_changed
+  ecs::mutable_ecs::each<PositionComponent>(
+      ecdb, [](const ecs::mutable_ecs::Entity &, PositionComponent &position) { position.x += 1; });
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) != ecs::mutable_ecs::compute_checksum(ecdb));
+  for (auto &entity : entities) {
+    ecs::mutable_ecs::mark_changed(ecdb, entity, ecs::type_utils::get_type_id<PositionComponent>());
+  }
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) == ecs::mutable_ecs::compute_checksum(ecdb));
+
+  // Entities are part of the checksum, with and without components
+  ecdb = remove_entity(ecdb, entities[0]);
+  ecs::mutable_ecs::Entity entity;
+  std::tie(ecdb, entity) = add_entity(ecdb);
+  ecs::mutable_ecs::CommandBuffer<TypeIndex, ComponentType> command_buffer;
+  command_buffer.add(entity, ComponentType{VelocityComponent{.y = 2, .x = 2}});
+  command_buffer.destroy(entities[1]);
+  ecs::mutable_ecs::FlushReport flush_report;
+  std::tie(ecdb, flush_report) = flush(ecdb, command_buffer);
+  std::vector<ecs::mutable_ecs::Entity> new_entities;
+  std::tie(ecdb, new_entities) = add_entities(ecdb, 3, {VelocityComponent{.y = 3, .x = 3}});
+  ecdb = remove_entities(ecdb, {entities[2], new_entities[1]});
+  REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) == ecs::mutable_ecs::compute_checksum(ecdb));
+
+  // The checksum does not depend on the order of the writes
+  auto other_ecdb = TestType();
+  other_ecdb = ecs::mutable_ecs::enable_checksum(other_ecdb);
+  std::tie(other_ecdb, entity) = add_entity(other_ecdb, {PositionComponent{.y = 1, .x = 2}});
+  other_ecdb = add_component(other_ecdb, entity, ComponentType{VelocityComponent{.y = 3, .x = 4}});
+  auto another_ecdb = TestType();
+  another_ecdb = ecs::mutable_ecs::enable_checksum(another_ecdb);
+  std::tie(another_ecdb, entity) =
+      add_entity(another_ecdb, {VelocityComponent{.y = 3, .x = 4}, PositionComponent{.y = 1, .x = 2}});
+  REQUIRE(ecs::mutable_ecs::get_checksum(other_ecdb) == ecs::mutable_ecs::get_checksum(another_ecdb));
+
+  ecdb = ecs::mutable_ecs::disable_checksum(ecdb);
+  REQUIRE_THROWS(ecs::mutable_ecs::get_checksum(ecdb));
+}
+
+TEMPLATE_TEST_CASE("Test Journal", "", ECDB_TYPES) {
+  const std::string snapshot_path = "test_journal.ecdb";
+  const std::string journal_path = "test_journal.ecdbj";
+
+  auto ecdb = TestType();
+  ecdb = ecs::mutable_ecs::enable_checksum(ecdb);
+  for (auto entity_index = 0; entity_index < 10; entity_index++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) =
+        add_entity(ecdb, {PositionComponent{.y = entity_index, .x = 0}, VelocityComponent{.y = 1, .x = entity_index}});
+  }
+  ecs::mutable_ecs::save_snapshot(ecdb, snapshot_path);
+  auto journal = ecs::mutable_ecs::create_journal<ActionUnion>(ecdb);
+
+  // Removed entities are replaced, so the frames also create entities
+  auto process_action_and_respawn = [](TestType &ecdb, ActionUnion &action) {
+    ecdb = process_action(ecdb, action);
+    if (std::holds_alternative<RemoveEntityAction>(action)) {
+      ecs::mutable_ecs::Entity entity;
+      std::tie(ecdb, entity) =
+          add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 2, .x = 1}});
+    }
+    return std::move(ecdb);
+  };
+
+  auto systems = ecs::mutable_ecs::create_systems<SystemUnion>();
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 1);
+  std::vector<std::uint64_t> checksums;
+  for (auto frame = 0; frame < 20; frame++) {
+    ecdb = ecs::mutable_ecs::process_systems_with_journal<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+        ecdb, systems, process_system<TestType>, process_action_and_respawn, journal);
+    REQUIRE(ecs::mutable_ecs::get_checksum(ecdb) == ecs::mutable_ecs::compute_checksum(ecdb));
+    checksums.push_back(ecs::mutable_ecs::get_checksum(ecdb));
+  }
+  REQUIRE(journal.num_frames() == 20);
+  REQUIRE(journal.checksum(19) == checksums.back());
+  REQUIRE(journal.created_entities(0).size() == 1);
+  REQUIRE(journal.created_entities(0)[0].generation == 1);
+
+  // A frame whose action throws leaves nothing in the journal and the ecdb stops recording created entities
+  auto journal_size_in_bytes = journal.size_in_bytes();
+  auto throwing_process_action = [](TestType &, ActionUnion &) -> TestType { throw std::runtime_error("failed"); };
+  REQUIRE_THROWS(ecs::mutable_ecs::process_systems_with_journal<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+      ecdb, systems, process_system<TestType>, throwing_process_action, journal));
+  REQUIRE_FALSE(ecdb._created_entities.has_value());
+  REQUIRE(journal.num_frames() == 20);
+  REQUIRE(journal.size_in_bytes() == journal_size_in_bytes);
+
+  REQUIRE(ecs::mutable_ecs::save_journal(journal, journal_path) ==
+          sizeof(ecs::mutable_ecs::JournalHeader) + journal.size_in_bytes());
+  auto loaded_journal = ecs::mutable_ecs::load_journal<ActionUnion>(journal_path);
+  REQUIRE(loaded_journal.num_frames() == journal.num_frames());
+
+  // Rebuild any frame from the snapshot without running the systems
+  auto replayed_ecdb = TestType();
+  replayed_ecdb = ecs::mutable_ecs::enable_checksum(replayed_ecdb);
+  replayed_ecdb = ecs::mutable_ecs::load_snapshot(replayed_ecdb, snapshot_path);
+  replayed_ecdb = ecs::mutable_ecs::replay_journal<TypeIndex, ComponentType, ActionUnion>(
+      replayed_ecdb, loaded_journal, process_action_and_respawn, 13);
+  REQUIRE(ecs::mutable_ecs::get_checksum(replayed_ecdb) == checksums[12]);
+  for (std::size_t frame = 13; frame < 20; frame++) {
+    replayed_ecdb = ecs::mutable_ecs::replay_journal_frame<TypeIndex, ComponentType, ActionUnion>(
+        replayed_ecdb, loaded_journal, process_action_and_respawn, frame);
+  }
+  REQUIRE(ecs::mutable_ecs::get_checksum(replayed_ecdb) == ecs::mutable_ecs::get_checksum(ecdb));
+  REQUIRE(replayed_ecdb.size() == ecdb.size());
+  for (auto [entity, position] : ecs::mutable_ecs::view<PositionComponent>(ecdb)) {
+    auto replayed_position = std::get<PositionComponent>(
+        get_component(replayed_ecdb, entity, ecs::type_utils::get_type_id<PositionComponent>()));
+    REQUIRE(replayed_position.x == position.x);
+    REQUIRE(replayed_position.y == position.y);
+  }
+
+  // Replays that do not create the same entities or do not start at the same state are detected
+  auto diverged_ecdb = TestType();
+  diverged_ecdb = ecs::mutable_ecs::enable_checksum(diverged_ecdb);
+  diverged_ecdb = ecs::mutable_ecs::load_snapshot(diverged_ecdb, snapshot_path);
+  REQUIRE_THROWS_AS((ecs::mutable_ecs::replay_journal<TypeIndex, ComponentType, ActionUnion>(
+                        diverged_ecdb, journal, process_action<TestType>, 20)),
+                    std::runtime_error);
+  auto empty_ecdb = TestType();
+  empty_ecdb = ecs::mutable_ecs::enable_checksum(empty_ecdb);
+  REQUIRE_THROWS_AS((ecs::mutable_ecs::replay_journal<TypeIndex, ComponentType, ActionUnion>(
+                        empty_ecdb, journal, process_action_and_respawn, 1)),
+                    std::runtime_error);
+  REQUIRE_THROWS_AS((ecs::mutable_ecs::replay_journal<TypeIndex, ComponentType, ActionUnion>(
+                        replayed_ecdb, journal, process_action_and_respawn, 21)),
+                    std::runtime_error);
+
+  {
+    std::ofstream file(journal_path, std::ios::binary | std::ios::in | std::ios::out);
+    file.write("NOTECDB!", 8);
+  }
+  REQUIRE_THROWS_AS(ecs::mutable_ecs::load_journal<ActionUnion>(journal_path), std::runtime_error);
+  std::remove(journal_path.c_str());
+  std::remove(snapshot_path.c_str());
+}
+
+TEMPLATE_TEST_CASE("Test Hierarchy", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::Entity;
+
+  auto ecdb = TestType();
+  // root -> {a -> {c, d}, b -> {e}}, unrelated has no relationships
+  std::vector<Entity> entities(7);
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index++) {
+    std::tie(ecdb, entities[entity_index]) =
+        add_entity(ecdb, {PositionComponent{.y = static_cast<int>(entity_index), .x = 1}});
+  }
+  auto [root, a, b, c, d, e, unrelated] =
+      std::make_tuple(entities[0], entities[1], entities[2], entities[3], entities[4], entities[5], entities[6]);
+  for (auto [child, parent] : std::vector<std::tuple<Entity, Entity>>{{a, root}, {b, root}, {c, a}, {d, a}, {e, b}}) {
+    ecdb = ecs::mutable_ecs::set_parent(ecdb, child, parent);
+  }
+  REQUIRE(ecdb._hierarchy.size() == 5);
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, root) == std::vector{a, b});
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, c).empty());
+  REQUIRE(ecs::mutable_ecs::get_parent(ecdb, c) == a);
+  REQUIRE(ecs::mutable_ecs::get_parent(ecdb, root) == std::nullopt);
+  REQUIRE(ecs::mutable_ecs::get_descendants(ecdb, root) == std::vector{a, b, c, d, e});
+  REQUIRE_THROWS(ecs::mutable_ecs::set_parent(ecdb, root, c));
+  REQUIRE_THROWS(ecs::mutable_ecs::set_parent(ecdb, a, a));
+
+  // Parents are visited before their children, so world positions are propagated in one pass
+  auto propagate = [&ecdb]() {
+    std::vector<Entity> visited_entities;
+    std::unordered_map<Entity, PositionComponent> world_positions;
+    ecs::mutable_ecs::each_breadth_first<PositionComponent>(
+        ecdb, [&](const Entity &entity, const Entity *parent, PositionComponent &position) {
+          auto world_position = position;
+          if (parent != nullptr and world_positions.count(*parent) == 1) {
+            world_position.x += world_positions[*parent].x;
+            world_position.y += world_positions[*parent].y;
+          }
+          world_positions[entity] = world_position;
+          visited_entities.push_back(entity);
+        });
+    return std::make_tuple(visited_entities, world_positions);
+  };
+  auto [visited_entities, world_positions] = propagate();
+  REQUIRE(visited_entities == std::vector{root, a, b, c, d, e});
+  REQUIRE(world_positions[d].x == 3);
+  REQUIRE(world_positions[d].y == 4 + 1 + 0);
+
+  // Reparenting moves the subtree, entities without the components are skipped but not their children
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, d, b);
+  ecdb = remove_component(ecdb, b, ecs::type_utils::get_type_id<PositionComponent>());
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, a) == std::vector{c});
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, b) == std::vector{e, d});
+  std::tie(visited_entities, world_positions) = propagate();
+  REQUIRE(visited_entities == std::vector{root, a, c, e, d});
+  ecdb = add_component(ecdb, b, ComponentType{PositionComponent{.y = 2, .x = 1}});
+  ecdb = ecs::mutable_ecs::remove_parent(ecdb, b);
+  REQUIRE(ecs::mutable_ecs::get_parent(ecdb, b) == std::nullopt);
+  std::tie(visited_entities, world_positions) = propagate();
+  REQUIRE(visited_entities == std::vector{root, b, a, e, d, c});
+
+  // Removing an entity removes its descendants and detaches it from its parent
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, b, root);
+  ecdb = remove_entity(ecdb, e);
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, b) == std::vector{d});
+  ecdb = remove_entity(ecdb, b);
+  REQUIRE_FALSE(is_alive(ecdb, b));
+  REQUIRE_FALSE(is_alive(ecdb, d));
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, root) == std::vector{a});
+
+  ecs::mutable_ecs::CommandBuffer<TypeIndex, ComponentType> command_buffer;
+  command_buffer.destroy(a);
+  ecs::mutable_ecs::FlushReport flush_report;
+  std::tie(ecdb, flush_report) = flush(ecdb, command_buffer);
+  REQUIRE_FALSE(is_alive(ecdb, c));
+  REQUIRE(ecs::mutable_ecs::get_children(ecdb, root).empty());
+
+  std::vector<Entity> new_entities;
+  std::tie(ecdb, new_entities) = add_entities(ecdb, 3);
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, new_entities[1], new_entities[0]);
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, new_entities[2], new_entities[1]);
+  ecdb = ecs::mutable_ecs::set_parent(ecdb, new_entities[0], root);
+  ecdb = remove_entities(ecdb, {root, new_entities[1]});
+  REQUIRE(ecdb.size() == 1);
+  REQUIRE(is_alive(ecdb, unrelated));
+  REQUIRE(ecdb._hierarchy.empty());
+  REQUIRE_THROWS(ecs::mutable_ecs::get_children(ecdb, root));
+}
+
+TEMPLATE_TEST_CASE("Test Observers", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::Entity;
+  using ecs::mutable_ecs::ObserverEvent;
+  auto position_type = ecs::type_utils::get_type_id<PositionComponent>();
+
+  auto ecdb = TestType();
+  std::map<ObserverEvent, std::vector<std::vector<Entity>>> batches;
+  std::vector<ecs::mutable_ecs::ObserverHandle> observer_handles;
+  for (auto event : {ObserverEvent::ADD, ObserverEvent::SET, ObserverEvent::REMOVE}) {
+    ecs::mutable_ecs::ObserverHandle observer_handle;
+    std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<PositionComponent>(
+        ecdb, event, [&batches, event](TestType &, const std::vector<Entity> &entities) {
+          batches[event].push_back(entities);
+        });
+    observer_handles.push_back(observer_handle);
+  }
+
+  // Events are buffered until they are dispatched, every observer gets one batch per dispatch
+  Entity a, b, c;
+  std::tie(ecdb, a) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}});
+  std::tie(ecdb, b) = add_entity(ecdb, {VelocityComponent{.y = 0, .x = 0}});
+  std::tie(ecdb, c) = add_entity(ecdb, {PositionComponent{.y = 1, .x = 1}, VelocityComponent{.y = 1, .x = 1}});
+  ecdb = add_component(ecdb, b, ComponentType{PositionComponent{.y = 2, .x = 2}});
+  REQUIRE(batches.empty());
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches[ObserverEvent::ADD] == std::vector<std::vector<Entity>>{{a, c, b}});
+  REQUIRE(batches[ObserverEvent::SET].empty());
+  REQUIRE(batches[ObserverEvent::REMOVE].empty());
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches[ObserverEvent::ADD].size() == 1);
+
+  batches.clear();
+  ecdb = add_component(ecdb, a, ComponentType{PositionComponent{.y = 3, .x = 3}});
+  ecs::mutable_ecs::mark_changed(ecdb, c, position_type);
+  ecdb = remove_component(ecdb, b, position_type);
+  ecdb = remove_component(ecdb, b, ecs::type_utils::get_type_id<VelocityComponent>());
+  ecdb = remove_entity(ecdb, c);
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches[ObserverEvent::ADD].empty());
+  REQUIRE(batches[ObserverEvent::SET] == std::vector<std::vector<Entity>>{{a, c}});
+  REQUIRE(batches[ObserverEvent::REMOVE] == std::vector<std::vector<Entity>>{{b, c}});
+
+  // Events caused by an observer are delivered by the next dispatch
+  ecs::mutable_ecs::ObserverHandle velocity_observer_handle;
+  std::tie(ecdb, velocity_observer_handle) = ecs::mutable_ecs::register_observer(
+      ecdb, ecs::type_utils::get_type_id<VelocityComponent>(), ObserverEvent::ADD,
+      [](TestType &ecdb, const std::vector<Entity> &entities) {
+        for (auto &entity : entities) {
+          ecdb = add_component(ecdb, entity, ComponentType{PositionComponent{.y = 0, .x = 0}});
+        }
+        REQUIRE_THROWS(ecs::mutable_ecs::unregister_observer(ecdb, ecs::mutable_ecs::ObserverHandle{0}));
+      });
+  batches.clear();
+  ecdb = add_component(ecdb, b, ComponentType{VelocityComponent{.y = 0, .x = 0}});
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches.empty());
+  REQUIRE(ecdb._entity_slots[b.index].signature.test(ecs::mutable_ecs::_find_bit<PositionComponent>(ecdb)));
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches[ObserverEvent::ADD] == std::vector<std::vector<Entity>>{{b}});
+  ecdb = ecs::mutable_ecs::unregister_observer(ecdb, velocity_observer_handle);
+
+  // process_systems dispatches the events of the frame at its end
+  batches.clear();
+  auto systems = ecs::mutable_ecs::create_systems<SystemUnion>();
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
+  ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+      ecdb, systems, process_system<TestType>, process_action<TestType>);
+  REQUIRE(batches[ObserverEvent::SET] == std::vector<std::vector<Entity>>{{b}});
+
+  // Unregistered observers are not called anymore and their slots are reused
+  for (auto &observer_handle : observer_handles) {
+    ecdb = ecs::mutable_ecs::unregister_observer(ecdb, observer_handle);
+  }
+  REQUIRE_THROWS(ecs::mutable_ecs::unregister_observer(ecdb, observer_handles.front()));
+  batches.clear();
+  ecdb = remove_entity(ecdb, a);
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(batches.empty());
+  ecs::mutable_ecs::ObserverHandle observer_handle;
+  std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<PositionComponent>(
+      ecdb, ObserverEvent::REMOVE, [](TestType &, const std::vector<Entity> &) {});
+  REQUIRE(observer_handle.index == observer_handles.front().index);
+  ecdb = ecs::mutable_ecs::unregister_observer(ecdb, observer_handle);
+
+  // Observers are called in the order they were registered, also when they reuse the slot of an unregistered one
+  std::vector<char> calls;
+  auto register_named_observer = [&ecdb, &calls](char name) {
+    ecs::mutable_ecs::ObserverHandle observer_handle;
+    std::tie(ecdb, observer_handle) = ecs::mutable_ecs::register_observer<PositionComponent>(
+        ecdb, ObserverEvent::ADD, [&calls, name](TestType &, const std::vector<Entity> &) { calls.push_back(name); });
+    return observer_handle;
+  };
+  auto observer_a = register_named_observer('a');
+  register_named_observer('b');
+  ecdb = ecs::mutable_ecs::unregister_observer(ecdb, observer_a);
+  auto observer_c = register_named_observer('c');
+  REQUIRE(observer_c.index == observer_a.index);
+  std::tie(ecdb, a) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}});
+  ecdb = ecs::mutable_ecs::dispatch_events(ecdb);
+  REQUIRE(calls == std::vector{'b', 'c'});
+}
+
+TEMPLATE_TEST_CASE("Test World Diff", "", ECDB_TYPES) {
+  using ecs::mutable_ecs::Entity;
+  using ecs::mutable_ecs::WorldDiffColumnHeader;
+  using ecs::mutable_ecs::WorldDiffHeader;
+  constexpr auto EMPTY_DIFF_SIZE = sizeof(WorldDiffHeader) + 2 * sizeof(WorldDiffColumnHeader);
+  auto position_type = ecs::type_utils::get_type_id<PositionComponent>();
+  auto velocity_type = ecs::type_utils::get_type_id<VelocityComponent>();
+
+  auto sender = TestType();
+  auto receiver = TestType();
+  sender = ecs::mutable_ecs::enable_checksum(sender);
+  receiver = ecs::mutable_ecs::enable_checksum(receiver);
+  ecs::mutable_ecs::WorldDiffBaseline<ComponentType> baseline;
+  std::array<char, 4096> buffer;
+  // The loopback network delivers a copy of the bytes of every diff
+  auto send = [&sender, &receiver, &baseline, &buffer]() {
+    auto size = ecs::mutable_ecs::write_world_diff(sender, baseline, buffer.data(), buffer.size());
+    std::vector<char> packet(buffer.begin(), buffer.begin() + size);
+    receiver = ecs::mutable_ecs::apply_world_diff(receiver, packet.data(), packet.size());
+    REQUIRE(ecs::mutable_ecs::compute_checksum(receiver) == ecs::mutable_ecs::compute_checksum(sender));
+    return size;
+  };
+
+  std::vector<Entity> entities(20);
+  for (std::size_t entity_index = 0; entity_index < entities.size(); entity_index++) {
+    std::vector<ComponentType> components = {PositionComponent{.y = static_cast<int>(entity_index), .x = 0}};
+    if (entity_index % 2 == 0) {
+      components.push_back(VelocityComponent{.y = 1, .x = 1});
+    }
+    std::tie(sender, entities[entity_index]) = add_entity(sender, components);
+  }
+  sender = remove_entity(sender, entities[3]);
+  REQUIRE(send() > EMPTY_DIFF_SIZE);
+  REQUIRE(receiver.size() == 19);
+  REQUIRE(receiver._free_entity_indices == std::vector<ecs::mutable_ecs::EntityIndex>{3});
+  REQUIRE(send() == EMPTY_DIFF_SIZE);
+
+  // Writing one word of a component sends the entity, the encoding, the mask and the word
+  sender = add_component(sender, entities[5], ComponentType{PositionComponent{.y = 5, .x = 7}});
+  REQUIRE(send() == EMPTY_DIFF_SIZE + sizeof(Entity) + 1 + 1 + 4);
+  REQUIRE(std::get<PositionComponent>(get_component(receiver, entities[5], position_type)).x == 7);
+  ecs::mutable_ecs::each<PositionComponent>(sender, [](const Entity &, PositionComponent &position) {
+    position.y += 1;
+    position.x += 1;
+  });
+  REQUIRE(send() == EMPTY_DIFF_SIZE + 19 * (sizeof(Entity) + 1 + sizeof(PositionComponent)));
+
+  // Destroyed entities, recreated indices and removed components
+  Entity new_entity;
+  sender = remove_entity(sender, entities[7]);
+  sender = remove_component(sender, entities[8], velocity_type);
+  std::tie(sender, new_entity) = add_entity(sender, {VelocityComponent{.y = 2, .x = 2}});
+  REQUIRE(new_entity.index == entities[7].index);
+  send();
+  REQUIRE_FALSE(is_alive(receiver, entities[7]));
+  REQUIRE(is_alive(receiver, new_entity));
+  REQUIRE(std::get<VelocityComponent>(get_component(receiver, new_entity, velocity_type)).x == 2);
+  REQUIRE_FALSE(receiver._entity_slots[entities[8].index].signature.test(
+      ecs::mutable_ecs::_find_bit<VelocityComponent>(receiver)));
+
+  // A diff that does not fit leaves the baseline as it was
+  sender = remove_entity(sender, entities[0]);
+  auto sequence = baseline.sequence();
+  REQUIRE_THROWS(ecs::mutable_ecs::write_world_diff(sender, baseline, buffer.data(), EMPTY_DIFF_SIZE));
+  REQUIRE(baseline.sequence() == sequence);
+  auto size = ecs::mutable_ecs::write_world_diff(sender, baseline, buffer.data(), buffer.size());
+  auto header = ecs::mutable_ecs::read_world_diff_header<ComponentType>(buffer.data(), size);
+  REQUIRE(header.sequence == sequence);
+  REQUIRE(header.num_destroyed_entities == 1);
+
+  // Malformed diffs are rejected before the receiver is changed
+  REQUIRE_THROWS(ecs::mutable_ecs::apply_world_diff(receiver, buffer.data(), size - 1));
+  auto corrupted_buffer = buffer;
+  corrupted_buffer[0] = 'X';
+  REQUIRE_THROWS(ecs::mutable_ecs::apply_world_diff(receiver, corrupted_buffer.data(), size));
+  REQUIRE(is_alive(receiver, entities[0]));
+  receiver = ecs::mutable_ecs::apply_world_diff(receiver, buffer.data(), size);
+  REQUIRE_FALSE(is_alive(receiver, entities[0]));
+  REQUIRE(ecs::mutable_ecs::compute_checksum(receiver) == ecs::mutable_ecs::compute_checksum(sender));
+}
+
+TEST_CASE("Test World Diff Of Serialized Components") {
+  using ComponentType = std::variant<PositionComponent, std::string>;
+  using EntityComponentDatabase = ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
+
+  auto sender = EntityComponentDatabase();
+  auto receiver = EntityComponentDatabase();
+  ecs::mutable_ecs::WorldDiffBaseline<ComponentType> baseline;
+  std::vector<char> buffer(1024);
+  auto send = [&sender, &receiver, &baseline, &buffer]() {
+    auto size = ecs::mutable_ecs::write_world_diff(sender, baseline, buffer.data(), buffer.size());
+    receiver = ecs::mutable_ecs::apply_world_diff(receiver, buffer.data(), size);
+    return size;
+  };
+
+  ecs::mutable_ecs::Entity entity;
+  std::tie(sender, entity) = add_entity(sender, {ComponentType{std::string("name")}});
+  send();
+  auto string_type = ecs::type_utils::get_type_id<std::string>();
+  REQUIRE(std::get<std::string>(get_component(receiver, entity, string_type)) == "name");
+  auto empty_diff_size = send();
+  sender = add_component(sender, entity, ComponentType{std::string("other name")});
+  REQUIRE(send() == empty_diff_size + sizeof(entity) + 1 + sizeof(std::uint32_t) + 10);
+  REQUIRE(std::get<std::string>(get_component(receiver, entity, string_type)) == "other name");
+}
+
+#undef ECDB_TYPES
 } // namespace test_mutable_ecs_cpp
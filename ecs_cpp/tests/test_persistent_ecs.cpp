@@ -0,0 +1,239 @@
+#include <variant>
+
+#include <catch2/catch.hpp>
+
+#include "ecs/persistent_ecs.hpp"
+#include "ecs/persistent_map.hpp"
+#include "ecs/variant_utils.hpp"
+
+namespace test_persistent_basics {
+using TypeIndex = std::size_t;
+using ComponentType = std::variant<int, float>;
+using EntityComponentDatabase = ecs::persistent_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
+
+constexpr int INT_COMPONENT = 6;
+constexpr float FLOAT_COMPONENT = 2.3;
+
+// Sends every key to one of 4 hashes, so most keys collide in all 64 bits
+struct CollidingHash {
+  std::size_t operator()(int key) const { return key % 4; }
+};
+
+TEST_CASE("Test PersistentMap") {
+  ecs::persistent_ecs::PersistentMap<int, int> map;
+  std::vector<ecs::persistent_ecs::PersistentMap<int, int>> versions;
+  for (auto key = 0; key < 1000; key++) {
+    versions.push_back(map);
+    map = map.set(key, key * 2);
+  }
+  REQUIRE(map.size() == 1000);
+
+  // every version still sees exactly the keys it was built with
+  for (std::size_t version = 0; version < versions.size(); version += 97) {
+    REQUIRE(versions[version].size() == version);
+    REQUIRE(versions[version].contains(version - 1) == (version > 0));
+    REQUIRE_FALSE(versions[version].contains(version));
+  }
+
+  auto overwritten_map = map.set(10, 0);
+  REQUIRE(overwritten_map.size() == 1000);
+  REQUIRE(overwritten_map.at(10) == 0);
+  REQUIRE(map.at(10) == 20);
+
+  auto erased_map = map;
+  for (auto key = 0; key < 1000; key += 2) {
+    erased_map = erased_map.erase(key);
+  }
+  REQUIRE(erased_map.size() == 500);
+  REQUIRE(map.size() == 1000);
+  std::size_t num_entries = 0;
+  erased_map.for_each([&num_entries](int key, int value) {
+    REQUIRE(key % 2 == 1);
+    REQUIRE(value == key * 2);
+    num_entries += 1;
+  });
+  REQUIRE(num_entries == 500);
+  REQUIRE_THROWS_AS(erased_map.at(0), std::out_of_range);
+
+  // erasing a missing key shares the whole trie
+  REQUIRE(erased_map.erase(0)._root == erased_map._root);
+}
+
+TEST_CASE("Test PersistentMap Hash Collisions") {
+  ecs::persistent_ecs::PersistentMap<int, int, CollidingHash> map;
+  for (auto key = 0; key < 100; key++) {
+    map = map.set(key, key);
+  }
+  REQUIRE(map.size() == 100);
+  for (auto key = 0; key < 100; key++) {
+    REQUIRE(map.at(key) == key);
+  }
+
+  for (auto key = 0; key < 100; key++) {
+    if (key % 3 != 0) {
+      map = map.erase(key);
+    }
+  }
+  REQUIRE(map.size() == 34);
+  for (auto key = 0; key < 100; key++) {
+    REQUIRE(map.contains(key) == (key % 3 == 0));
+  }
+}
+
+TEST_CASE("Test Persistent EntityComponentDataBase APIs") {
+  auto ecdb = ecs::persistent_ecs::create_ecdb<TypeIndex, ComponentType>();
+
+  ecs::persistent_ecs::Entity entity_0;
+  std::tie(ecdb, entity_0) = add_entity(ecdb, {INT_COMPONENT, FLOAT_COMPONENT});
+
+  ecs::persistent_ecs::Entity entity_1;
+  std::tie(ecdb, entity_1) = add_entity(ecdb, {INT_COMPONENT});
+  REQUIRE(ecdb.size() == 2);
+
+  auto int_type = ecs::type_utils::get_type_id<int>();
+  auto float_type = ecs::type_utils::get_type_id<float>();
+
+  auto queried_entities = ecs::persistent_ecs::query(ecdb, std::vector{int_type, float_type});
+  REQUIRE(queried_entities.size() == 1);
+  auto &[queried_entity, components] = queried_entities.front();
+  REQUIRE(queried_entity == entity_0);
+  REQUIRE(std::get<int>(components.at(0)) == INT_COMPONENT);
+  REQUIRE(std::get<float>(components.at(1)) == Approx(FLOAT_COMPONENT));
+  REQUIRE(ecs::persistent_ecs::query(ecdb).size() == 2);
+
+  ecdb = add_component(ecdb, entity_1, ComponentType{FLOAT_COMPONENT});
+  REQUIRE(ecs::persistent_ecs::query(ecdb, std::vector{int_type, float_type}).size() == 2);
+
+  ecdb = remove_component(ecdb, entity_0, float_type);
+  REQUIRE_FALSE(get_component(ecdb, entity_0, float_type).has_value());
+  REQUIRE(std::get<int>(*get_component(ecdb, entity_0, int_type)) == INT_COMPONENT);
+
+  ecdb = remove_entity(ecdb, entity_0);
+  REQUIRE(ecdb.size() == 1);
+  REQUIRE_THROWS_AS(remove_entity(ecdb, entity_0), std::runtime_error);
+  REQUIRE_THROWS_AS(add_component(ecdb, entity_0, ComponentType{INT_COMPONENT}), std::runtime_error);
+
+  // entities are never recycled
+  ecs::persistent_ecs::Entity entity_2;
+  std::tie(ecdb, entity_2) = add_entity(ecdb);
+  REQUIRE(entity_2 != entity_0);
+}
+
+TEST_CASE("Test Persistent EntityComponentDataBase Snapshots") {
+  auto ecdb = ecs::persistent_ecs::create_ecdb<TypeIndex, ComponentType>();
+  std::vector<ecs::persistent_ecs::Entity> entities;
+  for (auto i = 0; i < 100; i++) {
+    ecs::persistent_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {i});
+    entities.push_back(entity);
+  }
+
+  auto snapshot = ecdb;
+  REQUIRE(snapshot._entities._root == ecdb._entities._root);
+
+  auto int_type = ecs::type_utils::get_type_id<int>();
+  ecdb = add_component(ecdb, entities[3], ComponentType{-1});
+  ecdb = remove_entity(ecdb, entities[4]);
+
+  REQUIRE(snapshot.size() == 100);
+  REQUIRE(std::get<int>(*get_component(snapshot, entities[3], int_type)) == 3);
+  REQUIRE(snapshot.contains(entities[4]));
+  REQUIRE(ecdb.size() == 99);
+  REQUIRE(std::get<int>(*get_component(ecdb, entities[3], int_type)) == -1);
+  REQUIRE_FALSE(ecdb.contains(entities[4]));
+}
+} // namespace test_persistent_basics
+
+namespace test_persistent_ecs_cpp {
+using TypeIndex = std::size_t;
+
+struct PositionComponent {
+  int y;
+  int x;
+};
+
+struct VelocityComponent {
+  int y;
+  int x;
+};
+
+using ComponentType = std::variant<PositionComponent, VelocityComponent>;
+using EntityComponentDatabase = ecs::persistent_ecs::EntityComponentDatabase<TypeIndex, ComponentType>;
+
+struct AddComponentAction {
+  ecs::persistent_ecs::Entity entity;
+  ComponentType component;
+};
+
+struct RemoveEntityAction {
+  ecs::persistent_ecs::Entity entity;
+};
+
+using ActionUnion = std::variant<AddComponentAction, RemoveEntityAction>;
+
+EntityComponentDatabase process_action(const EntityComponentDatabase &ecdb, ActionUnion &action) {
+  return std::visit(
+      ecs::variant_utils::overloaded{
+          [&ecdb](const AddComponentAction &action) { return add_component(ecdb, action.entity, action.component); },
+          [&ecdb](const RemoveEntityAction &action) { return remove_entity(ecdb, action.entity); },
+      },
+      action);
+}
+
+struct MovementSystem {
+  std::vector<ActionUnion> operator()(const EntityComponentDatabase &ecdb) const {
+    std::vector<ActionUnion> actions;
+    auto component_types = std::vector{ecs::type_utils::get_type_id<PositionComponent>(),
+                                       ecs::type_utils::get_type_id<VelocityComponent>()};
+    for (auto &&[entity, components] : ecs::persistent_ecs::query(ecdb, component_types)) {
+      auto position_component = std::get<PositionComponent>(components.at(0));
+      auto velocity_component = std::get<VelocityComponent>(components.at(1));
+      actions.emplace_back(AddComponentAction{
+          entity, PositionComponent{position_component.y + velocity_component.y,
+                                    position_component.x + velocity_component.x}});
+      actions.emplace_back(AddComponentAction{entity, VelocityComponent{0, 0}});
+    }
+    return actions;
+  }
+};
+
+struct RemoveRandomEntitySystem {
+  std::vector<ActionUnion> operator()(const EntityComponentDatabase &ecdb) const {
+    std::vector<ActionUnion> actions;
+    auto queried_entities = ecs::persistent_ecs::query(ecdb);
+    actions.emplace_back(RemoveEntityAction{std::get<0>(queried_entities.front())});
+    return actions;
+  }
+};
+
+using SystemUnion = std::variant<MovementSystem, RemoveRandomEntitySystem>;
+
+std::vector<ActionUnion> process_system(const EntityComponentDatabase &ecdb, SystemUnion &system) {
+  return std::visit([&ecdb](const auto &system) { return system(ecdb); }, system);
+}
+
+TEST_CASE("Test Persistent C++ Ecs") {
+  auto ecdb = ecs::persistent_ecs::create_ecdb<TypeIndex, ComponentType>();
+  for (auto i = 0; i < 10; i++) {
+    ecs::persistent_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{0, 0}, VelocityComponent{1, 1}});
+  }
+
+  auto systems = ecs::persistent_ecs::create_systems<SystemUnion>();
+  systems = ecs::persistent_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
+  systems = ecs::persistent_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 0);
+
+  std::vector<EntityComponentDatabase> history;
+  while (ecdb.size() > 0) {
+    history.push_back(ecdb);
+    ecdb = ecs::persistent_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, ActionUnion>(
+        ecdb, systems, process_system, process_action);
+  }
+
+  // every frame is still intact after the loop
+  REQUIRE(history.size() == 10);
+  for (std::size_t frame = 0; frame < history.size(); frame++) {
+    REQUIRE(history[frame].size() == 10 - frame);
+  }
+}
+} // namespace test_persistent_ecs_cpp
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <variant>
+
+#include <catch2/catch.hpp>
+
+#include "ecs/mutable_ecs.hpp"
+#include "ecs/variant_utils.hpp"
+
+// Counts the allocations from the global heap. Replacing the global operator new affects the whole binary, so this
+// test has an executable of its own, and every form of new and delete is replaced so that each pair goes through
+// malloc and free.
+std::atomic<std::size_t> num_global_allocations = 0;
+
+namespace {
+void *allocate(std::size_t size) noexcept {
+  num_global_allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *allocate_aligned(std::size_t size, std::align_val_t alignment) noexcept {
+  num_global_allocations.fetch_add(1, std::memory_order_relaxed);
+  auto alignment_in_bytes = static_cast<std::size_t>(alignment);
+  auto num_aligned_blocks = std::max<std::size_t>((size + alignment_in_bytes - 1) / alignment_in_bytes, 1);
+  return std::aligned_alloc(alignment_in_bytes, num_aligned_blocks * alignment_in_bytes);
+}
+
+// Not inlined into operator delete, GCC would take the free of a pointer from operator new for a mismatch
+[[gnu::noinline]] void deallocate(void *pointer) noexcept { std::free(pointer); }
+
+void *allocate_or_throw(void *pointer) {
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+} // namespace
+
+void *operator new(std::size_t size) { return allocate_or_throw(allocate(size)); }
+void *operator new[](std::size_t size) { return allocate_or_throw(allocate(size)); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return allocate_or_throw(allocate_aligned(size, alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocate_or_throw(allocate_aligned(size, alignment));
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocate_aligned(size, alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocate_aligned(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, std::size_t) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, std::size_t, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, std::size_t, std::align_val_t) noexcept { deallocate(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { deallocate(pointer); }
+
+namespace test_steady_state_allocations {
+using TypeIndex = std::size_t;
+
+struct PositionComponent {
+  int y;
+  int x;
+};
+
+struct VelocityComponent {
+  int y;
+  int x;
+};
+
+PositionComponent operator+(const PositionComponent &a, const VelocityComponent &b) {
+  int y = a.y + b.y;
+  int x = a.x + b.x;
+  return PositionComponent{.y = y, .x = x};
+};
+
+using ComponentType = std::variant<PositionComponent, VelocityComponent>;
+
+struct MovementSystem {};
+
+struct RemoveRandomEntitySystem {};
+
+using SystemUnion = std::variant<MovementSystem, RemoveRandomEntitySystem>;
+
+struct AddComponentAction {
+  ecs::mutable_ecs::Entity entity;
+  ComponentType component;
+};
+
+struct RespawnEntityAction {
+  ecs::mutable_ecs::Entity entity;
+};
+
+using SteadyStateActionUnion = std::variant<AddComponentAction, RespawnEntityAction>;
+
+// Every frame moves all entities and removes the first entity and adds a new one in its place
+template <typename EntityComponentDatabase>
+void process_steady_state_system(EntityComponentDatabase &ecdb, SystemUnion &system,
+                                 ecs::mutable_ecs::ActionBuffer<SteadyStateActionUnion> &actions) {
+  std::visit(ecs::variant_utils::overloaded{
+                 [&ecdb, &actions](const MovementSystem &) {
+                   ecs::mutable_ecs::each<PositionComponent, VelocityComponent>(
+                       ecdb, [&actions](const ecs::mutable_ecs::Entity &entity, PositionComponent &position,
+                                        VelocityComponent &velocity) {
+                         actions.emplace_back(AddComponentAction{.entity{entity}, .component{position + velocity}});
+                       });
+                 },
+                 [&ecdb, &actions](const RemoveRandomEntitySystem &) {
+                   auto queried_entities =
+                       ecs::mutable_ecs::query<PositionComponent>(ecdb, actions.get_allocator().arena(), 1);
+                   actions.emplace_back(RespawnEntityAction{.entity{std::get<0>(queried_entities.front())}});
+                 },
+             },
+             system);
+}
+
+template <typename EntityComponentDatabase>
+EntityComponentDatabase process_steady_state_action(EntityComponentDatabase &ecdb, SteadyStateActionUnion &action) {
+  return std::visit(ecs::variant_utils::overloaded{
+                        [&ecdb](const AddComponentAction &action) {
+                          return add_component(ecdb, action.entity, action.component);
+                        },
+                        [&ecdb](const RespawnEntityAction &action) {
+                          ecdb = remove_entity(ecdb, action.entity);
+                          ecs::mutable_ecs::Entity entity;
+                          std::tie(ecdb, entity) = add_entity(ecdb);
+                          ecdb = add_component(ecdb, entity, ComponentType{PositionComponent{.y = 0, .x = 0}});
+                          return add_component(ecdb, entity, ComponentType{VelocityComponent{.y = 1, .x = 2}});
+                        },
+                    },
+                    action);
+}
+
+#define STEADY_STATE_ECDB_TYPES                                                                                        \
+  (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::HashMapStorage>),             \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::PoolHashMapStorage>),     \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::ArchetypeStorage>),     \
+      (ecs::mutable_ecs::EntityComponentDatabase<TypeIndex, ComponentType, ecs::mutable_ecs::SparseSetStorage>)
+
+TEMPLATE_TEST_CASE("Test Mutable C++ Ecs Steady State Allocations", "", STEADY_STATE_ECDB_TYPES) {
+  auto ecdb = TestType();
+  for (auto i = 0; i < 100; i++) {
+    ecs::mutable_ecs::Entity entity;
+    std::tie(ecdb, entity) = add_entity(ecdb, {PositionComponent{.y = 0, .x = 0}, VelocityComponent{.y = 1, .x = 2}});
+  }
+
+  auto systems = ecs::mutable_ecs::create_systems<SystemUnion>();
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, MovementSystem(), 0);
+  systems = ecs::mutable_ecs::add_system<SystemUnion>(systems, RemoveRandomEntitySystem(), 1);
+
+  auto process_frames = [&ecdb, &systems](int num_frames) {
+    for (auto frame_index = 0; frame_index < num_frames; frame_index++) {
+      ecdb = ecs::mutable_ecs::process_systems<TypeIndex, ComponentType, SystemUnion, SteadyStateActionUnion>(
+          ecdb, systems, process_steady_state_system<TestType>, process_steady_state_action<TestType>);
+    }
+  };
+
+  // warms up the frame arena, the pools and the capacities of the containers
+  process_frames(10);
+  auto num_allocations = num_global_allocations.load();
+  process_frames(100);
+  REQUIRE(num_global_allocations.load() == num_allocations);
+  REQUIRE(ecdb.size() == 100);
+  REQUIRE(systems._frame_arena.num_blocks() == 1);
+}
+#undef STEADY_STATE_ECDB_TYPES
+
+} // namespace test_steady_state_allocations
@@ -0,0 +1,95 @@
+from typing import Any, Dict, List
+
+import attr
+import pytest
+from toolz import count
+
+import ecs.ecs
+import ecs.mutable_ecs
+
+try:
+    from ecs_cpp import mutable_ecs as ecs_cpp_mutable_ecs  # pylint: disable=import-error
+    from ecs_cpp import persistent_ecs as ecs_cpp_persistent_ecs  # pylint: disable=import-error
+
+    ECS_CPP_MODULES = [ecs_cpp_mutable_ecs, ecs_cpp_persistent_ecs]
+except ImportError:
+    ECS_CPP_MODULES = []
+
+# Python counterparts of the scenarios of ecs_cpp_benchmarks, for every implementation of the Python API:
+#   pytest unit_tests/test_benchmark_ecs.py --benchmark-group-by=func,param:num_entities --benchmark-json=results.json
+MODULES = [ecs.ecs, ecs.mutable_ecs, *ECS_CPP_MODULES]
+MODULE_IDS = [module.__name__ for module in MODULES]
+NUM_ENTITIES = [1000]
+
+
+@attr.s(frozen=True, kw_only=True)
+class PositionComponent:
+    y_axis: int = attr.ib()
+    x_axis: int = attr.ib()
+
+
+@attr.s(frozen=True, kw_only=True)
+class VelocityComponent:
+    y_axis: int = attr.ib()
+    x_axis: int = attr.ib()
+
+
+@attr.s(frozen=True, kw_only=True)
+class HealthComponent:
+    health: int = attr.ib()
+
+
+def add_entities(module: Any, ecdb: Any, num_entities: int, components: List[Any]) -> Any:
+    entities = []
+    for _ in range(num_entities):
+        ecdb, entity = module.add_entity(ecdb=ecdb, components=components)
+        entities.append(entity)
+    return ecdb, entities
+
+
+@pytest.mark.parametrize("module", MODULES, ids=MODULE_IDS)
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+def test_benchmark_create_entities(benchmark: Any, module: Any, num_entities: int) -> None:
+    components = [PositionComponent(y_axis=0, x_axis=0), VelocityComponent(y_axis=1, x_axis=2)]
+
+    def create_entities() -> Any:
+        ecdb, _ = add_entities(module, module.create_ecdb(), num_entities, components)
+        return ecdb
+
+    ecdb = benchmark(create_entities)
+    assert len(ecdb) == num_entities
+
+
+@pytest.mark.parametrize("module", MODULES, ids=MODULE_IDS)
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+def test_benchmark_component_churn(benchmark: Any, module: Any, num_entities: int) -> None:
+    components = [PositionComponent(y_axis=0, x_axis=0), VelocityComponent(y_axis=1, x_axis=2)]
+    ecdb, entities = add_entities(module, module.create_ecdb(), num_entities, components)
+    state: Dict[str, Any] = {"ecdb": ecdb}
+
+    def churn() -> None:
+        ecdb = state["ecdb"]
+        for entity in entities:
+            ecdb = module.add_component(ecdb=ecdb, entity=entity, component=HealthComponent(health=1))
+        for entity in entities:
+            ecdb = module.remove_component(ecdb=ecdb, entity=entity, component_type=HealthComponent)
+        state["ecdb"] = ecdb
+
+    benchmark(churn)
+
+
+@pytest.mark.parametrize("module", MODULES, ids=MODULE_IDS)
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+@pytest.mark.parametrize("match_percentage", [100, 10])
+def test_benchmark_query(benchmark: Any, module: Any, num_entities: int, match_percentage: int) -> None:
+    matching_components = [PositionComponent(y_axis=0, x_axis=0), VelocityComponent(y_axis=1, x_axis=2)]
+    other_components = [PositionComponent(y_axis=0, x_axis=0)]
+    ecdb = module.create_ecdb()
+    for entity_index in range(num_entities):
+        components = matching_components if entity_index % 100 < match_percentage else other_components
+        ecdb, _ = module.add_entity(ecdb=ecdb, components=components)
+
+    def query() -> int:
+        return count(module.query(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent]))
+
+    benchmark(query)
@@ -0,0 +1,152 @@
+from typing import Any, Callable, Dict, Generator, List
+
+import attr
+import numpy as np
+import pytest
+
+import ecs.ecs
+import ecs.mutable_ecs
+
+try:
+    from ecs_cpp import mutable_ecs as ecs_cpp_mutable_ecs  # pylint: disable=import-error
+except ImportError:
+    ecs_cpp_mutable_ecs = None
+
+requires_ecs_cpp = pytest.mark.skipif(ecs_cpp_mutable_ecs is None, reason="ecs_cpp is not built")
+
+# One frame of a movement system over NUM_ENTITIES entities, run through process_systems of every implementation:
+#   pytest unit_tests/test_benchmark_process_systems.py --benchmark-group-by=param:num_entities
+NUM_ENTITIES = [100, 10000]
+
+
+@attr.s(frozen=True, kw_only=True)
+class PositionComponent:
+    y_axis: int = attr.ib()
+    x_axis: int = attr.ib()
+
+
+@attr.s(frozen=True, kw_only=True)
+class VelocityComponent:
+    y_axis: int = attr.ib()
+    x_axis: int = attr.ib()
+
+
+@attr.s(frozen=True, kw_only=True)
+class AddComponentAction:
+    entity: Any = attr.ib()
+    component: Any = attr.ib()
+
+
+class MovementSystem:
+    pass
+
+
+POSITION_DTYPE = np.dtype([("y_axis", np.int64), ("x_axis", np.int64)])
+VELOCITY_DTYPE = np.dtype([("y_axis", np.int64), ("x_axis", np.int64)])
+
+
+def create_components() -> List[Any]:
+    return [PositionComponent(y_axis=0, x_axis=0), VelocityComponent(y_axis=1, x_axis=2)]
+
+
+def make_process_system(module: Any) -> Callable[..., Generator[AddComponentAction, None, None]]:
+    def process_system(*, ecdb: Any, system: MovementSystem) -> Generator[AddComponentAction, None, None]:
+        component_types = [PositionComponent, VelocityComponent]
+        for entity, (position, velocity) in module.query(ecdb=ecdb, component_types=component_types):
+            yield AddComponentAction(
+                entity=entity,
+                component=PositionComponent(
+                    y_axis=position.y_axis + velocity.y_axis, x_axis=position.x_axis + velocity.x_axis
+                ),
+            )
+
+    return process_system
+
+
+def make_process_action(module: Any) -> Callable[..., Any]:
+    def process_action(ecdb: Any, action: AddComponentAction) -> Any:
+        return module.add_component(ecdb=ecdb, entity=action.entity, component=action.component)
+
+    return process_action
+
+
+@pytest.mark.parametrize("module", [ecs.ecs, ecs.mutable_ecs], ids=["ecs", "mutable_ecs"])
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+def test_benchmark_process_systems_python(benchmark: Any, module: Any, num_entities: int) -> None:
+    ecdb = module.create_ecdb()
+    for _ in range(num_entities):
+        ecdb, _ = module.add_entity(ecdb=ecdb, components=create_components())
+    systems = module.add_system(systems=module.create_systems(), system=MovementSystem(), priority=0)
+    process_system = make_process_system(module)
+    process_action = make_process_action(module)
+
+    state: Dict[str, Any] = {"ecdb": ecdb}
+
+    def frame() -> None:
+        state["ecdb"] = module.process_systems(
+            ecdb=state["ecdb"], systems=systems, process_system=process_system, process_action=process_action
+        )
+
+    benchmark(frame)
+
+
+@requires_ecs_cpp
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+def test_benchmark_process_systems_ecs_cpp(benchmark: Any, num_entities: int) -> None:
+    module = ecs_cpp_mutable_ecs
+    ecdb = module.create_ecdb()
+    for _ in range(num_entities):
+        ecdb, _ = module.add_entity(ecdb=ecdb, components=create_components())
+    systems = module.add_system(systems=module.create_systems(), system=MovementSystem(), priority=0)
+    process_system = make_process_system(module)
+    process_action = make_process_action(module)
+
+    def process_system_list(ecdb: Any, system: MovementSystem) -> List[AddComponentAction]:
+        return list(process_system(ecdb=ecdb, system=system))
+
+    state: Dict[str, Any] = {"ecdb": ecdb}
+
+    def frame() -> None:
+        state["ecdb"] = module.process_systems(
+            ecdb=state["ecdb"], systems=systems, process_system=process_system_list, process_action=process_action
+        )
+
+    benchmark(frame)
+
+
+@requires_ecs_cpp
+@pytest.mark.parametrize("num_entities", NUM_ENTITIES)
+def test_benchmark_process_systems_ecs_cpp_column_commands(benchmark: Any, num_entities: int) -> None:
+    module = ecs_cpp_mutable_ecs
+    ecdb = module.create_ecdb()
+    ecdb = module.register_column(ecdb=ecdb, component_type=PositionComponent, dtype=POSITION_DTYPE)
+    ecdb = module.register_column(ecdb=ecdb, component_type=VelocityComponent, dtype=VELOCITY_DTYPE)
+    velocities = np.zeros(num_entities, dtype=VELOCITY_DTYPE)
+    velocities["y_axis"] = 1
+    velocities["x_axis"] = 2
+    ecdb, _ = module.add_entities(
+        ecdb=ecdb,
+        num_entities=num_entities,
+        components={PositionComponent: np.zeros(num_entities, dtype=POSITION_DTYPE), VelocityComponent: velocities},
+    )
+    systems = module.add_system(systems=module.create_systems(), system=MovementSystem(), priority=0)
+
+    def process_system(ecdb: Any, system: MovementSystem, command_buffer: Any) -> None:
+        entities = module.query_entities(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent])
+        positions = module.get_components(ecdb=ecdb, entities=entities, component_type=PositionComponent)
+        velocities = module.get_components(ecdb=ecdb, entities=entities, component_type=VelocityComponent)
+        for field in POSITION_DTYPE.names:
+            positions[field] += velocities[field]
+        command_buffer.set(entities=entities, component_type=PositionComponent, components=positions)
+
+    state: Dict[str, Any] = {"ecdb": ecdb}
+
+    def frame() -> None:
+        state["ecdb"] = module.process_systems_with_column_commands(
+            ecdb=state["ecdb"], systems=systems, process_system=process_system
+        )
+
+    benchmark(frame)
+
+    _, positions = module.column(ecdb=state["ecdb"], component_type=PositionComponent)
+    assert (positions["x_axis"] == 2 * positions["y_axis"]).all()
@@ -1,6 +1,7 @@
 from typing import Any, Generator, Union, List, Type
 
 import attr
+import numpy as np
 import pytest
 from toolz import first, count
 
@@ -16,6 +17,16 @@ from ecs_cpp.mutable_ecs import (  # pylint: disable=import-error
     query,
     add_component,
     remove_entity,
+    get_component,
+    register_column,
+    column,
+    add_entities,
+    add_components,
+    query_entities,
+    get_components,
+    create_column_command_buffer,
+    flush_column_commands,
+    process_systems_with_column_commands,
 )
 
 
@@ -126,3 +137,118 @@ def test_mutable_ecs(num_original_entities: int) -> None:
             break
 
         loop_index += 1
+
+
+POSITION_DTYPE = np.dtype([("y_axis", np.int64), ("x_axis", np.int64)])
+VELOCITY_DTYPE = np.dtype([("y_axis", np.int64), ("x_axis", np.int64)])
+
+
+def test_mutable_ecs_columns() -> None:
+
+    ecdb: EntityComponentDatabase = create_ecdb()
+    ecdb = register_column(ecdb=ecdb, component_type=PositionComponent, dtype=POSITION_DTYPE)
+    ecdb = register_column(ecdb=ecdb, component_type=VelocityComponent, dtype=VELOCITY_DTYPE)
+
+    num_entities = 1000
+    positions = np.zeros(num_entities, dtype=POSITION_DTYPE)
+    velocities = np.ones(num_entities, dtype=VELOCITY_DTYPE)
+    ecdb, entities = add_entities(
+        ecdb=ecdb, num_entities=num_entities, components={PositionComponent: positions, VelocityComponent: velocities}
+    )
+    assert len(ecdb) == num_entities
+    assert len(entities) == num_entities
+
+    # Vectorized update of the column in place
+    _, position_column = column(ecdb=ecdb, component_type=PositionComponent)
+    _, velocity_column = column(ecdb=ecdb, component_type=VelocityComponent)
+    for field in POSITION_DTYPE.names:
+        position_column[field] += velocity_column[field]
+
+    _, position_column = column(ecdb=ecdb, component_type=PositionComponent)
+    assert (position_column["y_axis"] == 1).all()
+
+    # Components in columns are still visible to the object API
+    entity = Entity(int(entities[10]["index"]), int(entities[10]["generation"]))
+    assert get_component(ecdb=ecdb, entity=entity, component_type=PositionComponent) == PositionComponent(
+        y_axis=1, x_axis=1
+    )
+    # ecdb is changed in place, so the arrays of column keep the object that owns their memory alive
+    assert add_component(ecdb=ecdb, entity=entity, component=PositionComponent(y_axis=5, x_axis=6)) is ecdb
+    assert count(query(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent])) == num_entities
+
+    ecdb = add_components(
+        ecdb=ecdb,
+        entities=entities[:10],
+        component_type=VelocityComponent,
+        components=np.zeros(10, dtype=VELOCITY_DTYPE),
+    )
+    column_entities, velocity_column = column(ecdb=ecdb, component_type=VelocityComponent)
+    assert (velocity_column[:10]["x_axis"] == 0).all()
+    assert (column_entities[:10] == entities[:10]).all()
+
+    # Removing the entity would move the records that the arrays point to, like resizing a bytearray with live exports
+    with pytest.raises(BufferError):
+        remove_entity(ecdb=ecdb, entity=entity)
+    assert len(ecdb) == num_entities
+    del column_entities, position_column, velocity_column
+
+    ecdb = remove_entity(ecdb=ecdb, entity=entity)
+    column_entities, position_column = column(ecdb=ecdb, component_type=PositionComponent)
+    assert len(position_column) == num_entities - 1
+    assert len(column_entities) == num_entities - 1
+
+
+def test_mutable_ecs_column_commands() -> None:
+
+    ecdb: EntityComponentDatabase = create_ecdb()
+    ecdb = register_column(ecdb=ecdb, component_type=PositionComponent, dtype=POSITION_DTYPE)
+    ecdb = register_column(ecdb=ecdb, component_type=VelocityComponent, dtype=VELOCITY_DTYPE)
+
+    num_entities = 100
+    ecdb, entities = add_entities(
+        ecdb=ecdb,
+        num_entities=num_entities,
+        components={
+            PositionComponent: np.zeros(num_entities, dtype=POSITION_DTYPE),
+            VelocityComponent: np.ones(num_entities, dtype=VELOCITY_DTYPE),
+        },
+    )
+    assert (query_entities(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent]) == entities).all()
+
+    command_buffer = create_column_command_buffer(ecdb=ecdb)
+    command_buffer.remove(entities=entities[:10], component_type=VelocityComponent)
+    command_buffer.destroy(entities=entities[-10:])
+    assert len(command_buffer) == 20
+    ecdb = flush_column_commands(ecdb=ecdb, command_buffer=command_buffer)
+    assert len(command_buffer) == 0
+    assert len(ecdb) == num_entities - 10
+    moving_entities = query_entities(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent])
+    assert (moving_entities == entities[10:-10]).all()
+
+    def process_system(ecdb: EntityComponentDatabase, system: MovementSystem, command_buffer: Any) -> None:
+        entities = query_entities(ecdb=ecdb, component_types=[PositionComponent, VelocityComponent])
+        positions = get_components(ecdb=ecdb, entities=entities, component_type=PositionComponent)
+        velocities = get_components(ecdb=ecdb, entities=entities, component_type=VelocityComponent)
+        for field in POSITION_DTYPE.names:
+            positions[field] += velocities[field]
+        command_buffer.set(entities=entities, component_type=PositionComponent, components=positions)
+
+    systems: Systems[SystemUnion] = create_systems()
+    systems = add_system(systems=systems, priority=0, system=MovementSystem())
+    for _ in range(3):
+        ecdb = process_systems_with_column_commands(ecdb=ecdb, systems=systems, process_system=process_system)
+
+    positions = get_components(ecdb=ecdb, entities=moving_entities, component_type=PositionComponent)
+    assert (positions["y_axis"] == 3).all()
+    positions = get_components(ecdb=ecdb, entities=entities[:10], component_type=PositionComponent)
+    assert (positions["y_axis"] == 0).all()
+
+    # The same buffer is flushed once per frame
+    for frame in range(1, 4):
+        positions = get_components(ecdb=ecdb, entities=moving_entities, component_type=PositionComponent)
+        positions["x_axis"] = frame
+        command_buffer.set(entities=moving_entities, component_type=PositionComponent, components=positions)
+        ecdb = flush_column_commands(ecdb=ecdb, command_buffer=command_buffer)
+        assert len(command_buffer) == 0
+        positions = get_components(ecdb=ecdb, entities=moving_entities, component_type=PositionComponent)
+        assert (positions["x_axis"] == frame).all()